@@ -10,4 +10,19 @@
 #include <owm/owm_config.h>
 #include <owm/owm_forecast.h>
 #include <owm/owm_weather.h>
+#include <owm/owm_stats.h>
+#include <owm/owm_cache.h>
+#include <owm/owm_disk_cache.h>
+#include <owm/owm_serialize.h>
+#include <owm/owm_db.h>
+#include <owm/owm_shm.h>
+#include <owm/owm_scheduler.h>
+#include <owm/owm_diff.h>
+#include <owm/owm_archive.h>
+#include <owm/owm_city_list.h>
+#include <owm/owm_city_index.h>
+#include <owm/owm_city_names.h>
+#include <owm/owm_location_filter.h>
+#include <owm/owm_context.h>
+#include <owm/owm_pipeline.h>
 
@@ -0,0 +1,91 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_archive.h
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * An append-only archive of forecast runs, keyed by location and issue
+ *   time, for verifying forecasts after the event, and for answering
+ *   questions like "what did we forecast for this place and time, as of
+ *   yesterday?".
+ * Each run is stored as a compressed block, column by column: start
+ *   times as deltas of deltas, which are nearly always zero, and values
+ *   quantized and stored as deltas from the previous point. A typical
+ *   five-day run takes well under a kilobyte. Each block records the
+ *   range of times its points cover, and the smallest and largest value
+ *   of each field, so queries by time, and searches by value with
+ *   owm_archive_scan_values(), decode only the blocks they need.
+ * The archive's index is built when it is opened, by reading the block
+ *   headers only. If the last block is incomplete -- because a process
+ *   died while appending it -- it is discarded. If any other part of the
+ *   file can't be read, the open fails, and the file is not changed.
+ * =========================================================================*/
+
+#pragma once
+
+#include <time.h>
+#include <owm/owm_defs.h>
+#include <owm/owm_forecast.h>
+
+struct _OwmArchive;
+typedef struct _OwmArchive OwmArchive;
+
+/* The longest location ID that can be archived */
+#define OWM_ARCHIVE_MAX_LOCATION 64
+
+/* Called by owm_archive_scan() for each matching run. The forecast is
+   released when the callback returns. Return FALSE to stop the scan */
+typedef BOOL (*OwmArchiveScanCallback) (const char *location_id,
+                 time_t issued, const OwmForecast *forecast, void *user_data);
+
+#ifdef __CPLUSPLUS
+  extern "C" {
+#endif
+
+/** Open an archive, creating it if it does not exist. Fails if another
+ process has it open */
+OwmArchive   *owm_archive_open (const char *path, char **error);
+
+void          owm_archive_close (OwmArchive *self);
+
+/** Append a run to the archive. issued is the time it was issued, which
+ is usually its fetch time. The summaries are not stored; they are
+ worked out again when the run is read back */
+BOOL          owm_archive_append (OwmArchive *self, const char *location_id,
+                 time_t issued, const OwmForecast *forecast, char **error);
+
+/** Get the number of runs in the archive */
+int           owm_archive_get_runs (OwmArchive *self);
+
+/** Get the latest run for a location that was issued at or before
+ issued_by, and that has a point covering time valid_at. Use
+ owm_forecast_find_point() to find the point itself. If issued is not
+ NULL, it is set to the run's issue time. Returns NULL if there is no
+ such run, or sets *error if the archive can't be read */
+OwmForecast  *owm_archive_get_as_of (OwmArchive *self,
+                 const char *location_id, time_t valid_at, time_t issued_by,
+                 time_t *issued, char **error);
+
+/** Call the callback for each run, for the given location or for all
+ locations if location_id is NULL, that has points between valid_from
+ and valid_to, inclusive. Returns the number of points in the runs that
+ were passed to the callback, or -1 if the archive can't be read */
+long          owm_archive_scan (OwmArchive *self, const char *location_id,
+                 time_t valid_from, time_t valid_to,
+                 OwmArchiveScanCallback callback, void *user_data,
+                 char **error);
+
+/** As owm_archive_scan(), but call the callback only for runs that have
+ a point between valid_from and valid_to whose value of field is between
+ min and max, inclusive. field is one of OWM_VALID_TEMP, 
+ OWM_VALID_WIND_DIRECTION, OWM_VALID_WIND_SPEED, OWM_VALID_PRESSURE, 
+ OWM_VALID_HUMIDITY and OWM_VALID_CLOUD_COVER. Blocks whose range of 
+ values for the field can't match are not read */
+long          owm_archive_scan_values (OwmArchive *self, 
+                 const char *location_id, time_t valid_from, 
+                 time_t valid_to, int field, double min, double max,
+                 OwmArchiveScanCallback callback, void *user_data,
+                 char **error);
+
+#ifdef __CPLUSPLUS
+ }
+#endif
+
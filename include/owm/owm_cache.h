@@ -0,0 +1,109 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_cache.h
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * An in-memory cache of parsed forecasts, keyed by API endpoint, location
+ *   and units. Forecasts in the cache are shared, not copied: a lookup
+ *   returns a new reference, which the caller releases with
+ *   owm_forecast_destroy() in the usual way. Cached forecasts must be
+ *   treated as read-only.
+ * Entries expire at the end of OWM's update cycle in which they were
+ *   fetched, rather than after a fixed time -- there is no point in
+ *   fetching a forecast again until OWM has had a chance to change it.
+ * =========================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <time.h>
+#include <owm/owm_forecast.h>
+
+/* OwmCache itself is declared in owm_forecast.h */
+
+/* OWM's five-day forecasts are recalculated every three hours */
+#define OWM_CACHE_DEFAULT_CYCLE (3 * 3600)
+
+/* The default limit on background refreshes of stale entries */
+#define OWM_CACHE_DEFAULT_REFRESHES 4
+
+typedef struct _OwmCacheStats
+  {
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;  // Entries removed to stay within the budget
+  unsigned long expirations;
+  unsigned long stale_hits; // Expired entries served by lookup_stale()
+  int entries;
+  size_t bytes;
+  } OwmCacheStats;
+
+#ifdef __CPLUSPLUS
+  extern "C" {
+#endif
+
+/** Create a cache that will hold about max_bytes of forecasts. The
+ budget is approximate: the cache is split into shards, each with its own
+ lock, its own least-recently-used list, and an equal share of max_bytes.
+ When a shard is over its share, its least-recently used entries are
+ evicted, even if other shards have room. An entry just inserted is never
+ evicted, so a shard whose newest entry is bigger than its share holds
+ that one entry; the total can therefore exceed max_bytes by up to one
+ forecast per shard, and a budget smaller than one forecast per shard is
+ not enforced at all */
+OwmCache     *owm_cache_create (size_t max_bytes);
+
+/** Destroy the cache, releasing its references to the forecasts in it.
+ Forecasts that callers still hold references to remain valid. If any 
+ background refreshes are running, this waits for them to finish */
+void          owm_cache_destroy (OwmCache *self);
+
+/** Set the update cycle of the provider, in seconds, and the offset of
+ the cycle from midnight UTC. Entries fetched during one cycle expire
+ at the start of the next. The default is OWM_CACHE_DEFAULT_CYCLE, with
+ no offset */
+void          owm_cache_set_update_cycle (OwmCache *self, int cycle,
+                 int offset);
+
+/** Set how long past its expiry an entry may still be served by
+ owm_cache_lookup_stale(), in seconds, and how many stale entries may be
+ refreshed in the background at once. The defaults are zero -- nothing
+ is served stale -- and OWM_CACHE_DEFAULT_REFRESHES */
+void          owm_cache_set_stale_policy (OwmCache *self, int max_stale,
+                 int max_refreshes);
+
+/** Get the start of the first update cycle after the one in which
+ fetched falls, for cycles of the given length and offset */
+time_t        owm_cache_cycle_expiry (time_t fetched, int cycle, 
+                 int offset);
+
+/** Get the time at which an entry fetched at time fetched will expire */
+time_t        owm_cache_get_expiry (const OwmCache *self, time_t fetched);
+
+/** Look up an unexpired forecast. Returns a new reference to it, or
+ NULL if there is none */
+OwmForecast  *owm_cache_lookup (OwmCache *self, const char *endpoint,
+                 const char *location, const char *units);
+
+/** As owm_cache_lookup(), but also return a forecast that has expired
+ within the max_stale period, setting *stale to say whether it has */
+OwmForecast  *owm_cache_lookup_stale (OwmCache *self, const char *endpoint,
+                 const char *location, const char *units, BOOL *stale);
+
+/** Add a forecast to the cache, replacing any existing entry with the
+ same key. The cache takes its own reference to the forecast, so the
+ caller still owns the one it has */
+void          owm_cache_insert (OwmCache *self, const char *endpoint,
+                 const char *location, const char *units,
+                 OwmForecast *forecast, time_t fetched);
+
+/** Remove an entry, if there is one */
+void          owm_cache_remove (OwmCache *self, const char *endpoint,
+                 const char *location, const char *units);
+
+/** Get the counters. These are totals across all the cache's shards */
+void          owm_cache_get_stats (OwmCache *self, OwmCacheStats *stats);
+
+#ifdef __CPLUSPLUS
+ }
+#endif
+
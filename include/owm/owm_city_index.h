@@ -0,0 +1,54 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_city_index.h
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * A spatial index over a city list, for finding the locations nearest to
+ *   a point, and the locations in a range of latitude and longitude.
+ * Locations are indexed as points on the unit sphere, in a k-d tree, so
+ *   that there is nothing special about the poles or the 180th meridian.
+ *   The tree is built once and is then read-only, so any number of
+ *   threads can query it at once.
+ * =========================================================================*/
+
+#pragma once
+
+#include <owm/owm_defs.h>
+#include <owm/owm_city_list.h>
+
+struct _OwmCityIndex;
+typedef struct _OwmCityIndex OwmCityIndex;
+
+#ifdef __CPLUSPLUS
+  extern "C" {
+#endif
+
+/** Build an index over all the locations in a city list. The index does
+ not refer to the list once it is built, but the indexes that it returns
+ are indexes into the list */
+OwmCityIndex *owm_city_index_create (const OwmCityList *list);
+
+void          owm_city_index_destroy (OwmCityIndex *self);
+
+/** Find the n locations nearest to a point, nearest first. Their
+ indexes in the city list are stored in indexes and, if distances is not
+ NULL, their great-circle distances from the point, in kilometres, are
+ stored in distances. Returns the number of locations found, which is n
+ unless the list has fewer locations */
+int           owm_city_index_nearest (const OwmCityIndex *self,
+                 double lat, double lon, int n, int *indexes,
+                 double *distances);
+
+/** Find the locations with latitude between lat_min and lat_max and
+ longitude between lon_min and lon_max, inclusive. If lon_min is greater
+ than lon_max, the range crosses the 180th meridian. The indexes of up
+ to max locations, in no particular order, are stored in indexes.
+ Returns the number of locations in the range, which may be more than
+ max */
+int           owm_city_index_within (const OwmCityIndex *self,
+                 double lat_min, double lon_min, double lat_max,
+                 double lon_max, int *indexes, int max);
+
+#ifdef __CPLUSPLUS
+ }
+#endif
+
@@ -0,0 +1,57 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_city_list.h
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * A table of the locations in OWM's city.list.json, which gives the
+ *   location ID, name, country and coordinates of every place that OWM
+ *   knows about.
+ * The file is memory-mapped, and parsed in chunks by several threads at
+ *   once. Names and country codes are interned into one block of
+ *   strings, and each location takes only twenty bytes besides, so the
+ *   whole table of some two hundred thousand places fits in a few
+ *   megabytes. Locations are held in order of ID. Coordinates are held
+ *   in single precision, which is good to about a metre.
+ * =========================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <owm/owm_defs.h>
+
+struct _OwmCityList;
+typedef struct _OwmCityList OwmCityList;
+
+#ifdef __CPLUSPLUS
+  extern "C" {
+#endif
+
+/** Load a city list. threads is the number of threads to parse it with,
+ or zero to use one per CPU */
+OwmCityList  *owm_city_list_load (const char *path, int threads,
+                 char **error);
+
+void          owm_city_list_destroy (OwmCityList *self);
+
+/** Get the number of locations */
+int           owm_city_list_get_count (const OwmCityList *self);
+
+/** Get the index of the location with the given ID, or -1 if there is
+ none */
+int           owm_city_list_find_id (const OwmCityList *self, int id);
+
+/** Get the fields of the location at index, which must be less than
+ owm_city_list_get_count(). Strings belong to the city list */
+int           owm_city_list_get_id (const OwmCityList *self, int index);
+const char   *owm_city_list_get_name (const OwmCityList *self, int index);
+const char   *owm_city_list_get_country (const OwmCityList *self,
+                 int index);
+double        owm_city_list_get_lat (const OwmCityList *self, int index);
+double        owm_city_list_get_lon (const OwmCityList *self, int index);
+
+/** Get the number of bytes of memory that the city list takes */
+size_t        owm_city_list_get_size (const OwmCityList *self);
+
+#ifdef __CPLUSPLUS
+ }
+#endif
+
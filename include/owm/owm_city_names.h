@@ -0,0 +1,63 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_city_names.h
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * A search structure over the names in a city list, for completing names
+ *   as they are typed and for finding names that are misspelled.
+ * Names are matched without regard to case or to the accents on Latin
+ *   letters, so that "sefid" finds "Sefīd". The structure is built once
+ *   and is then read-only, so any number of threads can search it at
+ *   once.
+ * city.list.json says nothing about how important each place is, so the
+ *   caller may supply a priority for each location -- its population, say
+ *   -- to rank matches by. Without one, shorter names rank higher.
+ * =========================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <owm/owm_defs.h>
+#include <owm/owm_city_list.h>
+
+struct _OwmCityNames;
+typedef struct _OwmCityNames OwmCityNames;
+
+/* owm_city_names_fuzzy() looks at no more than this many letters of the
+   name it is given */
+#define OWM_CITY_NAMES_MAX_FUZZY 64
+
+#ifdef __CPLUSPLUS
+  extern "C" {
+#endif
+
+/** Build the search structure over all the names in a city list.
+ priorities, if not NULL, gives a priority for each location in the
+ list, by index; higher priorities rank first. The structure does not
+ refer to the list or the priorities once it is built */
+OwmCityNames *owm_city_names_create (const OwmCityList *list,
+                 const float *priorities);
+
+void          owm_city_names_destroy (OwmCityNames *self);
+
+/** Find up to k locations whose names begin with prefix, highest
+ priority first, and store their indexes in the city list in indexes.
+ Returns the number found */
+int           owm_city_names_prefix (const OwmCityNames *self,
+                 const char *prefix, int k, int *indexes);
+
+/** Find up to k locations whose names are within max_distance edits --
+ insertions, deletions, or substitutions of a letter -- of name, nearest
+ first and then highest priority first. Their indexes are stored in
+ indexes and, if distances is not NULL, their distances in distances.
+ Returns the number found */
+int           owm_city_names_fuzzy (const OwmCityNames *self,
+                 const char *name, int max_distance, int k, int *indexes,
+                 int *distances);
+
+/** Get the number of bytes of memory that the structure takes */
+size_t        owm_city_names_get_size (const OwmCityNames *self);
+
+#ifdef __CPLUSPLUS
+ }
+#endif
+
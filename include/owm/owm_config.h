@@ -7,5 +7,12 @@
 #pragma once
 
 #define OWM_HOST "http://api.openweathermap.org"
-#define OWM_URI "/data/2.5/%s?id=%s&mode=xml&APPID=%s"
+/* Arguments: endpoint, location, mode ("xml" or "json"), API key */
+#define OWM_URI "/data/2.5/%s?id=%s&mode=%s&APPID=%s"
+#define OWM_URI_COORDS "/data/2.5/%s?lat=%s&lon=%s&mode=%s&APPID=%s"
+/* Appended to either of the above to limit the number of points */
+#define OWM_URI_COUNT "&cnt=%d"
 
+/* OWM's units parameter. We always ask for standard units -- kelvin and
+   meters per second -- and convert to the ones we publish */
+#define OWM_UNITS "standard"
@@ -0,0 +1,86 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_context.h
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * A context holds what the library's network calls need from one call to
+ *   the next: the server to talk to, the caches and location filter to
+ *   consult, and the connections to the server that are kept open between
+ *   calls. Any number of threads can make calls with the same context at
+ *   once, or with different contexts, which are entirely independent.
+ *   Configure a context before sharing it between threads.
+ * The calls that don't take a context -- owm_forecast_get() and the rest
+ *   -- use a default context, which owm_forecast_set_cache() and the other
+ *   setters in owm_forecast.h configure.
+ * The parsers keep no state between calls, and need no context. In
+ *   particular, the library never changes the process's TZ, and never
+ *   registers sxmlc user tags or search functions, which are global.
+ * =========================================================================*/
+
+#pragma once
+
+#include <owm/owm_defs.h>
+#include <owm/owm_forecast.h>
+#include <owm/owm_weather.h>
+
+struct _OwmContext;
+typedef struct _OwmContext OwmContext;
+
+/* The most connections to the server that a context keeps open while
+   they are not in use */
+#define OWM_CONTEXT_MAX_IDLE 8
+
+#ifdef __CPLUSPLUS
+  extern "C" {
+#endif
+
+/** Create a context with no caches or filter, which talks to OWM_HOST */
+OwmContext  *owm_context_create (void);
+
+/** Free the context, and close its connections. The caches and filter it
+ was given are not destroyed. A background refresh of a stale cache
+ entry keeps the context until the refresh is complete */
+void         owm_context_destroy (OwmContext *self);
+
+/** The context used by calls that don't take one. It is never freed */
+OwmContext  *owm_context_get_default (void);
+
+/** Send requests to host -- "http://api.openweathermap.org", say --
+ rather than OWM_HOST. NULL restores OWM_HOST */
+void         owm_context_set_host (OwmContext *self, const char *host);
+const char  *owm_context_get_host (const OwmContext *self);
+
+/** As owm_forecast_set_cache(), owm_forecast_set_disk_cache() and
+ owm_forecast_set_location_filter(), for this context */
+void         owm_context_set_cache (OwmContext *self, OwmCache *cache);
+void         owm_context_set_disk_cache (OwmContext *self,
+                OwmDiskCache *disk_cache);
+void         owm_context_set_location_filter (OwmContext *self,
+                OwmLocationFilter *filter);
+OwmCache    *owm_context_get_cache (const OwmContext *self);
+OwmDiskCache *owm_context_get_disk_cache (const OwmContext *self);
+OwmLocationFilter *owm_context_get_location_filter (const OwmContext *self);
+
+/** As owm_forecast_get_ex(), using this context */
+OwmForecast *owm_context_get_forecast (OwmContext *self,
+                const char *app_id, const char *location_id,
+                const OwmForecastOptions *options, char **error);
+
+/** As owm_forecast_get_by_coords(), using this context */
+OwmForecast *owm_context_get_forecast_by_coords (OwmContext *self,
+                const char *app_id, double lat, double lon,
+                const OwmForecastOptions *options, char **error);
+
+/** As owm_forecast_get_progressive(), using this context */
+void         owm_context_get_forecast_progressive (OwmContext *self,
+                const char *app_id, const char *location_id,
+                const OwmForecastOptions *options,
+                OwmForecastProgressCallback callback, void *user_data);
+
+/** As owm_weather_get_current(), using this context */
+OwmWeather  *owm_context_get_current (OwmContext *self, const char *app_id,
+                const char *location_id, char **error);
+
+#ifdef __CPLUSPLUS
+ }
+#endif
+
@@ -6,12 +6,28 @@
 
 #pragma once
 
+#include <stddef.h>
+
+/* Called by owm_curl_get_progressive() with the whole of the response so
+   far, which is always null-terminated */
+typedef void (*OwmCurlProgressFn) (const char *data, size_t len, 
+                void *user_data);
+
 #ifdef __CPLUSPLUS
   extern "C" {
 #endif
 
 void owm_curl_get (const char *uri, char **result, char **error);
 
+void owm_curl_get_conditional (const char *uri, const char *etag,
+       const char *last_modified, char **result, char **new_etag, 
+       char **new_last_modified, long *http_code, char **error);
+
+void owm_curl_get_progressive (const char *uri, const char *etag,
+       const char *last_modified, OwmCurlProgressFn progress, 
+       void *user_data, char **result, char **new_etag, 
+       char **new_last_modified, long *http_code, char **error);
+
 #ifdef __CPLUSPLUS
   } 
 #endif
@@ -0,0 +1,72 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_db.h
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * A read-only database of forecasts for many locations, in one file, for
+ *   serving precomputed forecasts to many processes at once.
+ * A builder collects forecasts and writes the file. Readers memory-map
+ *   it, and look forecasts up by location ID through a hash index;
+ *   the forecasts they get back are views whose points are in the mapped
+ *   file, so nothing is parsed or copied. Opening the database reads
+ *   only its header.
+ * The builder writes to a temporary file and renames it into place, so
+ *   a reader sees either the old database or the new one, never a mix.
+ *   A reader that has the database open keeps seeing the old one until
+ *   it opens it again; owm_db_is_current() says when to do that.
+ * The file is in the machine's native layout, and can only be read by
+ *   a build of the library for the same platform.
+ * =========================================================================*/
+
+#pragma once
+
+#include <owm/owm_defs.h>
+#include <owm/owm_forecast.h>
+
+struct _OwmDb;
+typedef struct _OwmDb OwmDb;
+
+struct _OwmDbBuilder;
+typedef struct _OwmDbBuilder OwmDbBuilder;
+
+#ifdef __CPLUSPLUS
+  extern "C" {
+#endif
+
+OwmDbBuilder *owm_db_builder_create (void);
+
+void          owm_db_builder_destroy (OwmDbBuilder *self);
+
+/** Add the forecast for a location. The builder takes its own reference
+ to the forecast. If a location is added more than once, the last
+ forecast added for it is the one written */
+void          owm_db_builder_add (OwmDbBuilder *self, const char *location,
+                 OwmForecast *forecast);
+
+/** Write the database, replacing any existing file at path. The builder
+ can then be added to and written again */
+BOOL          owm_db_builder_write (OwmDbBuilder *self, const char *path,
+                 char **error);
+
+/** Open a database written by owm_db_builder_write() */
+OwmDb        *owm_db_open (const char *path, char **error);
+
+/** Close the database. Views into it that callers still hold remain
+ valid, and the file stays mapped until the last is destroyed */
+void          owm_db_close (OwmDb *self);
+
+/** Get the number of locations in the database */
+int           owm_db_get_locations (const OwmDb *self);
+
+/** Look up the forecast for a location. Returns a view, which must be
+ released with owm_forecast_destroy() and treated as read-only, or NULL
+ if the location is not in the database */
+OwmForecast  *owm_db_lookup (OwmDb *self, const char *location);
+
+/** Returns FALSE if the file has been replaced since the database was
+ opened */
+BOOL          owm_db_is_current (const OwmDb *self);
+
+#ifdef __CPLUSPLUS
+ }
+#endif
+
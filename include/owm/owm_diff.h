@@ -0,0 +1,65 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_diff.h
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * Comparison of two forecasts for the same location, to find what has
+ *   changed meaningfully between one fetch and the next. Points are
+ *   matched by start time. Numeric fields are reported as changed only
+ *   if they moved by at least a threshold; conditions and precipitation
+ *   are reported on any change, as is a field becoming valid or invalid.
+ * The comparison is a single pass over both forecasts, and allocates
+ *   nothing.
+ * =========================================================================*/
+
+#pragma once
+
+#include <time.h>
+#include <owm/owm_forecast.h>
+#include <owm/owm_weather.h>
+
+/* Flags in OwmPointChange.changed, alongside the OWM_VALID_xxx codes of
+   the fields that changed */
+#define OWM_DIFF_ADDED   0x00010000 // In the new forecast only
+#define OWM_DIFF_REMOVED 0x00020000 // In the old forecast only
+
+/* The least change that counts, for each numeric field. A threshold of
+   zero reports any change at all */
+typedef struct _OwmDiffThresholds
+  {
+  double temp;            // Celsius
+  double wind_speed;      // mph, as OwmWeather stores it
+  double wind_direction;  // degrees, measured the short way round
+  double pressure;        // mbar
+  double humidity;        // %
+  double cloud_cover;     // %
+  } OwmDiffThresholds;
+
+typedef struct _OwmPointChange
+  {
+  time_t start_time;
+  int old_index;  // Index of the point in the old forecast, or -1
+  int new_index;  // Index of the point in the new forecast, or -1
+  int changed;    // OWM_VALID_xxx codes and OWM_DIFF_xxx flags
+  } OwmPointChange;
+
+#ifdef __CPLUSPLUS
+  extern "C" {
+#endif
+
+/** Fill in the default thresholds */
+void          owm_diff_thresholds_init (OwmDiffThresholds *thresholds);
+
+/** Compare two forecasts, and store a record of each point that was
+ added, removed or changed, in order of start time, in changes, which
+ has room for max entries. thresholds may be NULL, to use the defaults.
+ In the manner of snprintf(), returns the total number of changed points,
+ which may be more than max */
+int           owm_forecast_diff (const OwmForecast *old_forecast,
+                 const OwmForecast *new_forecast,
+                 const OwmDiffThresholds *thresholds,
+                 OwmPointChange *changes, int max);
+
+#ifdef __CPLUSPLUS
+ }
+#endif
+
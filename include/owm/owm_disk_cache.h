@@ -0,0 +1,70 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_disk_cache.h
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * A persistent cache of raw server responses, one file per key, in a
+ *   directory. Each file records when the response was fetched, and the
+ *   server's validators (ETag and Last-Modified), so that an expired
+ *   entry can be refreshed with a conditional request.
+ * Nothing is read when the cache is created. Each file is memory-mapped
+ *   when it is first looked up, so a newly-started process can serve
+ *   from the cache at once. Files are written to a temporary name and
+ *   renamed into place, so concurrent writers cannot corrupt each other;
+ *   and files are checksummed, so a damaged or truncated file is ignored.
+ * =========================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <time.h>
+#include <owm/owm_defs.h>
+#include <owm/owm_forecast.h>
+
+/* OwmDiskCache itself is declared in owm_forecast.h */
+
+struct _OwmDiskCacheEntry;
+typedef struct _OwmDiskCacheEntry OwmDiskCacheEntry;
+
+#ifdef __CPLUSPLUS
+  extern "C" {
+#endif
+
+/** Create a cache in the given directory, which is created if it does
+ not exist */
+OwmDiskCache *owm_disk_cache_create (const char *directory, char **error);
+
+void          owm_disk_cache_destroy (OwmDiskCache *self);
+
+/** Map the entry for the key, if there is an intact one. Returns NULL
+ if not. The entry must be released with owm_disk_cache_entry_close() */
+OwmDiskCacheEntry *owm_disk_cache_open (OwmDiskCache *self,
+                 const char *endpoint, const char *location,
+                 const char *units);
+
+/** Store a response, replacing any existing entry for the key. etag and
+ last_modified may be NULL */
+BOOL          owm_disk_cache_store (OwmDiskCache *self,
+                 const char *endpoint, const char *location,
+                 const char *units, const char *data, size_t len,
+                 time_t fetched, const char *etag,
+                 const char *last_modified, char **error);
+
+/** Get the response, which is followed by a zero byte, so it may be
+ treated as a string. It remains valid until the entry is closed */
+const char   *owm_disk_cache_entry_get_data (const OwmDiskCacheEntry *self,
+                 size_t *len);
+
+time_t        owm_disk_cache_entry_get_fetch_time
+                 (const OwmDiskCacheEntry *self);
+
+/** Get the validators, or NULL if the server did not supply them */
+const char   *owm_disk_cache_entry_get_etag (const OwmDiskCacheEntry *self);
+const char   *owm_disk_cache_entry_get_last_modified
+                 (const OwmDiskCacheEntry *self);
+
+void          owm_disk_cache_entry_close (OwmDiskCacheEntry *self);
+
+#ifdef __CPLUSPLUS
+ }
+#endif
+
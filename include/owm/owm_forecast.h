@@ -7,12 +7,90 @@
 #pragma once
 
 #include <owm/owm_data.h>
+#include <stddef.h>
 #include <time.h>
+#include <owm/owm_defs.h>
 #include <owm/owm_weather.h>
 
 struct OwmForecast;
 typedef struct _OwmForecast OwmForecast;
 
+struct _OwmCache;
+typedef struct _OwmCache OwmCache;
+
+struct _OwmDiskCache;
+typedef struct _OwmDiskCache OwmDiskCache;
+
+struct _OwmLocationFilter;
+typedef struct _OwmLocationFilter OwmLocationFilter;
+
+/* The error message from owm_forecast_get() when the location ID is 
+   rejected by the location filter or by the server. Compare it with 
+   strcmp() */
+#define OWM_ERROR_UNKNOWN_LOCATION "Unknown location ID"
+
+/* A summary of one day's forecast, as produced by 
+   owm_forecast_get_daily_summaries(). Days run from 00:00 to 24:00 UTC. 
+   The valid member has OWM_VALID_CONDITIONS, OWM_VALID_TEMP, 
+   OWM_VALID_WIND_SPEED and OWM_VALID_WIND_DIRECTION set according to 
+   which of the other members could be worked out from the points */
+typedef struct _OwmDailySummary
+  {
+  time_t day;                     // 00:00 UTC on this day
+  int points;                     // Number of forecast points in the day
+  int valid;
+  double min_temp;
+  double max_temp;
+  OwmConditions modal_conditions;
+  double wind_speed;              // Mean
+  double wind_direction;          // Vector mean 
+  } OwmDailySummary;
+
+/* Flags for OwmForecastOptions */
+// Keep only the daily summaries, and discard the individual points. 
+//  owm_forecast_get_points() will return zero.
+#define OWM_FORECAST_SUMMARY_ONLY 0x00000001
+// If the cache holds an expired forecast that is within the cache's 
+//  max_stale period, return it at once, and refresh it in the background.
+//  See owm_cache_set_stale_policy() and owm_forecast_is_stale()
+#define OWM_FORECAST_ALLOW_STALE  0x00000002
+// Ask OWM for a JSON document rather than XML. The JSON is about a third
+//  smaller, and quicker to parse, but the result is the same
+#define OWM_FORECAST_JSON         0x00000004
+
+/* Options for owm_forecast_get_ex() and owm_forecast_parse_ex(). A 
+   zero-filled structure, or a NULL pointer, gives the default 
+   behaviour */
+typedef struct _OwmForecastOptions
+  {
+  int flags; // OWM_FORECAST_xxx
+  // The size, in degrees, of the grid that owm_forecast_get_by_coords()
+  //  snaps coordinates to, or zero for OWM_FORECAST_DEFAULT_GRID
+  double grid;
+  // The most points to fetch, from the start of the forecast, or zero 
+  //  for all that OWM provides. Eight points are the next 24 hours
+  int max_points;
+  // The OWM_VALID_xxx fields to parse, or zero for all. The parser skips
+  //  the elements for other fields, which are not valid in the points.
+  //  OWM_VALID_START and OWM_VALID_END are always valid
+  int fields;
+  } OwmForecastOptions;
+
+/* Called by owm_forecast_get_progressive(). While the forecast is being
+   fetched, it is called with each point in turn, as soon as the point 
+   has arrived, with forecast and error NULL. It is then called once more
+   with point NULL. On success, forecast is the finished forecast, which 
+   is released when the callback returns, so take a reference with 
+   owm_forecast_ref() to keep it. On failure, forecast is NULL and error
+   says why; points that arrived before the failure will already have 
+   been passed to the callback */
+typedef void (*OwmForecastProgressCallback) (const OwmWeather *point,
+                 OwmForecast *forecast, const char *error, void *user_data);
+
+/* The default grid for owm_forecast_get_by_coords(): about a kilometre,
+   which is finer than the model that OWM's forecasts come from */
+#define OWM_FORECAST_DEFAULT_GRID 0.01
+
 #ifdef __CPLUSPLUS
   extern "C" {
 #endif
@@ -20,9 +98,84 @@ typedef struct _OwmForecast OwmForecast;
 OwmForecast *owm_forecast_get (const char *app_id, const char *location_id, 
     char **error);
 
-/** Cleans up memory reserved by the forecast object. */
+/** As owm_forecast_get(), but with options. options may be NULL */
+OwmForecast *owm_forecast_get_ex (const char *app_id, 
+                     const char *location_id, 
+                     const OwmForecastOptions *options, char **error);
+
+/** As owm_forecast_get_ex(), but the points are passed to callback as
+ they arrive, so that the first few hours can be shown before the whole
+ document has been received. Only XML documents are parsed as they 
+ arrive; the points from a JSON document, or from a cache, are passed to
+ the callback when the forecast is complete. All the calls to callback
+ are made before this function returns, on the calling thread */
+void         owm_forecast_get_progressive (const char *app_id, 
+                     const char *location_id, 
+                     const OwmForecastOptions *options, 
+                     OwmForecastProgressCallback callback, 
+                     void *user_data);
+
+/** Get the forecast for the place at latitude lat and longitude lon, 
+ in degrees. The coordinates are snapped to a grid, set in the options,
+ and requests for places in the same cell of the grid share a cache 
+ entry, so that each slightly different position reported by a GPS
+ receiver does not cost a separate request to the server */
+OwmForecast *owm_forecast_get_by_coords (const char *app_id, double lat,
+                     double lon, const OwmForecastOptions *options, 
+                     char **error);
+
+/** Parse a forecast document, as returned by the OWM API in either XML
+ or JSON mode */
+OwmForecast *owm_forecast_parse (const char *xml, char **error);
+
+/** As owm_forecast_parse(), but with options. options may be NULL */
+OwmForecast *owm_forecast_parse_ex (const char *xml, 
+                     const OwmForecastOptions *options, char **error);
+
+/** Releases the caller's reference to the forecast object, and cleans
+ up its memory when no references remain. */
 void               owm_forecast_destroy (OwmForecast *self);
 
+/** Take another reference to the forecast, to be released with 
+ owm_forecast_destroy(). Forecasts that are shared in this way must be
+ treated as read-only */
+OwmForecast       *owm_forecast_ref (OwmForecast *self);
+
+/** Get the number of bytes of memory occupied by the forecast */
+size_t             owm_forecast_get_size (const OwmForecast *self);
+
+/** Get the time at which the forecast was fetched from the server, or 
+ zero if it was not */
+time_t             owm_forecast_get_fetch_time (const OwmForecast *self);
+
+/** Get the number of seconds since the forecast was fetched, or zero if
+ it was not fetched from the server */
+int                owm_forecast_get_age (const OwmForecast *self);
+
+/** Returns TRUE if OWM will have updated the forecast since it was 
+ fetched, according to the update cycle of the cache of the context that
+ fetched it, or the default cycle if that context had no cache. For a
+ forecast that was not fetched by a context, such as one deserialized,
+ the default context's cache is used */
+BOOL               owm_forecast_is_stale (const OwmForecast *self);
+
+/** Set a cache for owm_forecast_get() and owm_forecast_get_ex() to use, 
+ or NULL to stop using one. This should be done before any other threads
+ call those functions. The caller still owns the cache */
+void               owm_forecast_set_cache (OwmCache *cache);
+
+/** Set a persistent cache of server responses for owm_forecast_get() and 
+ owm_forecast_get_ex() to use, after the in-memory cache, or NULL to stop
+ using one. The same conditions apply as for owm_forecast_set_cache() */
+void               owm_forecast_set_disk_cache (OwmDiskCache *disk_cache);
+
+/** Set a filter for owm_forecast_get() and owm_forecast_get_ex() to check
+ location IDs against before doing anything else, or NULL to stop using
+ one. IDs that the server rejects are added to it. The same conditions 
+ apply as for owm_forecast_set_cache() */
+void               owm_forecast_set_location_filter 
+                     (OwmLocationFilter *filter);
+
 /** Get the number of forecast data points in the forecast list -- usually 40 */
 int                owm_forecast_get_points (const OwmForecast *self);
 
@@ -43,6 +196,55 @@ void               owm_forecast_get_daily_summary (const OwmForecast *forecast,
                      OwmConditions *modal_conditions, double *wind_direction, 
                      double *wind_speed, char **error);
 
+/** Copy the summary of every day covered by the forecast, at most 
+ max_days entries, into the summaries array, earliest first. Returns
+ the number of entries filled in. Five-day forecasts usually span six
+ calendar days. The summaries are worked out when the forecast is
+ parsed, so this is cheap, and it is reentrant */
+int                owm_forecast_get_daily_summaries 
+                     (const OwmForecast *self, OwmDailySummary *summaries, 
+                     int max_days);
+
+/** Copy one property of every point, selected by its OWM_VALID_xxx code,
+ into the values array, which has room for max entries. If mask is not 
+ NULL, mask[i] is set to 1 if the point has a valid value, and 0 if not. 
+ Returns the number of entries filled in. The results are suitable for 
+ the functions in owm_stats.h */
+int                owm_forecast_get_field (const OwmForecast *self, 
+                     int field, double *values, unsigned char *mask, 
+                     int max);
+
+/** As owm_forecast_get_field(), but copy the wind directions as unit 
+ vectors, x (east-west) and y (north-south), ready for 
+ owm_stats_wind_vector_mean(). These are worked out when the forecast is
+ parsed, so copying them needs no trigonometry. Points without a valid 
+ wind direction have a zero vector */
+int                owm_forecast_get_wind_vectors (const OwmForecast *self,
+                     double *x, double *y, unsigned char *mask, int max);
+
+/** Find the last point that starts at or before time t, by binary search.
+ Returns -1 if t is before the start of the forecast */
+int                owm_forecast_find_point (const OwmForecast *self, 
+                     time_t t);
+
+/** Get the value of a property, selected by its OWM_VALID_xxx code, at 
+ time t. Values are interpolated between points: linearly for most
+ properties, the shorter way round for wind direction, and not at all for
+ conditions and precipitation type. Returns FALSE if the forecast has 
+ no value for t */
+BOOL               owm_forecast_interpolate (const OwmForecast *self, 
+                     int field, time_t t, double *value);
+
+/** Fill values[0..n-1] with the value of a property at the times 
+ start + i * step, interpolated as for owm_forecast_interpolate(). This
+ converts the three-hourly forecast into an hourly or daily series, for 
+ example. If mask is not NULL, mask[i] is set to 1 for samples that have
+ a value, and 0 otherwise. Nothing is allocated. Returns the number of
+ samples that have a value */
+int                owm_forecast_resample (const OwmForecast *self, 
+                     int field, time_t start, int step, int n, 
+                     double *values, unsigned char *mask);
+
 /* Get the sunrise and sunset times from the forecast. Note that these only
  apply, strictly speaking, to the first day of the forecast */
 void               owm_forecast_get_rise_set (OwmForecast *self, 
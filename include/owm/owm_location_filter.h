@@ -0,0 +1,64 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_location_filter.h
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * A filter that says, without asking the server, whether a location ID
+ *   could be one that OWM knows about, so that requests for bad IDs can
+ *   fail at once instead of costing a round trip and some API quota.
+ * The filter holds the IDs in a city list as a blocked Bloom filter, in
+ *   which all the bits for an ID are in one 64-byte block, so that a
+ *   check reads one cache line. It can give false positives -- about one
+ *   ID in a thousand, at the default size -- but never false negatives.
+ * The filter also remembers, for a while, the IDs that the server has
+ *   rejected, which catches IDs that are in the city list but that the
+ *   server no longer knows. Nothing in the filter takes a lock.
+ * Set a filter with owm_forecast_set_location_filter(); owm_forecast_get()
+ *   then fails with OWM_ERROR_UNKNOWN_LOCATION for IDs it rejects.
+ * =========================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <owm/owm_defs.h>
+#include <owm/owm_city_list.h>
+
+struct _OwmLocationFilter;
+typedef struct _OwmLocationFilter OwmLocationFilter;
+
+/* Bits of filter per ID, if owm_location_filter_create() is given zero */
+#define OWM_LOCATION_FILTER_DEFAULT_BITS 16
+/* How long, in seconds, an ID that the server rejected is remembered */
+#define OWM_LOCATION_FILTER_REJECT_TTL (24 * 3600)
+
+#ifdef __CPLUSPLUS
+  extern "C" {
+#endif
+
+/** Create a filter that admits the IDs in a city list, using bits_per_id
+ bits of memory for each, or OWM_LOCATION_FILTER_DEFAULT_BITS if
+ bits_per_id is zero. More bits give fewer false positives */
+OwmLocationFilter *owm_location_filter_create (const OwmCityList *list,
+                     int bits_per_id);
+
+void               owm_location_filter_destroy (OwmLocationFilter *self);
+
+/** Returns FALSE if location_id is certainly not a location that the
+ server will accept: it is not a number, is not in the city list, or
+ was rejected by the server recently */
+BOOL               owm_location_filter_check (const OwmLocationFilter *self,
+                     const char *location_id);
+
+/** Note that the server has rejected location_id. It will fail the check
+ for OWM_LOCATION_FILTER_REJECT_TTL seconds, or until the entry is
+ displaced by another rejected ID */
+void               owm_location_filter_reject (OwmLocationFilter *self,
+                     const char *location_id);
+
+/** Get the number of bytes of memory that the filter takes */
+size_t             owm_location_filter_get_size
+                     (const OwmLocationFilter *self);
+
+#ifdef __CPLUSPLUS
+ }
+#endif
+
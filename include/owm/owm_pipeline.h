@@ -0,0 +1,126 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_pipeline.h
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * Refreshes a large batch of forecasts in three stages, each with its own
+ *   threads, so that waiting on the network and parsing overlap:
+ *   - fetch: threads that download the documents, on the context's
+ *     connections;
+ *   - parse: a pool of threads, one per CPU by default, that parse them
+ *     with owm_forecast_parse_ex();
+ *   - finish: one thread that stores each forecast in the context's
+ *     caches, serializes it if asked to, and passes it to the callback.
+ * The stages are linked by bounded queues. When a stage falls behind,
+ *   its queue fills, and the stage before it waits for room, and so on
+ *   back to owm_pipeline_submit(); so the number of documents in memory
+ *   at once is limited, however long the batch.
+ * Unlike owm_context_get_forecast(), the pipeline does not consult the
+ *   caches before fetching: every location submitted is fetched afresh.
+ * =========================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <owm/owm_defs.h>
+#include <owm/owm_forecast.h>
+#include <owm/owm_context.h>
+
+struct _OwmPipeline;
+typedef struct _OwmPipeline OwmPipeline;
+
+/* The stages, as indexes into OwmPipelineStats.stages */
+#define OWM_PIPELINE_FETCH 0
+#define OWM_PIPELINE_PARSE 1
+#define OWM_PIPELINE_FINISH 2
+#define OWM_PIPELINE_STAGES 3
+
+/* Flags for OwmPipelineOptions */
+// Pass the callback the serialized form of each forecast, as written by
+//  owm_forecast_serialize()
+#define OWM_PIPELINE_SERIALIZE 0x1
+
+#define OWM_PIPELINE_DEFAULT_FETCHERS 8
+#define OWM_PIPELINE_DEFAULT_QUEUE 64
+
+/* Options for owm_pipeline_create(). A zero-filled structure, or a NULL
+   pointer, gives the defaults */
+typedef struct _OwmPipelineOptions
+  {
+  int flags; // OWM_PIPELINE_xxx
+  // Threads in the fetch stage, or zero for OWM_PIPELINE_DEFAULT_FETCHERS.
+  //  These spend most of their time waiting on the server
+  int fetchers;
+  // Threads in the parse stage, or zero for one per online CPU
+  int parsers;
+  // The capacity of each stage's queue, or zero for
+  //  OWM_PIPELINE_DEFAULT_QUEUE
+  int queue_size;
+  } OwmPipelineOptions;
+
+/* Called on the finish thread for each location submitted, one call at a
+   time, in the order the forecasts are finished. On success, forecast is
+   the new forecast and error is NULL; the forecast is released when the
+   callback returns, so take a reference with owm_forecast_ref() to keep
+   it. If OWM_PIPELINE_SERIALIZE is set, data and len are its serialized
+   form, which is freed when the callback returns; otherwise data is
+   NULL. On failure, forecast and data are NULL and error says why */
+typedef void (*OwmPipelineCallback) (const char *location_id,
+                 OwmForecast *forecast, const unsigned char *data,
+                 size_t len, const char *error, void *user_data);
+
+typedef struct _OwmPipelineStageStats
+  {
+  int threads;
+  unsigned long items;     // Passed on to the next stage
+  unsigned long failures;  // Of those, the ones that failed in this stage
+  double throughput;       // Items per second since the pipeline started
+  double busy;             // Thread-seconds spent working
+  double blocked;          // Thread-seconds waiting for room in the next
+                           //  stage's queue
+  int queue_depth;         // Items waiting for this stage
+  int queue_max_depth;     // The most that have ever been waiting
+  int queue_size;
+  } OwmPipelineStageStats;
+
+typedef struct _OwmPipelineStats
+  {
+  OwmPipelineStageStats stages[OWM_PIPELINE_STAGES];
+  unsigned long submitted;
+  unsigned long completed;  // Passed to the callback
+  double elapsed;           // Seconds since the pipeline started
+  } OwmPipelineStats;
+
+#ifdef __CPLUSPLUS
+  extern "C" {
+#endif
+
+/** Create a pipeline, and start its threads. Requests are made with the
+ given context, or with the default context if it is NULL; the pipeline
+ keeps a reference to it until it is destroyed. forecast_options, which
+ may be NULL, are used for every request, as in
+ owm_context_get_forecast() */
+OwmPipeline  *owm_pipeline_create (OwmContext *context, const char *app_id,
+                 const OwmForecastOptions *forecast_options,
+                 const OwmPipelineOptions *options,
+                 OwmPipelineCallback callback, void *user_data);
+
+/** Finish every location submitted, then stop the threads and free the
+ pipeline */
+void          owm_pipeline_destroy (OwmPipeline *self);
+
+/** Add a location to the batch. This waits while the fetch stage's queue
+ is full. It must not be called from the callback */
+void          owm_pipeline_submit (OwmPipeline *self,
+                 const char *location_id);
+
+/** Wait until every location submitted so far has been passed to the
+ callback. It must not be called from the callback */
+void          owm_pipeline_wait (OwmPipeline *self);
+
+void          owm_pipeline_get_stats (OwmPipeline *self,
+                 OwmPipelineStats *stats);
+
+#ifdef __CPLUSPLUS
+ }
+#endif
+
@@ -0,0 +1,83 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_scheduler.h
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * Keeps forecasts for a set of registered locations fresh, by fetching
+ *   them with owm_context_get_forecast() on a pool of worker threads, and
+ *   passing each new forecast to a callback.
+ * Each location has a freshness target -- the age at which it should be
+ *   fetched again -- and a priority. Refreshes are paced by a token
+ *   bucket so as to stay within a per-minute budget of API calls; when
+ *   more locations are due than the budget allows, higher priorities go
+ *   first, and then those that have been waiting longest. Refresh times
+ *   are jittered, so that locations registered together drift apart
+ *   rather than all coming due at once, cycle after cycle.
+ * =========================================================================*/
+
+#pragma once
+
+#include <owm/owm_defs.h>
+#include <owm/owm_forecast.h>
+#include <owm/owm_context.h>
+
+struct _OwmScheduler;
+typedef struct _OwmScheduler OwmScheduler;
+
+/* Priorities run from 0 (lowest) to OWM_SCHEDULER_PRIORITIES - 1 */
+#define OWM_SCHEDULER_PRIORITIES 4
+
+/* Called on a worker thread after each refresh. On success, forecast is
+   the new forecast and error is NULL; the forecast is released when the
+   callback returns, so take a reference with owm_forecast_ref() to keep
+   it. On failure, forecast is NULL and error says why; the location is
+   tried again later, backing off after repeated failures */
+typedef void (*OwmSchedulerCallback) (const char *location_id,
+                 OwmForecast *forecast, const char *error, void *user_data);
+
+typedef struct _OwmSchedulerStats
+  {
+  int locations;
+  int backlog;       // Locations that are due, but not yet being fetched
+  int in_flight;     // Locations being fetched
+  double lag;        // Seconds since the longest-waiting location fell due
+  double mean_lag;   // Average delay between falling due and being fetched
+  unsigned long refreshes;
+  unsigned long failures;
+  } OwmSchedulerStats;
+
+#ifdef __CPLUSPLUS
+  extern "C" {
+#endif
+
+/** Create a scheduler, and start its workers. Fetches are made with the
+ given context, or with the default context if it is NULL; the scheduler
+ keeps a reference to it until it is destroyed. calls_per_minute is the
+ budget of API calls; zero means no limit. options, which may be NULL,
+ are passed to owm_context_get_forecast() for every fetch */
+OwmScheduler *owm_scheduler_create (OwmContext *context, const char *app_id,
+                 int workers, int calls_per_minute,
+                 const OwmForecastOptions *options,
+                 OwmSchedulerCallback callback, void *user_data);
+
+/** Stop the workers, waiting for any fetches in progress to finish, and
+ free the scheduler */
+void          owm_scheduler_destroy (OwmScheduler *self);
+
+/** Register a location, to be fetched as soon as the budget allows, and
+ then whenever its forecast is max_age seconds old. If the location is
+ already registered, its priority and max_age are updated */
+void          owm_scheduler_add (OwmScheduler *self, const char *location_id,
+                 int priority, int max_age);
+
+/** Stop refreshing a location. A fetch in progress for it still
+ completes, and its result is still passed to the callback */
+void          owm_scheduler_remove (OwmScheduler *self,
+                 const char *location_id);
+
+void          owm_scheduler_get_stats (OwmScheduler *self,
+                 OwmSchedulerStats *stats);
+
+#ifdef __CPLUSPLUS
+ }
+#endif
+
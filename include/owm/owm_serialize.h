@@ -0,0 +1,44 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_serialize.h
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * A compact, versioned binary form of OwmForecast, for passing parsed
+ *   forecasts between processes and hosts without going back to XML.
+ *   The format is the same on all platforms.
+ * Values are quantized: temperatures, wind speeds and pressures to 0.01,
+ *   and wind direction, humidity and cloud cover to 0.1. This is
+ *   finer than the precision OWM supplies, so nothing it sends is lost.
+ * =========================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <owm/owm_forecast.h>
+
+/* The version written by owm_forecast_serialize(). Earlier versions can
+   still be read */
+#define OWM_SERIALIZE_VERSION 2
+
+#ifdef __CPLUSPLUS
+  extern "C" {
+#endif
+
+/** Write the forecast into buffer, which has room for size bytes. In the
+ manner of snprintf(), returns the number of bytes the complete form
+ needs; if this is more than size, the buffer does not hold a usable
+ result, and the call should be repeated with a larger one. Call with a
+ NULL buffer and zero size to find the size needed */
+size_t        owm_forecast_serialize (const OwmForecast *self,
+                 unsigned char *buffer, size_t size);
+
+/** Create a forecast from the binary form. The buffer is checked
+ completely -- length, version, checksum and every field -- before
+ anything is trusted, so it may come from an untrusted source. Returns
+ NULL, and sets *error, if it is not valid */
+OwmForecast  *owm_forecast_deserialize (const unsigned char *buffer,
+                 size_t len, char **error);
+
+#ifdef __CPLUSPLUS
+ }
+#endif
+
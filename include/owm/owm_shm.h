@@ -0,0 +1,63 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_shm.h
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * A store of parsed forecasts in a POSIX shared-memory segment, so that
+ *   one process can fetch and parse forecasts for all the worker
+ *   processes on a host.
+ * The segment holds a fixed number of slots, one per location. Each slot
+ *   is protected by a sequence lock: the publisher never waits for
+ *   readers, and readers never wait for the publisher or take a lock --
+ *   a reader that overlaps an update simply copies the slot again. A
+ *   lookup returns a private copy of the forecast, which is read through
+ *   the usual accessors and released with owm_forecast_destroy().
+ * There must be only one publishing process for each segment.
+ * =========================================================================*/
+
+#pragma once
+
+#include <owm/owm_defs.h>
+#include <owm/owm_forecast.h>
+
+struct _OwmShm;
+typedef struct _OwmShm OwmShm;
+
+/* The longest location ID a slot can hold, including the terminator */
+#define OWM_SHM_MAX_LOCATION 32
+
+#ifdef __CPLUSPLUS
+  extern "C" {
+#endif
+
+/** Create the segment with the given name (which, as for shm_open(),
+ should start with a '/'), replacing any existing one, and attach to it
+ for publishing. It will hold forecasts for up to n_locations locations,
+ each with up to max_points points and max_days daily summaries */
+OwmShm       *owm_shm_create (const char *name, int n_locations,
+                 int max_points, int max_days, char **error);
+
+/** Attach to an existing segment, for reading */
+OwmShm       *owm_shm_attach (const char *name, char **error);
+
+/** Detach from the segment. The segment itself remains until it is
+ unlinked */
+void          owm_shm_detach (OwmShm *self);
+
+/** Remove the segment's name. Processes already attached to it are not
+ affected */
+void          owm_shm_unlink (const char *name);
+
+/** Publish a forecast for a location, replacing any earlier one. Fails
+ if the segment was attached for reading, if the forecast is too large
+ for a slot, or if every slot is taken by other locations */
+BOOL          owm_shm_publish (OwmShm *self, const char *location,
+                 const OwmForecast *forecast, char **error);
+
+/** Get a copy of the latest forecast for a location, or NULL if none
+ has been published */
+OwmForecast  *owm_shm_lookup (OwmShm *self, const char *location);
+
+#ifdef __CPLUSPLUS
+ }
+#endif
+
@@ -0,0 +1,55 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_stats.h
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * Aggregation functions that work on plain arrays of values, such as
+ *   those filled in by owm_forecast_get_field(). These are intended for
+ *   working out statistics over large numbers of forecasts. They use
+ *   SSE2 or AVX2 instructions where the CPU has them, which is decided
+ *   at run time.
+ * =========================================================================*/
+
+#pragma once
+
+/* The results of owm_stats_compute(). If count is zero, the other
+   members are undefined */
+typedef struct _OwmStats
+  {
+  int count;   // Number of values that were included
+  double min;
+  double max;
+  double sum;
+  double mean;
+  } OwmStats;
+
+#ifdef __CPLUSPLUS
+  extern "C" {
+#endif
+
+/** Work out the minimum, maximum, sum and mean of n values. If mask is
+ not NULL, only values[i] for which mask[i] is non-zero are included */
+void          owm_stats_compute (const double *values,
+                 const unsigned char *mask, int n, OwmStats *stats);
+
+/** Convert n wind directions in degrees to unit vectors, storing the
+ components in x (east-west) and y (north-south). This is the expensive
+ part of averaging wind directions, and need be done only once for
+ a set of values. For the points of a forecast, which hold their
+ vectors already, owm_forecast_get_wind_vectors() is much cheaper */
+void          owm_stats_wind_unit_vectors (const double *directions,
+                 int n, double *x, double *y);
+
+/** Get the vector mean, in degrees, of wind directions that have been
+ converted to unit vectors by owm_stats_wind_unit_vectors(). If mask is
+ not NULL, only vectors for which mask[i] is non-zero are included */
+double        owm_stats_wind_vector_mean (const double *x, const double *y,
+                 const unsigned char *mask, int n);
+
+/** Get the name of the instruction set used by the functions above --
+ "avx2", "sse2" or "scalar" */
+const char   *owm_stats_get_implementation (void);
+
+#ifdef __CPLUSPLUS
+ }
+#endif
+
@@ -157,6 +157,14 @@ double        owm_weather_get_cloud_cover (const OwmWeather *self); //%
 void          owm_weather_set_cloud_cover (OwmWeather *self, double cloud_cover); //%
 const char   *owm_weather_wind_direction_to_string (double wind_direction);
 const char   *owm_weather_get_wind_direction_string (const OwmWeather *self);
+// Get a property selected by its OWM_VALID_xxx code
+double        owm_weather_get_field (const OwmWeather *self, int field);
+
+// Get the current conditions from OWM's weather endpoint, rather than a 
+//  forecast. The caller must free the result with owm_weather_destroy()
+OwmWeather   *owm_weather_get_current (const char *app_id, 
+                 const char *location_id, char **error);
+OwmWeather   *owm_weather_parse_current (const char *xml, char **error);
 
 #ifdef __CPLUSPLUS
  }
@@ -0,0 +1,893 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_archive.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * The archive is a sequence of blocks, one per run, each laid out as
+ *   follows:
+ *     magic, length of the whole block, CRC-32 of everything after the
+ *       CRC (4 bytes each, little-endian)
+ *     version, location ID (length, then bytes), issue time, earliest
+ *       start time, latest end time - earliest start time, number of
+ *       points, forecast flags, sunrise, sunset - sunrise
+ *     a mask of the value columns that have any values, and for each of
+ *       them, in order, its smallest value and largest - smallest,
+ *       quantized; version 1 blocks have none of these
+ *     the columns, in the order of owm_archive_columns[] below
+ *   Integers are varints (see owm_varint.c). The header fields come
+ *   first, and the location ID is limited in length, so the index can be
+ *   built by reading just the start of each block; and the index holds
+ *   each block's value ranges, so a search by value reads only the
+ *   blocks that might match.
+ * Only one process may have an archive open at a time; owm_archive_open()
+ *   takes an exclusive flock() to make sure of it.
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <owm/owm_defs.h>
+#include <owm/owm_forecast.h>
+#include <owm/owm_archive.h>
+#include "owm_private.h"
+
+#define OWM_ARCHIVE_MAGIC 0x4257414Fu // "OAWB"
+#define OWM_ARCHIVE_VERSION 2
+#define OWM_ARCHIVE_PREFIX 12  // Magic, length, CRC
+
+/* The value columns. Each holds a value for every point that has the
+   field's validity bit set, quantized, as a delta from the last value in
+   the column */
+typedef struct _OwmArchiveColumn
+  {
+  int field;
+  size_t offset; // Of the value in OwmWeather
+  double scale;
+  } OwmArchiveColumn;
+
+static const OwmArchiveColumn owm_archive_columns[] =
+  {
+  { OWM_VALID_TEMP, offsetof (OwmWeather, temp), OWM_Q_TEMP },
+  { OWM_VALID_WIND_DIRECTION, offsetof (OwmWeather, wind_direction),
+      OWM_Q_DIRECTION },
+  { OWM_VALID_WIND_SPEED, offsetof (OwmWeather, wind_speed), OWM_Q_SPEED },
+  { OWM_VALID_PRESSURE, offsetof (OwmWeather, pressure), OWM_Q_PRESSURE },
+  { OWM_VALID_HUMIDITY, offsetof (OwmWeather, humidity), OWM_Q_PERCENT },
+  { OWM_VALID_CLOUD_COVER, offsetof (OwmWeather, cloud_cover),
+      OWM_Q_PERCENT },
+  };
+
+#define OWM_ARCHIVE_N_COLUMNS \
+  (sizeof (owm_archive_columns) / sizeof (owm_archive_columns[0]))
+
+// Enough to hold the prefix and the header fields, with every range
+#define OWM_ARCHIVE_HEADER_MAX (OWM_ARCHIVE_PREFIX \
+          + (11 + 2 * OWM_ARCHIVE_N_COLUMNS) * 10 + OWM_ARCHIVE_MAX_LOCATION)
+
+/* The quantized values of each value column in a block */
+typedef struct _OwmArchiveRanges
+  {
+  int fields; // The validity bits of the columns that have any values
+  int64_t min[OWM_ARCHIVE_N_COLUMNS];
+  int64_t max[OWM_ARCHIVE_N_COLUMNS];
+  } OwmArchiveRanges;
+
+typedef struct _OwmArchiveHeader
+  {
+  uint32_t length;
+  uint32_t checksum;
+  char location_id[OWM_ARCHIVE_MAX_LOCATION + 1];
+  time_t issued;
+  time_t min_time;
+  time_t max_time;
+  int n_points;
+  int flags;
+  time_t sunrise;
+  time_t sunset;
+  OwmArchiveRanges ranges;
+  } OwmArchiveHeader;
+
+/* What the index knows about a run */
+typedef struct _OwmArchiveRun
+  {
+  time_t issued;
+  time_t min_time;
+  time_t max_time;
+  uint64_t offset;
+  uint32_t length;
+  const char *location_id; // Belongs to the OwmArchiveLocation
+  OwmArchiveRanges ranges;
+  } OwmArchiveRun;
+
+typedef struct _OwmArchiveLocation
+  {
+  struct _OwmArchiveLocation *chain;
+  char *location_id;
+  uint32_t hash;
+  int n_runs;
+  int max_runs;
+  OwmArchiveRun *runs; // In order of issue time
+  } OwmArchiveLocation;
+
+struct _OwmArchive
+  {
+  pthread_mutex_t mutex;
+  int fd;
+  char *path;
+  uint64_t size;
+  BOOL damaged; // A failed append could not be undone
+  OwmArchiveLocation **buckets;
+  int n_buckets;
+  int n_locations;
+  int n_runs;
+  };
+
+
+/*============================================================================
+ * owm_archive_hash
+ * 32-bit FNV-1a
+ * =========================================================================*/
+static uint32_t owm_archive_hash (const char *s)
+  {
+  uint32_t hash = 2166136261u;
+  const unsigned char *p;
+  for (p = (const unsigned char *)s; *p; p++)
+    {
+    hash ^= *p;
+    hash *= 16777619u;
+    }
+  return hash;
+  }
+
+
+/*============================================================================
+ * owm_archive_find
+ * Call with the lock held
+ * =========================================================================*/
+static OwmArchiveLocation *owm_archive_find (const OwmArchive *self,
+      const char *location_id, uint32_t hash)
+  {
+  OwmArchiveLocation *l = self->buckets[hash & (self->n_buckets - 1)];
+  while (l)
+    {
+    if (l->hash == hash && strcmp (l->location_id, location_id) == 0)
+      return l;
+    l = l->chain;
+    }
+  return NULL;
+  }
+
+
+/*============================================================================
+ * owm_archive_grow
+ * Double the number of hash buckets. Call with the lock held
+ * =========================================================================*/
+static void owm_archive_grow (OwmArchive *self)
+  {
+  int n = self->n_buckets * 2;
+  OwmArchiveLocation **buckets = calloc ((size_t)n,
+    sizeof (OwmArchiveLocation *));
+  int i;
+  for (i = 0; i < self->n_buckets; i++)
+    {
+    OwmArchiveLocation *l = self->buckets[i];
+    while (l)
+      {
+      OwmArchiveLocation *chain = l->chain;
+      l->chain = buckets[l->hash & (n - 1)];
+      buckets[l->hash & (n - 1)] = l;
+      l = chain;
+      }
+    }
+  free (self->buckets);
+  self->buckets = buckets;
+  self->n_buckets = n;
+  }
+
+
+/*============================================================================
+ * owm_archive_index_add
+ * Add a run to the index. Runs are nearly always appended in order of
+ *   issue time, so keeping each location's list in order costs little.
+ *   Call with the lock held
+ * =========================================================================*/
+static void owm_archive_index_add (OwmArchive *self,
+      const OwmArchiveHeader *h, uint64_t offset)
+  {
+  uint32_t hash = owm_archive_hash (h->location_id);
+  OwmArchiveLocation *l = owm_archive_find (self, h->location_id, hash);
+  if (!l)
+    {
+    if (self->n_locations >= self->n_buckets) owm_archive_grow (self);
+    l = malloc (sizeof (OwmArchiveLocation));
+    memset (l, 0, sizeof (OwmArchiveLocation));
+    l->location_id = strdup (h->location_id);
+    l->hash = hash;
+    l->chain = self->buckets[hash & (self->n_buckets - 1)];
+    self->buckets[hash & (self->n_buckets - 1)] = l;
+    self->n_locations++;
+    }
+  if (l->n_runs == l->max_runs)
+    {
+    l->max_runs = l->max_runs ? l->max_runs * 2 : 8;
+    l->runs = realloc (l->runs, l->max_runs * sizeof (OwmArchiveRun));
+    }
+  int i = l->n_runs++;
+  while (i > 0 && l->runs[i - 1].issued > h->issued)
+    {
+    l->runs[i] = l->runs[i - 1];
+    i--;
+    }
+  OwmArchiveRun *run = &l->runs[i];
+  run->issued = h->issued;
+  run->min_time = h->min_time;
+  run->max_time = h->max_time;
+  run->offset = offset;
+  run->length = h->length;
+  run->location_id = l->location_id;
+  run->ranges = h->ranges;
+  self->n_runs++;
+  }
+
+
+/*============================================================================
+ * owm_archive_read_header
+ * Read the prefix and header fields of a block. Returns FALSE if they
+ *   are not valid
+ * =========================================================================*/
+static BOOL owm_archive_read_header (OwmReader *r, OwmArchiveHeader *h)
+  {
+  size_t c;
+  if (owm_reader_u32 (r) != OWM_ARCHIVE_MAGIC) return FALSE;
+  h->length = owm_reader_u32 (r);
+  h->checksum = owm_reader_u32 (r);
+  uint64_t version = owm_reader_uvarint (r);
+  if (version < 1 || version > OWM_ARCHIVE_VERSION) return FALSE;
+  uint64_t location_len = owm_reader_uvarint (r);
+  if (location_len > OWM_ARCHIVE_MAX_LOCATION) return FALSE;
+  if (location_len > (uint64_t)(r->end - r->p))
+    {
+    r->ok = FALSE;
+    return FALSE;
+    }
+  memcpy (h->location_id, r->p, location_len);
+  h->location_id[location_len] = 0;
+  r->p += location_len;
+  h->issued = owm_reader_varint (r);
+  h->min_time = owm_reader_varint (r);
+  h->max_time = h->min_time + owm_reader_varint (r);
+  h->n_points = (int)owm_reader_uvarint (r);
+  h->flags = (int)owm_reader_uvarint (r);
+  h->sunrise = owm_reader_varint (r);
+  h->sunset = h->sunrise + owm_reader_varint (r);
+  memset (&h->ranges, 0, sizeof (h->ranges));
+  if (version == 1)
+    {
+    // No ranges, so any column might match anything
+    for (c = 0; c < OWM_ARCHIVE_N_COLUMNS; c++)
+      {
+      h->ranges.fields |= owm_archive_columns[c].field;
+      h->ranges.min[c] = INT64_MIN;
+      h->ranges.max[c] = INT64_MAX;
+      }
+    }
+  else
+    {
+    h->ranges.fields = (int)owm_reader_uvarint (r);
+    for (c = 0; c < OWM_ARCHIVE_N_COLUMNS; c++)
+      {
+      if (!(h->ranges.fields & owm_archive_columns[c].field)) continue;
+      h->ranges.min[c] = owm_reader_varint (r);
+      h->ranges.max[c] = h->ranges.min[c] + owm_reader_varint (r);
+      }
+    }
+  return r->ok && h->length >= OWM_ARCHIVE_PREFIX && h->n_points >= 0;
+  }
+
+
+/*============================================================================
+ * owm_archive_encode
+ * Write a run into a block. Returns the length of the block, which will
+ *   have been written only if it is no more than size
+ * =========================================================================*/
+static size_t owm_archive_encode (const char *location_id, time_t issued,
+      const OwmForecast *f, unsigned char *buffer, size_t size)
+  {
+  OwmWriter w = { buffer, buffer ? size : 0, 0 };
+  const OwmWeather *p = f->points;
+  int n = f->n_points;
+  int i;
+  size_t c;
+
+  OwmArchiveRanges ranges;
+  memset (&ranges, 0, sizeof (ranges));
+  for (c = 0; c < OWM_ARCHIVE_N_COLUMNS; c++)
+    {
+    const OwmArchiveColumn *col = &owm_archive_columns[c];
+    for (i = 0; i < n; i++)
+      {
+      if (!(p[i].valid & col->field)) continue;
+      double v = *(const double *)((const char *)&p[i] + col->offset);
+      int64_t q = llround (v * col->scale);
+      if (!(ranges.fields & col->field))
+        {
+        ranges.fields |= col->field;
+        ranges.min[c] = ranges.max[c] = q;
+        }
+      else if (q < ranges.min[c])
+        ranges.min[c] = q;
+      else if (q > ranges.max[c])
+        ranges.max[c] = q;
+      }
+    }
+
+  owm_writer_u32 (&w, OWM_ARCHIVE_MAGIC);
+  owm_writer_u32 (&w, 0); // Length and checksum, filled in at the end
+  owm_writer_u32 (&w, 0);
+  owm_writer_uvarint (&w, OWM_ARCHIVE_VERSION);
+  size_t location_len = strlen (location_id);
+  owm_writer_uvarint (&w, location_len);
+  for (i = 0; i < (int)location_len; i++)
+    owm_writer_byte (&w, location_id[i]);
+  owm_writer_varint (&w, issued);
+  time_t min_time = n ? p[0].start_time : 0;
+  time_t max_time = n ? p[n - 1].end_time : 0;
+  owm_writer_varint (&w, min_time);
+  owm_writer_varint (&w, max_time - min_time);
+  owm_writer_uvarint (&w, n);
+  owm_writer_uvarint (&w, f->flags);
+  owm_writer_varint (&w, f->sunrise);
+  owm_writer_varint (&w, f->sunset - f->sunrise);
+  owm_writer_uvarint (&w, ranges.fields);
+  for (c = 0; c < OWM_ARCHIVE_N_COLUMNS; c++)
+    {
+    if (!(ranges.fields & owm_archive_columns[c].field)) continue;
+    owm_writer_varint (&w, ranges.min[c]);
+    owm_writer_varint (&w, ranges.max[c] - ranges.min[c]);
+    }
+
+  // Start times: the first, and then deltas of deltas
+  time_t last_delta = 0;
+  for (i = 0; i < n; i++)
+    {
+    if (i == 0)
+      owm_writer_varint (&w, p[0].start_time);
+    else
+      {
+      time_t delta = p[i].start_time - p[i - 1].start_time;
+      owm_writer_varint (&w, delta - last_delta);
+      last_delta = delta;
+      }
+    }
+  // Durations, validity masks, and precipitation, which is always
+  //  present, as changes from the previous point
+  for (i = 0; i < n; i++)
+    owm_writer_varint (&w, (p[i].end_time - p[i].start_time)
+      - (i ? p[i - 1].end_time - p[i - 1].start_time : 0));
+  for (i = 0; i < n; i++)
+    owm_writer_uvarint (&w, (uint32_t)(p[i].valid ^ (i ? p[i - 1].valid : 0)));
+  for (i = 0; i < n; i++)
+    owm_writer_varint (&w, p[i].precipitation
+      - (i ? p[i - 1].precipitation : 0));
+  int64_t last = 0;
+  for (i = 0; i < n; i++)
+    {
+    if (!(p[i].valid & OWM_VALID_CONDITIONS)) continue;
+    owm_writer_varint (&w, p[i].conditions - last);
+    last = p[i].conditions;
+    }
+  for (c = 0; c < OWM_ARCHIVE_N_COLUMNS; c++)
+    {
+    const OwmArchiveColumn *col = &owm_archive_columns[c];
+    last = 0;
+    for (i = 0; i < n; i++)
+      {
+      if (!(p[i].valid & col->field)) continue;
+      double v = *(const double *)((const char *)&p[i] + col->offset);
+      int64_t q = llround (v * col->scale);
+      owm_writer_varint (&w, q - last);
+      last = q;
+      }
+    }
+
+  if (w.pos <= w.size)
+    {
+    OwmWriter hw = { buffer + 4, 8, 0 };
+    owm_writer_u32 (&hw, (uint32_t)w.pos);
+    owm_writer_u32 (&hw, owm_crc32_update (0, buffer + OWM_ARCHIVE_PREFIX,
+      w.pos - OWM_ARCHIVE_PREFIX));
+    }
+  return w.pos;
+  }
+
+
+/*============================================================================
+ * owm_archive_decode
+ * Check a whole block, and decode it into a new forecast. Returns NULL
+ *   if the block is damaged
+ * =========================================================================*/
+static OwmForecast *owm_archive_decode (const unsigned char *buffer,
+      size_t len)
+  {
+  OwmReader r = { buffer, buffer + len, TRUE };
+  OwmArchiveHeader h;
+  if (!owm_archive_read_header (&r, &h) || h.length != len
+      || owm_crc32_update (0, buffer + OWM_ARCHIVE_PREFIX,
+           len - OWM_ARCHIVE_PREFIX) != h.checksum)
+    return NULL;
+  // Every point takes at least four bytes
+  int n = h.n_points;
+  if ((size_t)n > (size_t)(r.end - r.p) / 4) return NULL;
+
+  // With no more than one summary for each day the points touch
+  long span_days = (long)((h.max_time - h.min_time) / OWM_SECONDS_PER_DAY);
+  int max_days = span_days + 2 < n ? (int)span_days + 2 : n;
+  OwmForecast *self = owm_forecast_create (n, max_days);
+  OwmWeather *p = self->points;
+  self->flags = h.flags;
+  self->sunrise = h.sunrise;
+  self->sunset = h.sunset;
+  self->fetched = h.issued;
+  int i;
+  size_t c;
+
+  time_t last_delta = 0;
+  for (i = 0; i < n; i++)
+    {
+    owm_weather_init (&p[i]);
+    if (i == 0)
+      p[0].start_time = owm_reader_varint (&r);
+    else
+      {
+      last_delta += owm_reader_varint (&r);
+      p[i].start_time = p[i - 1].start_time + last_delta;
+      }
+    }
+  time_t duration = 0;
+  for (i = 0; i < n; i++)
+    {
+    duration += owm_reader_varint (&r);
+    p[i].end_time = p[i].start_time + duration;
+    }
+  for (i = 0; i < n; i++)
+    p[i].valid = (int)owm_reader_uvarint (&r) ^ (i ? p[i - 1].valid : 0);
+  for (i = 0; i < n; i++)
+    p[i].precipitation = (int)owm_reader_varint (&r)
+      + (i ? p[i - 1].precipitation : 0);
+  int64_t last = 0;
+  for (i = 0; i < n; i++)
+    {
+    if (!(p[i].valid & OWM_VALID_CONDITIONS)) continue;
+    last += owm_reader_varint (&r);
+    p[i].conditions = (OwmConditions)last;
+    }
+  for (c = 0; c < OWM_ARCHIVE_N_COLUMNS; c++)
+    {
+    const OwmArchiveColumn *col = &owm_archive_columns[c];
+    last = 0;
+    for (i = 0; i < n; i++)
+      {
+      if (!(p[i].valid & col->field)) continue;
+      last += owm_reader_varint (&r);
+      *(double *)((char *)&p[i] + col->offset) = last / col->scale;
+      }
+    }
+  if (!r.ok || r.p != r.end)
+    {
+    owm_forecast_destroy (self);
+    return NULL;
+    }
+
+  OwmDayAccumulator acc;
+  owm_forecast_begin_points (self, &acc);
+  for (i = 0; i < n; i++)
+    owm_forecast_add_point (self, &acc, &p[i]);
+  owm_forecast_end_points (self, &acc);
+  return self;
+  }
+
+
+/*============================================================================
+ * owm_archive_is_magic
+ * Do the n bytes at p match the start of a block's magic?
+ * =========================================================================*/
+static BOOL owm_archive_is_magic (const unsigned char *p, size_t n)
+  {
+  unsigned char magic[4];
+  OwmWriter w = { magic, sizeof (magic), 0 };
+  owm_writer_u32 (&w, OWM_ARCHIVE_MAGIC);
+  return memcmp (p, magic, n < 4 ? n : 4) == 0;
+  }
+
+
+/*============================================================================
+ * owm_archive_open
+ * A block at the end that runs past the end of the file, or whose header
+ *   does, is one that a process was appending when it died, and is cut
+ *   off. Anything else that doesn't read as a block means the file is
+ *   damaged, or isn't an archive; then the open fails, and the file is
+ *   left alone
+ * =========================================================================*/
+OwmArchive *owm_archive_open (const char *path, char **error)
+  {
+  int fd = open (path, O_RDWR | O_CREAT | O_APPEND, 0644);
+  struct stat sb;
+  if (fd < 0 || fstat (fd, &sb) != 0)
+    {
+    if (error)
+      asprintf (error, "Can't open archive %s: %s", path, strerror (errno));
+    if (fd >= 0) close (fd);
+    return NULL;
+    }
+  if (flock (fd, LOCK_EX | LOCK_NB) != 0)
+    {
+    if (error && errno == EWOULDBLOCK)
+      asprintf (error, "Archive %s is open in another process", path);
+    else if (error)
+      asprintf (error, "Can't lock archive %s: %s", path, strerror (errno));
+    close (fd);
+    return NULL;
+    }
+
+  OwmArchive *self = malloc (sizeof (OwmArchive));
+  memset (self, 0, sizeof (OwmArchive));
+  pthread_mutex_init (&self->mutex, NULL);
+  self->fd = fd;
+  self->path = strdup (path);
+  self->n_buckets = 64;
+  self->buckets = calloc (self->n_buckets, sizeof (OwmArchiveLocation *));
+
+  uint64_t size = sb.st_size;
+  uint64_t offset = 0;
+  unsigned char prefix[OWM_ARCHIVE_HEADER_MAX];
+  BOOL cut_off = FALSE;
+  while (offset < size && !cut_off)
+    {
+    ssize_t n = pread (fd, prefix, sizeof (prefix), offset);
+    if (n <= 0) break;
+    OwmReader r = { prefix, prefix + n, TRUE };
+    OwmArchiveHeader h;
+    if (owm_archive_read_header (&r, &h))
+      {
+      if (h.length > size - offset)
+        cut_off = TRUE;
+      else
+        {
+        owm_archive_index_add (self, &h, offset);
+        offset += h.length;
+        }
+      }
+    else if (!r.ok && offset + n == size && owm_archive_is_magic (prefix, n))
+      cut_off = TRUE;
+    else
+      break;
+    }
+  if (offset < size)
+    {
+    if (!cut_off)
+      {
+      if (error && offset == 0)
+        asprintf (error, "%s is not a forecast archive", path);
+      else if (error)
+        asprintf (error, "Archive %s is damaged at offset %llu", path,
+          (unsigned long long)offset);
+      owm_archive_close (self);
+      return NULL;
+      }
+    if (ftruncate (fd, offset) != 0)
+      {
+      if (error)
+        asprintf (error, "Can't repair archive %s: %s", path,
+          strerror (errno));
+      owm_archive_close (self);
+      return NULL;
+      }
+    }
+  self->size = offset;
+  return self;
+  }
+
+
+/*============================================================================
+ * owm_archive_close
+ * =========================================================================*/
+void owm_archive_close (OwmArchive *self)
+  {
+  if (!self) return;
+  int i;
+  for (i = 0; i < self->n_buckets; i++)
+    {
+    OwmArchiveLocation *l = self->buckets[i];
+    while (l)
+      {
+      OwmArchiveLocation *chain = l->chain;
+      free (l->runs);
+      free (l->location_id);
+      free (l);
+      l = chain;
+      }
+    }
+  free (self->buckets);
+  free (self->path);
+  close (self->fd);
+  pthread_mutex_destroy (&self->mutex);
+  free (self);
+  }
+
+
+/*============================================================================
+ * owm_archive_append
+ * =========================================================================*/
+BOOL owm_archive_append (OwmArchive *self, const char *location_id,
+      time_t issued, const OwmForecast *forecast, char **error)
+  {
+  if (strlen (location_id) > OWM_ARCHIVE_MAX_LOCATION)
+    {
+    if (error) asprintf (error, "Location ID %s is too long", location_id);
+    return FALSE;
+    }
+  size_t len = owm_archive_encode (location_id, issued, forecast, NULL, 0);
+  unsigned char *buffer = malloc (len);
+  owm_archive_encode (location_id, issued, forecast, buffer, len);
+
+  BOOL ret = FALSE;
+  pthread_mutex_lock (&self->mutex);
+  if (self->damaged)
+    {
+    pthread_mutex_unlock (&self->mutex);
+    free (buffer);
+    if (error)
+      asprintf (error, "Archive %s must be reopened after a failed write",
+        self->path);
+    return FALSE;
+    }
+  // One write, so that a crash leaves at worst one incomplete block at
+  //  the end, which is discarded on the next open
+  ssize_t n = write (self->fd, buffer, len);
+  if (n == (ssize_t)len)
+    {
+    OwmReader r = { buffer, buffer + len, TRUE };
+    OwmArchiveHeader h;
+    owm_archive_read_header (&r, &h);
+    owm_archive_index_add (self, &h, self->size);
+    self->size += len;
+    ret = TRUE;
+    }
+  else
+    {
+    if (error)
+      asprintf (error, "Can't write to archive %s: %s", self->path,
+        n < 0 ? strerror (errno) : "short write");
+    // Don't leave part of a block for the next append to follow; if
+    //  that can't be helped, the next open will discard it
+    if (n > 0 && ftruncate (self->fd, self->size) != 0)
+      self->damaged = TRUE;
+    }
+  pthread_mutex_unlock (&self->mutex);
+
+  free (buffer);
+  return ret;
+  }
+
+
+/*============================================================================
+ * owm_archive_get_runs
+ * =========================================================================*/
+int owm_archive_get_runs (OwmArchive *self)
+  {
+  pthread_mutex_lock (&self->mutex);
+  int ret = self->n_runs;
+  pthread_mutex_unlock (&self->mutex);
+  return ret;
+  }
+
+
+/*============================================================================
+ * owm_archive_read_run
+ * =========================================================================*/
+static OwmForecast *owm_archive_read_run (OwmArchive *self,
+      const OwmArchiveRun *run, char **error)
+  {
+  unsigned char *buffer = malloc (run->length);
+  OwmForecast *ret = NULL;
+  if (pread (self->fd, buffer, run->length, run->offset)
+        == (ssize_t)run->length)
+    ret = owm_archive_decode (buffer, run->length);
+  if (!ret && error)
+    asprintf (error, "Archive %s is damaged at offset %llu", self->path,
+      (unsigned long long)run->offset);
+  free (buffer);
+  return ret;
+  }
+
+
+/*============================================================================
+ * owm_archive_get_as_of
+ * =========================================================================*/
+OwmForecast *owm_archive_get_as_of (OwmArchive *self,
+      const char *location_id, time_t valid_at, time_t issued_by,
+      time_t *issued, char **error)
+  {
+  OwmArchiveRun run;
+  BOOL found = FALSE;
+
+  pthread_mutex_lock (&self->mutex);
+  OwmArchiveLocation *l = owm_archive_find (self, location_id,
+    owm_archive_hash (location_id));
+  if (l)
+    {
+    // The last run issued by issued_by, by binary search, and then back
+    //  from there to the latest that covers valid_at
+    int lo = 0, hi = l->n_runs;
+    while (lo < hi)
+      {
+      int mid = (lo + hi) / 2;
+      if (l->runs[mid].issued <= issued_by) lo = mid + 1; else hi = mid;
+      }
+    int i;
+    for (i = lo - 1; i >= 0; i--)
+      {
+      if (l->runs[i].min_time <= valid_at && valid_at < l->runs[i].max_time)
+        {
+        run = l->runs[i];
+        found = TRUE;
+        break;
+        }
+      }
+    }
+  pthread_mutex_unlock (&self->mutex);
+
+  if (!found) return NULL;
+  if (issued) *issued = run.issued;
+  return owm_archive_read_run (self, &run, error);
+  }
+
+
+/*============================================================================
+ * owm_archive_column_for
+ * The index in owm_archive_columns[] of a field, or -1
+ * =========================================================================*/
+static int owm_archive_column_for (int field)
+  {
+  size_t c;
+  for (c = 0; c < OWM_ARCHIVE_N_COLUMNS; c++)
+    if (owm_archive_columns[c].field == field) return (int)c;
+  return -1;
+  }
+
+
+/*============================================================================
+ * owm_archive_has_value
+ * Does the forecast have a point between valid_from and valid_to whose
+ *   value in column c is between min and max?
+ * =========================================================================*/
+static BOOL owm_archive_has_value (const OwmForecast *f, time_t valid_from,
+      time_t valid_to, int c, double min, double max)
+  {
+  const OwmArchiveColumn *col = &owm_archive_columns[c];
+  int i;
+  for (i = 0; i < f->n_points; i++)
+    {
+    const OwmWeather *p = &f->points[i];
+    if (!(p->valid & col->field) || p->end_time < valid_from
+        || p->start_time > valid_to)
+      continue;
+    double v = *(const double *)((const char *)p + col->offset);
+    if (v >= min && v <= max) return TRUE;
+    }
+  return FALSE;
+  }
+
+
+/*============================================================================
+ * owm_archive_scan_runs
+ * The matching runs are listed with the lock held, and then read without
+ *   it, so that the callback can take as long as it likes. If c is not
+ *   -1, runs whose ranges show they have no value of column c between
+ *   min and max are not read at all, and of those that are, only the ones
+ *   with a matching point go to the callback
+ * =========================================================================*/
+static long owm_archive_scan_runs (OwmArchive *self, const char *location_id,
+      time_t valid_from, time_t valid_to, int c, double min, double max,
+      OwmArchiveScanCallback callback, void *user_data, char **error)
+  {
+  int n = 0, max_runs = 0, i, j;
+  OwmArchiveRun *runs = NULL;
+
+  pthread_mutex_lock (&self->mutex);
+  for (i = 0; i < self->n_buckets; i++)
+    {
+    OwmArchiveLocation *l;
+    for (l = self->buckets[i]; l; l = l->chain)
+      {
+      if (location_id && strcmp (l->location_id, location_id) != 0)
+        continue;
+      for (j = 0; j < l->n_runs; j++)
+        {
+        const OwmArchiveRun *run = &l->runs[j];
+        if (run->max_time < valid_from || run->min_time > valid_to)
+          continue;
+        if (c >= 0)
+          {
+          const OwmArchiveColumn *col = &owm_archive_columns[c];
+          if (!(run->ranges.fields & col->field)
+              || run->ranges.max[c] / col->scale < min
+              || run->ranges.min[c] / col->scale > max)
+            continue;
+          }
+        if (n == max_runs)
+          {
+          max_runs = max_runs ? max_runs * 2 : 64;
+          runs = realloc (runs, max_runs * sizeof (OwmArchiveRun));
+          }
+        runs[n++] = *run;
+        }
+      }
+    }
+  pthread_mutex_unlock (&self->mutex);
+
+  long points = 0;
+  for (i = 0; i < n; i++)
+    {
+    OwmForecast *f = owm_archive_read_run (self, &runs[i], error);
+    if (!f)
+      {
+      points = -1;
+      break;
+      }
+    if (c >= 0 && !owm_archive_has_value (f, valid_from, valid_to, c, 
+          min, max))
+      {
+      owm_forecast_destroy (f);
+      continue;
+      }
+    points += f->n_points;
+    BOOL more = callback (runs[i].location_id, runs[i].issued, f,
+      user_data);
+    owm_forecast_destroy (f);
+    if (!more) break;
+    }
+  free (runs);
+  return points;
+  }
+
+
+/*============================================================================
+ * owm_archive_scan
+ * =========================================================================*/
+long owm_archive_scan (OwmArchive *self, const char *location_id,
+      time_t valid_from, time_t valid_to, OwmArchiveScanCallback callback,
+      void *user_data, char **error)
+  {
+  return owm_archive_scan_runs (self, location_id, valid_from, valid_to,
+    -1, 0, 0, callback, user_data, error);
+  }
+
+
+/*============================================================================
+ * owm_archive_scan_values
+ * =========================================================================*/
+long owm_archive_scan_values (OwmArchive *self, const char *location_id,
+      time_t valid_from, time_t valid_to, int field, double min, double max,
+      OwmArchiveScanCallback callback, void *user_data, char **error)
+  {
+  int c = owm_archive_column_for (field);
+  if (c < 0)
+    {
+    if (error) asprintf (error, "Field %d is not archived by value", field);
+    return -1;
+    }
+  return owm_archive_scan_runs (self, location_id, valid_from, valid_to,
+    c, min, max, callback, user_data, error);
+  }
+
@@ -0,0 +1,489 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_cache.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * The cache is divided into shards, each with its own lock, hash table
+ *   and LRU list. A key always maps to the same shard, so threads working
+ *   on different locations rarely contend for a lock.
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <owm/owm_defs.h>
+#include <owm/owm_forecast.h>
+#include <owm/owm_cache.h>
+#include "owm_private.h"
+
+/* Must be a power of two */
+#define OWM_CACHE_SHARDS 16
+#define OWM_CACHE_INITIAL_BUCKETS 64
+
+typedef struct _OwmCacheEntry
+  {
+  struct _OwmCacheEntry *chain; // Next entry in the same hash bucket
+  struct _OwmCacheEntry *prev;  // LRU list, most recently used first
+  struct _OwmCacheEntry *next;
+  uint32_t hash;
+  char *key;
+  OwmForecast *forecast;
+  time_t fetched;
+  time_t expires;
+  size_t size;
+  BOOL refreshing; // See owm_cache_begin_refresh()
+  } OwmCacheEntry;
+
+typedef struct _OwmCacheShard
+  {
+  pthread_mutex_t mutex;
+  OwmCacheEntry **buckets;
+  int n_buckets;
+  int entries;
+  size_t bytes;
+  size_t max_bytes;
+  OwmCacheEntry *head;
+  OwmCacheEntry *tail;
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+  unsigned long expirations;
+  unsigned long stale_hits;
+  } OwmCacheShard;
+
+struct _OwmCache
+  {
+  int cycle;
+  int offset;
+  int max_stale;
+  int max_refreshes;
+  int refreshes; // Guarded by refresh_mutex
+  pthread_mutex_t refresh_mutex;
+  pthread_cond_t refresh_cond; // Signalled when refreshes falls to zero
+  OwmCacheShard shards[OWM_CACHE_SHARDS];
+  };
+
+
+/*============================================================================
+ * owm_cache_make_key
+ * Combine the parts of the key into a new string, and return its hash
+ *   (FNV-1a)
+ * =========================================================================*/
+static uint32_t owm_cache_make_key (const char *endpoint,
+      const char *location, const char *units, char **key)
+  {
+  asprintf (key, "%s|%s|%s", endpoint, location, units);
+  uint32_t hash = 2166136261u;
+  const unsigned char *p;
+  for (p = (const unsigned char *)*key; *p; p++)
+    {
+    hash ^= *p;
+    hash *= 16777619u;
+    }
+  return hash;
+  }
+
+
+/*============================================================================
+ * owm_cache_shard_for
+ * =========================================================================*/
+static OwmCacheShard *owm_cache_shard_for (OwmCache *self, uint32_t hash)
+  {
+  // The low bits pick the bucket within the shard, so use the high ones
+  return &self->shards[(hash >> 24) & (OWM_CACHE_SHARDS - 1)];
+  }
+
+
+/*============================================================================
+ * owm_cache_shard_find
+ * Call with the shard locked
+ * =========================================================================*/
+static OwmCacheEntry *owm_cache_shard_find (OwmCacheShard *shard,
+      uint32_t hash, const char *key)
+  {
+  OwmCacheEntry *e = shard->buckets[hash & (shard->n_buckets - 1)];
+  while (e)
+    {
+    if (e->hash == hash && strcmp (e->key, key) == 0) return e;
+    e = e->chain;
+    }
+  return NULL;
+  }
+
+
+/*============================================================================
+ * owm_cache_lru_unlink
+ * =========================================================================*/
+static void owm_cache_lru_unlink (OwmCacheShard *shard, OwmCacheEntry *e)
+  {
+  if (e->prev) e->prev->next = e->next; else shard->head = e->next;
+  if (e->next) e->next->prev = e->prev; else shard->tail = e->prev;
+  e->prev = e->next = NULL;
+  }
+
+
+/*============================================================================
+ * owm_cache_lru_push
+ * Make e the most recently used entry
+ * =========================================================================*/
+static void owm_cache_lru_push (OwmCacheShard *shard, OwmCacheEntry *e)
+  {
+  e->prev = NULL;
+  e->next = shard->head;
+  if (shard->head) shard->head->prev = e; else shard->tail = e;
+  shard->head = e;
+  }
+
+
+/*============================================================================
+ * owm_cache_shard_remove
+ * Unlink an entry from its bucket and the LRU list, and free it. Call
+ *   with the shard locked
+ * =========================================================================*/
+static void owm_cache_shard_remove (OwmCacheShard *shard, OwmCacheEntry *e)
+  {
+  OwmCacheEntry **pp = &shard->buckets[e->hash & (shard->n_buckets - 1)];
+  while (*pp != e) pp = &(*pp)->chain;
+  *pp = e->chain;
+  owm_cache_lru_unlink (shard, e);
+  shard->entries--;
+  shard->bytes -= e->size;
+  owm_forecast_destroy (e->forecast);
+  free (e->key);
+  free (e);
+  }
+
+
+/*============================================================================
+ * owm_cache_shard_grow
+ * Double the number of hash buckets. Call with the shard locked
+ * =========================================================================*/
+static void owm_cache_shard_grow (OwmCacheShard *shard)
+  {
+  int n = shard->n_buckets * 2;
+  OwmCacheEntry **buckets = calloc ((size_t)n, sizeof (OwmCacheEntry *));
+  if (!buckets) return;
+  int i;
+  for (i = 0; i < shard->n_buckets; i++)
+    {
+    OwmCacheEntry *e = shard->buckets[i];
+    while (e)
+      {
+      OwmCacheEntry *chain = e->chain;
+      e->chain = buckets[e->hash & (n - 1)];
+      buckets[e->hash & (n - 1)] = e;
+      e = chain;
+      }
+    }
+  free (shard->buckets);
+  shard->buckets = buckets;
+  shard->n_buckets = n;
+  }
+
+
+/*============================================================================
+ * owm_cache_create
+ * =========================================================================*/
+OwmCache *owm_cache_create (size_t max_bytes)
+  {
+  OwmCache *self = malloc (sizeof (OwmCache));
+  memset (self, 0, sizeof (OwmCache));
+  self->cycle = OWM_CACHE_DEFAULT_CYCLE;
+  self->max_refreshes = OWM_CACHE_DEFAULT_REFRESHES;
+  pthread_mutex_init (&self->refresh_mutex, NULL);
+  pthread_cond_init (&self->refresh_cond, NULL);
+  int i;
+  for (i = 0; i < OWM_CACHE_SHARDS; i++)
+    {
+    OwmCacheShard *shard = &self->shards[i];
+    pthread_mutex_init (&shard->mutex, NULL);
+    shard->n_buckets = OWM_CACHE_INITIAL_BUCKETS;
+    shard->buckets = calloc (OWM_CACHE_INITIAL_BUCKETS,
+      sizeof (OwmCacheEntry *));
+    // Each shard enforces its own share; see owm_cache_create() in
+    //  owm_cache.h for what that means for the total
+    shard->max_bytes = max_bytes / OWM_CACHE_SHARDS;
+    }
+  return self;
+  }
+
+
+/*============================================================================
+ * owm_cache_destroy
+ * =========================================================================*/
+void owm_cache_destroy (OwmCache *self)
+  {
+  if (!self) return;
+  // Background refreshes call back into the cache when they finish
+  pthread_mutex_lock (&self->refresh_mutex);
+  while (self->refreshes > 0)
+    pthread_cond_wait (&self->refresh_cond, &self->refresh_mutex);
+  pthread_mutex_unlock (&self->refresh_mutex);
+  int i;
+  for (i = 0; i < OWM_CACHE_SHARDS; i++)
+    {
+    OwmCacheShard *shard = &self->shards[i];
+    while (shard->head)
+      owm_cache_shard_remove (shard, shard->head);
+    free (shard->buckets);
+    pthread_mutex_destroy (&shard->mutex);
+    }
+  pthread_cond_destroy (&self->refresh_cond);
+  pthread_mutex_destroy (&self->refresh_mutex);
+  free (self);
+  }
+
+
+/*============================================================================
+ * owm_cache_set_update_cycle
+ * =========================================================================*/
+void owm_cache_set_update_cycle (OwmCache *self, int cycle, int offset)
+  {
+  if (cycle <= 0) cycle = OWM_CACHE_DEFAULT_CYCLE;
+  self->cycle = cycle;
+  self->offset = offset % cycle;
+  }
+
+
+/*============================================================================
+ * owm_cache_cycle_expiry
+ * The start of the first update cycle after the one in which fetched
+ *   falls
+ * =========================================================================*/
+time_t owm_cache_cycle_expiry (time_t fetched, int cycle, int offset)
+  {
+  time_t t = fetched - offset;
+  time_t cycle_start = t - (t % cycle);
+  if (t % cycle < 0) cycle_start -= cycle;
+  return cycle_start + cycle + offset;
+  }
+
+
+/*============================================================================
+ * owm_cache_get_expiry
+ * =========================================================================*/
+time_t owm_cache_get_expiry (const OwmCache *self, time_t fetched)
+  {
+  return owm_cache_cycle_expiry (fetched, self->cycle, self->offset);
+  }
+
+
+/*============================================================================
+ * owm_cache_set_stale_policy
+ * =========================================================================*/
+void owm_cache_set_stale_policy (OwmCache *self, int max_stale,
+      int max_refreshes)
+  {
+  self->max_stale = max_stale > 0 ? max_stale : 0;
+  self->max_refreshes = max_refreshes > 0 ? max_refreshes : 1;
+  }
+
+
+/*============================================================================
+ * owm_cache_find_fresh
+ * Look up an entry, and return a new reference to its forecast if it is
+ *   unexpired or, if allow_stale is set, no more than max_stale seconds
+ *   past its expiry. An expired entry is kept until it is too old even
+ *   to be served stale
+ * =========================================================================*/
+static OwmForecast *owm_cache_find_fresh (OwmCache *self,
+      const char *endpoint, const char *location, const char *units,
+      BOOL allow_stale, BOOL *stale)
+  {
+  OwmForecast *ret = NULL;
+  char *key;
+  uint32_t hash = owm_cache_make_key (endpoint, location, units, &key);
+  OwmCacheShard *shard = owm_cache_shard_for (self, hash);
+  time_t now = time (NULL);
+
+  pthread_mutex_lock (&shard->mutex);
+  OwmCacheEntry *e = owm_cache_shard_find (shard, hash, key);
+  if (e && now >= e->expires + self->max_stale)
+    {
+    owm_cache_shard_remove (shard, e);
+    shard->expirations++;
+    e = NULL;
+    }
+  BOOL is_stale = e && now >= e->expires;
+  if (e && (!is_stale 
+      || (allow_stale && now < e->expires + self->max_stale)))
+    {
+    owm_cache_lru_unlink (shard, e);
+    owm_cache_lru_push (shard, e);
+    ret = owm_forecast_ref (e->forecast);
+    if (is_stale) shard->stale_hits++; else shard->hits++;
+    }
+  else
+    shard->misses++;
+  pthread_mutex_unlock (&shard->mutex);
+
+  if (stale) *stale = ret && is_stale;
+  free (key);
+  return ret;
+  }
+
+
+/*============================================================================
+ * owm_cache_lookup
+ * =========================================================================*/
+OwmForecast *owm_cache_lookup (OwmCache *self, const char *endpoint,
+      const char *location, const char *units)
+  {
+  return owm_cache_find_fresh (self, endpoint, location, units, 
+    FALSE, NULL);
+  }
+
+
+/*============================================================================
+ * owm_cache_lookup_stale
+ * =========================================================================*/
+OwmForecast *owm_cache_lookup_stale (OwmCache *self, const char *endpoint,
+      const char *location, const char *units, BOOL *stale)
+  {
+  return owm_cache_find_fresh (self, endpoint, location, units, 
+    TRUE, stale);
+  }
+
+
+/*============================================================================
+ * owm_cache_begin_refresh
+ * Claim the right to refresh an entry. This succeeds for only one caller
+ *   at a time for each entry, and for at most max_refreshes callers
+ *   across the whole cache. A successful call must be matched by a call
+ *   to owm_cache_end_refresh()
+ * =========================================================================*/
+BOOL owm_cache_begin_refresh (OwmCache *self, const char *endpoint,
+      const char *location, const char *units)
+  {
+  BOOL ret = FALSE;
+  char *key;
+  uint32_t hash = owm_cache_make_key (endpoint, location, units, &key);
+  OwmCacheShard *shard = owm_cache_shard_for (self, hash);
+
+  pthread_mutex_lock (&shard->mutex);
+  OwmCacheEntry *e = owm_cache_shard_find (shard, hash, key);
+  if (e && !e->refreshing)
+    {
+    pthread_mutex_lock (&self->refresh_mutex);
+    if (self->refreshes < self->max_refreshes)
+      {
+      self->refreshes++;
+      e->refreshing = TRUE;
+      ret = TRUE;
+      }
+    pthread_mutex_unlock (&self->refresh_mutex);
+    }
+  pthread_mutex_unlock (&shard->mutex);
+
+  free (key);
+  return ret;
+  }
+
+
+/*============================================================================
+ * owm_cache_end_refresh
+ * The entry may have been replaced by the refresh, in which case the new
+ *   one is not marked as refreshing anyway
+ * =========================================================================*/
+void owm_cache_end_refresh (OwmCache *self, const char *endpoint,
+      const char *location, const char *units)
+  {
+  char *key;
+  uint32_t hash = owm_cache_make_key (endpoint, location, units, &key);
+  OwmCacheShard *shard = owm_cache_shard_for (self, hash);
+
+  pthread_mutex_lock (&shard->mutex);
+  OwmCacheEntry *e = owm_cache_shard_find (shard, hash, key);
+  if (e) e->refreshing = FALSE;
+  pthread_mutex_unlock (&shard->mutex);
+  // owm_cache_destroy() may be waiting for the last refresh
+  pthread_mutex_lock (&self->refresh_mutex);
+  if (--self->refreshes == 0)
+    pthread_cond_broadcast (&self->refresh_cond);
+  pthread_mutex_unlock (&self->refresh_mutex);
+
+  free (key);
+  }
+
+
+/*============================================================================
+ * owm_cache_insert
+ * =========================================================================*/
+void owm_cache_insert (OwmCache *self, const char *endpoint,
+      const char *location, const char *units, OwmForecast *forecast,
+      time_t fetched)
+  {
+  OwmCacheEntry *e = malloc (sizeof (OwmCacheEntry));
+  memset (e, 0, sizeof (OwmCacheEntry));
+  e->hash = owm_cache_make_key (endpoint, location, units, &e->key);
+  e->forecast = owm_forecast_ref (forecast);
+  e->fetched = fetched;
+  e->expires = owm_cache_get_expiry (self, fetched);
+  e->size = sizeof (OwmCacheEntry) + strlen (e->key) + 1
+    + owm_forecast_get_size (forecast);
+  OwmCacheShard *shard = owm_cache_shard_for (self, e->hash);
+
+  pthread_mutex_lock (&shard->mutex);
+  OwmCacheEntry *old = owm_cache_shard_find (shard, e->hash, e->key);
+  if (old) owm_cache_shard_remove (shard, old);
+
+  if (shard->entries >= shard->n_buckets)
+    owm_cache_shard_grow (shard);
+  int b = e->hash & (shard->n_buckets - 1);
+  e->chain = shard->buckets[b];
+  shard->buckets[b] = e;
+  owm_cache_lru_push (shard, e);
+  shard->entries++;
+  shard->bytes += e->size;
+
+  // Evict from the cold end, but never the entry just added
+  while (shard->bytes > shard->max_bytes && shard->tail != e)
+    {
+    owm_cache_shard_remove (shard, shard->tail);
+    shard->evictions++;
+    }
+  pthread_mutex_unlock (&shard->mutex);
+  }
+
+
+/*============================================================================
+ * owm_cache_remove
+ * =========================================================================*/
+void owm_cache_remove (OwmCache *self, const char *endpoint,
+      const char *location, const char *units)
+  {
+  char *key;
+  uint32_t hash = owm_cache_make_key (endpoint, location, units, &key);
+  OwmCacheShard *shard = owm_cache_shard_for (self, hash);
+  pthread_mutex_lock (&shard->mutex);
+  OwmCacheEntry *e = owm_cache_shard_find (shard, hash, key);
+  if (e) owm_cache_shard_remove (shard, e);
+  pthread_mutex_unlock (&shard->mutex);
+  free (key);
+  }
+
+
+/*============================================================================
+ * owm_cache_get_stats
+ * =========================================================================*/
+void owm_cache_get_stats (OwmCache *self, OwmCacheStats *stats)
+  {
+  memset (stats, 0, sizeof (OwmCacheStats));
+  int i;
+  for (i = 0; i < OWM_CACHE_SHARDS; i++)
+    {
+    OwmCacheShard *shard = &self->shards[i];
+    pthread_mutex_lock (&shard->mutex);
+    stats->hits += shard->hits;
+    stats->misses += shard->misses;
+    stats->evictions += shard->evictions;
+    stats->expirations += shard->expirations;
+    stats->stale_hits += shard->stale_hits;
+    stats->entries += shard->entries;
+    stats->bytes += shard->bytes;
+    pthread_mutex_unlock (&shard->mutex);
+    }
+  }
+
@@ -0,0 +1,441 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_city_index.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * The k-d tree is implicit: the points are arranged so that the point at
+ *   the middle of any range of the array is the one that splits it, with
+ *   those below it on the splitting axis to its left and those above to
+ *   its right. Each range is split on the axis along which its points are
+ *   most spread out; the axis is recorded for each splitting point.
+ * Distances between points are compared as squared chord lengths, which
+ *   are in the same order as great-circle distances but much cheaper.
+ * A range of latitude and longitude is not a box in three dimensions, so
+ *   a range query walks the tree with the smallest box that encloses the
+ *   range, and tests the points it finds against the range itself.
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <owm/owm_defs.h>
+#include <owm/owm_city_list.h>
+#include <owm/owm_city_index.h>
+
+#define OWM_CITY_INDEX_EARTH_RADIUS 6371.0088 // km, mean
+#define OWM_CITY_INDEX_RAD (M_PI / 180.0)
+
+typedef struct _OwmCityPoint
+  {
+  float p[3];       // On the unit sphere
+  float lat;
+  float lon;
+  int32_t city;     // Index in the city list
+  } OwmCityPoint;
+
+struct _OwmCityIndex
+  {
+  int n_points;
+  OwmCityPoint *points;
+  unsigned char *axes;
+  };
+
+/* The n best points found so far by a nearest search, as a max-heap on
+   squared chord length */
+typedef struct _OwmCityHeap
+  {
+  int n;
+  int max;
+  int *cities;
+  double *d2;
+  } OwmCityHeap;
+
+
+/*============================================================================
+ * owm_city_index_to_xyz
+ * =========================================================================*/
+static void owm_city_index_to_xyz (double lat, double lon, double *p)
+  {
+  double phi = lat * OWM_CITY_INDEX_RAD;
+  double lambda = lon * OWM_CITY_INDEX_RAD;
+  p[0] = cos (phi) * cos (lambda);
+  p[1] = cos (phi) * sin (lambda);
+  p[2] = sin (phi);
+  }
+
+
+/*============================================================================
+ * owm_city_index_select
+ * Rearrange points[lo..hi) so that the point at k is the one that would
+ *   be there if they were sorted on axis, with none above it to its left
+ *   and none below it to its right
+ * =========================================================================*/
+static void owm_city_index_select (OwmCityPoint *points, int lo, int hi,
+      int k, int axis)
+  {
+  hi--;
+  while (lo < hi)
+    {
+    float pivot = points[lo + (hi - lo) / 2].p[axis];
+    int i = lo, j = hi;
+    while (i <= j)
+      {
+      while (points[i].p[axis] < pivot) i++;
+      while (points[j].p[axis] > pivot) j--;
+      if (i <= j)
+        {
+        OwmCityPoint t = points[i];
+        points[i++] = points[j];
+        points[j--] = t;
+        }
+      }
+    if (k <= j)
+      hi = j;
+    else if (k >= i)
+      lo = i;
+    else
+      break;
+    }
+  }
+
+
+/*============================================================================
+ * owm_city_index_build
+ * =========================================================================*/
+static void owm_city_index_build (OwmCityIndex *self, int lo, int hi)
+  {
+  while (hi - lo > 1)
+    {
+    float min[3], max[3];
+    int i, a, axis = 0;
+    for (a = 0; a < 3; a++)
+      min[a] = max[a] = self->points[lo].p[a];
+    for (i = lo + 1; i < hi; i++)
+      for (a = 0; a < 3; a++)
+        {
+        float v = self->points[i].p[a];
+        if (v < min[a]) min[a] = v;
+        if (v > max[a]) max[a] = v;
+        }
+    for (a = 1; a < 3; a++)
+      if (max[a] - min[a] > max[axis] - min[axis]) axis = a;
+
+    int mid = lo + (hi - lo) / 2;
+    owm_city_index_select (self->points, lo, hi, mid, axis);
+    self->axes[mid] = axis;
+    owm_city_index_build (self, lo, mid);
+    lo = mid + 1;
+    }
+  }
+
+
+/*============================================================================
+ * owm_city_index_create
+ * =========================================================================*/
+OwmCityIndex *owm_city_index_create (const OwmCityList *list)
+  {
+  int i, n = owm_city_list_get_count (list);
+  OwmCityIndex *self = malloc (sizeof (OwmCityIndex));
+  self->n_points = n;
+  self->points = malloc ((n ? n : 1) * sizeof (OwmCityPoint));
+  self->axes = calloc (n ? n : 1, 1);
+  for (i = 0; i < n; i++)
+    {
+    OwmCityPoint *pt = &self->points[i];
+    double p[3];
+    pt->lat = owm_city_list_get_lat (list, i);
+    pt->lon = owm_city_list_get_lon (list, i);
+    pt->city = i;
+    owm_city_index_to_xyz (pt->lat, pt->lon, p);
+    pt->p[0] = p[0];
+    pt->p[1] = p[1];
+    pt->p[2] = p[2];
+    }
+  owm_city_index_build (self, 0, n);
+  return self;
+  }
+
+
+/*============================================================================
+ * owm_city_index_destroy
+ * =========================================================================*/
+void owm_city_index_destroy (OwmCityIndex *self)
+  {
+  if (!self) return;
+  free (self->points);
+  free (self->axes);
+  free (self);
+  }
+
+
+/*============================================================================
+ * owm_city_index_sift_down
+ * =========================================================================*/
+static void owm_city_index_sift_down (OwmCityHeap *h, int i, int n)
+  {
+  for (;;)
+    {
+    int c = 2 * i + 1;
+    if (c >= n) break;
+    if (c + 1 < n && h->d2[c + 1] > h->d2[c]) c++;
+    if (h->d2[c] <= h->d2[i]) break;
+    double d = h->d2[i];
+    h->d2[i] = h->d2[c];
+    h->d2[c] = d;
+    int t = h->cities[i];
+    h->cities[i] = h->cities[c];
+    h->cities[c] = t;
+    i = c;
+    }
+  }
+
+
+/*============================================================================
+ * owm_city_index_offer
+ * Add a point to the heap, if it is one of the best so far
+ * =========================================================================*/
+static void owm_city_index_offer (OwmCityHeap *h, int city, double d2)
+  {
+  if (h->n < h->max)
+    {
+    int i = h->n++;
+    while (i > 0 && h->d2[(i - 1) / 2] < d2)
+      {
+      h->d2[i] = h->d2[(i - 1) / 2];
+      h->cities[i] = h->cities[(i - 1) / 2];
+      i = (i - 1) / 2;
+      }
+    h->d2[i] = d2;
+    h->cities[i] = city;
+    }
+  else if (d2 < h->d2[0])
+    {
+    h->d2[0] = d2;
+    h->cities[0] = city;
+    owm_city_index_sift_down (h, 0, h->n);
+    }
+  }
+
+
+/*============================================================================
+ * owm_city_index_search
+ * =========================================================================*/
+static void owm_city_index_search (const OwmCityIndex *self, int lo, int hi,
+      const double *q, OwmCityHeap *h)
+  {
+  while (lo < hi)
+    {
+    int mid = lo + (hi - lo) / 2;
+    const OwmCityPoint *pt = &self->points[mid];
+    double dx = q[0] - pt->p[0];
+    double dy = q[1] - pt->p[1];
+    double dz = q[2] - pt->p[2];
+    owm_city_index_offer (h, pt->city, dx * dx + dy * dy + dz * dz);
+
+    // Search the near side first, then the far side if it could hold
+    //  anything better than the worst point so far
+    double diff = q[self->axes[mid]] - pt->p[self->axes[mid]];
+    int near_lo = diff < 0 ? lo : mid + 1;
+    int near_hi = diff < 0 ? mid : hi;
+    owm_city_index_search (self, near_lo, near_hi, q, h);
+    if (h->n == h->max && diff * diff >= h->d2[0]) break;
+    lo = diff < 0 ? mid + 1 : lo;
+    hi = diff < 0 ? hi : mid;
+    }
+  }
+
+
+/*============================================================================
+ * owm_city_index_nearest
+ * =========================================================================*/
+int owm_city_index_nearest (const OwmCityIndex *self, double lat,
+      double lon, int n, int *indexes, double *distances)
+  {
+  if (n > self->n_points) n = self->n_points;
+  if (n <= 0) return 0;
+
+  double q[3];
+  owm_city_index_to_xyz (lat, lon, q);
+  OwmCityHeap h;
+  h.n = 0;
+  h.max = n;
+  h.cities = indexes;
+  h.d2 = distances ? distances : malloc (n * sizeof (double));
+  owm_city_index_search (self, 0, self->n_points, q, &h);
+
+  // Sort the heap, nearest first
+  int i;
+  for (i = h.n - 1; i > 0; i--)
+    {
+    double d = h.d2[0];
+    h.d2[0] = h.d2[i];
+    h.d2[i] = d;
+    int t = h.cities[0];
+    h.cities[0] = h.cities[i];
+    h.cities[i] = t;
+    owm_city_index_sift_down (&h, 0, i);
+    }
+
+  if (distances)
+    {
+    for (i = 0; i < h.n; i++)
+      {
+      double half_chord = sqrt (h.d2[i]) / 2;
+      if (half_chord > 1) half_chord = 1;
+      distances[i] = 2 * OWM_CITY_INDEX_EARTH_RADIUS * asin (half_chord);
+      }
+    }
+  else
+    free (h.d2);
+  return h.n;
+  }
+
+
+/* A range query: the box that encloses the range, and the range */
+typedef struct _OwmCityRange
+  {
+  double min[3];
+  double max[3];
+  double lat_min;
+  double lat_max;
+  double lon_min;
+  double lon_max;
+  BOOL wraps;       // Crosses the 180th meridian
+  int *indexes;
+  int max_indexes;
+  int n;
+  } OwmCityRange;
+
+
+/*============================================================================
+ * owm_city_index_in_range
+ * =========================================================================*/
+static BOOL owm_city_index_in_range (const OwmCityRange *r,
+      const OwmCityPoint *pt)
+  {
+  if (pt->lat < r->lat_min || pt->lat > r->lat_max) return FALSE;
+  if (r->wraps)
+    return pt->lon >= r->lon_min || pt->lon <= r->lon_max;
+  return pt->lon >= r->lon_min && pt->lon <= r->lon_max;
+  }
+
+
+/*============================================================================
+ * owm_city_index_walk
+ * =========================================================================*/
+static void owm_city_index_walk (const OwmCityIndex *self, int lo, int hi,
+      OwmCityRange *r)
+  {
+  while (lo < hi)
+    {
+    int mid = lo + (hi - lo) / 2;
+    const OwmCityPoint *pt = &self->points[mid];
+    if (pt->p[0] >= r->min[0] && pt->p[0] <= r->max[0]
+        && pt->p[1] >= r->min[1] && pt->p[1] <= r->max[1]
+        && pt->p[2] >= r->min[2] && pt->p[2] <= r->max[2]
+        && owm_city_index_in_range (r, pt))
+      {
+      if (r->n < r->max_indexes) r->indexes[r->n] = pt->city;
+      r->n++;
+      }
+
+    int axis = self->axes[mid];
+    BOOL left = pt->p[axis] >= r->min[axis];
+    BOOL right = pt->p[axis] <= r->max[axis];
+    if (left && right)
+      {
+      owm_city_index_walk (self, lo, mid, r);
+      lo = mid + 1;
+      }
+    else if (left)
+      hi = mid;
+    else if (right)
+      lo = mid + 1;
+    else
+      break;
+    }
+  }
+
+
+/*============================================================================
+ * owm_city_index_trig_range
+ * Get the range of the cosine and sine of the angles between a and b
+ *   degrees, where a <= b. Each is at an end, or at a multiple of 90
+ *   degrees in between
+ * =========================================================================*/
+static void owm_city_index_trig_range (double a, double b, double *cos_min,
+      double *cos_max, double *sin_min, double *sin_max)
+  {
+  *cos_min = fmin (cos (a * OWM_CITY_INDEX_RAD), cos (b * OWM_CITY_INDEX_RAD));
+  *cos_max = fmax (cos (a * OWM_CITY_INDEX_RAD), cos (b * OWM_CITY_INDEX_RAD));
+  *sin_min = fmin (sin (a * OWM_CITY_INDEX_RAD), sin (b * OWM_CITY_INDEX_RAD));
+  *sin_max = fmax (sin (a * OWM_CITY_INDEX_RAD), sin (b * OWM_CITY_INDEX_RAD));
+  int k;
+  for (k = (int)ceil (a / 90); k * 90 <= b; k++)
+    {
+    switch (((k % 4) + 4) % 4)
+      {
+      case 0: *cos_max = 1; break;
+      case 1: *sin_max = 1; break;
+      case 2: *cos_min = -1; break;
+      case 3: *sin_min = -1; break;
+      }
+    }
+  }
+
+
+/*============================================================================
+ * owm_city_index_within
+ * =========================================================================*/
+int owm_city_index_within (const OwmCityIndex *self, double lat_min,
+      double lon_min, double lat_max, double lon_max, int *indexes, int max)
+  {
+  if (lat_min > lat_max) return 0;
+  OwmCityRange r;
+  r.lat_min = lat_min;
+  r.lat_max = lat_max;
+  r.lon_min = lon_min;
+  r.lon_max = lon_max;
+  r.wraps = lon_min > lon_max;
+  r.indexes = indexes;
+  r.max_indexes = max;
+  r.n = 0;
+
+  // The enclosing box. x is cos (lat) cos (lon), and y is
+  //  cos (lat) sin (lon), so their extremes are among the products of
+  //  the extremes of the factors
+  double lat_cos_min, lat_cos_max, lat_sin_min, lat_sin_max;
+  double lon_cos_min, lon_cos_max, lon_sin_min, lon_sin_max;
+  owm_city_index_trig_range (lat_min, lat_max, &lat_cos_min, &lat_cos_max,
+    &lat_sin_min, &lat_sin_max);
+  owm_city_index_trig_range (lon_min, r.wraps ? lon_max + 360 : lon_max,
+    &lon_cos_min, &lon_cos_max, &lon_sin_min, &lon_sin_max);
+  double c[2] = { lat_cos_min, lat_cos_max };
+  double x[2] = { lon_cos_min, lon_cos_max };
+  double y[2] = { lon_sin_min, lon_sin_max };
+  int i, j;
+  r.min[0] = r.min[1] = 1;
+  r.max[0] = r.max[1] = -1;
+  for (i = 0; i < 2; i++)
+    for (j = 0; j < 2; j++)
+      {
+      r.min[0] = fmin (r.min[0], c[i] * x[j]);
+      r.max[0] = fmax (r.max[0], c[i] * x[j]);
+      r.min[1] = fmin (r.min[1], c[i] * y[j]);
+      r.max[1] = fmax (r.max[1], c[i] * y[j]);
+      }
+  r.min[2] = lat_sin_min;
+  r.max[2] = lat_sin_max;
+  // The points are held in single precision, so allow for rounding
+  for (i = 0; i < 3; i++)
+    {
+    r.min[i] -= 1e-6;
+    r.max[i] += 1e-6;
+    }
+
+  owm_city_index_walk (self, 0, self->n_points, &r);
+  return r.n;
+  }
+
@@ -0,0 +1,582 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_city_list.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * city.list.json is one array of objects like this:
+ *   {"id":833,"name":"Ḩeşār-e Sefīd","state":"","country":"IR",
+ *     "coord":{"lon":47.159401,"lat":34.330502}}
+ *   and is pretty-printed in the copies that OWM distributes.
+ * Loading it goes like this:
+ *   1. The file is split into one chunk per thread, each starting at the
+ *      beginning of an object. A split is found by looking forward from
+ *      an arbitrary place for an opening brace followed by "id", which
+ *      is how every object in the file starts.
+ *   2. The threads parse their chunks into lists of raw entries whose
+ *      strings point into the mapped file, except for the few strings
+ *      with escapes, which are unescaped into a per-thread buffer.
+ *   3. The raw entries are merged, and their strings interned, by one
+ *      thread, and then sorted by ID.
+ * A split found in step 1 could, in principle, be in the middle of a
+ *   string that happens to contain {"id". But each chunk is only accepted
+ *   if the chunk before it was parsed cleanly and ended exactly where it
+ *   starts -- which it can't, if it starts in the middle of a string --
+ *   and if any chunk is not accepted, the whole file is parsed again by
+ *   one thread.
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <owm/owm_defs.h>
+#include <owm/owm_city_list.h>
+#include "owm_json.h"
+
+// There is no point in giving a thread less than this much to parse
+#define OWM_CITY_LIST_MIN_CHUNK (1024 * 1024)
+#define OWM_CITY_LIST_MAX_THREADS 64
+
+typedef struct _OwmCity
+  {
+  int32_t id;
+  uint32_t name;     // Offsets into the strings
+  uint32_t country;
+  float lat;
+  float lon;
+  } OwmCity;
+
+struct _OwmCityList
+  {
+  int n_cities;
+  OwmCity *cities;
+  char *strings;
+  size_t strings_len;
+  };
+
+/* A string found by a parsing thread. If p is NULL, the string is at
+   offset off in the thread's buffer; otherwise it is in the file */
+typedef struct _OwmCityString
+  {
+  const char *p;
+  size_t off;
+  size_t len;
+  } OwmCityString;
+
+typedef struct _OwmCityRaw
+  {
+  int32_t id;
+  float lat;
+  float lon;
+  OwmCityString name;
+  OwmCityString country;
+  } OwmCityRaw;
+
+typedef struct _OwmCityChunk
+  {
+  const char *start;
+  const char *end;
+  BOOL last;         // The chunk runs to the end of the file
+  BOOL ok;
+  OwmCityRaw *raw;
+  int n_raw;
+  int max_raw;
+  char *buff;        // Unescaped strings
+  size_t buff_len;
+  size_t buff_max;
+  } OwmCityChunk;
+
+
+/*============================================================================
+ * owm_city_list_string
+ * Note a string from the file, unescaping it if need be
+ * =========================================================================*/
+static void owm_city_list_string (OwmCityChunk *c, const OwmJsonToken *t,
+      OwmCityString *s)
+  {
+  if (!t->escaped)
+    {
+    s->p = t->start;
+    s->len = t->len;
+    return;
+    }
+  // Unescaping never makes a string longer
+  if (c->buff_len + t->len + 1 > c->buff_max)
+    {
+    c->buff_max = (c->buff_max + t->len + 1) * 2;
+    c->buff = realloc (c->buff, c->buff_max);
+    }
+  s->p = NULL;
+  s->off = c->buff_len;
+  s->len = owm_json_get_string (t, c->buff + c->buff_len, t->len + 1);
+  c->buff_len += s->len + 1;
+  }
+
+
+/*============================================================================
+ * owm_city_list_parse_coord
+ * =========================================================================*/
+static BOOL owm_city_list_parse_coord (OwmJsonScanner *s, OwmCityRaw *r)
+  {
+  OwmJsonToken key, value;
+  while (owm_json_next (s, &key) != OWM_JSON_END_OBJECT)
+    {
+    if (key.type != OWM_JSON_STRING) return FALSE;
+    owm_json_next (s, &value);
+    if (owm_json_equals (&key, "lat") && value.type == OWM_JSON_NUMBER)
+      r->lat = owm_json_get_number (&value);
+    else if (owm_json_equals (&key, "lon") && value.type == OWM_JSON_NUMBER)
+      r->lon = owm_json_get_number (&value);
+    else if (!owm_json_skip (s, &value))
+      return FALSE;
+    }
+  return TRUE;
+  }
+
+
+/*============================================================================
+ * owm_city_list_parse_city
+ * Parse one object, whose opening brace has been read. Objects without
+ *   an ID are skipped
+ * =========================================================================*/
+static BOOL owm_city_list_parse_city (OwmCityChunk *c, OwmJsonScanner *s)
+  {
+  OwmCityRaw r;
+  memset (&r, 0, sizeof (r));
+  r.name.p = r.country.p = "";
+  BOOL has_id = FALSE;
+
+  OwmJsonToken key, value;
+  while (owm_json_next (s, &key) != OWM_JSON_END_OBJECT)
+    {
+    if (key.type != OWM_JSON_STRING) return FALSE;
+    owm_json_next (s, &value);
+    if (owm_json_equals (&key, "id") && value.type == OWM_JSON_NUMBER)
+      {
+      r.id = owm_json_get_number (&value);
+      has_id = TRUE;
+      }
+    else if (owm_json_equals (&key, "name") && value.type == OWM_JSON_STRING)
+      owm_city_list_string (c, &value, &r.name);
+    else if (owm_json_equals (&key, "country")
+        && value.type == OWM_JSON_STRING)
+      owm_city_list_string (c, &value, &r.country);
+    else if (owm_json_equals (&key, "coord")
+        && value.type == OWM_JSON_BEGIN_OBJECT)
+      {
+      if (!owm_city_list_parse_coord (s, &r)) return FALSE;
+      }
+    else if (!owm_json_skip (s, &value))
+      return FALSE;
+    }
+
+  if (has_id)
+    {
+    if (c->n_raw == c->max_raw)
+      {
+      c->max_raw = c->max_raw * 2 + 1024;
+      c->raw = realloc (c->raw, c->max_raw * sizeof (OwmCityRaw));
+      }
+    c->raw[c->n_raw++] = r;
+    }
+  return TRUE;
+  }
+
+
+/*============================================================================
+ * owm_city_list_parse_chunk
+ * Thread function. A chunk other than the last must end between two
+ *   objects; the last must end with the end of the array
+ * =========================================================================*/
+static void *owm_city_list_parse_chunk (void *arg)
+  {
+  OwmCityChunk *c = arg;
+  OwmJsonScanner s;
+  OwmJsonToken t;
+  owm_json_init (&s, c->start, c->end - c->start);
+  for (;;)
+    {
+    OwmJsonType type = owm_json_next (&s, &t);
+    if (type == OWM_JSON_BEGIN_OBJECT)
+      {
+      if (!owm_city_list_parse_city (c, &s)) break;
+      }
+    else
+      {
+      if (type == OWM_JSON_END && !c->last)
+        c->ok = TRUE;
+      else if (type == OWM_JSON_END_ARRAY && c->last)
+        c->ok = owm_json_next (&s, &t) == OWM_JSON_END;
+      break;
+      }
+    }
+  return NULL;
+  }
+
+
+/*============================================================================
+ * owm_city_list_find_split
+ * Find the first object at or after p that starts {"id"
+ * =========================================================================*/
+static const char *owm_city_list_find_split (const char *p,
+      const char *end)
+  {
+  while (p < end && (p = memchr (p, '{', end - p)))
+    {
+    const char *q = p + 1;
+    while (q < end && (*q == ' ' || *q == '\n' || *q == '\r' || *q == '\t'))
+      q++;
+    if (end - q >= 4 && memcmp (q, "\"id\"", 4) == 0) return p;
+    p++;
+    }
+  return end;
+  }
+
+
+/*============================================================================
+ * owm_city_list_parse
+ * Parse the array that starts at start, in up to n_threads chunks
+ * =========================================================================*/
+static BOOL owm_city_list_parse (const char *start, const char *end,
+      int n_threads, OwmCityChunk *chunks, int *n_chunks)
+  {
+  int n = 0, i;
+  const char *p = start;
+  while (p < end && n < n_threads)
+    {
+    OwmCityChunk *c = &chunks[n++];
+    memset (c, 0, sizeof (OwmCityChunk));
+    c->start = p;
+    p = owm_city_list_find_split
+      (start + (end - start) * (size_t)n / n_threads, end);
+    if (p <= c->start) p = owm_city_list_find_split (c->start + 1, end);
+    c->end = p;
+    }
+  chunks[n - 1].last = TRUE;
+  chunks[n - 1].end = end;
+  *n_chunks = n;
+
+  pthread_t threads[OWM_CITY_LIST_MAX_THREADS];
+  BOOL started[OWM_CITY_LIST_MAX_THREADS];
+  for (i = 1; i < n; i++)
+    started[i] = pthread_create (&threads[i], NULL,
+      owm_city_list_parse_chunk, &chunks[i]) == 0;
+  owm_city_list_parse_chunk (&chunks[0]);
+  BOOL ok = chunks[0].ok;
+  for (i = 1; i < n; i++)
+    {
+    if (started[i])
+      pthread_join (threads[i], NULL);
+    else
+      owm_city_list_parse_chunk (&chunks[i]);
+    ok = ok && chunks[i].ok;
+    }
+  return ok;
+  }
+
+
+/*============================================================================
+ * owm_city_list_free_chunks
+ * =========================================================================*/
+static void owm_city_list_free_chunks (OwmCityChunk *chunks, int n)
+  {
+  int i;
+  for (i = 0; i < n; i++)
+    {
+    free (chunks[i].raw);
+    free (chunks[i].buff);
+    }
+  }
+
+
+/*============================================================================
+ * owm_city_list_hash
+ * 32-bit FNV-1a
+ * =========================================================================*/
+static uint32_t owm_city_list_hash (const char *s, size_t len)
+  {
+  uint32_t hash = 2166136261u;
+  size_t i;
+  for (i = 0; i < len; i++)
+    {
+    hash ^= (unsigned char)s[i];
+    hash *= 16777619u;
+    }
+  return hash;
+  }
+
+
+/* The table that strings are interned through while merging. A slot
+   holds the offset of a string plus one, or zero if it is empty */
+typedef struct _OwmCityIntern
+  {
+  uint32_t *hashes;
+  uint32_t *slots;
+  uint32_t mask;
+  char *strings;
+  size_t len;
+  size_t max;
+  } OwmCityIntern;
+
+
+/*============================================================================
+ * owm_city_list_intern
+ * Get the offset of a string in the string block, adding it if it is not
+ *   already there
+ * =========================================================================*/
+static uint32_t owm_city_list_intern (OwmCityIntern *in, const char *s,
+      size_t len)
+  {
+  uint32_t hash = owm_city_list_hash (s, len);
+  uint32_t i = hash & in->mask;
+  while (in->slots[i])
+    {
+    const char *t = in->strings + in->slots[i] - 1;
+    if (in->hashes[i] == hash && memcmp (t, s, len) == 0 && t[len] == 0)
+      return in->slots[i] - 1;
+    i = (i + 1) & in->mask;
+    }
+
+  if (in->len + len + 1 > in->max)
+    {
+    in->max = (in->max + len + 1) * 2;
+    in->strings = realloc (in->strings, in->max);
+    }
+  uint32_t off = in->len;
+  memcpy (in->strings + off, s, len);
+  in->strings[off + len] = 0;
+  in->len += len + 1;
+  in->hashes[i] = hash;
+  in->slots[i] = off + 1;
+  return off;
+  }
+
+
+/*============================================================================
+ * owm_city_list_compare
+ * =========================================================================*/
+static int owm_city_list_compare (const void *a, const void *b)
+  {
+  int32_t x = ((const OwmCity *)a)->id;
+  int32_t y = ((const OwmCity *)b)->id;
+  return x < y ? -1 : x > y;
+  }
+
+
+/*============================================================================
+ * owm_city_list_merge
+ * =========================================================================*/
+static OwmCityList *owm_city_list_merge (OwmCityChunk *chunks, int n_chunks)
+  {
+  int i, j, n = 0;
+  for (i = 0; i < n_chunks; i++)
+    n += chunks[i].n_raw;
+
+  OwmCityIntern in;
+  uint32_t n_slots = 1024;
+  while (n_slots < (uint32_t)n * 2) n_slots *= 2;
+  in.hashes = malloc (n_slots * sizeof (uint32_t));
+  in.slots = calloc (n_slots, sizeof (uint32_t));
+  in.mask = n_slots - 1;
+  in.max = (size_t)n * 12 + 1024;
+  in.strings = malloc (in.max);
+  in.len = 0;
+
+  OwmCityList *self = malloc (sizeof (OwmCityList));
+  self->cities = malloc ((n ? n : 1) * sizeof (OwmCity));
+  self->n_cities = n;
+  OwmCity *city = self->cities;
+  for (i = 0; i < n_chunks; i++)
+    {
+    const OwmCityChunk *c = &chunks[i];
+    for (j = 0; j < c->n_raw; j++)
+      {
+      const OwmCityRaw *r = &c->raw[j];
+      city->id = r->id;
+      city->lat = r->lat;
+      city->lon = r->lon;
+      city->name = owm_city_list_intern (&in,
+        r->name.p ? r->name.p : c->buff + r->name.off, r->name.len);
+      city->country = owm_city_list_intern (&in,
+        r->country.p ? r->country.p : c->buff + r->country.off,
+        r->country.len);
+      city++;
+      }
+    }
+  free (in.hashes);
+  free (in.slots);
+
+  self->strings = realloc (in.strings, in.len ? in.len : 1);
+  self->strings_len = in.len;
+  qsort (self->cities, n, sizeof (OwmCity), owm_city_list_compare);
+  return self;
+  }
+
+
+/*============================================================================
+ * owm_city_list_load
+ * =========================================================================*/
+OwmCityList *owm_city_list_load (const char *path, int threads, char **error)
+  {
+  int fd = open (path, O_RDONLY);
+  if (fd < 0)
+    {
+    if (error)
+      asprintf (error, "Can't open city list %s: %s", path, strerror (errno));
+    return NULL;
+    }
+
+  struct stat sb;
+  void *map = MAP_FAILED;
+  size_t len = 0;
+  if (fstat (fd, &sb) == 0 && sb.st_size > 0)
+    {
+    len = sb.st_size;
+    map = mmap (NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+  close (fd);
+  if (map == MAP_FAILED)
+    {
+    if (error)
+      asprintf (error, "Can't read city list %s", path);
+    return NULL;
+    }
+  // Every page will be wanted, and straight away
+  madvise (map, len, MADV_WILLNEED);
+
+  const char *start = map;
+  const char *end = start + len;
+  while (start < end && *start != '[') start++;
+
+  OwmCityList *self = NULL;
+  if (start < end)
+    {
+    start++;
+    if (threads <= 0) threads = sysconf (_SC_NPROCESSORS_ONLN);
+    if ((size_t)threads > len / OWM_CITY_LIST_MIN_CHUNK + 1)
+      threads = len / OWM_CITY_LIST_MIN_CHUNK + 1;
+    if (threads > OWM_CITY_LIST_MAX_THREADS)
+      threads = OWM_CITY_LIST_MAX_THREADS;
+    if (threads < 1) threads = 1;
+
+    OwmCityChunk chunks[OWM_CITY_LIST_MAX_THREADS];
+    int n_chunks;
+    BOOL ok = owm_city_list_parse (start, end, threads, chunks, &n_chunks);
+    if (!ok && n_chunks > 1)
+      {
+      // A split must have been in the wrong place
+      owm_city_list_free_chunks (chunks, n_chunks);
+      ok = owm_city_list_parse (start, end, 1, chunks, &n_chunks);
+      }
+    if (ok)
+      self = owm_city_list_merge (chunks, n_chunks);
+    owm_city_list_free_chunks (chunks, n_chunks);
+    }
+  munmap (map, len);
+
+  if (!self && error)
+    asprintf (error, "%s is not a valid city list", path);
+  return self;
+  }
+
+
+/*============================================================================
+ * owm_city_list_destroy
+ * =========================================================================*/
+void owm_city_list_destroy (OwmCityList *self)
+  {
+  if (!self) return;
+  free (self->cities);
+  free (self->strings);
+  free (self);
+  }
+
+
+/*============================================================================
+ * owm_city_list_get_count
+ * =========================================================================*/
+int owm_city_list_get_count (const OwmCityList *self)
+  {
+  return self->n_cities;
+  }
+
+
+/*============================================================================
+ * owm_city_list_find_id
+ * =========================================================================*/
+int owm_city_list_find_id (const OwmCityList *self, int id)
+  {
+  int lo = 0, hi = self->n_cities;
+  while (lo < hi)
+    {
+    int mid = lo + (hi - lo) / 2;
+    if (self->cities[mid].id < id)
+      lo = mid + 1;
+    else
+      hi = mid;
+    }
+  return lo < self->n_cities && self->cities[lo].id == id ? lo : -1;
+  }
+
+
+/*============================================================================
+ * owm_city_list_get_id
+ * =========================================================================*/
+int owm_city_list_get_id (const OwmCityList *self, int index)
+  {
+  return self->cities[index].id;
+  }
+
+
+/*============================================================================
+ * owm_city_list_get_name
+ * =========================================================================*/
+const char *owm_city_list_get_name (const OwmCityList *self, int index)
+  {
+  return self->strings + self->cities[index].name;
+  }
+
+
+/*============================================================================
+ * owm_city_list_get_country
+ * =========================================================================*/
+const char *owm_city_list_get_country (const OwmCityList *self, int index)
+  {
+  return self->strings + self->cities[index].country;
+  }
+
+
+/*============================================================================
+ * owm_city_list_get_lat
+ * =========================================================================*/
+double owm_city_list_get_lat (const OwmCityList *self, int index)
+  {
+  return self->cities[index].lat;
+  }
+
+
+/*============================================================================
+ * owm_city_list_get_lon
+ * =========================================================================*/
+double owm_city_list_get_lon (const OwmCityList *self, int index)
+  {
+  return self->cities[index].lon;
+  }
+
+
+/*============================================================================
+ * owm_city_list_get_size
+ * =========================================================================*/
+size_t owm_city_list_get_size (const OwmCityList *self)
+  {
+  return sizeof (OwmCityList) + self->n_cities * sizeof (OwmCity)
+    + self->strings_len;
+  }
+
@@ -0,0 +1,565 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_city_names.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * Each name is folded -- lower-cased, and its accented Latin letters
+ *   replaced by plain ones -- and the locations are sorted by folded
+ *   name. Equal folded names are stored only once. Then:
+ *   - The locations whose names begin with a prefix are a run of the
+ *     sorted array, found by binary search. The best k of them are found
+ *     with a range-maximum table over the priorities: the best in the
+ *     run is taken, and the parts of the run either side of it become
+ *     new runs to take the next best from.
+ *   - Fuzzy matching works out the edit distance from the query to each
+ *     name, as a table of one row per letter of the name. Names that
+ *     share a prefix share the rows for it, so the sorted array is, in
+ *     effect, walked as a trie; and when every entry in a row is over the
+ *     limit, every name with that prefix is skipped.
+ * Letters that are not folded, from non-Latin scripts, are left as UTF-8,
+ *   and so count as more than one edit.
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <owm/owm_defs.h>
+#include <owm/owm_city_list.h>
+#include <owm/owm_city_names.h>
+
+// Positions per block of the range-maximum table
+#define OWM_CITY_NAMES_BLOCK 32
+
+/* The plain letters for U+00C0 to U+017F, and for U+1E00 to U+1EFF.
+   '?' means the character has no plain letter, and is kept as it is */
+static const char owm_city_names_latin1[] =
+  "aaaaaaaceeeeiiiidnooooo?ouuuuytsaaaaaaaceeeeiiiidnooooo?ouuuuyty"
+  "aaaaaaccccccccddddeeeeeeeeeegggggggghhhhiiiiiiiiiiiijjkkklllllll"
+  "lllnnnnnn?nnoooooooorrrrrrssssssssttttttuuuuuuuuuuuuwwyyyzzzzzzs";
+static const char owm_city_names_extended[] =
+  "aabbbbbbccddddddddddeeeeeeeeeeffgghhhhhhhhhhiiiikkkkkkllllllllmm"
+  "mmmmnnnnnnnnoooooooopppprrrrrrrrssssssssssttttttttuuuuuuuuuuvvvv"
+  "wwwwwwwwwwxxxxyyzzzzzzhtwyas????aaaaaaaaaaaaaaaaaaaaaaaaeeeeeeee"
+  "eeeeeeeeiiiioooooooooooooooooooooooouuuuuuuuuuuuuuyyyyyyyy??????";
+
+struct _OwmCityNames
+  {
+  int n;
+  uint32_t *keys;        // Offsets of the folded names, in sorted order
+  int32_t *cities;       // Indexes in the city list
+  float *priorities;
+  char *strings;
+  size_t strings_len;
+  int n_blocks;
+  int n_levels;
+  uint32_t *table;       // n_levels rows of n_blocks positions
+  };
+
+/* A run of the sorted array, and the best position in it */
+typedef struct _OwmCityRun
+  {
+  int lo;
+  int hi;
+  int best;
+  } OwmCityRun;
+
+
+/*============================================================================
+ * owm_city_names_fold
+ * Fold a name into buff, which must be at least as long as the name.
+ *   Folding never makes a name longer
+ * =========================================================================*/
+static size_t owm_city_names_fold (const char *s, char *buff)
+  {
+  const unsigned char *p = (const unsigned char *)s;
+  size_t n = 0;
+  while (*p)
+    {
+    unsigned char c = *p;
+    if (c < 0x80)
+      {
+      buff[n++] = c >= 'A' && c <= 'Z' ? c + 'a' - 'A' : c;
+      p++;
+      continue;
+      }
+    int len = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+    int i, cp = len == 4 ? c & 0x07 : len == 3 ? c & 0x0F : c & 0x1F;
+    for (i = 1; i < len; i++)
+      {
+      if ((p[i] & 0xC0) != 0x80) break;
+      cp = (cp << 6) | (p[i] & 0x3F);
+      }
+    char plain = '?';
+    if (i == len && len > 1)
+      {
+      if (cp >= 0xC0 && cp < 0x180)
+        plain = owm_city_names_latin1[cp - 0xC0];
+      else if (cp >= 0x1E00 && cp < 0x1F00)
+        plain = owm_city_names_extended[cp - 0x1E00];
+      }
+    else
+      len = 1;
+    if (plain != '?')
+      buff[n++] = plain;
+    else
+      {
+      memcpy (buff + n, p, len);
+      n += len;
+      }
+    p += len;
+    }
+  buff[n] = 0;
+  return n;
+  }
+
+
+/*============================================================================
+ * owm_city_names_compare
+ * =========================================================================*/
+static int owm_city_names_compare (const void *a, const void *b, void *arg)
+  {
+  const char **names = arg;
+  int x = *(const int *)a, y = *(const int *)b;
+  int c = strcmp (names[x], names[y]);
+  return c ? c : x - y;
+  }
+
+
+/*============================================================================
+ * owm_city_names_better
+ * The better of two positions: the one of higher priority or, if they
+ *   are equal, the earlier
+ * =========================================================================*/
+static inline int owm_city_names_better (const OwmCityNames *self, int a,
+      int b)
+  {
+  float pa = self->priorities[a], pb = self->priorities[b];
+  return pa > pb || (pa == pb && a < b) ? a : b;
+  }
+
+
+/*============================================================================
+ * owm_city_names_best
+ * Get the best position in [lo, hi), which must not be empty
+ * =========================================================================*/
+static int owm_city_names_best (const OwmCityNames *self, int lo, int hi)
+  {
+  int bl = lo / OWM_CITY_NAMES_BLOCK;
+  int bh = (hi - 1) / OWM_CITY_NAMES_BLOCK;
+  int i, best = lo;
+  if (bh - bl <= 1)
+    {
+    for (i = lo + 1; i < hi; i++)
+      best = owm_city_names_better (self, best, i);
+    return best;
+    }
+  for (i = lo + 1; i < (bl + 1) * OWM_CITY_NAMES_BLOCK; i++)
+    best = owm_city_names_better (self, best, i);
+  for (i = bh * OWM_CITY_NAMES_BLOCK; i < hi; i++)
+    best = owm_city_names_better (self, best, i);
+  int blocks = bh - bl - 1, level = 0;
+  while ((2 << level) <= blocks) level++;
+  const uint32_t *row = self->table + (size_t)level * self->n_blocks;
+  best = owm_city_names_better (self, best, row[bl + 1]);
+  return owm_city_names_better (self, best, row[bh - (1 << level)]);
+  }
+
+
+/*============================================================================
+ * owm_city_names_create
+ * =========================================================================*/
+OwmCityNames *owm_city_names_create (const OwmCityList *list,
+      const float *priorities)
+  {
+  int i, n = owm_city_list_get_count (list);
+  size_t n_alloc = n > 0 ? n : 1;
+  OwmCityNames *self = malloc (sizeof (OwmCityNames));
+  self->n = n;
+
+  // Fold every name into one block
+  size_t len = 0;
+  for (i = 0; i < n; i++)
+    len += strlen (owm_city_list_get_name (list, i)) + 1;
+  char *folded = malloc (len ? len : 1);
+  const char **names = malloc (n_alloc * sizeof (char *));
+  int *order = malloc (n_alloc * sizeof (int));
+  len = 0;
+  for (i = 0; i < n; i++)
+    {
+    names[i] = folded + len;
+    len += owm_city_names_fold (owm_city_list_get_name (list, i),
+      folded + len) + 1;
+    order[i] = i;
+    }
+  qsort_r (order, n, sizeof (int), owm_city_names_compare, names);
+
+  // Copy the names in order, storing each one only once
+  self->keys = malloc (n_alloc * sizeof (uint32_t));
+  self->cities = malloc (n_alloc * sizeof (int32_t));
+  self->priorities = malloc (n_alloc * sizeof (float));
+  self->strings = malloc (len ? len : 1);
+  self->strings_len = 0;
+  for (i = 0; i < n; i++)
+    {
+    const char *name = names[order[i]];
+    size_t name_len = strlen (name);
+    if (i > 0 && strcmp (name, self->strings + self->keys[i - 1]) == 0)
+      self->keys[i] = self->keys[i - 1];
+    else
+      {
+      self->keys[i] = self->strings_len;
+      memcpy (self->strings + self->strings_len, name, name_len + 1);
+      self->strings_len += name_len + 1;
+      }
+    self->cities[i] = order[i];
+    self->priorities[i] = priorities ? priorities[order[i]]
+      : -(float)name_len;
+    }
+  self->strings = realloc (self->strings,
+    self->strings_len ? self->strings_len : 1);
+  free (folded);
+  free (names);
+  free (order);
+
+  // The range-maximum table. Row l gives the best position in the
+  //  2^l blocks starting at each block
+  self->n_blocks = (n + OWM_CITY_NAMES_BLOCK - 1) / OWM_CITY_NAMES_BLOCK;
+  self->n_levels = 1;
+  while ((2 << (self->n_levels - 1)) <= self->n_blocks) self->n_levels++;
+  self->table = malloc ((size_t)self->n_levels
+    * (self->n_blocks ? self->n_blocks : 1) * sizeof (uint32_t));
+  int b, l;
+  for (b = 0; b < self->n_blocks; b++)
+    {
+    int best = b * OWM_CITY_NAMES_BLOCK;
+    int end = best + OWM_CITY_NAMES_BLOCK;
+    if (end > n) end = n;
+    for (i = best + 1; i < end; i++)
+      best = owm_city_names_better (self, best, i);
+    self->table[b] = best;
+    }
+  for (l = 1; l < self->n_levels; l++)
+    {
+    const uint32_t *prev = self->table + (size_t)(l - 1) * self->n_blocks;
+    uint32_t *row = self->table + (size_t)l * self->n_blocks;
+    for (b = 0; b + (1 << l) <= self->n_blocks; b++)
+      row[b] = owm_city_names_better (self, prev[b],
+        prev[b + (1 << (l - 1))]);
+    }
+  return self;
+  }
+
+
+/*============================================================================
+ * owm_city_names_destroy
+ * =========================================================================*/
+void owm_city_names_destroy (OwmCityNames *self)
+  {
+  if (!self) return;
+  free (self->keys);
+  free (self->cities);
+  free (self->priorities);
+  free (self->strings);
+  free (self->table);
+  free (self);
+  }
+
+
+/*============================================================================
+ * owm_city_names_run_end
+ * Get the end of the run, starting at start, of names that begin with the
+ *   first len bytes of prefix, given that the name at start does. Runs
+ *   are usually short, so this gallops forward before searching
+ * =========================================================================*/
+static int owm_city_names_run_end (const OwmCityNames *self, int start,
+      const char *prefix, size_t len)
+  {
+  int known = start, step = 1, hi = self->n;
+  while (known + step < self->n)
+    {
+    if (strncmp (self->strings + self->keys[known + step], prefix, len) != 0)
+      {
+      hi = known + step;
+      break;
+      }
+    known += step;
+    step *= 2;
+    }
+  int lo = known + 1;
+  while (lo < hi)
+    {
+    int mid = lo + (hi - lo) / 2;
+    if (strncmp (self->strings + self->keys[mid], prefix, len) == 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+    }
+  return lo;
+  }
+
+
+/*============================================================================
+ * owm_city_names_push
+ * Add a run to the heap of runs, which is ordered by their best
+ *   positions
+ * =========================================================================*/
+static void owm_city_names_push (const OwmCityNames *self, OwmCityRun *heap,
+      int *n, int lo, int hi)
+  {
+  if (lo >= hi) return;
+  OwmCityRun r = { lo, hi, owm_city_names_best (self, lo, hi) };
+  int i = (*n)++;
+  while (i > 0 && owm_city_names_better (self, heap[(i - 1) / 2].best,
+      r.best) == r.best)
+    {
+    heap[i] = heap[(i - 1) / 2];
+    i = (i - 1) / 2;
+    }
+  heap[i] = r;
+  }
+
+
+/*============================================================================
+ * owm_city_names_pop
+ * =========================================================================*/
+static OwmCityRun owm_city_names_pop (const OwmCityNames *self,
+      OwmCityRun *heap, int *n)
+  {
+  OwmCityRun top = heap[0];
+  OwmCityRun last = heap[--(*n)];
+  int i = 0;
+  for (;;)
+    {
+    int c = 2 * i + 1;
+    if (c >= *n) break;
+    if (c + 1 < *n && owm_city_names_better (self, heap[c].best,
+        heap[c + 1].best) == heap[c + 1].best)
+      c++;
+    if (owm_city_names_better (self, last.best, heap[c].best) == last.best)
+      break;
+    heap[i] = heap[c];
+    i = c;
+    }
+  heap[i] = last;
+  return top;
+  }
+
+
+/*============================================================================
+ * owm_city_names_prefix
+ * =========================================================================*/
+int owm_city_names_prefix (const OwmCityNames *self, const char *prefix,
+      int k, int *indexes)
+  {
+  if (k <= 0 || self->n == 0) return 0;
+  char *folded = malloc (strlen (prefix) + 1);
+  size_t len = owm_city_names_fold (prefix, folded);
+
+  int lo = 0, hi = self->n;
+  while (lo < hi)
+    {
+    int mid = lo + (hi - lo) / 2;
+    if (strcmp (self->strings + self->keys[mid], folded) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+    }
+  int found = 0;
+  if (lo < self->n
+      && strncmp (self->strings + self->keys[lo], folded, len) == 0)
+    {
+    hi = owm_city_names_run_end (self, lo, folded, len);
+    // Each run taken from the heap adds at most two
+    OwmCityRun *heap = malloc ((k + 1) * sizeof (OwmCityRun));
+    int n_heap = 0;
+    owm_city_names_push (self, heap, &n_heap, lo, hi);
+    while (found < k && n_heap > 0)
+      {
+      OwmCityRun r = owm_city_names_pop (self, heap, &n_heap);
+      indexes[found++] = self->cities[r.best];
+      owm_city_names_push (self, heap, &n_heap, r.lo, r.best);
+      owm_city_names_push (self, heap, &n_heap, r.best + 1, r.hi);
+      }
+    free (heap);
+    }
+  free (folded);
+  return found;
+  }
+
+
+/* The state of a fuzzy search */
+typedef struct _OwmCityFuzzy
+  {
+  const char *query;
+  int query_len;
+  int max_distance;
+  int k;
+  int n;              // Matches so far, best first
+  int *positions;
+  int *distances;
+  } OwmCityFuzzy;
+
+
+/*============================================================================
+ * owm_city_names_before
+ * Does one match rank before another?
+ * =========================================================================*/
+static BOOL owm_city_names_before (const OwmCityNames *self, int distance,
+      int position, int other_distance, int other_position)
+  {
+  if (distance != other_distance) return distance < other_distance;
+  return position != other_position
+    && owm_city_names_better (self, position, other_position) == position;
+  }
+
+
+/*============================================================================
+ * owm_city_names_offer
+ * Add a match, if it is one of the best k so far. When there are k, the
+ *   limit comes down to the distance of the worst of them
+ * =========================================================================*/
+static void owm_city_names_offer (const OwmCityNames *self, OwmCityFuzzy *f,
+      int position, int distance)
+  {
+  int i;
+  if (f->n < f->k)
+    i = f->n++;
+  else
+    {
+    // The list is full, so this replaces the worst, if it is better
+    i = f->k - 1;
+    if (!owm_city_names_before (self, distance, position, f->distances[i],
+        f->positions[i]))
+      return;
+    }
+  while (i > 0 && owm_city_names_before (self, distance, position,
+      f->distances[i - 1], f->positions[i - 1]))
+    {
+    f->positions[i] = f->positions[i - 1];
+    f->distances[i] = f->distances[i - 1];
+    i--;
+    }
+  f->positions[i] = position;
+  f->distances[i] = distance;
+  if (f->n == f->k) f->max_distance = f->distances[f->k - 1];
+  }
+
+
+/*============================================================================
+ * owm_city_names_fuzzy
+ * =========================================================================*/
+int owm_city_names_fuzzy (const OwmCityNames *self, const char *name,
+      int max_distance, int k, int *indexes, int *distances)
+  {
+  if (k <= 0 || max_distance < 0 || self->n == 0) return 0;
+  char query[OWM_CITY_NAMES_MAX_FUZZY + 1];
+  size_t name_len = strlen (name);
+  char *folded = malloc (name_len + 1);
+  int q_len = owm_city_names_fold (name, folded);
+  if (q_len > OWM_CITY_NAMES_MAX_FUZZY) q_len = OWM_CITY_NAMES_MAX_FUZZY;
+  memcpy (query, folded, q_len);
+  query[q_len] = 0;
+  free (folded);
+  if (max_distance > q_len) max_distance = q_len;
+
+  OwmCityFuzzy f;
+  f.query = query;
+  f.query_len = q_len;
+  f.max_distance = max_distance;
+  f.k = k;
+  f.n = 0;
+  f.positions = malloc (k * sizeof (int));
+  f.distances = malloc (k * sizeof (int));
+
+  // rows[d] is the row for the first d letters of the current name;
+  //  rows 0 to valid are correct for prev. Only the entries within
+  //  band of the diagonal are worked out, since the others must be over
+  //  the limit; the entries either side of the band are set to far
+  int band = max_distance;
+  int far = band + 1;
+  int depth_max = q_len + max_distance;
+  int width = q_len + 1;
+  int *rows = malloc ((size_t)(depth_max + 1) * width * sizeof (int));
+  int i, j, d;
+  for (j = 0; j < width; j++) rows[j] = j;
+  const char *prev = "";
+  int valid = 0;
+
+  i = 0;
+  while (i < self->n)
+    {
+    const char *key = self->strings + self->keys[i];
+    d = 0;
+    while (d < valid && key[d] && key[d] == prev[d]) d++;
+    int len = strlen (key);
+    int limit = len < f.max_distance + q_len ? len : f.max_distance + q_len;
+    BOOL pruned = FALSE;
+    for (d = d + 1; d <= limit; d++)
+      {
+      const int *up = rows + (size_t)(d - 1) * width;
+      int *row = rows + (size_t)d * width;
+      int row_min = row[0] = d;
+      int lo = d - band > 1 ? d - band : 1;
+      int hi = d + band < q_len ? d + band : q_len;
+      if (lo > 1) row[lo - 1] = far;
+      if (hi < q_len) row[hi + 1] = far;
+      for (j = lo; j <= hi; j++)
+        {
+        int v = up[j - 1] + (key[d - 1] != query[j - 1]);
+        if (up[j] + 1 < v) v = up[j] + 1;
+        if (row[j - 1] + 1 < v) v = row[j - 1] + 1;
+        row[j] = v;
+        if (v < row_min) row_min = v;
+        }
+      if (row_min > f.max_distance)
+        {
+        // Nothing that starts with these d letters can match
+        pruned = TRUE;
+        break;
+        }
+      }
+    prev = key;
+    if (pruned || len > limit)
+      {
+      // A name longer than the limit can't match, and nor can any name
+      //  that it is a prefix of
+      if (!pruned) d = limit;
+      valid = d;
+      i = owm_city_names_run_end (self, i, key, d);
+      continue;
+      }
+    valid = limit;
+    int distance = q_len - len > band ? far
+      : rows[(size_t)len * width + q_len];
+    int end = i + 1;
+    while (end < self->n && self->keys[end] == self->keys[i]) end++;
+    if (distance <= f.max_distance)
+      for (j = i; j < end; j++)
+        owm_city_names_offer (self, &f, j, distance);
+    i = end;
+    }
+
+  for (i = 0; i < f.n; i++)
+    {
+    indexes[i] = self->cities[f.positions[i]];
+    if (distances) distances[i] = f.distances[i];
+    }
+  free (rows);
+  free (f.positions);
+  free (f.distances);
+  return f.n;
+  }
+
+
+/*============================================================================
+ * owm_city_names_get_size
+ * =========================================================================*/
+size_t owm_city_names_get_size (const OwmCityNames *self)
+  {
+  return sizeof (OwmCityNames)
+    + self->n * (sizeof (uint32_t) + sizeof (int32_t) + sizeof (float))
+    + self->strings_len
+    + (size_t)self->n_levels * self->n_blocks * sizeof (uint32_t);
+  }
+
@@ -0,0 +1,207 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_context.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * The connections a context keeps are curl easy handles, which hold their
+ *   connections open after a transfer. A handle is used by one request at
+ *   a time: a request takes one from the context, or creates one if there
+ *   are none idle, and gives it back when it is done.
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <curl/curl.h>
+#include <owm/owm_defs.h>
+#include <owm/owm_config.h>
+#include <owm/owm_context.h>
+#include "owm_private.h"
+
+struct _OwmContext
+  {
+  int refcount; // Updated atomically; see owm_context_ref()
+  char *host; // NULL for OWM_HOST
+  OwmCache *cache;
+  OwmDiskCache *disk_cache;
+  OwmLocationFilter *location_filter;
+  pthread_mutex_t mutex; // Protects the idle handles
+  int n_idle;
+  CURL *idle[OWM_CONTEXT_MAX_IDLE];
+  };
+
+static OwmContext owm_context_default =
+  {
+  .refcount = 1,
+  .mutex = PTHREAD_MUTEX_INITIALIZER
+  };
+
+
+/*============================================================================
+ * owm_context_create
+ * =========================================================================*/
+OwmContext *owm_context_create (void)
+  {
+  OwmContext *self = calloc (1, sizeof (OwmContext));
+  self->refcount = 1;
+  pthread_mutex_init (&self->mutex, NULL);
+  return self;
+  }
+
+
+/*============================================================================
+ * owm_context_ref
+ * Take another reference to the context, to be released with
+ *   owm_context_destroy(), for a background refresh
+ * =========================================================================*/
+OwmContext *owm_context_ref (OwmContext *self)
+  {
+  __atomic_add_fetch (&self->refcount, 1, __ATOMIC_RELAXED);
+  return self;
+  }
+
+
+/*============================================================================
+ * owm_context_destroy
+ * =========================================================================*/
+void owm_context_destroy (OwmContext *self)
+  {
+  if (!self || self == &owm_context_default) return;
+  if (__atomic_sub_fetch (&self->refcount, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+    int i;
+    for (i = 0; i < self->n_idle; i++)
+      curl_easy_cleanup (self->idle[i]);
+    pthread_mutex_destroy (&self->mutex);
+    free (self->host);
+    free (self);
+    }
+  }
+
+
+/*============================================================================
+ * owm_context_get_default
+ * =========================================================================*/
+OwmContext *owm_context_get_default (void)
+  {
+  return &owm_context_default;
+  }
+
+
+/*============================================================================
+ * owm_context_set_host
+ * =========================================================================*/
+void owm_context_set_host (OwmContext *self, const char *host)
+  {
+  free (self->host);
+  self->host = host ? strdup (host) : NULL;
+  }
+
+
+/*============================================================================
+ * owm_context_get_host
+ * =========================================================================*/
+const char *owm_context_get_host (const OwmContext *self)
+  {
+  return self->host ? self->host : OWM_HOST;
+  }
+
+
+/*============================================================================
+ * owm_context_set_cache
+ * =========================================================================*/
+void owm_context_set_cache (OwmContext *self, OwmCache *cache)
+  {
+  self->cache = cache;
+  }
+
+
+/*============================================================================
+ * owm_context_get_cache
+ * =========================================================================*/
+OwmCache *owm_context_get_cache (const OwmContext *self)
+  {
+  return self->cache;
+  }
+
+
+/*============================================================================
+ * owm_context_set_disk_cache
+ * =========================================================================*/
+void owm_context_set_disk_cache (OwmContext *self, OwmDiskCache *disk_cache)
+  {
+  self->disk_cache = disk_cache;
+  }
+
+
+/*============================================================================
+ * owm_context_get_disk_cache
+ * =========================================================================*/
+OwmDiskCache *owm_context_get_disk_cache (const OwmContext *self)
+  {
+  return self->disk_cache;
+  }
+
+
+/*============================================================================
+ * owm_context_set_location_filter
+ * =========================================================================*/
+void owm_context_set_location_filter (OwmContext *self,
+      OwmLocationFilter *filter)
+  {
+  self->location_filter = filter;
+  }
+
+
+/*============================================================================
+ * owm_context_get_location_filter
+ * =========================================================================*/
+OwmLocationFilter *owm_context_get_location_filter (const OwmContext *self)
+  {
+  return self->location_filter;
+  }
+
+
+/*============================================================================
+ * owm_context_take_handle
+ * Get a curl handle for one request, reset to its defaults, but with any
+ *   connection it has left open
+ * =========================================================================*/
+void *owm_context_take_handle (OwmContext *self)
+  {
+  CURL *curl = NULL;
+  pthread_mutex_lock (&self->mutex);
+  if (self->n_idle > 0)
+    curl = self->idle[--self->n_idle];
+  pthread_mutex_unlock (&self->mutex);
+
+  if (curl)
+    curl_easy_reset (curl);
+  else
+    {
+    owm_curl_init ();
+    curl = curl_easy_init ();
+    }
+  return curl;
+  }
+
+
+/*============================================================================
+ * owm_context_give_handle
+ * Return a handle from owm_context_take_handle(), to be kept for another
+ *   request if there is room
+ * =========================================================================*/
+void owm_context_give_handle (OwmContext *self, void *handle)
+  {
+  CURL *curl = handle;
+  pthread_mutex_lock (&self->mutex);
+  if (self->n_idle < OWM_CONTEXT_MAX_IDLE)
+    {
+    self->idle[self->n_idle++] = curl;
+    curl = NULL;
+    }
+  pthread_mutex_unlock (&self->mutex);
+  if (curl) curl_easy_cleanup (curl);
+  }
+
@@ -0,0 +1,64 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_crc32.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * The usual CRC-32 (as used by zlib and PNG), for detecting damaged 
+ *   files and buffers. Eight bytes are done at a time with eight tables
+ *   ("slicing-by-8"), which is several times faster than the usual one
+ *   byte at a time, and matters because archive scans check every block
+ * =========================================================================*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "owm_private.h"
+
+static uint32_t owm_crc32_table[8][256];
+static pthread_once_t owm_crc32_once = PTHREAD_ONCE_INIT;
+
+
+/*============================================================================
+ * owm_crc32_init
+ * =========================================================================*/
+static void owm_crc32_init (void)
+  {
+  uint32_t i;
+  for (i = 0; i < 256; i++)
+    {
+    uint32_t c = i;
+    int k;
+    for (k = 0; k < 8; k++)
+      c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+    owm_crc32_table[0][i] = c;
+    }
+  // Table k gives the effect of a byte followed by k zero bytes
+  int k;
+  for (k = 1; k < 8; k++)
+    for (i = 0; i < 256; i++)
+      owm_crc32_table[k][i] = owm_crc32_table[0][owm_crc32_table[k - 1][i] 
+        & 0xFF] ^ (owm_crc32_table[k - 1][i] >> 8);
+  }
+
+
+/*============================================================================
+ * owm_crc32_update
+ * Add len bytes to a running CRC. Start with a crc of zero
+ * =========================================================================*/
+uint32_t owm_crc32_update (uint32_t crc, const void *data, size_t len)
+  {
+  pthread_once (&owm_crc32_once, owm_crc32_init);
+  const unsigned char *p = data;
+  const uint32_t (*t)[256] = owm_crc32_table;
+  crc = ~crc;
+  for (; len >= 8; len -= 8, p += 8)
+    {
+    uint32_t a = crc ^ (p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16
+      | (uint32_t)p[3] << 24);
+    crc = t[7][a & 0xFF] ^ t[6][(a >> 8) & 0xFF] ^ t[5][(a >> 16) & 0xFF]
+      ^ t[4][a >> 24] ^ t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+    }
+  while (len--)
+    crc = t[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+  }
+
@@ -9,12 +9,18 @@
 #include <curl/curl.h>
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include <owm/owm_defs.h>
 #include <owm/owm_config.h>
 #include <owm/owm_string.h>
+#include <owm/owm_curl.h>
+#include <owm/owm_context.h>
+#include "owm_private.h"
 
 #define EASY_INIT_FAIL "Cannot initialize curl"
 
+static pthread_once_t owm_curl_once = PTHREAD_ONCE_INIT;
+
 /*---------------------------------------------------------------------------
 Private structs
 ---------------------------------------------------------------------------*/
@@ -22,9 +28,39 @@ struct DBWriteStruct
   {
   char *memory;
   size_t size;
+  CURL *curl;
+  OwmCurlProgressFn progress;
+  void *user_data;
+  };
+
+struct OwmCurlHeaders
+  {
+  char *etag;
+  char *last_modified;
   };
 
 
+/*---------------------------------------------------------------------------
+owm_curl_global_init
+---------------------------------------------------------------------------*/
+static void owm_curl_global_init (void)
+  {
+  curl_global_init (CURL_GLOBAL_DEFAULT);
+  }
+
+
+/*---------------------------------------------------------------------------
+owm_curl_init
+curl_global_init() is not thread-safe, and curl_easy_init() calls it
+if it has not been called, so make sure that it is called once, before
+any handle is created
+---------------------------------------------------------------------------*/
+void owm_curl_init (void)
+  {
+  pthread_once (&owm_curl_once, owm_curl_global_init);
+  }
+
+
 /*---------------------------------------------------------------------------
 feed_write_callback
 Callback for storing server response into an expandable memory block
@@ -38,19 +74,125 @@ static size_t owm_curl_write_callback (void *contents, size_t size,
   memcpy(&(mem->memory[mem->size]), contents, realsize);
   mem->size += realsize;
   mem->memory[mem->size] = 0;
+  if (mem->progress)
+    {
+    // Only a successful response is of interest to the caller
+    long code = 0;
+    curl_easy_getinfo (mem->curl, CURLINFO_RESPONSE_CODE, &code);
+    if (code == 200)
+      mem->progress (mem->memory, mem->size, mem->user_data);
+    }
   return realsize;
   }
 
 
 
-void owm_curl_get (const char *uri, char **result, char **error)
+/*---------------------------------------------------------------------------
+owm_curl_header_value
+If the header line starts with name, return a copy of its value, with
+surrounding white space removed. Otherwise return NULL
+---------------------------------------------------------------------------*/
+static char *owm_curl_header_value (const char *line, size_t len,
+    const char *name)
+  {
+  size_t name_len = strlen (name);
+  if (len <= name_len || strncasecmp (line, name, name_len) != 0) 
+    return NULL;
+  const char *start = line + name_len;
+  const char *end = line + len;
+  while (start < end && (*start == ' ' || *start == '\t')) start++;
+  while (end > start && (end[-1] == '\r' || end[-1] == '\n' 
+      || end[-1] == ' ')) end--;
+  return strndup (start, end - start);
+  }
+
+
+/*---------------------------------------------------------------------------
+owm_curl_header_callback
+Pick out the validators we need for conditional requests
+---------------------------------------------------------------------------*/
+static size_t owm_curl_header_callback (char *buffer, size_t size,
+    size_t nitems, void *userp)
+  {
+  size_t len = size * nitems;
+  struct OwmCurlHeaders *h = (struct OwmCurlHeaders *)userp;
+  char *value;
+  if ((value = owm_curl_header_value (buffer, len, "ETag:")))
+    {
+    free (h->etag);
+    h->etag = value;
+    }
+  else if ((value = owm_curl_header_value (buffer, len, "Last-Modified:")))
+    {
+    free (h->last_modified);
+    h->last_modified = value;
+    }
+  return len;
+  }
+
+
+/*---------------------------------------------------------------------------
+owm_curl_get_conditional
+Fetch uri. If etag or last_modified are not NULL, they are sent as
+If-None-Match and If-Modified-Since, and if the server says that nothing
+has changed, *http_code is set to 304, and *result is left NULL, without
+this being an error. The server's validators for the new response are 
+stored in *new_etag and *new_last_modified, if these are not NULL; the 
+caller must free them. http_code may also be NULL. 
+---------------------------------------------------------------------------*/
+void owm_curl_get_conditional (const char *uri, const char *etag,
+    const char *last_modified, char **result, char **new_etag, 
+    char **new_last_modified, long *http_code, char **error)
+  {
+  owm_curl_get_progressive (uri, etag, last_modified, NULL, NULL, result, 
+    new_etag, new_last_modified, http_code, error);
+  }
+
+
+/*---------------------------------------------------------------------------
+owm_curl_get_progressive
+As owm_curl_get_conditional(), but if progress is not NULL, it is called
+as each part of a successful response arrives, with all of the response
+so far
+---------------------------------------------------------------------------*/
+void owm_curl_get_progressive (const char *uri, const char *etag,
+    const char *last_modified, OwmCurlProgressFn progress, void *user_data,
+    char **result, char **new_etag, char **new_last_modified, 
+    long *http_code, char **error)
   {
-  CURL* curl = curl_easy_init();
+  owm_curl_fetch (NULL, uri, etag, last_modified, progress, user_data, 
+    result, new_etag, new_last_modified, http_code, error);
+  }
+
+
+/*---------------------------------------------------------------------------
+owm_curl_fetch
+As owm_curl_get_progressive(), using one of context's connections, or a
+new one if context is NULL
+---------------------------------------------------------------------------*/
+void owm_curl_fetch (OwmContext *context, const char *uri, 
+    const char *etag, const char *last_modified, OwmCurlProgressFn progress,
+    void *user_data, char **result, char **new_etag, 
+    char **new_last_modified, long *http_code, char **error)
+  {
+  if (http_code) *http_code = 0;
+  CURL *curl;
+  if (context)
+    curl = owm_context_take_handle (context);
+  else
+    {
+    owm_curl_init ();
+    curl = curl_easy_init ();
+    }
   if (curl)
    {
    struct DBWriteStruct response;
    response.memory = malloc(1);  
    response.size = 0;    
+   response.curl = curl;
+   response.progress = progress;
+   response.user_data = user_data;
+   struct OwmCurlHeaders validators = { NULL, NULL };
    
    struct curl_slist *headers = NULL;
 
@@ -60,17 +202,41 @@ void owm_curl_get (const char *uri, char **result, char **error)
     curl_easy_setopt (curl, CURLOPT_ERRORBUFFER, curl_error);
     curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, owm_curl_write_callback);
     curl_easy_setopt (curl, CURLOPT_WRITEDATA, &response);
+    curl_easy_setopt (curl, CURLOPT_HEADERFUNCTION, owm_curl_header_callback);
+    curl_easy_setopt (curl, CURLOPT_HEADERDATA, &validators);
+
+    if (etag)
+      {
+      char *h;
+      asprintf (&h, "If-None-Match: %s", etag);
+      headers = curl_slist_append (headers, h);
+      free (h);
+      }
+    if (last_modified)
+      {
+      char *h;
+      asprintf (&h, "If-Modified-Since: %s", last_modified);
+      headers = curl_slist_append (headers, h);
+      free (h);
+      }
+    if (headers)
+      curl_easy_setopt (curl, CURLOPT_HTTPHEADER, headers);
 
     CURLcode curl_code = curl_easy_perform (curl);
     if (curl_code == 0)
       {
       long codep = 0;
       curl_easy_getinfo (curl, CURLINFO_RESPONSE_CODE, &codep); 
+      if (http_code) *http_code = codep;
       if (codep == 200)
         {
         char *resp = response.memory;
         *result = strdup (resp);
         }
+      else if (codep == 304 && (etag || last_modified))
+        {
+        // Not modified -- the caller's copy is still good
+        }
       else
         {
         if (error)
@@ -85,9 +251,20 @@ void owm_curl_get (const char *uri, char **result, char **error)
         *error = strdup (curl_error); 
       }
 
+    if (new_etag) 
+      *new_etag = validators.etag;
+    else
+      free (validators.etag);
+    if (new_last_modified) 
+      *new_last_modified = validators.last_modified;
+    else
+      free (validators.last_modified);
     free (response.memory);
     curl_slist_free_all (headers); 
-    curl_easy_cleanup (curl);
+    if (context)
+      owm_context_give_handle (context, curl);
+    else
+      curl_easy_cleanup (curl);
     }
   else
     {
@@ -97,3 +274,14 @@ void owm_curl_get (const char *uri, char **result, char **error)
   }
 
 
+/*---------------------------------------------------------------------------
+owm_curl_get
+Fetch uri, storing the response body in *result if the server returns
+status 200, and an error message in *error if not
+---------------------------------------------------------------------------*/
+void owm_curl_get (const char *uri, char **result, char **error)
+  {
+  owm_curl_get_conditional (uri, NULL, NULL, result, NULL, NULL, NULL, 
+    error);
+  }
+
@@ -0,0 +1,479 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_db.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * The file is laid out as follows, with each part starting on a
+ *   64-byte boundary:
+ *     OwmDbHeader
+ *     the index: a power-of-two number of OwmDbSlots, at most half full,
+ *       with linear probing
+ *     the records, each an OwmDbRecord, the location ID and its zero
+ *       terminator, then the points as an array of OwmWeather and the
+ *       daily summaries as an array of OwmDailySummary
+ *   A slot with a zero offset is empty. Offsets are from the start of the
+ *   file. The header records the sizes of the structs, so that a file
+ *   written by an incompatible build is rejected rather than misread.
+ * Opening the file checks only the header and the extent of the index;
+ *   each record is bounds-checked when it is looked up.
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <owm/owm_defs.h>
+#include <owm/owm_db.h>
+#include "owm_private.h"
+
+#define OWM_DB_MAGIC "OWMDB\0\0\0"
+#define OWM_DB_VERSION 2
+#define OWM_DB_BLOCK 64
+#define OWM_DB_ROUND(n) (((n) + OWM_DB_BLOCK - 1) & ~(uint64_t)(OWM_DB_BLOCK - 1))
+
+typedef struct _OwmDbHeader
+  {
+  char magic[8];
+  uint32_t version;
+  uint32_t weather_size;  // sizeof (OwmWeather) in the writer
+  uint32_t summary_size;  // sizeof (OwmDailySummary) in the writer
+  uint32_t n_slots;
+  uint32_t n_records;
+  uint32_t reserved;
+  uint64_t file_size;
+  uint64_t index_offset;
+  } OwmDbHeader;
+
+typedef struct _OwmDbSlot
+  {
+  uint64_t hash;
+  uint64_t offset;
+  } OwmDbSlot;
+
+typedef struct _OwmDbRecord
+  {
+  int64_t fetched;
+  int64_t sunrise;
+  int64_t sunset;
+  int32_t flags;
+  int32_t n_points;
+  int32_t n_days;
+  int32_t fields;        // OWM_VALID_xxx fields parsed, or zero for all
+  uint32_t location_len; // Excluding the terminator
+  uint64_t points_offset;
+  uint64_t days_offset;
+  } OwmDbRecord;
+
+typedef struct _OwmDbBuilderEntry
+  {
+  char *location;
+  OwmForecast *forecast;
+  } OwmDbBuilderEntry;
+
+struct _OwmDbBuilder
+  {
+  int n_entries;
+  int max_entries;
+  OwmDbBuilderEntry *entries;
+  };
+
+struct _OwmDb
+  {
+  int refcount; // The caller's, plus one for each view
+  char *path;
+  dev_t dev;
+  ino_t ino;
+  const char *map;
+  size_t map_len;
+  const OwmDbHeader *header;
+  const OwmDbSlot *slots;
+  };
+
+
+/*============================================================================
+ * owm_db_hash
+ * 64-bit FNV-1a
+ * =========================================================================*/
+static uint64_t owm_db_hash (const char *s)
+  {
+  uint64_t hash = 14695981039346656037ull;
+  const unsigned char *p;
+  for (p = (const unsigned char *)s; *p; p++)
+    {
+    hash ^= *p;
+    hash *= 1099511628211ull;
+    }
+  return hash;
+  }
+
+
+/*============================================================================
+ * owm_db_builder_create
+ * =========================================================================*/
+OwmDbBuilder *owm_db_builder_create (void)
+  {
+  OwmDbBuilder *self = malloc (sizeof (OwmDbBuilder));
+  memset (self, 0, sizeof (OwmDbBuilder));
+  return self;
+  }
+
+
+/*============================================================================
+ * owm_db_builder_destroy
+ * =========================================================================*/
+void owm_db_builder_destroy (OwmDbBuilder *self)
+  {
+  if (self)
+    {
+    int i;
+    for (i = 0; i < self->n_entries; i++)
+      {
+      free (self->entries[i].location);
+      owm_forecast_destroy (self->entries[i].forecast);
+      }
+    free (self->entries);
+    free (self);
+    }
+  }
+
+
+/*============================================================================
+ * owm_db_builder_add
+ * =========================================================================*/
+void owm_db_builder_add (OwmDbBuilder *self, const char *location,
+      OwmForecast *forecast)
+  {
+  if (self->n_entries == self->max_entries)
+    {
+    self->max_entries = self->max_entries ? self->max_entries * 2 : 64;
+    self->entries = realloc (self->entries,
+      self->max_entries * sizeof (OwmDbBuilderEntry));
+    }
+  OwmDbBuilderEntry *e = &self->entries[self->n_entries++];
+  e->location = strdup (location);
+  e->forecast = owm_forecast_ref (forecast);
+  }
+
+
+/*============================================================================
+ * owm_db_builder_write_at
+ * Write len bytes at offset. The file is written front to back, so this
+ *   just pads with zeros up to the offset first
+ * =========================================================================*/
+static BOOL owm_db_builder_write_at (FILE *f, uint64_t offset,
+      const void *data, size_t len)
+  {
+  long pos = ftell (f);
+  if (pos < 0) return FALSE;
+  for (; (uint64_t)pos < offset; pos++)
+    if (fputc (0, f) == EOF) return FALSE;
+  return fwrite (data, 1, len, f) == len;
+  }
+
+
+/*============================================================================
+ * owm_db_builder_write
+ * =========================================================================*/
+BOOL owm_db_builder_write (OwmDbBuilder *self, const char *path,
+      char **error)
+  {
+  int n = self->n_entries;
+  uint32_t n_slots = 16;
+  while (n_slots < 2 * (uint32_t)n) n_slots *= 2;
+
+  // Lay out the records, and fill in the index
+  OwmDbSlot *slots = calloc (n_slots, sizeof (OwmDbSlot));
+  uint64_t *offsets = malloc ((n + 1) * sizeof (uint64_t));
+  uint64_t index_offset = OWM_DB_ROUND (sizeof (OwmDbHeader));
+  uint64_t offset = OWM_DB_ROUND (index_offset
+    + (uint64_t)n_slots * sizeof (OwmDbSlot));
+  int n_records = 0;
+  int i;
+  for (i = 0; i < n; i++)
+    {
+    const OwmDbBuilderEntry *e = &self->entries[i];
+    const OwmForecast *f = e->forecast;
+    offsets[i] = offset;
+    uint64_t hash = owm_db_hash (e->location);
+    uint32_t s = hash & (n_slots - 1);
+    while (slots[s].offset != 0)
+      {
+      // A location added again replaces the earlier record, which is
+      //  left in the file, unreferenced
+      if (slots[s].hash == hash
+          && strcmp (self->entries[slots[s].offset >> 32].location,
+               e->location) == 0)
+        break;
+      s = (s + 1) & (n_slots - 1);
+      }
+    if (slots[s].offset == 0) n_records++;
+    slots[s].hash = hash;
+    // Until the file is written, the offset holds the entry number in
+    //  its top half, and is never zero
+    slots[s].offset = ((uint64_t)i << 32) | 1;
+
+    uint64_t points_offset = OWM_DB_ROUND (offset + sizeof (OwmDbRecord)
+      + strlen (e->location) + 1);
+    uint64_t days_offset = points_offset
+      + OWM_ALIGN ((uint64_t)f->n_points * sizeof (OwmWeather));
+    offset = OWM_DB_ROUND (days_offset
+      + (uint64_t)f->n_days * sizeof (OwmDailySummary));
+    }
+  offsets[n] = offset;
+  for (i = 0; i < (int)n_slots; i++)
+    if (slots[i].offset)
+      slots[i].offset = offsets[slots[i].offset >> 32];
+
+  OwmDbHeader h;
+  memset (&h, 0, sizeof (h));
+  memcpy (h.magic, OWM_DB_MAGIC, 8);
+  h.version = OWM_DB_VERSION;
+  h.weather_size = sizeof (OwmWeather);
+  h.summary_size = sizeof (OwmDailySummary);
+  h.n_slots = n_slots;
+  h.n_records = n_records;
+  h.file_size = offsets[n];
+  h.index_offset = index_offset;
+
+  BOOL ret = FALSE;
+  char *tmp;
+  asprintf (&tmp, "%s.tmp.XXXXXX", path);
+  int fd = mkstemp (tmp);
+  FILE *f = fd >= 0 ? fdopen (fd, "w") : NULL;
+  if (f)
+    {
+    BOOL ok = fchmod (fd, 0644) == 0
+      && owm_db_builder_write_at (f, 0, &h, sizeof (h))
+      && owm_db_builder_write_at (f, index_offset, slots,
+           n_slots * sizeof (OwmDbSlot));
+    for (i = 0; i < n && ok; i++)
+      {
+      const OwmDbBuilderEntry *e = &self->entries[i];
+      const OwmForecast *fc = e->forecast;
+      OwmDbRecord r;
+      memset (&r, 0, sizeof (r));
+      r.fetched = fc->fetched;
+      r.sunrise = fc->sunrise;
+      r.sunset = fc->sunset;
+      r.flags = fc->flags;
+      r.fields = fc->fields;
+      r.n_points = fc->n_points;
+      r.n_days = fc->n_days;
+      r.location_len = strlen (e->location);
+      r.points_offset = OWM_DB_ROUND (offsets[i] + sizeof (OwmDbRecord)
+        + r.location_len + 1);
+      r.days_offset = r.points_offset
+        + OWM_ALIGN ((uint64_t)fc->n_points * sizeof (OwmWeather));
+      ok = owm_db_builder_write_at (f, offsets[i], &r, sizeof (r))
+        && owm_db_builder_write_at (f, offsets[i] + sizeof (r),
+             e->location, r.location_len + 1)
+        && owm_db_builder_write_at (f, r.points_offset, fc->points,
+             fc->n_points * sizeof (OwmWeather))
+        && owm_db_builder_write_at (f, r.days_offset, fc->days,
+             fc->n_days * sizeof (OwmDailySummary));
+      }
+    ok = ok && owm_db_builder_write_at (f, offsets[n], NULL, 0)
+      && fflush (f) == 0 && fsync (fd) == 0;
+    if (fclose (f) != 0) ok = FALSE;
+    if (ok && rename (tmp, path) == 0)
+      ret = TRUE;
+    else
+      {
+      if (error)
+        asprintf (error, "Can't write database %s: %s", path,
+          strerror (errno));
+      unlink (tmp);
+      }
+    }
+  else
+    {
+    if (error)
+      asprintf (error, "Can't create temporary file for %s: %s", path,
+        strerror (errno));
+    if (fd >= 0)
+      {
+      close (fd);
+      unlink (tmp);
+      }
+    }
+
+  free (tmp);
+  free (offsets);
+  free (slots);
+  return ret;
+  }
+
+
+/*============================================================================
+ * owm_db_open
+ * =========================================================================*/
+OwmDb *owm_db_open (const char *path, char **error)
+  {
+  int fd = open (path, O_RDONLY);
+  if (fd < 0)
+    {
+    if (error)
+      asprintf (error, "Can't open database %s: %s", path, strerror (errno));
+    return NULL;
+    }
+
+  OwmDb *self = NULL;
+  struct stat sb;
+  void *map = MAP_FAILED;
+  size_t len = 0;
+  if (fstat (fd, &sb) == 0 && (size_t)sb.st_size >= sizeof (OwmDbHeader))
+    {
+    len = sb.st_size;
+    map = mmap (NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    }
+  close (fd);
+
+  if (map != MAP_FAILED)
+    {
+    const OwmDbHeader *h = map;
+    if (memcmp (h->magic, OWM_DB_MAGIC, 8) == 0
+        && h->version == OWM_DB_VERSION
+        && h->weather_size == sizeof (OwmWeather)
+        && h->summary_size == sizeof (OwmDailySummary)
+        && h->file_size == len
+        && h->n_slots != 0 && (h->n_slots & (h->n_slots - 1)) == 0
+        && h->index_offset % OWM_DB_BLOCK == 0
+        && h->index_offset <= len
+        && (uint64_t)h->n_slots * sizeof (OwmDbSlot)
+             <= len - h->index_offset)
+      {
+      // Lookups go wherever the hash takes them, so read-ahead would
+      //  mostly fetch pages nobody wants
+      madvise (map, len, MADV_RANDOM);
+      self = malloc (sizeof (OwmDb));
+      self->refcount = 1;
+      self->path = strdup (path);
+      self->dev = sb.st_dev;
+      self->ino = sb.st_ino;
+      self->map = map;
+      self->map_len = len;
+      self->header = h;
+      self->slots = (const OwmDbSlot *)((const char *)map + h->index_offset);
+      }
+    else
+      munmap (map, len);
+    }
+
+  if (!self && error)
+    asprintf (error, "%s is not a valid forecast database", path);
+  return self;
+  }
+
+
+/*============================================================================
+ * owm_db_release
+ * Drop a reference, and unmap the file if it was the last
+ * =========================================================================*/
+void owm_db_release (OwmDb *self)
+  {
+  if (__atomic_sub_fetch (&self->refcount, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+    munmap ((void *)self->map, self->map_len);
+    free (self->path);
+    free (self);
+    }
+  }
+
+
+/*============================================================================
+ * owm_db_close
+ * =========================================================================*/
+void owm_db_close (OwmDb *self)
+  {
+  if (self) owm_db_release (self);
+  }
+
+
+/*============================================================================
+ * owm_db_get_locations
+ * =========================================================================*/
+int owm_db_get_locations (const OwmDb *self)
+  {
+  return self->header->n_records;
+  }
+
+
+/*============================================================================
+ * owm_db_record_valid
+ * Check that a record, and everything it points to, lies within the file
+ * =========================================================================*/
+static BOOL owm_db_record_valid (const OwmDb *self, uint64_t offset)
+  {
+  uint64_t len = self->map_len;
+  if (offset % OWM_DB_BLOCK != 0 || offset > len
+      || sizeof (OwmDbRecord) > len - offset)
+    return FALSE;
+  const OwmDbRecord *r = (const OwmDbRecord *)(self->map + offset);
+  uint64_t name_end = offset + sizeof (OwmDbRecord) + r->location_len;
+  return r->n_points >= 0 && r->n_days >= 0
+    && name_end < len && self->map[name_end] == 0
+    && r->points_offset % sizeof (double) == 0
+    && r->days_offset % sizeof (double) == 0
+    && r->points_offset <= len && r->days_offset <= len
+    && (uint64_t)r->n_points * sizeof (OwmWeather)
+         <= len - r->points_offset
+    && (uint64_t)r->n_days * sizeof (OwmDailySummary)
+         <= len - r->days_offset;
+  }
+
+
+/*============================================================================
+ * owm_db_lookup
+ * =========================================================================*/
+OwmForecast *owm_db_lookup (OwmDb *self, const char *location)
+  {
+  uint64_t hash = owm_db_hash (location);
+  uint32_t mask = self->header->n_slots - 1;
+  uint32_t s = hash & mask;
+  uint32_t probes;
+  for (probes = 0; probes <= mask; probes++, s = (s + 1) & mask)
+    {
+    const OwmDbSlot *slot = &self->slots[s];
+    if (slot->offset == 0) return NULL;
+    if (slot->hash != hash) continue;
+    if (!owm_db_record_valid (self, slot->offset)) return NULL;
+    const OwmDbRecord *r = (const OwmDbRecord *)(self->map + slot->offset);
+    if (strcmp ((const char *)(r + 1), location) != 0) continue;
+
+    OwmForecast *ret = malloc (sizeof (OwmForecast));
+    memset (ret, 0, sizeof (OwmForecast));
+    ret->refcount = 1;
+    ret->size = sizeof (OwmForecast);
+    ret->fetched = r->fetched;
+    ret->sunrise = r->sunrise;
+    ret->sunset = r->sunset;
+    ret->flags = r->flags;
+    ret->fields = r->fields;
+    ret->n_points = ret->max_points = r->n_points;
+    ret->points = (OwmWeather *)(self->map + r->points_offset);
+    ret->n_days = ret->max_days = r->n_days;
+    ret->days = (OwmDailySummary *)(self->map + r->days_offset);
+    __atomic_add_fetch (&self->refcount, 1, __ATOMIC_RELAXED);
+    ret->db = self;
+    return ret;
+    }
+  return NULL;
+  }
+
+
+/*============================================================================
+ * owm_db_is_current
+ * =========================================================================*/
+BOOL owm_db_is_current (const OwmDb *self)
+  {
+  struct stat sb;
+  return stat (self->path, &sb) == 0
+    && sb.st_dev == self->dev && sb.st_ino == self->ino;
+  }
+
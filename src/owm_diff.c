@@ -0,0 +1,147 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_diff.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <owm/owm_defs.h>
+#include <owm/owm_forecast.h>
+#include <owm/owm_weather.h>
+#include <owm/owm_diff.h>
+#include "owm_private.h"
+
+
+/*============================================================================
+ * owm_diff_thresholds_init
+ * Roughly the smallest changes that anyone looking at a forecast would
+ *   notice
+ * =========================================================================*/
+void owm_diff_thresholds_init (OwmDiffThresholds *thresholds)
+  {
+  thresholds->temp = 0.5;
+  thresholds->wind_speed = 2.2; // About 1 m/s
+  thresholds->wind_direction = 22.5;
+  thresholds->pressure = 1.0;
+  thresholds->humidity = 5.0;
+  thresholds->cloud_cover = 10.0;
+  }
+
+
+/*============================================================================
+ * owm_diff_field
+ * Has a numeric field changed? A field that is valid in one point but not
+ *   the other has
+ * =========================================================================*/
+static int owm_diff_field (const OwmWeather *a, const OwmWeather *b,
+      int field, double va, double vb, double threshold)
+  {
+  int valid = (a->valid & field) | ((b->valid & field) << 1);
+  if (valid == 0) return 0;
+  if (valid != (field | (field << 1))) return field;
+  return fabs (va - vb) >= threshold && va != vb ? field : 0;
+  }
+
+
+/*============================================================================
+ * owm_diff_direction
+ * The difference between two bearings, the short way round
+ * =========================================================================*/
+static double owm_diff_direction (double a, double b)
+  {
+  double d = fmod (fabs (a - b), 360.0);
+  return d > 180.0 ? 360.0 - d : d;
+  }
+
+
+/*============================================================================
+ * owm_diff_points
+ * Get the OWM_VALID_xxx codes of the fields that differ between two
+ *   points with the same start time
+ * =========================================================================*/
+static int owm_diff_points (const OwmWeather *a, const OwmWeather *b,
+      const OwmDiffThresholds *t)
+  {
+  int changed = 0;
+  if (((a->valid ^ b->valid) & OWM_VALID_CONDITIONS)
+      || ((a->valid & OWM_VALID_CONDITIONS) && a->conditions != b->conditions))
+    changed |= OWM_VALID_CONDITIONS;
+  // The parser sets precipitation without marking it valid, so compare
+  //  it regardless
+  if (a->precipitation != b->precipitation)
+    changed |= OWM_VALID_PRECIPITATION;
+  if (a->end_time != b->end_time)
+    changed |= OWM_VALID_END;
+  changed |= owm_diff_field (a, b, OWM_VALID_TEMP, a->temp, b->temp,
+    t->temp);
+  changed |= owm_diff_field (a, b, OWM_VALID_WIND_SPEED, a->wind_speed,
+    b->wind_speed, t->wind_speed);
+  changed |= owm_diff_field (a, b, OWM_VALID_WIND_DIRECTION, 0,
+    owm_diff_direction (a->wind_direction, b->wind_direction),
+    t->wind_direction);
+  changed |= owm_diff_field (a, b, OWM_VALID_PRESSURE, a->pressure,
+    b->pressure, t->pressure);
+  changed |= owm_diff_field (a, b, OWM_VALID_HUMIDITY, a->humidity,
+    b->humidity, t->humidity);
+  changed |= owm_diff_field (a, b, OWM_VALID_CLOUD_COVER, a->cloud_cover,
+    b->cloud_cover, t->cloud_cover);
+  return changed;
+  }
+
+
+/*============================================================================
+ * owm_forecast_diff
+ * The points in each forecast are in order of start time, so matching
+ *   them up is a merge
+ * =========================================================================*/
+int owm_forecast_diff (const OwmForecast *old_forecast,
+      const OwmForecast *new_forecast, const OwmDiffThresholds *thresholds,
+      OwmPointChange *changes, int max)
+  {
+  OwmDiffThresholds defaults;
+  if (!thresholds)
+    {
+    owm_diff_thresholds_init (&defaults);
+    thresholds = &defaults;
+    }
+
+  const OwmWeather *a = old_forecast->points;
+  const OwmWeather *b = new_forecast->points;
+  int na = old_forecast->n_points;
+  int nb = new_forecast->n_points;
+  int i = 0, j = 0, n = 0;
+  while (i < na || j < nb)
+    {
+    OwmPointChange c;
+    if (j >= nb || (i < na && a[i].start_time < b[j].start_time))
+      {
+      c.start_time = a[i].start_time;
+      c.old_index = i++;
+      c.new_index = -1;
+      c.changed = OWM_DIFF_REMOVED;
+      }
+    else if (i >= na || b[j].start_time < a[i].start_time)
+      {
+      c.start_time = b[j].start_time;
+      c.old_index = -1;
+      c.new_index = j++;
+      c.changed = OWM_DIFF_ADDED;
+      }
+    else
+      {
+      c.start_time = b[j].start_time;
+      c.changed = owm_diff_points (&a[i], &b[j], thresholds);
+      c.old_index = i++;
+      c.new_index = j++;
+      if (!c.changed) continue;
+      }
+    if (n < max) changes[n] = c;
+    n++;
+    }
+  return n;
+  }
+
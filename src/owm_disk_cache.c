@@ -0,0 +1,330 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_disk_cache.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * Each entry is a file, named from a hash of its key, laid out as
+ *   follows:
+ *     OwmDiskCacheHeader
+ *     key, etag, last_modified, data -- each followed by a zero byte
+ *   The checksum in the header covers everything after the header. The
+ *   files are native-endian, since they are only meant to be read on
+ *   the machine that wrote them.
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <owm/owm_defs.h>
+#include <owm/owm_disk_cache.h>
+#include "owm_private.h"
+
+#define OWM_DISK_CACHE_MAGIC "OWMDC\0\0\0"
+#define OWM_DISK_CACHE_VERSION 1
+
+typedef struct _OwmDiskCacheHeader
+  {
+  char magic[8];
+  uint32_t version;
+  uint32_t checksum;
+  int64_t fetched;
+  uint32_t key_len;          // Lengths exclude the zero terminators
+  uint32_t etag_len;         // Zero if there is no ETag
+  uint32_t last_modified_len;
+  uint32_t reserved;
+  uint64_t data_len;
+  } OwmDiskCacheHeader;
+
+struct _OwmDiskCache
+  {
+  char *directory;
+  };
+
+struct _OwmDiskCacheEntry
+  {
+  void *map;
+  size_t map_len;
+  const OwmDiskCacheHeader *header;
+  const char *etag;
+  const char *last_modified;
+  const char *data;
+  };
+
+
+/*============================================================================
+ * owm_disk_cache_make_key
+ * Combine the parts of the key into a new string
+ * =========================================================================*/
+static char *owm_disk_cache_make_key (const char *endpoint,
+      const char *location, const char *units)
+  {
+  char *key;
+  asprintf (&key, "%s|%s|%s", endpoint, location, units);
+  return key;
+  }
+
+
+/*============================================================================
+ * owm_disk_cache_path
+ * The file for a key is named from a 64-bit FNV-1a hash of it. The key
+ *   itself is stored in the file, in case of collisions
+ * =========================================================================*/
+static char *owm_disk_cache_path (const OwmDiskCache *self, const char *key)
+  {
+  uint64_t hash = 14695981039346656037ull;
+  const unsigned char *p;
+  for (p = (const unsigned char *)key; *p; p++)
+    {
+    hash ^= *p;
+    hash *= 1099511628211ull;
+    }
+  char *path;
+  asprintf (&path, "%s/%016llx.owm", self->directory,
+    (unsigned long long)hash);
+  return path;
+  }
+
+
+/*============================================================================
+ * owm_disk_cache_create
+ * =========================================================================*/
+OwmDiskCache *owm_disk_cache_create (const char *directory, char **error)
+  {
+  if (mkdir (directory, 0755) != 0 && errno != EEXIST)
+    {
+    if (error)
+      asprintf (error, "Can't create cache directory %s: %s", directory,
+        strerror (errno));
+    return NULL;
+    }
+  OwmDiskCache *self = malloc (sizeof (OwmDiskCache));
+  self->directory = strdup (directory);
+  return self;
+  }
+
+
+/*============================================================================
+ * owm_disk_cache_destroy
+ * =========================================================================*/
+void owm_disk_cache_destroy (OwmDiskCache *self)
+  {
+  if (self)
+    {
+    free (self->directory);
+    free (self);
+    }
+  }
+
+
+/*============================================================================
+ * owm_disk_cache_open
+ * =========================================================================*/
+OwmDiskCacheEntry *owm_disk_cache_open (OwmDiskCache *self,
+      const char *endpoint, const char *location, const char *units)
+  {
+  OwmDiskCacheEntry *ret = NULL;
+  char *key = owm_disk_cache_make_key (endpoint, location, units);
+  char *path = owm_disk_cache_path (self, key);
+
+  int fd = open (path, O_RDONLY);
+  struct stat sb;
+  if (fd >= 0 && fstat (fd, &sb) == 0
+      && (size_t)sb.st_size >= sizeof (OwmDiskCacheHeader))
+    {
+    size_t len = sb.st_size;
+    void *map = mmap (NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    if (map != MAP_FAILED)
+      {
+      const OwmDiskCacheHeader *h = map;
+      const char *body = (const char *)map + sizeof (OwmDiskCacheHeader);
+      size_t body_len = len - sizeof (OwmDiskCacheHeader);
+      // Check the lengths before using any of them, so that a damaged
+      //  file can't take us outside the mapping
+      uint64_t expected = (uint64_t)h->key_len + h->etag_len
+        + h->last_modified_len + h->data_len + 4;
+      if (memcmp (h->magic, OWM_DISK_CACHE_MAGIC, 8) == 0
+          && h->version == OWM_DISK_CACHE_VERSION
+          && expected == body_len
+          && h->key_len == strlen (key)
+          && memcmp (body, key, h->key_len) == 0
+          && owm_crc32_update (0, body, body_len) == h->checksum)
+        {
+        ret = malloc (sizeof (OwmDiskCacheEntry));
+        ret->map = map;
+        ret->map_len = len;
+        ret->header = h;
+        const char *p = body + h->key_len + 1;
+        ret->etag = h->etag_len ? p : NULL;
+        p += h->etag_len + 1;
+        ret->last_modified = h->last_modified_len ? p : NULL;
+        p += h->last_modified_len + 1;
+        ret->data = p;
+        }
+      else
+        munmap (map, len);
+      }
+    }
+  // The mapping stays valid after the file is closed, and even if the
+  //  file is replaced by another writer
+  if (fd >= 0) close (fd);
+
+  free (path);
+  free (key);
+  return ret;
+  }
+
+
+/*============================================================================
+ * owm_disk_cache_write_all
+ * =========================================================================*/
+static BOOL owm_disk_cache_write_all (int fd, const void *buff, size_t len)
+  {
+  const char *p = buff;
+  while (len > 0)
+    {
+    ssize_t n = write (fd, p, len);
+    if (n < 0)
+      {
+      if (errno == EINTR) continue;
+      return FALSE;
+      }
+    p += n;
+    len -= n;
+    }
+  return TRUE;
+  }
+
+
+/*============================================================================
+ * owm_disk_cache_store
+ * =========================================================================*/
+BOOL owm_disk_cache_store (OwmDiskCache *self, const char *endpoint,
+      const char *location, const char *units, const char *data,
+      size_t len, time_t fetched, const char *etag,
+      const char *last_modified, char **error)
+  {
+  BOOL ret = FALSE;
+  char *key = owm_disk_cache_make_key (endpoint, location, units);
+  char *path = owm_disk_cache_path (self, key);
+  if (!etag) etag = "";
+  if (!last_modified) last_modified = "";
+
+  OwmDiskCacheHeader h;
+  memset (&h, 0, sizeof (h));
+  memcpy (h.magic, OWM_DISK_CACHE_MAGIC, 8);
+  h.version = OWM_DISK_CACHE_VERSION;
+  h.fetched = fetched;
+  h.key_len = strlen (key);
+  h.etag_len = strlen (etag);
+  h.last_modified_len = strlen (last_modified);
+  h.data_len = len;
+
+  // The zero terminators are part of the checksummed body
+  const char *parts[4] = { key, etag, last_modified, data };
+  size_t lens[4] = { h.key_len, h.etag_len, h.last_modified_len, len };
+  uint32_t crc = 0;
+  int i;
+  for (i = 0; i < 4; i++)
+    {
+    crc = owm_crc32_update (crc, parts[i], lens[i]);
+    crc = owm_crc32_update (crc, "", 1);
+    }
+  h.checksum = crc;
+
+  char *tmp;
+  asprintf (&tmp, "%s/.tmp.XXXXXX", self->directory);
+  int fd = mkstemp (tmp);
+  if (fd >= 0)
+    {
+    // mkstemp() makes the file private to us, which is too restrictive
+    //  for a cache shared between processes
+    BOOL ok = fchmod (fd, 0644) == 0
+      && owm_disk_cache_write_all (fd, &h, sizeof (h));
+    for (i = 0; i < 4 && ok; i++)
+      {
+      ok = owm_disk_cache_write_all (fd, parts[i], lens[i])
+        && owm_disk_cache_write_all (fd, "", 1);
+      }
+    if (close (fd) != 0) ok = FALSE;
+    if (ok && rename (tmp, path) == 0)
+      ret = TRUE;
+    else
+      {
+      if (error)
+        asprintf (error, "Can't write cache file %s: %s", path,
+          strerror (errno));
+      unlink (tmp);
+      }
+    }
+  else
+    {
+    if (error)
+      asprintf (error, "Can't create file in %s: %s", self->directory,
+        strerror (errno));
+    }
+
+  free (tmp);
+  free (path);
+  free (key);
+  return ret;
+  }
+
+
+/*============================================================================
+ * owm_disk_cache_entry_get_data
+ * =========================================================================*/
+const char *owm_disk_cache_entry_get_data (const OwmDiskCacheEntry *self,
+      size_t *len)
+  {
+  if (len) *len = self->header->data_len;
+  return self->data;
+  }
+
+
+/*============================================================================
+ * owm_disk_cache_entry_get_fetch_time
+ * =========================================================================*/
+time_t owm_disk_cache_entry_get_fetch_time (const OwmDiskCacheEntry *self)
+  {
+  return (time_t)self->header->fetched;
+  }
+
+
+/*============================================================================
+ * owm_disk_cache_entry_get_etag
+ * =========================================================================*/
+const char *owm_disk_cache_entry_get_etag (const OwmDiskCacheEntry *self)
+  {
+  return self->etag;
+  }
+
+
+/*============================================================================
+ * owm_disk_cache_entry_get_last_modified
+ * =========================================================================*/
+const char *owm_disk_cache_entry_get_last_modified
+      (const OwmDiskCacheEntry *self)
+  {
+  return self->last_modified;
+  }
+
+
+/*============================================================================
+ * owm_disk_cache_entry_close
+ * =========================================================================*/
+void owm_disk_cache_entry_close (OwmDiskCacheEntry *self)
+  {
+  if (self)
+    {
+    munmap (self->map, self->map_len);
+    free (self);
+    }
+  }
+
@@ -11,6 +11,10 @@
 #include <stdlib.h>
 #include <time.h>
 #include <math.h>
+#include <limits.h>
+#include <stddef.h>
+#include <ctype.h>
+#include <pthread.h>
 #include <owm/owm_defs.h>
 #include <owm/owm_config.h>
 #include <owm/owm_string.h>
@@ -18,489 +22,1227 @@
 #include <owm/owm_forecast.h>
 #include <owm/owm_curl.h>
 #include <owm/owm_weather.h>
-#include <owm/owm_list.h>
+#include <owm/owm_cache.h>
+#include <owm/owm_disk_cache.h>
+#include <owm/owm_location_filter.h>
+#include <owm/owm_context.h>
 #include "sxmlc.h"
+#include "owm_private.h"
+#include "owm_parse.h"
 
 
 /*============================================================================
- * Private function prototypes 
+ * owm_forecast_create
+ * Create a new, empty forecast object, with room for max_points data
+ *   points and max_days daily summaries. The points and summaries follow
+ *   the header in the same block of memory, so there is exactly one 
+ *   allocation per forecast. 
  * =========================================================================*/
-void owm_forecast_set_rise_set (OwmForecast *self, time_t rise, time_t set);
+OwmForecast *owm_forecast_create (int max_points, int max_days)
+  {
+  if (max_points < 0) max_points = 0;
+  if (max_days < 0) max_days = 0;
+  size_t points_offset = OWM_ALIGN (sizeof (OwmForecast));
+  size_t days_offset = points_offset 
+    + OWM_ALIGN ((size_t)max_points * sizeof (OwmWeather));
+  size_t size = days_offset + (size_t)max_days * sizeof (OwmDailySummary);
+  OwmForecast *self = malloc (size);
+  memset (self, 0, sizeof (OwmForecast));
+  self->refcount = 1;
+  self->size = size;
+  self->max_points = max_points;
+  self->max_days = max_days;
+  self->points = (OwmWeather *)((char *)self + points_offset);
+  self->days = (OwmDailySummary *)((char *)self + days_offset);
+  return self;
+  }
+
 
 /*============================================================================
- *  Opaque data structure for results
+ * owm_forecast_ref
+ * Take an additional reference to a forecast, which must be released
+ *   with owm_forecast_destroy(). This is how the cache shares a forecast
+ *   between callers without copying it
  * =========================================================================*/
-struct _OwmForecast
+OwmForecast *owm_forecast_ref (OwmForecast *self)
   {
-  time_t sunrise;
-  time_t sunset;
-  OwmList *points;
-  };
+  __atomic_add_fetch (&self->refcount, 1, __ATOMIC_RELAXED);
+  return self;
+  }
+
+
+/*============================================================================
+ * owm_forecast_destroy
+ * Releases a reference to the forecast object, and cleans up its memory
+ *   if that was the last one. Since the points are part of the same 
+ *   allocation, this is a single free(). A view into a database also
+ *   releases its hold on the database
+ * =========================================================================*/
+void owm_forecast_destroy (OwmForecast *self)
+  {
+  if (!self) return;
+  if (__atomic_sub_fetch (&self->refcount, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+    if (self->db) owm_db_release (self->db);
+    free (self);
+    }
+  }
+
+
+/*============================================================================
+ * owm_forecast_get_size
+ * Get the number of bytes of memory the forecast occupies
+ * =========================================================================*/
+size_t owm_forecast_get_size (const OwmForecast *self)
+  {
+  return self->size;
+  }
+
+
+/*============================================================================
+ * owm_forecast_get_fetch_time
+ * Get the time at which the forecast was retrieved from the server. This
+ *   is zero for forecasts that were parsed from some other source 
+ * =========================================================================*/
+time_t owm_forecast_get_fetch_time (const OwmForecast *self)
+  {
+  return self->fetched;
+  }
+
+
+/*============================================================================
+ * owm_forecast_set_cache
+ * =========================================================================*/
+void owm_forecast_set_cache (OwmCache *cache)
+  {
+  owm_context_set_cache (owm_context_get_default (), cache);
+  }
 
 
 /*============================================================================
- * owm_parse_time_value
- * Parses a time value in OWM format into a time_t. Note that this involves
- *   ugly timezone conversions, because the OWM values are always in UTC,
- *   and the platform might not be
+ * owm_forecast_set_disk_cache
  * =========================================================================*/
-static time_t owm_parse_time_value (const char *value) 
+void owm_forecast_set_disk_cache (OwmDiskCache *disk_cache)
   {
-  char *old_tz = getenv ("TZ");
+  owm_context_set_disk_cache (owm_context_get_default (), disk_cache);
+  }
 
-  // Ugh. This sucks. There is no UTC/GMT equivalent of mktime() in
-  //  C :/
-  setenv ("TZ", "UTC0", 1);
-  tzset();
 
-  struct tm tm;
-  memset (&tm, 0, sizeof (struct tm));
-  strptime (value, "%FT%T", &tm);  
+/*============================================================================
+ * owm_forecast_set_location_filter
+ * =========================================================================*/
+void owm_forecast_set_location_filter (OwmLocationFilter *filter)
+  {
+  owm_context_set_location_filter (owm_context_get_default (), filter);
+  }
+
 
-  time_t t = mktime (&tm);   
+/*============================================================================
+ * owm_forecast_expiry
+ * When a forecast fetched at time fetched should be fetched again. The
+ *   memory cache's update cycle applies to the disk cache as well
+ * =========================================================================*/
+static time_t owm_forecast_expiry (const OwmCache *cache, time_t fetched)
+  {
+  if (cache)
+    return owm_cache_get_expiry (cache, fetched);
+  return owm_cache_cycle_expiry (fetched, OWM_CACHE_DEFAULT_CYCLE, 0);
+  }
 
-  if (old_tz)
+
+/*============================================================================
+ * owm_forecast_get_age
+ * =========================================================================*/
+int owm_forecast_get_age (const OwmForecast *self)
+  {
+  if (self->fetched == 0) return 0;
+  return (int)(time (NULL) - self->fetched);
+  }
+
+
+/*============================================================================
+ * owm_forecast_set_fetched
+ * Record when the forecast was fetched, and when it will expire by the
+ *   update cycle of the cache of the context that fetched it
+ * =========================================================================*/
+void owm_forecast_set_fetched (OwmForecast *self, OwmContext *context,
+      time_t fetched)
+  {
+  self->fetched = fetched;
+  self->expires = owm_forecast_expiry (owm_context_get_cache (context),
+    fetched);
+  }
+
+
+/*============================================================================
+ * owm_forecast_is_stale
+ * A forecast that was not fetched by a context -- one deserialized, say
+ *   -- is judged by the default context's cache
+ * =========================================================================*/
+BOOL owm_forecast_is_stale (const OwmForecast *self)
+  {
+  if (self->fetched == 0) return FALSE;
+  if (self->expires) return time (NULL) >= self->expires;
+  return time (NULL) >= owm_forecast_expiry 
+    (owm_context_get_cache (owm_context_get_default ()), self->fetched);
+  }
+
+
+/*============================================================================
+ * owm_forecast_get_point
+ * Get a specific OwmWeather entry from the forecast. Entries start
+ * at zero, and continue to owm_forecast_get_points()-1 -- usually 39 
+ * =========================================================================*/
+const OwmWeather *owm_forecast_get_point (const OwmForecast *self, int n)
+  {
+  if (n < 0 || n >= self->n_points) return NULL;
+  return &self->points[n];
+  }
+
+
+/*============================================================================
+ * owm_forecast_get_points
+ * Get the number of forecast data points -- usually 40
+ * =========================================================================*/
+int owm_forecast_get_points (const OwmForecast *self)
+  {
+  return self->n_points;
+  }
+
+/*============================================================================
+ * owm_forecast_field_offset
+ * The offset in OwmWeather of a field that is stored as a double, or -1
+ * =========================================================================*/
+static int owm_forecast_field_offset (int field)
+  {
+  switch (field)
     {
-    setenv ("TZ", old_tz, 1);
-    tzset();
+    case OWM_VALID_TEMP: return offsetof (OwmWeather, temp);
+    case OWM_VALID_WIND_DIRECTION: return offsetof (OwmWeather, wind_direction);
+    case OWM_VALID_WIND_SPEED: return offsetof (OwmWeather, wind_speed);
+    case OWM_VALID_PRESSURE: return offsetof (OwmWeather, pressure);
+    case OWM_VALID_HUMIDITY: return offsetof (OwmWeather, humidity);
+    case OWM_VALID_CLOUD_COVER: return offsetof (OwmWeather, cloud_cover);
     }
-  else
+  return -1;
+  }
+
+
+/*============================================================================
+ * owm_forecast_copy_column
+ * Copy the double at offset in each of n points, and its validity bit
+ * =========================================================================*/
+static void owm_forecast_copy_column (const OwmWeather *points, int n, 
+      int offset, int field, double *values, unsigned char *mask)
+  {
+  int i;
+  const char *p = (const char *)points + offset;
+  for (i = 0; i < n; i++, p += sizeof (OwmWeather))
+    values[i] = *(const double *)p;
+  if (mask)
+    for (i = 0; i < n; i++)
+      mask[i] = (points[i].valid & field) != 0;
+  }
+
+
+/*============================================================================
+ * owm_forecast_get_field
+ * Copy one property of every point into a plain array, for bulk 
+ *   processing. The fields stored as doubles -- which are the ones worth
+ *   aggregating -- are copied in a straight loop; the others go through
+ *   owm_weather_get_field()
+ * =========================================================================*/
+int owm_forecast_get_field (const OwmForecast *self, int field, 
+      double *values, unsigned char *mask, int max)
+  {
+  int i, n = self->n_points < max ? self->n_points : max;
+  int offset = owm_forecast_field_offset (field);
+  if (offset >= 0)
     {
-    unsetenv ("TZ");
+    owm_forecast_copy_column (self->points, n, offset, field, values, mask);
+    return n;
     }
+  for (i = 0; i < n; i++)
+    {
+    const OwmWeather *w = &self->points[i];
+    values[i] = owm_weather_get_field (w, field);
+    if (mask) mask[i] = (w->valid & field) != 0;
+    }
+  return n;
+  }
+
+
+/*============================================================================
+ * owm_forecast_get_wind_vectors
+ * =========================================================================*/
+int owm_forecast_get_wind_vectors (const OwmForecast *self, double *x, 
+      double *y, unsigned char *mask, int max)
+  {
+  int n = self->n_points < max ? self->n_points : max;
+  owm_forecast_copy_column (self->points, n, offsetof (OwmWeather, wind_x),
+    OWM_VALID_WIND_DIRECTION, x, mask);
+  owm_forecast_copy_column (self->points, n, offsetof (OwmWeather, wind_y),
+    OWM_VALID_WIND_DIRECTION, y, NULL);
+  return n;
+  }
+
+
+/*============================================================================
+ * owm_day_number
+ * Convert a time_t to a day number -- days since the epoch, UTC. This is
+ *   what gmtime() was used for, but it's reentrant and much cheaper. 
+ * =========================================================================*/
+static long owm_day_number (time_t t)
+  {
+  long day = (long)(t / OWM_SECONDS_PER_DAY);
+  if (t % OWM_SECONDS_PER_DAY < 0) day--;
+  return day;
+  }
+
 
-  return t;
+/*============================================================================
+ * owm_day_accumulator_init
+ * =========================================================================*/
+static void owm_day_accumulator_init (OwmDayAccumulator *acc, long day)
+  {
+  memset (acc, 0, sizeof (OwmDayAccumulator));
+  acc->day = day;
+  acc->min_temp = 1000;
+  acc->max_temp = -1000;
   }
 
 
 /*============================================================================
- * owm_parse_times
- * Parse the <times> element from the OWM response for a specific 
- *   weather point
+ * owm_day_accumulator_add
+ * Fold one data point into the running totals for a day
  * =========================================================================*/
-static void owm_parse_times (const XMLNode *n, time_t *from, time_t *to)
+static void owm_day_accumulator_add (OwmDayAccumulator *acc, 
+      const OwmWeather *w)
   {
-  int i, nattrs = n->n_attributes;
-  for (i = 0; i < nattrs; i++)
+  acc->points++;
+  acc->valid |= w->valid & OWM_SUMMARY_FIELDS;
+
+  if (w->valid & OWM_VALID_CONDITIONS)
     {
-    char *name = n->attributes[i].name;
-    if (strcmp (name, "from") == 0)
+    OwmConditions cond = w->conditions;
+    if (cond > 0 && cond < OWM_MAX_CONDS)
       {
-      char *value= n->attributes[i].value;
-      *from = owm_parse_time_value (value);
-      }
-    else if (strcmp (name, "to") == 0)
-      {
-      char *value= n->attributes[i].value;
-      *to = owm_parse_time_value (value);
+      // There are rarely more than eight points in a day, so a short
+      //  linear search of the codes seen so far is all we need
+      int i;
+      for (i = 0; i < acc->n_conds; i++)
+        {
+        if (acc->conds[i] == cond) break;
+        }
+      if (i < acc->n_conds)
+        acc->cond_counts[i]++;
+      else if (acc->n_conds < OWM_DAY_MAX_CONDS)
+        {
+        acc->conds[acc->n_conds] = cond;
+        acc->cond_counts[acc->n_conds] = 1;
+        acc->n_conds++;
+        }
       }
     }
+  if (w->valid & OWM_VALID_TEMP)
+    {
+    if (w->temp > acc->max_temp) acc->max_temp = w->temp;
+    if (w->temp < acc->min_temp) acc->min_temp = w->temp;
+    }
+  if (w->valid & OWM_VALID_WIND_SPEED)
+    {
+    acc->total_wind_speed += w->wind_speed;
+    acc->wind_speed_points++;
+    }
+  if (w->valid & OWM_VALID_WIND_DIRECTION)
+    {
+    acc->total_cos_wind_dir += w->wind_y;
+    acc->total_sin_wind_dir += w->wind_x;
+    acc->wind_dir_points++;
+    }
   }
 
 
 /*============================================================================
- * owm_parse_temp 
- * parse the <temperature> element from the OWM response 
+ * owm_day_accumulator_finish
+ * Turn the running totals into a summary. Where two conditions are 
+ *   equally common, the lower code wins, as it always has
  * =========================================================================*/
-static double owm_parse_temp (const XMLNode *n)
+static void owm_day_accumulator_finish (const OwmDayAccumulator *acc, 
+      OwmDailySummary *summary)
   {
-  double ret = 0;
-  int i, nattrs = n->n_attributes;
-  for (i = 0; i < nattrs; i++)
+  memset (summary, 0, sizeof (OwmDailySummary));
+  summary->day = (time_t)acc->day * OWM_SECONDS_PER_DAY;
+  summary->points = acc->points;
+  summary->valid = acc->valid;
+  summary->min_temp = acc->min_temp;
+  summary->max_temp = acc->max_temp;
+
+  int i, cond_max = 0;
+  OwmConditions cond_num = 0;
+  for (i = 0; i < acc->n_conds; i++)
     {
-    char *name = n->attributes[i].name;
-    if (strcmp (name, "value") == 0)
+    int c = acc->cond_counts[i];
+    if (c > cond_max || (c == cond_max && acc->conds[i] < cond_num)) 
       {
-      char *value= n->attributes[i].value;
-      sscanf (value, "%lf", &ret);
-      }
+      cond_max = c;
+      cond_num = acc->conds[i];
+      } 
     }
-  return ret - 273.15;
+  summary->modal_conditions = cond_num;
+
+  if (acc->wind_speed_points > 0)
+    summary->wind_speed = acc->total_wind_speed 
+      / (double) acc->wind_speed_points;
+
+  // Avoid a div by zero here -- wind directions can, in theory cancel out
+  if (acc->total_cos_wind_dir == 0.0)
+    summary->wind_direction = 0.0;
+  else
+    summary->wind_direction = atan2 (acc->total_sin_wind_dir, 
+      acc->total_cos_wind_dir) * 360.0 / 2.0 / M_PI;
+  if (summary->wind_direction < 0) summary->wind_direction += 360.0;
   }
 
 
 /*============================================================================
- * owm_parse_wind_direction
- * parse the <windDirection> element from the OWM response 
+ * owm_forecast_begin_points
+ * Prepare to add points to a new forecast with owm_forecast_add_point()
  * =========================================================================*/
-static double owm_parse_wind_direction (const XMLNode *n)
+void owm_forecast_begin_points (OwmForecast *self, OwmDayAccumulator *acc)
   {
-  double ret = 0;
-  int i, nattrs = n->n_attributes;
-  for (i = 0; i < nattrs; i++)
+  self->n_points = 0;
+  self->n_days = 0;
+  memset (acc, 0, sizeof (OwmDayAccumulator));
+  }
+
+
+/*============================================================================
+ * owm_forecast_add_point
+ * Add a point to the forecast, and fold it into the running summary for
+ *   its day. Points must be added in time order -- as OWM supplies them --
+ *   because a change of day completes the summary of the previous one. 
+ *   If the forecast was created with no room for points, only the 
+ *   summaries are kept. 
+ * =========================================================================*/
+void owm_forecast_add_point (OwmForecast *self, OwmDayAccumulator *acc, 
+      const OwmWeather *point)
+  {
+  // The wind vector is worked out once here, for the summary and for
+  //  owm_forecast_get_wind_vectors()
+  OwmWeather copy = *point;
+  const OwmWeather *w = &copy;
+  owm_weather_update_wind_vector (&copy);
+  long day = owm_day_number (w->start_time);
+  if (acc->points == 0)
+    owm_day_accumulator_init (acc, day);
+  else if (day != acc->day)
     {
-    char *name = n->attributes[i].name;
-    if (strcmp (name, "deg") == 0)
-      {
-      char *value= n->attributes[i].value;
-      sscanf (value, "%lf", &ret);
-      }
+    if (self->n_days < self->max_days)
+      owm_day_accumulator_finish (acc, &self->days[self->n_days++]);
+    owm_day_accumulator_init (acc, day);
+    }
+  owm_day_accumulator_add (acc, w);
+
+  if (self->n_points < self->max_points)
+    {
+    memcpy (&self->points[self->n_points], w, sizeof (OwmWeather));
+    self->n_points++;
     }
+  }
+
+
+/*============================================================================
+ * owm_forecast_end_points
+ * Complete the summary of the last day in the forecast
+ * =========================================================================*/
+void owm_forecast_end_points (OwmForecast *self, OwmDayAccumulator *acc)
+  {
+  if (acc->points > 0 && self->n_days < self->max_days)
+    owm_day_accumulator_finish (acc, &self->days[self->n_days++]);
+  memset (acc, 0, sizeof (OwmDayAccumulator));
+  }
+
+
+/*============================================================================
+ * owm_forecast_shrink
+ * Give back the unused part of a forecast's allocation. This is only 
+ *   worthwhile for summary-only forecasts, whose summaries array was sized
+ *   for the worst case of one day per point
+ * =========================================================================*/
+OwmForecast *owm_forecast_shrink (OwmForecast *self)
+  {
+  size_t days_offset = (char *)self->days - (char *)self;
+  size_t size = days_offset + (size_t)self->n_days 
+    * sizeof (OwmDailySummary);
+  OwmForecast *ret = realloc (self, size);
+  if (!ret) return self; 
+  ret->size = size;
+  ret->max_days = ret->n_days;
+  ret->points = (OwmWeather *)((char *)ret + OWM_ALIGN (sizeof (OwmForecast)));
+  ret->days = (OwmDailySummary *)((char *)ret + days_offset);
   return ret;
   }
 
 
+/* The elements of <time>, and the fields they hold */
+static const struct
+  {
+  const char *tag;
+  int field;
+  } owm_forecast_elements[] =
+  {
+  { "temperature", OWM_VALID_TEMP },
+  { "symbol", OWM_VALID_CONDITIONS },
+  { "precipitation", OWM_VALID_PRECIPITATION },
+  { "windDirection", OWM_VALID_WIND_DIRECTION },
+  { "windSpeed", OWM_VALID_WIND_SPEED },
+  { "pressure", OWM_VALID_PRESSURE },
+  { "humidity", OWM_VALID_HUMIDITY },
+  { "clouds", OWM_VALID_CLOUD_COVER },
+  };
+
+
 /*============================================================================
- * owm_parse_wind_speeed
- * parse the <windSpeed> element from the OWM response 
+ * owm_forecast_parse_point
+ * Decode the <time> element whose start tag the scanner s has just 
+ *   returned into point, reading up to its end tag. Only the elements for 
+ *   fields in the mask fields are decoded; the others are passed over 
+ *   without being copied or split into attributes. Returns 1 for a usable
+ *   point, 0 if the element has none of the fields, and -1 if the 
+ *   document is malformed
  * =========================================================================*/
-static double owm_parse_wind_speed (const XMLNode *n)
+static int owm_forecast_parse_point (OwmXmlScanner *s, const OwmXmlTag *t1,
+    int fields, OwmWeather *point)
   {
-  double ret = 0;
-  int i, nattrs = n->n_attributes;
-  for (i = 0; i < nattrs; i++)
+  XMLNode node;
+  if (!owm_xml_decode (t1, &node)) return -1;
+  time_t from = 0, to = 0;
+  owm_parse_times (&node, &from, &to);
+  XMLNode_free (&node);
+  double temp = 0;
+  double wind_direction = 0;
+  double wind_speed = 0;
+  double pressure = 0;
+  double humidity = 0;
+  double cloud_cover = 0;
+  OwmConditions conditions = -1;
+  OwmPrecipitation precipitation = -1;
+  int valid = 0;
+  OwmXmlTag f1;
+  while (!t1->empty)
     {
-    char *name = n->attributes[i].name;
-    if (strcmp (name, "mps") == 0)
+    OwmXmlType type = owm_xml_next (s, &f1);
+    if (type == OWM_XML_ERROR) return -1;
+    // An element left open at the end is taken to end there, as sxmlc 
+    //  would
+    if (type == OWM_XML_END) break;
+    if (type == OWM_XML_CLOSE)
       {
-      char *value= n->attributes[i].value;
-      sscanf (value, "%lf", &ret);
+      if (f1.depth == t1->depth) break;
+      continue;
       }
+    if (f1.depth != t1->depth + 1) continue;
+    int i, field = 0;
+    for (i = 0; i < (int)(sizeof (owm_forecast_elements) 
+        / sizeof (owm_forecast_elements[0])); i++)
+      if (owm_xml_is (&f1, owm_forecast_elements[i].tag))
+        {
+        field = owm_forecast_elements[i].field;
+        break;
+        }
+    if (!(field & fields)) continue;
+    if (!owm_xml_decode (&f1, &node)) return -1;
+    switch (field)
+      {
+      case OWM_VALID_TEMP: 
+        temp = owm_parse_temp (&node); break;
+      case OWM_VALID_CONDITIONS: 
+        conditions = owm_parse_conditions (&node); break;
+      case OWM_VALID_PRECIPITATION: 
+        precipitation = owm_parse_precipitation (&node); break;
+      case OWM_VALID_WIND_DIRECTION: 
+        wind_direction = owm_parse_wind_direction (&node); break;
+      case OWM_VALID_WIND_SPEED: 
+        wind_speed = owm_parse_wind_speed (&node); break;
+      case OWM_VALID_PRESSURE: 
+        pressure = owm_parse_pressure (&node); break;
+      case OWM_VALID_HUMIDITY: 
+        humidity = owm_parse_humidity (&node); break;
+      case OWM_VALID_CLOUD_COVER: 
+        cloud_cover = owm_parse_cloud_cover (&node); break;
+      }
+    valid |= field;
+    XMLNode_free (&node);
     }
-  return ret * 2.23694;
+  if (valid == 0) return 0;
+
+  OwmWeather *weather = point;
+  owm_weather_init (weather);
+  owm_weather_set_start_time (weather, from);
+  owm_weather_set_end_time (weather, to);
+  if (valid & OWM_VALID_TEMP)
+    owm_weather_set_temperature (weather, temp);
+  if (valid & OWM_VALID_CONDITIONS)
+    owm_weather_set_conditions (weather, conditions);
+  if (valid & OWM_VALID_PRECIPITATION)
+    owm_weather_set_precipitation (weather, precipitation);
+  if (valid & OWM_VALID_WIND_DIRECTION)
+    owm_weather_set_wind_direction (weather, wind_direction);
+  if (valid & OWM_VALID_WIND_SPEED)
+    owm_weather_set_wind_speed (weather, wind_speed);
+  if (valid & OWM_VALID_PRESSURE)
+    owm_weather_set_pressure (weather, pressure);
+  if (valid & OWM_VALID_HUMIDITY)
+    owm_weather_set_humidity (weather, humidity);
+  if (valid & OWM_VALID_CLOUD_COVER)
+    owm_weather_set_cloud_cover (weather, cloud_cover);
+
+  return 1;
   }
 
 
 /*============================================================================
- * owm_parse_pressure
- * parse the <pressure> element from the OWM response 
+ * owm_forecast_find_time
+ * Find the next "<time" at or after p that begins a <time> element, and 
+ *   not, say, a <timezone>, or return NULL
  * =========================================================================*/
-static double owm_parse_pressure (const XMLNode *n)
+static const char *owm_forecast_find_time (const char *p, const char *end)
   {
-  double ret = 0;
-  int i, nattrs = n->n_attributes;
-  for (i = 0; i < nattrs; i++)
+  for (;;)
     {
-    char *name = n->attributes[i].name;
-    if (strcmp (name, "value") == 0)
-      {
-      char *value= n->attributes[i].value;
-      sscanf (value, "%lf", &ret);
-      }
+    const char *start = memmem (p, end - p, "<time", 5);
+    if (!start || start + 5 >= end || start[5] == ' ' || start[5] == '>'
+        || start[5] == '/' || start[5] == '\t' || start[5] == '\r' 
+        || start[5] == '\n')
+      return start;
+    p = start + 5;
     }
-  return ret;
   }
 
 
 /*============================================================================
- * owm_parse_cloud_cover
- * parse the <cloud> element from the OWM response 
+ * owm_forecast_parse_ex 
+ * Parse the XML data returned from the OWM API call. The document is 
+ *   read with a streaming scanner, rather than into a tree, so that the
+ *   elements for fields not asked for are never decoded, and nothing 
+ *   after the last point wanted is read at all. The daily summaries are 
+ *   built up as each <time> element is decoded, so that later summary 
+ *   queries need not look at the points at all. A JSON document is 
+ *   handed to owm_forecast_parse_json()
  * =========================================================================*/
-static double owm_parse_cloud_cover (const XMLNode *n)
+OwmForecast *owm_forecast_parse_ex (const char *xml, 
+    const OwmForecastOptions *options, char **error)
   {
-  double ret = 0;
-  int i, nattrs = n->n_attributes;
-  for (i = 0; i < nattrs; i++)
+  const char *p = xml;
+  while (isspace ((unsigned char)*p)) p++;
+  if (*p == '{')
+    return owm_forecast_parse_json (p, strlen (p), options, error);
+
+  int flags = options ? options->flags : 0;
+  int fields = options && options->fields ? options->fields : ~0;
+  int limit = options && options->max_points > 0 ? options->max_points 
+    : INT_MAX;
+  size_t len = strlen (xml);
+
+  // Size the forecast from the number of <time> elements, so that all 
+  //  the points can be stored in the same allocation. Not every one need
+  //  be usable, so this is an upper limit
+  int max_points = 0;
+  const char *end = xml + len;
+  for (p = owm_forecast_find_time (xml, end); p && max_points < limit; 
+      p = owm_forecast_find_time (p + 5, end))
+    max_points++;
+  // Each day has at least one point, so max_points is also a limit on 
+  //  the number of days
+  OwmForecast *ret;
+  if (flags & OWM_FORECAST_SUMMARY_ONLY)
+    ret = owm_forecast_create (0, max_points);
+  else
+    ret = owm_forecast_create (max_points, max_points);
+  ret->flags = flags;
+  ret->fields = options ? options->fields : 0;
+
+  int n_points = 0;
+  OwmDayAccumulator acc;
+  owm_forecast_begin_points (ret, &acc);
+
+  OwmXmlScanner s;
+  OwmXmlTag r1;
+  BOOL ok = TRUE, in_forecast = FALSE;
+  owm_xml_init (&s, xml, len);
+  while (ok && n_points < limit)
     {
-    char *name = n->attributes[i].name;
-    if (strcmp (name, "all") == 0)
+    OwmXmlType type = owm_xml_next (&s, &r1);
+    if (type == OWM_XML_END) break;
+    if (type == OWM_XML_ERROR)
+      ok = FALSE;
+    else if (type == OWM_XML_CLOSE)
       {
-      char *value= n->attributes[i].value;
-      sscanf (value, "%lf", &ret);
+      if (r1.depth == 1) in_forecast = FALSE;
+      }
+    else if (r1.depth == 1 && owm_xml_is (&r1, "sun"))
+      {
+      XMLNode node;
+      if (owm_xml_decode (&r1, &node))
+        {
+        time_t rise = 0, set = 0;
+        owm_parse_rise_set (&node, &rise, &set);
+        owm_forecast_set_rise_set (ret, rise, set);
+        XMLNode_free (&node);
+        }
+      else
+        ok = FALSE;
+      }
+    else if (r1.depth == 1 && owm_xml_is (&r1, "forecast"))
+      in_forecast = !r1.empty;
+    else if (in_forecast && r1.depth == 2 && owm_xml_is (&r1, "time"))
+      {
+      OwmWeather point;
+      int got = owm_forecast_parse_point (&s, &r1, fields, &point);
+      if (got < 0) 
+        ok = FALSE;
+      else if (got)
+        {
+        owm_forecast_add_point (ret, &acc, &point);
+        n_points++;
+        }
       }
     }
-  return ret;
+  // A document that is not XML at all has no elements
+  if (ok && s.root)
+    {
+    owm_forecast_end_points (ret, &acc);
+    if (flags & OWM_FORECAST_SUMMARY_ONLY)
+      ret = owm_forecast_shrink (ret);
+    return ret;
+    }
+  owm_forecast_destroy (ret);
+  asprintf (error, "Can't parse XML");
+  return NULL;
+  }
+
+
+/*============================================================================
+ * owm_forecast_parse 
+ * Parse the XML data returned from the OWM API call, with default options
+ * =========================================================================*/
+OwmForecast *owm_forecast_parse (const char *xml, char **error)
+  {
+  return owm_forecast_parse_ex (xml, NULL, error);
+  }
+
+
+/*============================================================================
+ * owm_forecast_set_rise_set
+ * =========================================================================*/
+void owm_forecast_set_rise_set (OwmForecast *self, time_t rise, time_t set)
+  {
+  self->sunrise = rise;
+  self->sunset = set;
+  }
+
+
+/*============================================================================
+ * owm_forecast_get_rise_set
+ * =========================================================================*/
+void owm_forecast_get_rise_set (OwmForecast *self, time_t *rise, time_t *set)
+  {
+  *rise = self->sunrise;
+  *set = self->sunset;
+  }
+
+
+/*============================================================================
+ * OwmForecastRefresh
+ * What a background refresh of a stale cache entry needs to know
+ * =========================================================================*/
+typedef struct _OwmForecastRefresh
+  {
+  OwmContext *context;
+  OwmCache *cache;
+  char *key; // Of the cache entry
+  char *location_id;
+  char *uri;
+  OwmForecastOptions options;
+  } OwmForecastRefresh;
+
+/*============================================================================
+ * OwmForecastStream
+ * The state of a progressive fetch. Points are passed to the callback as
+ *   their <time> elements arrive, before the document is complete
+ * =========================================================================*/
+typedef struct _OwmForecastStream
+  {
+  OwmForecastProgressCallback callback;
+  void *user_data;
+  int fields;
+  int limit;
+  size_t scanned; // Where to look for the next <time> element
+  int delivered; // Points passed to the callback so far
+  } OwmForecastStream;
+
+static OwmForecast *owm_forecast_fetch (OwmContext *context, 
+    const char *location_id, const char *s_uri, 
+    const OwmForecastOptions *options, OwmForecastStream *stream, 
+    char **error);
+
+
+/*============================================================================
+ * owm_forecast_refresh_thread
+ * The stale entry is expired, so an ordinary get will pass over it and
+ *   fetch a new forecast, which replaces it in the cache. There is no 
+ *   one to report an error to, so a failed refresh just leaves the stale
+ *   entry in place until a later request tries again
+ * =========================================================================*/
+static void *owm_forecast_refresh_thread (void *data)
+  {
+  OwmForecastRefresh *r = data;
+  char *error = NULL;
+  OwmForecast *f = owm_forecast_fetch (r->context, r->location_id, r->uri, 
+    &r->options, NULL, &error);
+  owm_forecast_destroy (f);
+  free (error);
+  owm_cache_end_refresh (r->cache, "forecast", r->key, OWM_UNITS);
+  owm_context_destroy (r->context);
+  free (r->key);
+  free (r->location_id);
+  free (r->uri);
+  free (r);
+  return NULL;
   }
 
 
 /*============================================================================
- * owm_parse_humidity
- * parse the <humidity> element from the OWM response 
+ * owm_forecast_start_refresh
+ * Start a background refresh of the stale entry with key key, unless one
+ *   is already running for it, or the cache's limit on refreshes has 
+ *   been reached
  * =========================================================================*/
-static double owm_parse_humidity (const XMLNode *n)
+static void owm_forecast_start_refresh (OwmContext *context, 
+    OwmCache *cache, const char *key,
+    const char *location_id, const char *uri, 
+    const OwmForecastOptions *options)
   {
-  double ret = 0;
-  int i, nattrs = n->n_attributes;
-  for (i = 0; i < nattrs; i++)
+  if (!owm_cache_begin_refresh (cache, "forecast", key, OWM_UNITS))
+    return;
+
+  OwmForecastRefresh *r = malloc (sizeof (OwmForecastRefresh));
+  r->context = owm_context_ref (context);
+  r->cache = cache;
+  r->key = strdup (key);
+  r->location_id = strdup (location_id);
+  r->uri = strdup (uri);
+  if (options)
+    r->options = *options;
+  else
+    memset (&r->options, 0, sizeof (OwmForecastOptions));
+  r->options.flags &= ~OWM_FORECAST_ALLOW_STALE;
+
+  pthread_t thread;
+  pthread_attr_t attr;
+  pthread_attr_init (&attr);
+  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+  if (pthread_create (&thread, &attr, owm_forecast_refresh_thread, r) != 0)
     {
-    char *name = n->attributes[i].name;
-    if (strcmp (name, "value") == 0)
-      {
-      char *value= n->attributes[i].value;
-      sscanf (value, "%lf", &ret);
-      }
+    owm_cache_end_refresh (cache, "forecast", key, OWM_UNITS);
+    owm_context_destroy (r->context);
+    free (r->key);
+    free (r->location_id);
+    free (r->uri);
+    free (r);
     }
-  return ret;
+  pthread_attr_destroy (&attr);
   }
 
 
 /*============================================================================
- * owm_parse_rise_set
- * parse the <sun> element from the OWM response 
+ * owm_forecast_stream_progress
+ * Called as each part of the document arrives. Each complete <time> 
+ *   element since the last call is parsed on its own, by the same code 
+ *   that parses the whole document, so the points passed to the callback 
+ *   are the same as those in the finished forecast
  * =========================================================================*/
-static void owm_parse_rise_set (const XMLNode *n, time_t *rise, time_t *set)
+static void owm_forecast_stream_progress (const char *data, size_t len, 
+    void *user_data)
   {
-  int i, nattrs = n->n_attributes;
-  for (i = 0; i < nattrs; i++)
+  OwmForecastStream *stream = user_data;
+  const char *end = data + len;
+  while (stream->delivered < stream->limit)
     {
-    char *name = n->attributes[i].name;
-    if (strcmp (name, "rise") == 0)
+    const char *p = data + stream->scanned;
+    const char *start = owm_forecast_find_time (p, end);
+    if (!start)
+      {
+      // The last few characters might be the beginning of a <time>
+      size_t keep = len > 4 ? len - 4 : 0;
+      stream->scanned = (size_t)(p - data) > keep ? (size_t)(p - data) 
+        : keep;
+      break;
+      }
+    const char *close = start + 5 < end 
+      ? memmem (start, end - start, "</time>", 7) : NULL;
+    if (!close)
       {
-      char *value= n->attributes[i].value;
-      *rise = owm_parse_time_value (value);
+      stream->scanned = start - data;
+      break;
       }
-    else if (strcmp (name, "set") == 0)
+    close += 7;
+    stream->scanned = close - data;
+
+    OwmXmlScanner s;
+    OwmXmlTag t1;
+    owm_xml_init (&s, start, close - start);
+    if (owm_xml_next (&s, &t1) == OWM_XML_START)
       {
-      char *value= n->attributes[i].value;
-      *set = owm_parse_time_value (value);
+      OwmWeather point;
+      if (owm_forecast_parse_point (&s, &t1, stream->fields, &point) > 0)
+        {
+        stream->callback (&point, NULL, NULL, stream->user_data);
+        stream->delivered++;
+        }
       }
     }
   }
 
 
 /*============================================================================
- * owm_parse_symbol
- * parse the <precipitation> element from the OWM response 
+ * owm_forecast_cache_key
+ * A request for fewer points gets a shorter document, so it has its own
+ *   cache entries, with the number of points in the key
+ * =========================================================================*/
+const char *owm_forecast_cache_key (const char *location_id, 
+    const OwmForecastOptions *options, char *buff, size_t size)
+  {
+  if (!options || options->max_points <= 0) return location_id;
+  snprintf (buff, size, "%s/%d", location_id, options->max_points);
+  return buff;
+  }
+
+
+/*============================================================================
+ * owm_forecast_fetch
+ * Get the forecast for location_id, which is the key for the caches, from
+ *   uri. If a cache has been set with owm_forecast_set_cache(), it is 
+ *   consulted before the server, and updated after it. Similarly for a 
+ *   disk cache; an expired disk cache entry is refreshed with a 
+ *   conditional request, so that the server need not send the whole 
+ *   document again if it has not changed. 
+ * A request for fewer points has its own cache entries; see 
+ *   owm_forecast_cache_key(). If stream is not NULL, points are passed 
+ *   to its callback as they are received from the server
  * =========================================================================*/
-static OwmPrecipitation owm_parse_precipitation (const XMLNode *n)
+static OwmForecast *owm_forecast_fetch (OwmContext *context, 
+    const char *location_id, const char *s_uri, 
+    const OwmForecastOptions *options, OwmForecastStream *stream, 
+    char **error)
   {
-  OwmPrecipitation ret = OWM_PRECIP_NONE;
+  OwmForecast *ret = NULL;
+  int flags = options ? options->flags : 0;
+  int fields = options ? options->fields : 0;
+  int max_points = options ? options->max_points : 0;
+  char limited_key[128];
+  const char *key = owm_forecast_cache_key (location_id, options, 
+    limited_key, sizeof (limited_key));
+  OwmString *limited_uri = NULL;
+  if (max_points > 0)
+    {
+    limited_uri = owm_string_create_empty();
+    owm_string_append_printf (limited_uri, "%s" OWM_URI_COUNT, s_uri, 
+      max_points);
+    }
+  OwmCache *cache = owm_context_get_cache (context);
+  OwmDiskCache *disk_cache = owm_context_get_disk_cache (context);
+  OwmLocationFilter *filter = owm_context_get_location_filter (context);
+  time_t now = time (NULL);
 
-  int i, nattrs = n->n_attributes;
-  for (i = 0; i < nattrs; i++)
+  if (cache)
     {
-    char *name = n->attributes[i].name;
-    if (strcmp (name, "type") == 0)
+    BOOL stale = FALSE;
+    if (flags & OWM_FORECAST_ALLOW_STALE)
+      ret = owm_cache_lookup_stale (cache, "forecast", key, 
+        OWM_UNITS, &stale);
+    else
+      ret = owm_cache_lookup (cache, "forecast", key, OWM_UNITS);
+    // A full forecast will do for a summary-only request, but not the
+    //  other way round. Similarly for one parsed with fewer fields
+    if (ret && (((ret->flags & OWM_FORECAST_SUMMARY_ONLY) 
+        && !(flags & OWM_FORECAST_SUMMARY_ONLY))
+        || (ret->fields && (fields == 0 || (fields & ~ret->fields)))))
       {
-      char *value= n->attributes[i].value;
-      if (strcasecmp (value, "drizzle") == 0)
-        ret = OWM_PRECIP_DRIZZLE;
-      else if (strcasecmp (value, "rain") == 0)
-        ret = OWM_PRECIP_RAIN;
-      else if (strcasecmp (value, "sleet") == 0)
-        ret = OWM_PRECIP_SLEET;
-      else if (strcasecmp (value, "snow") == 0)
-        ret = OWM_PRECIP_SNOW;
-      else if (strcasecmp (value, "graupel") == 0)
-        ret = OWM_PRECIP_GRAUPEL;
-      else if (strcasecmp (value, "hail") == 0)
-        ret = OWM_PRECIP_HAIL;
-      else
-        ret = OWM_PRECIP_NONE;
+      owm_forecast_destroy (ret);
+      ret = NULL;
+      }
+    if (ret && stale)
+      owm_forecast_start_refresh (context, cache, key, location_id, s_uri, 
+        options);
+    if (ret) 
+      {
+      owm_string_destroy (limited_uri);
+      return ret;
       }
     }
-  return ret;
-  }
 
+  OwmDiskCacheEntry *entry = NULL;
+  if (disk_cache)
+    {
+    entry = owm_disk_cache_open (disk_cache, "forecast", key, 
+      OWM_UNITS);
+    time_t fetched = entry ? owm_disk_cache_entry_get_fetch_time (entry) : 0;
+    if (entry && owm_forecast_expiry (cache, fetched) > now)
+      {
+      char *disk_error = NULL;
+      ret = owm_forecast_parse_ex 
+        (owm_disk_cache_entry_get_data (entry, NULL), options, &disk_error);
+      if (ret)
+        {
+        owm_forecast_set_fetched (ret, context, fetched);
+        if (cache)
+          owm_cache_insert (cache, "forecast", key, OWM_UNITS, 
+            ret, fetched);
+        owm_disk_cache_entry_close (entry);
+        owm_string_destroy (limited_uri);
+        return ret;
+        }
+      // If we can't parse the cached copy, go to the server as if we
+      //  didn't have one
+      free (disk_error);
+      owm_disk_cache_entry_close (entry);
+      entry = NULL;
+      }
+    }
 
-/*============================================================================
- * owm_parse_conditions
- * parse the <symbol> element from the OWM response 
- * =========================================================================*/
-static int owm_parse_conditions (const XMLNode *n)
-  {
-  int ret = 0;
-  int i, nattrs = n->n_attributes;
-  for (i = 0; i < nattrs; i++)
+  char *result = NULL;
+  char *etag = NULL;
+  char *last_modified = NULL;
+  long http_code = 0;
+
+  owm_curl_fetch (context, limited_uri ? owm_string_cstr (limited_uri) 
+    : s_uri, 
+    entry ? owm_disk_cache_entry_get_etag (entry) : NULL,
+    entry ? owm_disk_cache_entry_get_last_modified (entry) : NULL,
+    stream ? owm_forecast_stream_progress : NULL, stream,
+    &result, &etag, &last_modified, &http_code, error);
+  if (*error == NULL)
     {
-    char *name = n->attributes[i].name;
-    if (strcmp (name, "number") == 0)
+    const char *data = result;
+    if (http_code == 304 && entry)
+      {
+      // Not modified, so use the copy we have. The server need not 
+      //  repeat the validators in a 304 response
+      data = owm_disk_cache_entry_get_data (entry, NULL);
+      if (!etag && owm_disk_cache_entry_get_etag (entry))
+        etag = strdup (owm_disk_cache_entry_get_etag (entry));
+      if (!last_modified && owm_disk_cache_entry_get_last_modified (entry))
+        last_modified = strdup 
+          (owm_disk_cache_entry_get_last_modified (entry));
+      }
+    ret = owm_forecast_parse_ex (data, options, error);
+    if (ret)
       {
-      char *value= n->attributes[i].value;
-      sscanf (value, "%d", &ret);
+      owm_forecast_set_fetched (ret, context, now);
+      if (disk_cache)
+        owm_disk_cache_store (disk_cache, "forecast", key, 
+          OWM_UNITS, data, strlen (data), now, etag, last_modified, NULL);
+      if (cache)
+        owm_cache_insert (cache, "forecast", key, OWM_UNITS, 
+          ret, now);
       }
     }
+  else if (http_code == 404)
+    {
+    // This is how OWM says that it does not know the location
+    if (filter)
+      owm_location_filter_reject (filter, location_id);
+    free (*error);
+    *error = strdup (OWM_ERROR_UNKNOWN_LOCATION);
+    }
+
+  free (result);
+  free (etag);
+  free (last_modified);
+  owm_disk_cache_entry_close (entry);
+  owm_string_destroy (limited_uri);
+
   return ret;
   }
 
+
 /*============================================================================
- * owm_forecast_create
- * Create a new, empty forecast object. 
+ * owm_forecast_mode
+ * The mode parameter for the request. Either document is parsed by
+ *   owm_forecast_parse_ex(), so the caches can hold both
  * =========================================================================*/
-static OwmForecast *owm_forecast_create (void)
+const char *owm_forecast_mode (const OwmForecastOptions *options)
   {
-  OwmForecast *self = malloc (sizeof (OwmForecast));
-  memset (self, 0, sizeof (OwmForecast));
-  return self;
+  return options && (options->flags & OWM_FORECAST_JSON) ? "json" : "xml";
   }
 
 
 /*============================================================================
- * owm_forecast_destroy
- * Cleans up memory reserved by the forecast object
+ * owm_forecast_get_stream
+ * Get the forecast for location_id, passing points to stream, if it is
+ *   not NULL, as they arrive
  * =========================================================================*/
-void owm_forecast_destroy (OwmForecast *self)
+static OwmForecast *owm_forecast_get_stream (OwmContext *context, 
+    const char *app_id, const char *location_id, 
+    const OwmForecastOptions *options, OwmForecastStream *stream, 
+    char **error)
   {
-  if (self)
+  OwmLocationFilter *filter = owm_context_get_location_filter (context);
+  if (filter && !owm_location_filter_check (filter, location_id))
     {
-    if (self->points)
-      {
-      owm_list_destroy (self->points);
-      }
-    free (self);
+    *error = strdup (OWM_ERROR_UNKNOWN_LOCATION);
+    return NULL;
     }
+
+  OwmString *uri = owm_string_create_empty();
+  owm_string_append_printf (uri, "%s" OWM_URI, 
+    owm_context_get_host (context), "forecast", location_id, 
+    owm_forecast_mode (options), app_id);
+  OwmForecast *ret = owm_forecast_fetch (context, location_id, 
+    owm_string_cstr (uri), options, stream, error);
+  owm_string_destroy (uri);
+  return ret;
   }
 
 
 /*============================================================================
- * owm_forecast_get_point
- * Get a specific OwmWeather entry from the forecast. Entries start
- * at zero, and continue to owm_forecast_get_points()-1 -- usually 39 
+ * owm_forecast_get_ex
+ * As owm_forecast_get(), but with options that control how the response
+ *   is handled. options may be NULL
  * =========================================================================*/
-const OwmWeather *owm_forecast_get_point (const OwmForecast *self, int n)
+OwmForecast *owm_forecast_get_ex (const char *app_id, 
+    const char *location_id, const OwmForecastOptions *options, 
+    char **error)
   {
-  return owm_list_get (self->points, n);
+  return owm_context_get_forecast (owm_context_get_default (), app_id, 
+    location_id, options, error);
   }
 
 
 /*============================================================================
- * owm_forecast_get_points
- * Get the number of forecast data points -- usually 40
+ * owm_context_get_forecast
  * =========================================================================*/
-int owm_forecast_get_points (const OwmForecast *self)
+OwmForecast *owm_context_get_forecast (OwmContext *self, const char *app_id,
+    const char *location_id, const OwmForecastOptions *options, 
+    char **error)
   {
-  if (self->points)
-    return owm_list_length (self->points);
-  else
-    return 0;
+  return owm_forecast_get_stream (self, app_id, location_id, options, NULL, 
+    error);
   }
 
+
 /*============================================================================
- * owm_forecast_parse 
- * Parse the XML data returned from the OWM API call
+ * owm_forecast_get_progressive
  * =========================================================================*/
-OwmForecast *owm_forecast_parse (const char *xml, char ** error)
+void owm_forecast_get_progressive (const char *app_id, 
+    const char *location_id, const OwmForecastOptions *options, 
+    OwmForecastProgressCallback callback, void *user_data)
   {
-  OwmForecast *ret = NULL;
+  owm_context_get_forecast_progressive (owm_context_get_default (), app_id, 
+    location_id, options, callback, user_data);
+  }
 
-  XMLDoc doc;
-  XMLDoc_init (&doc);
-  if (XMLDoc_parse_buffer_DOM (xml, "openweathermap", &doc))
-    {
-    ret = owm_forecast_create();
-    ret->points = owm_list_create ((OwmListItemFreeFn)owm_weather_destroy);
 
-    XMLNode *root = XMLDoc_root (&doc);
-    int i, l = root->n_children;
-    for (i = 0; i < l; i++)
-      {
-      XMLNode *r1 = root->children[i]; 
-      if (strcmp (r1->tag, "sun") == 0)
-        {
-        time_t rise, set;
-        owm_parse_rise_set (r1, &rise, &set);
-        owm_forecast_set_rise_set (ret, rise, set);
-        }
-      else if (strcmp (r1->tag, "forecast") == 0)
-        {
-        int i, l = r1->n_children;
-        for (i = 0; i < l; i++)
-          {
-          XMLNode *t1 = r1->children[i]; 
-          if (strcmp (t1->tag, "time") == 0)
-            {
-            time_t from, to;
-            owm_parse_times (t1, &from, &to);
-            double temp = 0;
-            double wind_direction = 0;
-            double wind_speed = 0;
-            double pressure = 0;
-            double humidity = 0;
-            double cloud_cover = 0;
-            OwmConditions conditions = -1;
-            OwmPrecipitation precipitation = -1;
-            int valid = 0;
-            int i, l = t1->n_children;
-            for (i = 0; i < l; i++)
-              {
-              XMLNode *f1 = t1->children[i]; 
-              if (strcmp (f1->tag, "temperature") == 0)
-                {
-                temp = owm_parse_temp (f1); 
-                valid |= OWM_VALID_TEMP;
-                }
-              else if (strcmp (f1->tag, "symbol") == 0)
-                {
-                conditions = owm_parse_conditions (f1); 
-                valid |= OWM_VALID_CONDITIONS;
-                }
-              else if (strcmp (f1->tag, "precipitation") == 0)
-                {
-                precipitation = owm_parse_precipitation (f1); 
-                valid |= OWM_VALID_PRECIPITATION;
-                }
-              else if (strcmp (f1->tag, "windDirection") == 0)
-                {
-                wind_direction = owm_parse_wind_direction (f1); 
-                valid |= OWM_VALID_WIND_DIRECTION;
-                }
-              else if (strcmp (f1->tag, "windSpeed") == 0)
-                {
-                wind_speed = owm_parse_wind_speed (f1); 
-                valid |= OWM_VALID_WIND_SPEED;
-                }
-              else if (strcmp (f1->tag, "pressure") == 0)
-                {
-                pressure = owm_parse_pressure (f1); 
-                valid |= OWM_VALID_PRESSURE;
-                }
-              else if (strcmp (f1->tag, "humidity") == 0)
-                {
-                humidity = owm_parse_humidity (f1); 
-                valid |= OWM_VALID_HUMIDITY;
-                }
-              else if (strcmp (f1->tag, "clouds") == 0)
-                {
-                cloud_cover = owm_parse_cloud_cover (f1); 
-                valid |= OWM_VALID_CLOUD_COVER;
-                }
-              
-              }
-            if (valid != 0)
-              {
-              OwmWeather *weather = owm_weather_create (); 
-              owm_weather_set_start_time (weather, from);
-              owm_weather_set_end_time (weather, to);
-              if (valid & OWM_VALID_TEMP)
-                owm_weather_set_temperature (weather, temp);
-              if (valid & OWM_VALID_CONDITIONS)
-                owm_weather_set_conditions (weather, conditions);
-              if (valid & OWM_VALID_PRECIPITATION)
-                owm_weather_set_precipitation (weather, precipitation);
-              if (valid & OWM_VALID_WIND_DIRECTION)
-                owm_weather_set_wind_direction (weather, wind_direction);
-              if (valid & OWM_VALID_WIND_SPEED)
-                owm_weather_set_wind_speed (weather, wind_speed);
-              if (valid & OWM_VALID_PRESSURE)
-                owm_weather_set_pressure (weather, pressure);
-              if (valid & OWM_VALID_HUMIDITY)
-                owm_weather_set_humidity (weather, humidity);
-              if (valid & OWM_VALID_CLOUD_COVER)
-                owm_weather_set_cloud_cover (weather, cloud_cover);
-
-              owm_list_append (ret->points, weather);
-              }
-            }
-          }
-        } 
-      }
-    XMLDoc_free (&doc);
-    }
-  else
+/*============================================================================
+ * owm_context_get_forecast_progressive
+ * Points that were not parsed as they arrived -- because the forecast
+ *   came from a cache, or was a JSON document -- are passed to the 
+ *   callback once the forecast is complete, so the callback always sees
+ *   every point, in order
+ * =========================================================================*/
+void owm_context_get_forecast_progressive (OwmContext *self, 
+    const char *app_id, const char *location_id, 
+    const OwmForecastOptions *options, 
+    OwmForecastProgressCallback callback, void *user_data)
+  {
+  OwmForecastStream stream;
+  memset (&stream, 0, sizeof (OwmForecastStream));
+  stream.callback = callback;
+  stream.user_data = user_data;
+  stream.fields = options && options->fields ? options->fields : ~0;
+  stream.limit = options && options->max_points > 0 ? options->max_points 
+    : INT_MAX;
+
+  char *error = NULL;
+  OwmForecast *forecast = owm_forecast_get_stream (self, app_id, 
+    location_id, options, &stream, &error);
+  if (forecast)
     {
-    asprintf (error, "Can't parse XML");
+    int i, n = owm_forecast_get_points (forecast);
+    for (i = stream.delivered; i < n; i++)
+      callback (owm_forecast_get_point (forecast, i), NULL, NULL, 
+        user_data);
     }
-  return ret;
+  callback (NULL, forecast, error, user_data);
+  owm_forecast_destroy (forecast);
+  free (error);
   }
 
 
 /*============================================================================
- * owm_forecast_set_rise_set
+ * owm_forecast_snap
+ * Snap a coordinate to the grid, and format it with as many decimal 
+ *   places as the grid needs: enough that the grid is a whole number of
+ *   units in the last place, so that a grid of 0.25 gets two, not one
  * =========================================================================*/
-void owm_forecast_set_rise_set (OwmForecast *self, time_t rise, time_t set)
+static void owm_forecast_snap (double value, double grid, char *buff, 
+    size_t size)
   {
-  self->sunrise = rise;
-  self->sunset = set;
+  int places = 0;
+  while (places < 6 && fabs (grid * pow (10, places) 
+      - round (grid * pow (10, places))) >= 1e-9)
+    places++;
+  double snapped = round (value / grid) * grid;
+  if (snapped == 0) snapped = 0; // Not -0
+  snprintf (buff, size, "%.*f", places, snapped);
   }
 
 
 /*============================================================================
- * owm_forecast_get_rise_set
+ * owm_forecast_get_by_coords
  * =========================================================================*/
-void owm_forecast_get_rise_set (OwmForecast *self, time_t *rise, time_t *set)
+OwmForecast *owm_forecast_get_by_coords (const char *app_id, double lat, 
+    double lon, const OwmForecastOptions *options, char **error)
   {
-  *rise = self->sunrise;
-  *set = self->sunset;
+  return owm_context_get_forecast_by_coords (owm_context_get_default (), 
+    app_id, lat, lon, options, error);
+  }
+
+
+/*============================================================================
+ * owm_context_get_forecast_by_coords
+ * The cache key for a grid cell is "lat,lon", which can't be mistaken 
+ *   for an OWM location ID
+ * =========================================================================*/
+OwmForecast *owm_context_get_forecast_by_coords (OwmContext *self, 
+    const char *app_id, double lat, double lon, 
+    const OwmForecastOptions *options, char **error)
+  {
+  if (!(lat >= -90 && lat <= 90 && lon >= -180 && lon <= 180))
+    {
+    asprintf (error, "Invalid coordinates %f,%f", lat, lon);
+    return NULL;
+    }
+  double grid = options && options->grid > 0 ? options->grid 
+    : OWM_FORECAST_DEFAULT_GRID;
+  // 180 and -180 are the same place, and must have the same key
+  if (round (lon / grid) * grid >= 180) lon -= 360;
+
+  char s_lat[32], s_lon[32], key[64];
+  owm_forecast_snap (lat, grid, s_lat, sizeof (s_lat));
+  owm_forecast_snap (lon, grid, s_lon, sizeof (s_lon));
+  snprintf (key, sizeof (key), "%s,%s", s_lat, s_lon);
+
+  OwmString *uri = owm_string_create_empty();
+  owm_string_append_printf (uri, "%s" OWM_URI_COORDS, 
+    owm_context_get_host (self), "forecast", s_lat, s_lon, 
+    owm_forecast_mode (options), app_id);
+  OwmForecast *ret = owm_forecast_fetch (self, key, owm_string_cstr (uri), 
+    options, NULL, error);
+  owm_string_destroy (uri);
+  return ret;
   }
 
 
@@ -514,26 +1256,41 @@ void owm_forecast_get_rise_set (OwmForecast *self, time_t *rise, time_t *set)
 OwmForecast *owm_forecast_get (const char *app_id, const char *location_id, 
     char **error)
   {
-  OwmForecast *ret = NULL;
+  return owm_forecast_get_ex (app_id, location_id, NULL, error);
+  }
 
-  OwmString *uri = owm_string_create_empty();
-  owm_string_append_printf (uri, OWM_HOST OWM_URI, "forecast", 
-    location_id, app_id);
 
-  const char *s_uri = owm_string_cstr (uri);
+/*============================================================================
+ * owm_forecast_get_daily_summaries
+ * Copy up to max_days of the forecast's daily summaries into the 
+ *   summaries array, earliest first. These were worked out when the 
+ *   forecast was parsed. Returns the number of entries filled in. 
+ * =========================================================================*/
+int owm_forecast_get_daily_summaries (const OwmForecast *self, 
+      OwmDailySummary *summaries, int max_days)
+  {
+  int days = self->n_days < max_days ? self->n_days : max_days;
+  if (days <= 0) return 0;
+  memcpy (summaries, self->days, (size_t)days * sizeof (OwmDailySummary));
+  return days;
+  }
 
-  char *result = NULL;
 
-  owm_curl_get (s_uri, &result, error);
-  if (*error == NULL)
+/*============================================================================
+ * owm_forecast_find_day
+ * Get the precomputed summary for the day in which t falls, or NULL if
+ *   the forecast does not cover that day
+ * =========================================================================*/
+static const OwmDailySummary *owm_forecast_find_day (const OwmForecast *self, 
+      time_t t)
+  {
+  time_t day = (time_t)owm_day_number (t) * OWM_SECONDS_PER_DAY;
+  int i;
+  for (i = 0; i < self->n_days; i++)
     {
-    ret = owm_forecast_parse (result, error);
-    free (result);
+    if (self->days[i].day == day) return &self->days[i];
     }
-
-  owm_string_destroy (uri);
-
-  return ret;
+  return NULL;
   }
 
 
@@ -551,89 +1308,21 @@ void owm_forecast_get_daily_summary (const OwmForecast *forecast, time_t t,
       double *min_temp, double *max_temp, OwmConditions *modal_conditions, 
       double *wind_direction, double *wind_speed, char **error)
   {
-  *min_temp = 1000;
-  *max_temp = -1000;
-  BOOL got_cond = FALSE;
-  BOOL got_temp = FALSE;
-  int conds[OWM_MAX_CONDS];
-  memset (conds, 0, sizeof (conds));
-  struct tm tm;
-  memcpy (&tm, gmtime (&t), sizeof (tm));
-  int i, n = owm_forecast_get_points (forecast);
-  int wind_dir_points = 0;
-  int wind_speed_points = 0;
-  double total_wind_speed = 0;
-  double total_sin_wind_dir = 0;
-  double total_cos_wind_dir = 0;
-  for (i = 0; i < n; i++)
-    {
-    const OwmWeather *w = owm_forecast_get_point (forecast, i);
-    time_t t1 = owm_weather_get_start_time (w);
-    struct tm t1_tm;
-    memcpy (&t1_tm, gmtime (&t1), sizeof (t1_tm));
-    if (tm.tm_mday == t1_tm.tm_mday && 
-      tm.tm_mon == t1_tm.tm_mon && 
-      tm.tm_year == t1_tm.tm_year)
-      {
-      if (owm_weather_get_valid (w) & OWM_VALID_CONDITIONS)
-        {
-        OwmConditions cond = owm_weather_get_conditions (w);
-        got_cond = TRUE;
-        if (cond > 0 && cond < OWM_MAX_CONDS)
-          {
-          conds [cond]++;
-          }
-        }
-      if (owm_weather_get_valid (w) & OWM_VALID_TEMP)
-        {
-        double temp = owm_weather_get_temperature (w);
-        if (temp > *max_temp) *max_temp = temp;
-        if (temp < *min_temp) *min_temp = temp;
-        got_temp = TRUE;
-        }
-      if (owm_weather_get_valid (w) & OWM_VALID_WIND_SPEED)
-        {
-        double wind_speed = owm_weather_get_wind_speed (w);
-        total_wind_speed += wind_speed;
-        wind_speed_points++;
-        }
-      if (owm_weather_get_valid (w) & OWM_VALID_WIND_DIRECTION)
-        {
-        double wind_dir = owm_weather_get_wind_direction (w);
-        total_cos_wind_dir += cos (wind_dir / 360.0 * 2.0 * M_PI);
-        total_sin_wind_dir += sin (wind_dir / 360.0 * 2.0 * M_PI);
-        wind_dir_points++;
-        }
-      }
-    }
-  if (!got_temp || !got_cond || wind_speed_points == 0 || wind_dir_points == 0)
+  const OwmDailySummary *summary = owm_forecast_find_day (forecast, t);
+  if (!summary 
+      || (summary->valid & OWM_SUMMARY_FIELDS) != OWM_SUMMARY_FIELDS)
     {
+    *min_temp = summary ? summary->min_temp : 1000;
+    *max_temp = summary ? summary->max_temp : -1000;
     *error = strdup ("Insufficient data for daily summary");
     }
   else
     {
-    int cond_max = 0;
-    int cond_num = 0;
-    for (i = 0; i < OWM_MAX_CONDS; i++)
-      {
-      int c = conds[i];
-      if (c > cond_max) 
-         {
-         cond_max = c;
-         cond_num = i;
-         } 
-      }
-    *modal_conditions = cond_num;
-    *wind_speed = total_wind_speed / (double) wind_speed_points;
-    // Avoid a div by zero here -- wind directions can, in theory cancel out
-    if (total_cos_wind_dir == 0.0)
-      *wind_direction = 0.0;
-    else
-      *wind_direction = atan2 (total_sin_wind_dir, total_cos_wind_dir) 
-        * 360.0 / 2.0 / M_PI;
-    if (*wind_direction < 0) *wind_direction += 360.0;
+    *min_temp = summary->min_temp;
+    *max_temp = summary->max_temp;
+    *modal_conditions = summary->modal_conditions;
+    *wind_speed = summary->wind_speed;
+    *wind_direction = summary->wind_direction;
     }
-
   }
 
-
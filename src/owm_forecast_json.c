@@ -0,0 +1,420 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_forecast_json.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * Parser for OWM's JSON forecast documents, which produces the same
+ *   OwmForecast as the XML parser in owm_forecast.c. The document is read
+ *   in one pass with the scanner in owm_json.c, and nothing is allocated
+ *   but the forecast itself. A point in the JSON is one object in the
+ *   "list" array, like this (some members omitted):
+ *
+ *   {"dt":1519894800,"main":{"temp":266.89,"pressure":994.72,"humidity":88},
+ *    "weather":[{"id":800}],"clouds":{"all":57},
+ *    "wind":{"speed":9.63,"deg":204.9},"rain":{"3h":0.1}}
+ *
+ *   Unlike the XML, this gives only the start of each period, not its end.
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <time.h>
+#include <owm/owm_defs.h>
+#include <owm/owm_weather.h>
+#include <owm/owm_forecast.h>
+#include "owm_private.h"
+#include "owm_parse.h"
+#include "owm_json.h"
+
+// The length of the period that each point describes
+#define OWM_FORECAST_JSON_PERIOD (3 * 3600)
+
+/*============================================================================
+ * OwmForecastJsonPoint
+ * The values read for one point, which are only applied to an OwmWeather
+ *   when the point is complete, in the same order as the XML parser
+ *   applies them
+ * =========================================================================*/
+typedef struct _OwmForecastJsonPoint
+  {
+  int valid;
+  time_t from;
+  double temp;
+  double wind_direction;
+  double wind_speed;
+  double pressure;
+  double humidity;
+  double cloud_cover;
+  OwmConditions conditions;
+  OwmPrecipitation precipitation;
+  } OwmForecastJsonPoint;
+
+
+/*============================================================================
+ * owm_forecast_json_main
+ * Read the "main" object, whose opening brace has been read
+ * =========================================================================*/
+static BOOL owm_forecast_json_main (OwmJsonScanner *s, int fields,
+      OwmForecastJsonPoint *p)
+  {
+  OwmJsonToken key, value;
+  while (owm_json_next (s, &key) != OWM_JSON_END_OBJECT)
+    {
+    if (key.type != OWM_JSON_STRING) return FALSE;
+    owm_json_next (s, &value);
+    if (value.type == OWM_JSON_NUMBER && (fields & OWM_VALID_TEMP)
+        && owm_json_equals (&key, "temp"))
+      {
+      p->temp = owm_json_get_number (&value) - OWM_PARSE_KELVIN;
+      p->valid |= OWM_VALID_TEMP;
+      }
+    else if (value.type == OWM_JSON_NUMBER && (fields & OWM_VALID_PRESSURE)
+        && owm_json_equals (&key, "pressure"))
+      {
+      p->pressure = owm_json_get_number (&value);
+      p->valid |= OWM_VALID_PRESSURE;
+      }
+    else if (value.type == OWM_JSON_NUMBER && (fields & OWM_VALID_HUMIDITY)
+        && owm_json_equals (&key, "humidity"))
+      {
+      p->humidity = owm_json_get_number (&value);
+      p->valid |= OWM_VALID_HUMIDITY;
+      }
+    else if (!owm_json_skip (s, &value))
+      return FALSE;
+    }
+  return TRUE;
+  }
+
+
+/*============================================================================
+ * owm_forecast_json_wind
+ * Read the "wind" object, whose opening brace has been read
+ * =========================================================================*/
+static BOOL owm_forecast_json_wind (OwmJsonScanner *s, int fields,
+      OwmForecastJsonPoint *p)
+  {
+  OwmJsonToken key, value;
+  while (owm_json_next (s, &key) != OWM_JSON_END_OBJECT)
+    {
+    if (key.type != OWM_JSON_STRING) return FALSE;
+    owm_json_next (s, &value);
+    if (value.type == OWM_JSON_NUMBER && (fields & OWM_VALID_WIND_SPEED)
+        && owm_json_equals (&key, "speed"))
+      {
+      p->wind_speed = owm_json_get_number (&value) * OWM_PARSE_MPS_TO_MPH;
+      p->valid |= OWM_VALID_WIND_SPEED;
+      }
+    else if (value.type == OWM_JSON_NUMBER
+        && (fields & OWM_VALID_WIND_DIRECTION)
+        && owm_json_equals (&key, "deg"))
+      {
+      p->wind_direction = owm_json_get_number (&value);
+      p->valid |= OWM_VALID_WIND_DIRECTION;
+      }
+    else if (!owm_json_skip (s, &value))
+      return FALSE;
+    }
+  return TRUE;
+  }
+
+
+/*============================================================================
+ * owm_forecast_json_number
+ * Read an object, whose opening brace has been read, and get the value of
+ *   its member name, if it has one and it is a number
+ * =========================================================================*/
+static BOOL owm_forecast_json_number (OwmJsonScanner *s, const char *name,
+      double *number, BOOL *found)
+  {
+  OwmJsonToken key, value;
+  while (owm_json_next (s, &key) != OWM_JSON_END_OBJECT)
+    {
+    if (key.type != OWM_JSON_STRING) return FALSE;
+    owm_json_next (s, &value);
+    if (value.type == OWM_JSON_NUMBER && owm_json_equals (&key, name))
+      {
+      *number = owm_json_get_number (&value);
+      *found = TRUE;
+      }
+    else if (!owm_json_skip (s, &value))
+      return FALSE;
+    }
+  return TRUE;
+  }
+
+
+/*============================================================================
+ * owm_forecast_json_weather
+ * Read the "weather" array, whose opening bracket has been read. The
+ *   conditions are the ID of its first element
+ * =========================================================================*/
+static BOOL owm_forecast_json_weather (OwmJsonScanner *s,
+      OwmForecastJsonPoint *p)
+  {
+  OwmJsonToken t;
+  OwmJsonType type;
+  while ((type = owm_json_next (s, &t)) != OWM_JSON_END_ARRAY)
+    {
+    if (type == OWM_JSON_BEGIN_OBJECT && !(p->valid & OWM_VALID_CONDITIONS))
+      {
+      double id = 0;
+      BOOL found = FALSE;
+      if (!owm_forecast_json_number (s, "id", &id, &found)) return FALSE;
+      if (found)
+        {
+        p->conditions = (OwmConditions)id;
+        p->valid |= OWM_VALID_CONDITIONS;
+        }
+      }
+    else if (!owm_json_skip (s, &t))
+      return FALSE;
+    }
+  return TRUE;
+  }
+
+
+/*============================================================================
+ * owm_forecast_json_point
+ * Read one element of the "list" array, whose opening brace has been read
+ * =========================================================================*/
+static BOOL owm_forecast_json_point (OwmJsonScanner *s, int fields,
+      OwmForecastJsonPoint *p)
+  {
+  memset (p, 0, sizeof (OwmForecastJsonPoint));
+  p->conditions = -1;
+  p->precipitation = -1;
+  BOOL has_time = FALSE;
+
+  OwmJsonToken key, value;
+  while (owm_json_next (s, &key) != OWM_JSON_END_OBJECT)
+    {
+    if (key.type != OWM_JSON_STRING) return FALSE;
+    OwmJsonType type = owm_json_next (s, &value);
+    BOOL ok = TRUE;
+    if (type == OWM_JSON_NUMBER && owm_json_equals (&key, "dt"))
+      {
+      p->from = (time_t)owm_json_get_number (&value);
+      has_time = TRUE;
+      }
+    else if (type == OWM_JSON_BEGIN_OBJECT && owm_json_equals (&key, "main"))
+      ok = owm_forecast_json_main (s, fields, p);
+    else if (type == OWM_JSON_BEGIN_OBJECT && owm_json_equals (&key, "wind"))
+      ok = owm_forecast_json_wind (s, fields, p);
+    else if (type == OWM_JSON_BEGIN_ARRAY && (fields & OWM_VALID_CONDITIONS)
+        && owm_json_equals (&key, "weather"))
+      ok = owm_forecast_json_weather (s, p);
+    else if (type == OWM_JSON_BEGIN_OBJECT
+        && (fields & OWM_VALID_CLOUD_COVER)
+        && owm_json_equals (&key, "clouds"))
+      {
+      BOOL found = FALSE;
+      ok = owm_forecast_json_number (s, "all", &p->cloud_cover, &found);
+      if (found) p->valid |= OWM_VALID_CLOUD_COVER;
+      }
+    else if ((fields & OWM_VALID_PRECIPITATION)
+        && (owm_json_equals (&key, "rain") || owm_json_equals (&key, "snow")))
+      {
+      // The XML always has a <precipitation> element, but the JSON
+      //  has only "rain" or "snow", if there is any
+      p->precipitation = owm_json_equals (&key, "rain")
+        ? OWM_PRECIP_RAIN : OWM_PRECIP_SNOW;
+      ok = owm_json_skip (s, &value);
+      }
+    else
+      ok = owm_json_skip (s, &value);
+    if (!ok) return FALSE;
+    }
+
+  if (fields & OWM_VALID_PRECIPITATION)
+    {
+    if (p->precipitation == -1) p->precipitation = OWM_PRECIP_NONE;
+    p->valid |= OWM_VALID_PRECIPITATION;
+    }
+  // A point without a time is no use, so drop it as the XML parser drops
+  //  a <time> without data
+  if (!has_time) p->valid = 0;
+  return TRUE;
+  }
+
+
+/*============================================================================
+ * owm_forecast_json_count
+ * Count the elements of the array whose opening bracket has just been
+ *   read, without disturbing the scanner, so that the forecast can be
+ *   allocated before the points are read. Returns -1 on error
+ * =========================================================================*/
+static int owm_forecast_json_count (const OwmJsonScanner *s)
+  {
+  OwmJsonScanner ahead = *s;
+  OwmJsonToken t;
+  int n = 0;
+  for (;;)
+    {
+    OwmJsonType type = owm_json_next (&ahead, &t);
+    if (type == OWM_JSON_END_ARRAY) return n;
+    if (!owm_json_skip (&ahead, &t)) return -1;
+    n++;
+    }
+  }
+
+
+/*============================================================================
+ * owm_forecast_json_city
+ * Read the "city" object, whose opening brace has been read, for the
+ *   times of sunrise and sunset
+ * =========================================================================*/
+static BOOL owm_forecast_json_city (OwmJsonScanner *s, time_t *rise,
+      time_t *set)
+  {
+  OwmJsonToken key, value;
+  while (owm_json_next (s, &key) != OWM_JSON_END_OBJECT)
+    {
+    if (key.type != OWM_JSON_STRING) return FALSE;
+    owm_json_next (s, &value);
+    if (value.type == OWM_JSON_NUMBER && owm_json_equals (&key, "sunrise"))
+      *rise = (time_t)owm_json_get_number (&value);
+    else if (value.type == OWM_JSON_NUMBER
+        && owm_json_equals (&key, "sunset"))
+      *set = (time_t)owm_json_get_number (&value);
+    else if (!owm_json_skip (s, &value))
+      return FALSE;
+    }
+  return TRUE;
+  }
+
+
+/*============================================================================
+ * owm_forecast_json_list
+ * Read the "list" array, whose opening bracket has been read, into a new
+ *   forecast. Returns NULL on error
+ * =========================================================================*/
+static OwmForecast *owm_forecast_json_list (OwmJsonScanner *s,
+      const OwmForecastOptions *options)
+  {
+  int flags = options ? options->flags : 0;
+  int fields = options && options->fields ? options->fields : ~0;
+  int limit = options && options->max_points > 0 ? options->max_points
+    : INT_MAX;
+
+  int max_points = owm_forecast_json_count (s);
+  if (max_points < 0) return NULL;
+  if (max_points > limit) max_points = limit;
+
+  OwmForecast *ret;
+  if (flags & OWM_FORECAST_SUMMARY_ONLY)
+    ret = owm_forecast_create (0, max_points);
+  else
+    ret = owm_forecast_create (max_points, max_points);
+  ret->flags = flags;
+  ret->fields = options ? options->fields : 0;
+
+  int n_points = 0;
+  OwmDayAccumulator acc;
+  owm_forecast_begin_points (ret, &acc);
+
+  OwmJsonToken t;
+  OwmJsonType type;
+  while ((type = owm_json_next (s, &t)) != OWM_JSON_END_ARRAY)
+    {
+    if (type == OWM_JSON_BEGIN_OBJECT && n_points < limit)
+      {
+      OwmForecastJsonPoint p;
+      if (!owm_forecast_json_point (s, fields, &p))
+        {
+        owm_forecast_destroy (ret);
+        return NULL;
+        }
+      if (p.valid != 0)
+        {
+        OwmWeather point;
+        OwmWeather *weather = &point;
+        owm_weather_init (weather);
+        owm_weather_set_start_time (weather, p.from);
+        owm_weather_set_end_time (weather, p.from + OWM_FORECAST_JSON_PERIOD);
+        if (p.valid & OWM_VALID_TEMP)
+          owm_weather_set_temperature (weather, p.temp);
+        if (p.valid & OWM_VALID_CONDITIONS)
+          owm_weather_set_conditions (weather, p.conditions);
+        if (p.valid & OWM_VALID_PRECIPITATION)
+          owm_weather_set_precipitation (weather, p.precipitation);
+        if (p.valid & OWM_VALID_WIND_DIRECTION)
+          owm_weather_set_wind_direction (weather, p.wind_direction);
+        if (p.valid & OWM_VALID_WIND_SPEED)
+          owm_weather_set_wind_speed (weather, p.wind_speed);
+        if (p.valid & OWM_VALID_PRESSURE)
+          owm_weather_set_pressure (weather, p.pressure);
+        if (p.valid & OWM_VALID_HUMIDITY)
+          owm_weather_set_humidity (weather, p.humidity);
+        if (p.valid & OWM_VALID_CLOUD_COVER)
+          owm_weather_set_cloud_cover (weather, p.cloud_cover);
+
+        owm_forecast_add_point (ret, &acc, weather);
+        n_points++;
+        }
+      }
+    else if (!owm_json_skip (s, &t))
+      {
+      owm_forecast_destroy (ret);
+      return NULL;
+      }
+    }
+
+  owm_forecast_end_points (ret, &acc);
+  return ret;
+  }
+
+
+/*============================================================================
+ * owm_forecast_parse_json
+ * The sunrise and sunset are in the "city" object, which might come
+ *   before or after the list of points
+ * =========================================================================*/
+OwmForecast *owm_forecast_parse_json (const char *json, size_t len,
+      const OwmForecastOptions *options, char **error)
+  {
+  OwmForecast *ret = NULL;
+  time_t rise = 0, set = 0;
+  BOOL ok = TRUE;
+
+  OwmJsonScanner s;
+  OwmJsonToken key, value;
+  owm_json_init (&s, json, len);
+  if (owm_json_next (&s, &key) != OWM_JSON_BEGIN_OBJECT) ok = FALSE;
+  while (ok && owm_json_next (&s, &key) != OWM_JSON_END_OBJECT)
+    {
+    if (key.type != OWM_JSON_STRING)
+      {
+      ok = FALSE;
+      break;
+      }
+    OwmJsonType type = owm_json_next (&s, &value);
+    if (type == OWM_JSON_BEGIN_ARRAY && !ret
+        && owm_json_equals (&key, "list"))
+      {
+      ret = owm_forecast_json_list (&s, options);
+      ok = ret != NULL;
+      }
+    else if (type == OWM_JSON_BEGIN_OBJECT && owm_json_equals (&key, "city"))
+      ok = owm_forecast_json_city (&s, &rise, &set);
+    else
+      ok = owm_json_skip (&s, &value);
+    }
+
+  if (ok && ret)
+    {
+    owm_forecast_set_rise_set (ret, rise, set);
+    if (ret->flags & OWM_FORECAST_SUMMARY_ONLY)
+      ret = owm_forecast_shrink (ret);
+    }
+  else
+    {
+    owm_forecast_destroy (ret);
+    ret = NULL;
+    asprintf (error, "Can't parse JSON");
+    }
+  return ret;
+  }
+
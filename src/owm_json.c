@@ -0,0 +1,320 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_json.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * =========================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <owm/owm_defs.h>
+#include "owm_json.h"
+
+/* Powers of ten that are exact as doubles */
+static const double owm_json_pow10[] =
+  {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+
+
+/*============================================================================
+ * owm_json_init
+ * =========================================================================*/
+void owm_json_init (OwmJsonScanner *self, const char *data, size_t len)
+  {
+  self->p = data;
+  self->end = data + len;
+  self->depth = 0;
+  }
+
+
+/*============================================================================
+ * owm_json_match
+ * Check for a literal, and make a token of it
+ * =========================================================================*/
+static OwmJsonType owm_json_match (OwmJsonScanner *self, OwmJsonToken *token,
+      const char *literal, OwmJsonType type)
+  {
+  size_t len = strlen (literal);
+  if ((size_t)(self->end - self->p) < len
+      || memcmp (self->p, literal, len) != 0)
+    return token->type = OWM_JSON_ERROR;
+  token->len = len;
+  self->p += len;
+  return token->type = type;
+  }
+
+
+/*============================================================================
+ * owm_json_next
+ * =========================================================================*/
+OwmJsonType owm_json_next (OwmJsonScanner *self, OwmJsonToken *token)
+  {
+  const char *p = self->p;
+  const char *end = self->end;
+  while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t'
+      || *p == ',' || *p == ':'))
+    p++;
+  self->p = p;
+  token->start = p;
+  token->len = 1;
+  token->escaped = FALSE;
+  if (p >= end) return token->type = OWM_JSON_END;
+
+  switch (*p)
+    {
+    case '{':
+      self->p++;
+      self->depth++;
+      return token->type = OWM_JSON_BEGIN_OBJECT;
+    case '}':
+      self->p++;
+      self->depth--;
+      return token->type = OWM_JSON_END_OBJECT;
+    case '[':
+      self->p++;
+      self->depth++;
+      return token->type = OWM_JSON_BEGIN_ARRAY;
+    case ']':
+      self->p++;
+      self->depth--;
+      return token->type = OWM_JSON_END_ARRAY;
+    case '"':
+      {
+      // Find the closing quote, which is one not preceded by an odd
+      //  number of backslashes
+      const char *s = p + 1;
+      const char *q = s;
+      for (;;)
+        {
+        q = memchr (q, '"', end - q);
+        if (!q) return token->type = OWM_JSON_ERROR;
+        const char *b = q;
+        while (b > s && b[-1] == '\\') b--;
+        if ((q - b) % 2 == 0) break;
+        q++;
+        }
+      token->start = s;
+      token->len = q - s;
+      token->escaped = memchr (s, '\\', q - s) != NULL;
+      self->p = q + 1;
+      return token->type = OWM_JSON_STRING;
+      }
+    case 't':
+      return owm_json_match (self, token, "true", OWM_JSON_TRUE);
+    case 'f':
+      return owm_json_match (self, token, "false", OWM_JSON_FALSE);
+    case 'n':
+      return owm_json_match (self, token, "null", OWM_JSON_NULL);
+    default:
+      if (*p == '-' || (*p >= '0' && *p <= '9'))
+        {
+        const char *q = p + 1;
+        while (q < end && ((*q >= '0' && *q <= '9') || *q == '.'
+            || *q == 'e' || *q == 'E' || *q == '+' || *q == '-'))
+          q++;
+        token->len = q - p;
+        self->p = q;
+        return token->type = OWM_JSON_NUMBER;
+        }
+    }
+  return token->type = OWM_JSON_ERROR;
+  }
+
+
+/*============================================================================
+ * owm_json_skip
+ * =========================================================================*/
+BOOL owm_json_skip (OwmJsonScanner *self, const OwmJsonToken *token)
+  {
+  if (token->type == OWM_JSON_ERROR || token->type == OWM_JSON_END)
+    return FALSE;
+  if (token->type != OWM_JSON_BEGIN_OBJECT
+      && token->type != OWM_JSON_BEGIN_ARRAY)
+    return TRUE;
+  int depth = self->depth - 1;
+  OwmJsonToken t;
+  while (self->depth > depth)
+    {
+    OwmJsonType type = owm_json_next (self, &t);
+    if (type == OWM_JSON_ERROR || type == OWM_JSON_END) return FALSE;
+    }
+  return TRUE;
+  }
+
+
+/*============================================================================
+ * owm_json_equals
+ * =========================================================================*/
+BOOL owm_json_equals (const OwmJsonToken *token, const char *s)
+  {
+  return token->type == OWM_JSON_STRING && !token->escaped
+    && strlen (s) == token->len && memcmp (token->start, s, token->len) == 0;
+  }
+
+
+/*============================================================================
+ * owm_json_hex
+ * =========================================================================*/
+static int owm_json_hex (const char *p, const char *end)
+  {
+  int v = 0, i;
+  if (end - p < 4) return -1;
+  for (i = 0; i < 4; i++)
+    {
+    char c = p[i];
+    v <<= 4;
+    if (c >= '0' && c <= '9') v |= c - '0';
+    else if (c >= 'a' && c <= 'f') v |= c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F') v |= c - 'A' + 10;
+    else return -1;
+    }
+  return v;
+  }
+
+
+/*============================================================================
+ * owm_json_get_string
+ * =========================================================================*/
+size_t owm_json_get_string (const OwmJsonToken *token, char *buff,
+      size_t size)
+  {
+  if (size == 0) return 0;
+  size_t n = 0;
+  if (!token->escaped)
+    {
+    n = token->len < size - 1 ? token->len : size - 1;
+    memcpy (buff, token->start, n);
+    buff[n] = 0;
+    return n;
+    }
+
+  const char *p = token->start;
+  const char *end = p + token->len;
+  while (p < end)
+    {
+    char out[4];
+    int out_len = 1;
+    if (*p != '\\')
+      out[0] = *p++;
+    else
+      {
+      p++;
+      char c = p < end ? *p++ : 0;
+      switch (c)
+        {
+        case 'b': out[0] = '\b'; break;
+        case 'f': out[0] = '\f'; break;
+        case 'n': out[0] = '\n'; break;
+        case 'r': out[0] = '\r'; break;
+        case 't': out[0] = '\t'; break;
+        case 'u':
+          {
+          int cp = owm_json_hex (p, end);
+          if (cp < 0)
+            {
+            out[0] = '?';
+            break;
+            }
+          p += 4;
+          // A surrogate pair makes one code point
+          if (cp >= 0xD800 && cp < 0xDC00 && end - p >= 6
+              && p[0] == '\\' && p[1] == 'u')
+            {
+            int lo = owm_json_hex (p + 2, end);
+            if (lo >= 0xDC00 && lo < 0xE000)
+              {
+              cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+              p += 6;
+              }
+            }
+          if (cp < 0x80)
+            out[0] = cp;
+          else if (cp < 0x800)
+            {
+            out[0] = 0xC0 | (cp >> 6);
+            out[1] = 0x80 | (cp & 0x3F);
+            out_len = 2;
+            }
+          else if (cp < 0x10000)
+            {
+            out[0] = 0xE0 | (cp >> 12);
+            out[1] = 0x80 | ((cp >> 6) & 0x3F);
+            out[2] = 0x80 | (cp & 0x3F);
+            out_len = 3;
+            }
+          else
+            {
+            out[0] = 0xF0 | (cp >> 18);
+            out[1] = 0x80 | ((cp >> 12) & 0x3F);
+            out[2] = 0x80 | ((cp >> 6) & 0x3F);
+            out[3] = 0x80 | (cp & 0x3F);
+            out_len = 4;
+            }
+          break;
+          }
+        default:
+          // \" \\ \/ and anything unexpected stand for themselves
+          out[0] = c;
+        }
+      }
+    if (n + out_len > size - 1) break;
+    memcpy (buff + n, out, out_len);
+    n += out_len;
+    }
+  buff[n] = 0;
+  return n;
+  }
+
+
+/*============================================================================
+ * owm_json_get_number
+ * Numbers with no exponent and up to 15 significant digits -- which is
+ *   nearly all the numbers OWM sends -- are converted directly, and
+ *   exactly. Anything else goes to strtod()
+ * =========================================================================*/
+double owm_json_get_number (const OwmJsonToken *token)
+  {
+  if (token->type != OWM_JSON_NUMBER) return 0;
+  const char *p = token->start;
+  const char *end = p + token->len;
+  BOOL negative = FALSE;
+  if (p < end && *p == '-')
+    {
+    negative = TRUE;
+    p++;
+    }
+  uint64_t mantissa = 0;
+  int digits = 0, frac_digits = 0;
+  BOOL point = FALSE, simple = TRUE;
+  for (; p < end; p++)
+    {
+    if (*p >= '0' && *p <= '9')
+      {
+      if (digits > 0 || *p != '0') digits++;
+      mantissa = mantissa * 10 + (*p - '0');
+      if (point) frac_digits++;
+      }
+    else if (*p == '.' && !point)
+      point = TRUE;
+    else
+      {
+      simple = FALSE;
+      break;
+      }
+    }
+  if (simple && digits <= 15 && frac_digits <= 22)
+    {
+    double v = (double)mantissa / owm_json_pow10[frac_digits];
+    return negative ? -v : v;
+    }
+
+  char buff[64];
+  size_t len = token->len < sizeof (buff) - 1 ? token->len : sizeof (buff) - 1;
+  memcpy (buff, token->start, len);
+  buff[len] = 0;
+  return strtod (buff, NULL);
+  }
+
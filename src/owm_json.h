@@ -0,0 +1,66 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_json.h
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * A small streaming JSON scanner, for the library's own use. It breaks
+ *   a buffer into tokens without allocating anything, leaving it to the
+ *   caller, which knows what structure to expect, to make sense of them.
+ *   Strings are returned as pointers into the buffer, and are unescaped
+ *   only on request. Colons and commas are skipped.
+ * =========================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <owm/owm_defs.h>
+
+typedef enum _OwmJsonType
+  {
+  OWM_JSON_END = 0,    // End of the buffer
+  OWM_JSON_ERROR,
+  OWM_JSON_BEGIN_OBJECT,
+  OWM_JSON_END_OBJECT,
+  OWM_JSON_BEGIN_ARRAY,
+  OWM_JSON_END_ARRAY,
+  OWM_JSON_STRING,
+  OWM_JSON_NUMBER,
+  OWM_JSON_TRUE,
+  OWM_JSON_FALSE,
+  OWM_JSON_NULL
+  } OwmJsonType;
+
+typedef struct _OwmJsonScanner
+  {
+  const char *p;
+  const char *end;
+  int depth;
+  } OwmJsonScanner;
+
+typedef struct _OwmJsonToken
+  {
+  OwmJsonType type;
+  const char *start; // For strings, excludes the quotes
+  size_t len;
+  BOOL escaped;      // The string contains escapes
+  } OwmJsonToken;
+
+void        owm_json_init (OwmJsonScanner *self, const char *data, size_t len);
+
+/** Get the next token */
+OwmJsonType owm_json_next (OwmJsonScanner *self, OwmJsonToken *token);
+
+/** Skip the value that starts with token -- if it begins an object or
+ array, everything up to the end of it. Returns FALSE on error */
+BOOL        owm_json_skip (OwmJsonScanner *self, const OwmJsonToken *token);
+
+/** Compare a string token with a (plain ASCII) key */
+BOOL        owm_json_equals (const OwmJsonToken *token, const char *s);
+
+/** Unescape a string token into buff, as UTF-8, truncating it if need be
+ to fit in size bytes, including the terminator. Returns the length */
+size_t      owm_json_get_string (const OwmJsonToken *token, char *buff,
+               size_t size);
+
+/** Get the value of a number token. Other tokens give zero */
+double      owm_json_get_number (const OwmJsonToken *token);
+
@@ -0,0 +1,171 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_location_filter.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * Each block of the Bloom filter is eight 64-bit words, and an ID sets
+ *   one bit in each word of its block. The rejected IDs are kept in a
+ *   direct-mapped table, each slot holding an ID and its expiry time in
+ *   one 64-bit word, so that it can be read and written atomically.
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <owm/owm_defs.h>
+#include <owm/owm_city_list.h>
+#include <owm/owm_location_filter.h>
+
+#define OWM_LOCATION_FILTER_WORDS 8 // Per block
+#define OWM_LOCATION_FILTER_REJECTS 4096
+
+struct _OwmLocationFilter
+  {
+  uint32_t n_blocks;
+  uint64_t *blocks;
+  uint64_t rejects[OWM_LOCATION_FILTER_REJECTS];
+  };
+
+
+/*============================================================================
+ * owm_location_filter_mix
+ * The splitmix64 finalizer
+ * =========================================================================*/
+static uint64_t owm_location_filter_mix (uint64_t x)
+  {
+  x += 0x9e3779b97f4a7c15ull;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+  }
+
+
+/*============================================================================
+ * owm_location_filter_parse_id
+ * OWM location IDs are decimal numbers
+ * =========================================================================*/
+static BOOL owm_location_filter_parse_id (const char *s, uint32_t *id)
+  {
+  uint64_t v = 0;
+  int n = 0;
+  for (; *s; s++, n++)
+    {
+    if (*s < '0' || *s > '9' || n >= 10) return FALSE;
+    v = v * 10 + (*s - '0');
+    }
+  if (n == 0 || v > UINT32_MAX) return FALSE;
+  *id = v;
+  return TRUE;
+  }
+
+
+/*============================================================================
+ * owm_location_filter_block
+ * Get the block for an ID, and the bits to set in each of its words
+ * =========================================================================*/
+static uint64_t *owm_location_filter_block (const OwmLocationFilter *self,
+      uint32_t id, uint64_t *bits)
+  {
+  uint64_t h = owm_location_filter_mix (id);
+  uint64_t block = ((h >> 32) * self->n_blocks) >> 32;
+  uint64_t b = owm_location_filter_mix (h);
+  int i;
+  for (i = 0; i < OWM_LOCATION_FILTER_WORDS; i++)
+    bits[i] = 1ull << ((b >> (6 * i)) & 63);
+  return self->blocks + block * OWM_LOCATION_FILTER_WORDS;
+  }
+
+
+/*============================================================================
+ * owm_location_filter_create
+ * =========================================================================*/
+OwmLocationFilter *owm_location_filter_create (const OwmCityList *list,
+      int bits_per_id)
+  {
+  if (bits_per_id <= 0) bits_per_id = OWM_LOCATION_FILTER_DEFAULT_BITS;
+  int i, n = owm_city_list_get_count (list);
+  OwmLocationFilter *self = calloc (1, sizeof (OwmLocationFilter));
+  uint64_t bits = (uint64_t)n * bits_per_id;
+  self->n_blocks = bits / (OWM_LOCATION_FILTER_WORDS * 64) + 1;
+  size_t size = (size_t)self->n_blocks * OWM_LOCATION_FILTER_WORDS
+    * sizeof (uint64_t);
+  void *blocks = NULL;
+  if (posix_memalign (&blocks, 64, size) != 0)
+    blocks = malloc (size);
+  self->blocks = blocks;
+  memset (self->blocks, 0, size);
+
+  for (i = 0; i < n; i++)
+    {
+    uint64_t mask[OWM_LOCATION_FILTER_WORDS];
+    uint64_t *block = owm_location_filter_block (self,
+      (uint32_t)owm_city_list_get_id (list, i), mask);
+    int w;
+    for (w = 0; w < OWM_LOCATION_FILTER_WORDS; w++)
+      block[w] |= mask[w];
+    }
+  return self;
+  }
+
+
+/*============================================================================
+ * owm_location_filter_destroy
+ * =========================================================================*/
+void owm_location_filter_destroy (OwmLocationFilter *self)
+  {
+  if (!self) return;
+  free (self->blocks);
+  free (self);
+  }
+
+
+/*============================================================================
+ * owm_location_filter_check
+ * =========================================================================*/
+BOOL owm_location_filter_check (const OwmLocationFilter *self,
+      const char *location_id)
+  {
+  uint32_t id;
+  if (!owm_location_filter_parse_id (location_id, &id)) return FALSE;
+
+  uint64_t mask[OWM_LOCATION_FILTER_WORDS];
+  const uint64_t *block = owm_location_filter_block (self, id, mask);
+  uint64_t missing = 0;
+  int w;
+  for (w = 0; w < OWM_LOCATION_FILTER_WORDS; w++)
+    missing |= mask[w] & ~block[w];
+  if (missing) return FALSE;
+
+  uint64_t slot = __atomic_load_n (&self->rejects[id
+    & (OWM_LOCATION_FILTER_REJECTS - 1)], __ATOMIC_RELAXED);
+  if ((uint32_t)slot == id && (time_t)(slot >> 32) > time (NULL))
+    return FALSE;
+  return TRUE;
+  }
+
+
+/*============================================================================
+ * owm_location_filter_reject
+ * =========================================================================*/
+void owm_location_filter_reject (OwmLocationFilter *self,
+      const char *location_id)
+  {
+  uint32_t id;
+  if (!owm_location_filter_parse_id (location_id, &id)) return;
+  uint64_t expires = (uint64_t)time (NULL) + OWM_LOCATION_FILTER_REJECT_TTL;
+  __atomic_store_n (&self->rejects[id & (OWM_LOCATION_FILTER_REJECTS - 1)],
+    (expires << 32) | id, __ATOMIC_RELAXED);
+  }
+
+
+/*============================================================================
+ * owm_location_filter_get_size
+ * =========================================================================*/
+size_t owm_location_filter_get_size (const OwmLocationFilter *self)
+  {
+  return sizeof (OwmLocationFilter) + (size_t)self->n_blocks
+    * OWM_LOCATION_FILTER_WORDS * sizeof (uint64_t);
+  }
+
@@ -0,0 +1,470 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_parse.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * Helpers for decoding the elements of OWM's XML documents, shared by the
+ *   forecast and current-conditions parsers
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <owm/owm_defs.h>
+#include <owm/owm_weather.h>
+#include "sxmlc.h"
+#include "owm_private.h"
+#include "owm_parse.h"
+
+
+/*============================================================================
+ * owm_xml_init
+ * =========================================================================*/
+void owm_xml_init (OwmXmlScanner *self, const char *data, size_t len)
+  {
+  self->p = data;
+  self->end = data + len;
+  self->depth = 0;
+  self->root = FALSE;
+  }
+
+
+/*============================================================================
+ * owm_xml_find
+ * Find the end of the string s, of length n, at or after p, and return
+ *   the position after it, or NULL
+ * =========================================================================*/
+static const char *owm_xml_find (const OwmXmlScanner *self, const char *p,
+      const char *s, size_t n)
+  {
+  const char *found = memmem (p, self->end - p, s, n);
+  return found ? found + n : NULL;
+  }
+
+
+/*============================================================================
+ * owm_xml_next
+ * =========================================================================*/
+OwmXmlType owm_xml_next (OwmXmlScanner *self, OwmXmlTag *tag)
+  {
+  const char *p;
+  for (;;)
+    {
+    p = memchr (self->p, '<', self->end - self->p);
+    if (!p) return OWM_XML_END;
+    const char *next;
+    size_t rest = self->end - p;
+    if (rest >= 2 && p[1] == '?')
+      next = owm_xml_find (self, p + 2, "?>", 2);
+    else if (rest >= 4 && memcmp (p, "<!--", 4) == 0)
+      next = owm_xml_find (self, p + 4, "-->", 3);
+    else if (rest >= 9 && memcmp (p, "<![CDATA[", 9) == 0)
+      next = owm_xml_find (self, p + 9, "]]>", 3);
+    else if (rest >= 2 && p[1] == '!')
+      next = owm_xml_find (self, p + 2, ">", 1);
+    else
+      break;
+    if (!next) return OWM_XML_ERROR;
+    self->p = next;
+    }
+
+  BOOL close = p + 1 < self->end && p[1] == '/';
+  const char *name = p + 1 + close;
+  const char *q = name;
+  while (q < self->end && *q != '>' && *q != '/' && *q != ' ' 
+      && *q != '\t' && *q != '\r' && *q != '\n')
+    q++;
+  // The end of the tag, which may not be in a quoted attribute value
+  char quote = 0;
+  const char *gt = q;
+  while (gt < self->end && (quote || *gt != '>'))
+    {
+    if (quote && *gt == quote) quote = 0;
+    else if (!quote && (*gt == '"' || *gt == '\'')) quote = *gt;
+    gt++;
+    }
+  if (gt == self->end || q == name) return OWM_XML_ERROR;
+
+  tag->start = p;
+  tag->len = gt + 1 - p;
+  tag->name = name;
+  tag->name_len = q - name;
+  tag->empty = !close && gt[-1] == '/';
+  self->p = gt + 1;
+  if (close)
+    {
+    if (self->depth == 0 
+        || self->open_len[self->depth - 1] != tag->name_len
+        || memcmp (self->open[self->depth - 1], name, tag->name_len) != 0)
+      return OWM_XML_ERROR;
+    tag->type = OWM_XML_CLOSE;
+    tag->depth = --self->depth;
+    return OWM_XML_CLOSE;
+    }
+  tag->type = OWM_XML_START;
+  tag->depth = self->depth;
+  self->root = TRUE;
+  if (!tag->empty)
+    {
+    if (self->depth == OWM_XML_MAX_DEPTH) return OWM_XML_ERROR;
+    self->open[self->depth] = name;
+    self->open_len[self->depth] = tag->name_len;
+    self->depth++;
+    }
+  return OWM_XML_START;
+  }
+
+
+/*============================================================================
+ * owm_xml_is
+ * =========================================================================*/
+BOOL owm_xml_is (const OwmXmlTag *tag, const char *name)
+  {
+  return strncmp (tag->name, name, tag->name_len) == 0 
+    && name[tag->name_len] == 0;
+  }
+
+
+/*============================================================================
+ * owm_xml_decode
+ * sxmlc decodes a tag in place, so it gets a copy
+ * =========================================================================*/
+BOOL owm_xml_decode (const OwmXmlTag *tag, XMLNode *node)
+  {
+  char buff[512];
+  char *copy = tag->len < sizeof (buff) ? buff : malloc (tag->len + 1);
+  memcpy (copy, tag->start, tag->len);
+  copy[tag->len] = 0;
+  XMLNode_init (node);
+  TagType type = XML_parse_1string (copy, node);
+  if (copy != buff) free (copy);
+  if (type == TAG_FATHER || type == TAG_SELF) return TRUE;
+  XMLNode_free (node);
+  return FALSE;
+  }
+
+
+/*============================================================================
+ * owm_parse_number
+ * Get the value of a numeric attribute, or zero if there is none
+ * =========================================================================*/
+double owm_parse_number (const XMLNode *n, const char *attribute)
+  {
+  double ret = 0;
+  int i, nattrs = n->n_attributes;
+  for (i = 0; i < nattrs; i++)
+    {
+    if (strcmp (n->attributes[i].name, attribute) == 0)
+      {
+      sscanf (n->attributes[i].value, "%lf", &ret);
+      break;
+      }
+    }
+  return ret;
+  }
+
+
+/*============================================================================
+ * owm_parse_digits
+ * Read n decimal digits at *p, advancing *p. Returns -1 if they are not
+ *   all digits
+ * =========================================================================*/
+static int owm_parse_digits (const char **p, int n)
+  {
+  int v = 0;
+  for (; n > 0; n--, (*p)++)
+    {
+    if (**p < '0' || **p > '9') return -1;
+    v = v * 10 + (**p - '0');
+    }
+  return v;
+  }
+
+
+/*============================================================================
+ * owm_parse_days_from_civil
+ * The number of days from 1970-01-01 to a date in the proleptic Gregorian
+ *   calendar. Years are counted in 400-year eras starting in March, so
+ *   that the leap day is the last day of the year
+ * =========================================================================*/
+static long owm_parse_days_from_civil (long y, int m, int d)
+  {
+  y -= m <= 2;
+  long era = (y >= 0 ? y : y - 399) / 400;
+  long yoe = y - era * 400;
+  long doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+  }
+
+
+/*============================================================================
+ * owm_parse_time_value
+ * Parses a time value in OWM format, YYYY-MM-DDTHH:MM:SS, into a time_t. 
+ *   The OWM values are always in UTC, so this is plain arithmetic, with
+ *   none of the library's time zone machinery -- which would mean 
+ *   changing TZ for the whole process, and so could not be done from
+ *   more than one thread. Returns -1 if the value is not in this form
+ * =========================================================================*/
+time_t owm_parse_time_value (const char *value) 
+  {
+  const char *p = value;
+  int y = owm_parse_digits (&p, 4);
+  if (y < 0 || *p++ != '-') return -1;
+  int mo = owm_parse_digits (&p, 2);
+  if (mo < 1 || mo > 12 || *p++ != '-') return -1;
+  int d = owm_parse_digits (&p, 2);
+  if (d < 1 || d > 31 || *p++ != 'T') return -1;
+  int h = owm_parse_digits (&p, 2);
+  if (h < 0 || *p++ != ':') return -1;
+  int mi = owm_parse_digits (&p, 2);
+  if (mi < 0 || *p++ != ':') return -1;
+  int s = owm_parse_digits (&p, 2);
+  if (s < 0) return -1;
+
+  return (time_t)owm_parse_days_from_civil (y, mo, d) * OWM_SECONDS_PER_DAY
+    + h * 3600 + mi * 60 + s;
+  }
+
+
+/*============================================================================
+ * owm_parse_times
+ * Parse the <times> element from the OWM response for a specific 
+ *   weather point
+ * =========================================================================*/
+void owm_parse_times (const XMLNode *n, time_t *from, time_t *to)
+  {
+  int i, nattrs = n->n_attributes;
+  for (i = 0; i < nattrs; i++)
+    {
+    char *name = n->attributes[i].name;
+    if (strcmp (name, "from") == 0)
+      {
+      char *value= n->attributes[i].value;
+      *from = owm_parse_time_value (value);
+      }
+    else if (strcmp (name, "to") == 0)
+      {
+      char *value= n->attributes[i].value;
+      *to = owm_parse_time_value (value);
+      }
+    }
+  }
+
+
+/*============================================================================
+ * owm_parse_temp 
+ * parse the <temperature> element from the OWM response 
+ * =========================================================================*/
+double owm_parse_temp (const XMLNode *n)
+  {
+  double ret = 0;
+  int i, nattrs = n->n_attributes;
+  for (i = 0; i < nattrs; i++)
+    {
+    char *name = n->attributes[i].name;
+    if (strcmp (name, "value") == 0)
+      {
+      char *value= n->attributes[i].value;
+      sscanf (value, "%lf", &ret);
+      }
+    }
+  return ret - OWM_PARSE_KELVIN;
+  }
+
+
+/*============================================================================
+ * owm_parse_wind_direction
+ * parse the <windDirection> element from the OWM response 
+ * =========================================================================*/
+double owm_parse_wind_direction (const XMLNode *n)
+  {
+  double ret = 0;
+  int i, nattrs = n->n_attributes;
+  for (i = 0; i < nattrs; i++)
+    {
+    char *name = n->attributes[i].name;
+    if (strcmp (name, "deg") == 0)
+      {
+      char *value= n->attributes[i].value;
+      sscanf (value, "%lf", &ret);
+      }
+    }
+  return ret;
+  }
+
+
+/*============================================================================
+ * owm_parse_wind_speeed
+ * parse the <windSpeed> element from the OWM response 
+ * =========================================================================*/
+double owm_parse_wind_speed (const XMLNode *n)
+  {
+  double ret = 0;
+  int i, nattrs = n->n_attributes;
+  for (i = 0; i < nattrs; i++)
+    {
+    char *name = n->attributes[i].name;
+    if (strcmp (name, "mps") == 0)
+      {
+      char *value= n->attributes[i].value;
+      sscanf (value, "%lf", &ret);
+      }
+    }
+  return ret * OWM_PARSE_MPS_TO_MPH;
+  }
+
+
+/*============================================================================
+ * owm_parse_pressure
+ * parse the <pressure> element from the OWM response 
+ * =========================================================================*/
+double owm_parse_pressure (const XMLNode *n)
+  {
+  double ret = 0;
+  int i, nattrs = n->n_attributes;
+  for (i = 0; i < nattrs; i++)
+    {
+    char *name = n->attributes[i].name;
+    if (strcmp (name, "value") == 0)
+      {
+      char *value= n->attributes[i].value;
+      sscanf (value, "%lf", &ret);
+      }
+    }
+  return ret;
+  }
+
+
+/*============================================================================
+ * owm_parse_cloud_cover
+ * parse the <cloud> element from the OWM response 
+ * =========================================================================*/
+double owm_parse_cloud_cover (const XMLNode *n)
+  {
+  double ret = 0;
+  int i, nattrs = n->n_attributes;
+  for (i = 0; i < nattrs; i++)
+    {
+    char *name = n->attributes[i].name;
+    if (strcmp (name, "all") == 0)
+      {
+      char *value= n->attributes[i].value;
+      sscanf (value, "%lf", &ret);
+      }
+    }
+  return ret;
+  }
+
+
+/*============================================================================
+ * owm_parse_humidity
+ * parse the <humidity> element from the OWM response 
+ * =========================================================================*/
+double owm_parse_humidity (const XMLNode *n)
+  {
+  double ret = 0;
+  int i, nattrs = n->n_attributes;
+  for (i = 0; i < nattrs; i++)
+    {
+    char *name = n->attributes[i].name;
+    if (strcmp (name, "value") == 0)
+      {
+      char *value= n->attributes[i].value;
+      sscanf (value, "%lf", &ret);
+      }
+    }
+  return ret;
+  }
+
+
+/*============================================================================
+ * owm_parse_rise_set
+ * parse the <sun> element from the OWM response 
+ * =========================================================================*/
+void owm_parse_rise_set (const XMLNode *n, time_t *rise, time_t *set)
+  {
+  int i, nattrs = n->n_attributes;
+  for (i = 0; i < nattrs; i++)
+    {
+    char *name = n->attributes[i].name;
+    if (strcmp (name, "rise") == 0)
+      {
+      char *value= n->attributes[i].value;
+      *rise = owm_parse_time_value (value);
+      }
+    else if (strcmp (name, "set") == 0)
+      {
+      char *value= n->attributes[i].value;
+      *set = owm_parse_time_value (value);
+      }
+    }
+  }
+
+
+/*============================================================================
+ * owm_parse_precipitation_type
+ * Decode the type of precipitation -- the type attribute of a forecast's
+ *   <precipitation> element, or the mode attribute of current conditions'
+ * =========================================================================*/
+OwmPrecipitation owm_parse_precipitation_type (const char *value)
+  {
+  if (strcasecmp (value, "drizzle") == 0)
+    return OWM_PRECIP_DRIZZLE;
+  else if (strcasecmp (value, "rain") == 0)
+    return OWM_PRECIP_RAIN;
+  else if (strcasecmp (value, "sleet") == 0)
+    return OWM_PRECIP_SLEET;
+  else if (strcasecmp (value, "snow") == 0)
+    return OWM_PRECIP_SNOW;
+  else if (strcasecmp (value, "graupel") == 0)
+    return OWM_PRECIP_GRAUPEL;
+  else if (strcasecmp (value, "hail") == 0)
+    return OWM_PRECIP_HAIL;
+  return OWM_PRECIP_NONE;
+  }
+
+
+/*============================================================================
+ * owm_parse_symbol
+ * parse the <precipitation> element from the OWM response 
+ * =========================================================================*/
+OwmPrecipitation owm_parse_precipitation (const XMLNode *n)
+  {
+  OwmPrecipitation ret = OWM_PRECIP_NONE;
+
+  int i, nattrs = n->n_attributes;
+  for (i = 0; i < nattrs; i++)
+    {
+    char *name = n->attributes[i].name;
+    if (strcmp (name, "type") == 0)
+      {
+      char *value= n->attributes[i].value;
+      ret = owm_parse_precipitation_type (value);
+      }
+    }
+  return ret;
+  }
+
+
+/*============================================================================
+ * owm_parse_conditions
+ * parse the <symbol> element from the OWM response 
+ * =========================================================================*/
+int owm_parse_conditions (const XMLNode *n)
+  {
+  int ret = 0;
+  int i, nattrs = n->n_attributes;
+  for (i = 0; i < nattrs; i++)
+    {
+    char *name = n->attributes[i].name;
+    if (strcmp (name, "number") == 0)
+      {
+      char *value= n->attributes[i].value;
+      sscanf (value, "%d", &ret);
+      }
+    }
+  return ret;
+  }
+
@@ -0,0 +1,85 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_parse.h
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * Helpers for decoding the elements of OWM's XML documents, for the
+ *   library's own use. The forecast and the current conditions describe
+ *   the weather with mostly the same elements, so both parsers use these.
+ *   Temperatures are returned in Celsius and speeds in miles per hour.
+ * The documents are read with a streaming scanner, which finds each tag
+ *   without decoding it; only the tags a parser wants are handed to sxmlc
+ *   to decode, so that elements it doesn't want cost no more than a
+ *   search for their ends, and no document tree is built.
+ * =========================================================================*/
+
+#pragma once
+
+#include <time.h>
+#include <owm/owm_defs.h>
+#include <owm/owm_weather.h>
+#include "sxmlc.h"
+
+#define OWM_PARSE_KELVIN 273.15
+#define OWM_PARSE_MPS_TO_MPH 2.23694
+
+// Deeper elements are treated as an error; OWM's documents have four
+//  levels
+#define OWM_XML_MAX_DEPTH 32
+
+typedef enum _OwmXmlType
+  {
+  OWM_XML_END = 0,   // End of the buffer
+  OWM_XML_ERROR,
+  OWM_XML_START,     // <tag ...> or <tag .../>
+  OWM_XML_CLOSE      // </tag>
+  } OwmXmlType;
+
+typedef struct _OwmXmlScanner
+  {
+  const char *p;
+  const char *end;
+  int depth;         // Elements open
+  const char *open[OWM_XML_MAX_DEPTH]; // Their names, which are not
+  size_t open_len[OWM_XML_MAX_DEPTH];  //  terminated
+  BOOL root;         // An element has been seen
+  } OwmXmlScanner;
+
+typedef struct _OwmXmlTag
+  {
+  OwmXmlType type;
+  const char *start; // From '<' to '>' inclusive
+  size_t len;
+  const char *name;  // Not terminated
+  size_t name_len;
+  int depth;         // Of the element: zero for the root
+  BOOL empty;        // <tag/>, which has no close
+  } OwmXmlTag;
+
+void        owm_xml_init (OwmXmlScanner *self, const char *data, size_t len);
+
+/** Get the next start or end tag, skipping text, comments, and the 
+ like. A close that doesn't match the open element is an error */
+OwmXmlType  owm_xml_next (OwmXmlScanner *self, OwmXmlTag *tag);
+
+/** Compare a tag's name */
+BOOL        owm_xml_is (const OwmXmlTag *tag, const char *name);
+
+/** Decode a start tag's name and attributes into node, which the caller
+ frees with XMLNode_free(). Returns FALSE if the tag is malformed */
+BOOL        owm_xml_decode (const OwmXmlTag *tag, XMLNode *node);
+
+double           owm_parse_number (const XMLNode *n, const char *attribute);
+time_t           owm_parse_time_value (const char *value);
+void             owm_parse_times (const XMLNode *n, time_t *from, time_t *to);
+double           owm_parse_temp (const XMLNode *n);
+double           owm_parse_wind_direction (const XMLNode *n);
+double           owm_parse_wind_speed (const XMLNode *n);
+double           owm_parse_pressure (const XMLNode *n);
+double           owm_parse_cloud_cover (const XMLNode *n);
+double           owm_parse_humidity (const XMLNode *n);
+void             owm_parse_rise_set (const XMLNode *n, time_t *rise,
+                   time_t *set);
+OwmPrecipitation owm_parse_precipitation_type (const char *value);
+OwmPrecipitation owm_parse_precipitation (const XMLNode *n);
+int              owm_parse_conditions (const XMLNode *n);
+
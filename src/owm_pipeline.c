@@ -0,0 +1,391 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_pipeline.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * Each location submitted becomes a job, which passes through the stages'
+ *   queues in turn, collecting the document, then the forecast, on the
+ *   way. A job that fails in one stage still goes through the rest, which
+ *   pass it on untouched, so that the finish stage reports every job.
+ * Every stage's threads run the same loop, and differ only in what they
+ *   do to a job. The threads are stopped stage by stage, with one NULL job
+ *   per thread, so that each stage has drained before the next is told
+ *   to stop.
+ * The counters are updated with atomic operations, and the times kept in
+ *   nanoseconds so that they can be too. Nothing in the path of a job
+ *   takes a lock, except at the end, to wake owm_pipeline_wait().
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <owm/owm_defs.h>
+#include <owm/owm_config.h>
+#include <owm/owm_string.h>
+#include <owm/owm_forecast.h>
+#include <owm/owm_cache.h>
+#include <owm/owm_disk_cache.h>
+#include <owm/owm_serialize.h>
+#include <owm/owm_location_filter.h>
+#include <owm/owm_context.h>
+#include <owm/owm_pipeline.h>
+#include "owm_private.h"
+#include "owm_queue.h"
+
+typedef struct _OwmPipelineJob
+  {
+  char *location_id;
+  char *data;       // The document, until it has been parsed and stored
+  char *etag;
+  char *last_modified;
+  time_t fetched;
+  OwmForecast *forecast;
+  char *error;
+  } OwmPipelineJob;
+
+struct _OwmPipeline;
+
+typedef struct _OwmPipelineStage
+  {
+  struct _OwmPipeline *pipeline;
+  // Returns FALSE if the job failed in this stage
+  BOOL (*process) (struct _OwmPipeline *pipeline, OwmPipelineJob *job);
+  struct _OwmPipelineStage *next;
+  OwmQueue *queue; // Jobs waiting for this stage
+  int n_threads;
+  pthread_t *threads;
+  unsigned long items;
+  unsigned long failures;
+  uint64_t busy;    // Nanoseconds
+  uint64_t blocked; // Nanoseconds
+  } OwmPipelineStage;
+
+struct _OwmPipeline
+  {
+  OwmContext *context;
+  char *app_id;
+  OwmForecastOptions forecast_options;
+  int flags;
+  OwmPipelineCallback callback;
+  void *user_data;
+  OwmPipelineStage stages[OWM_PIPELINE_STAGES];
+  double started;
+  pthread_mutex_t mutex; // Protects submitted and completed
+  pthread_cond_t cond;
+  unsigned long submitted;
+  unsigned long completed;
+  };
+
+
+/*============================================================================
+ * owm_pipeline_now
+ * =========================================================================*/
+static double owm_pipeline_now (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+  }
+
+
+/*============================================================================
+ * owm_pipeline_job_free
+ * =========================================================================*/
+static void owm_pipeline_job_free (OwmPipelineJob *job)
+  {
+  free (job->location_id);
+  free (job->data);
+  free (job->etag);
+  free (job->last_modified);
+  owm_forecast_destroy (job->forecast);
+  free (job->error);
+  free (job);
+  }
+
+
+/*============================================================================
+ * owm_pipeline_fetch
+ * The request is made as owm_context_get_forecast() would make it, and a
+ *   404 is taken the same way, as a location the server doesn't know
+ * =========================================================================*/
+static BOOL owm_pipeline_fetch (OwmPipeline *self, OwmPipelineJob *job)
+  {
+  OwmLocationFilter *filter =
+    owm_context_get_location_filter (self->context);
+  if (filter && !owm_location_filter_check (filter, job->location_id))
+    {
+    job->error = strdup (OWM_ERROR_UNKNOWN_LOCATION);
+    return FALSE;
+    }
+
+  OwmString *uri = owm_string_create_empty();
+  owm_string_append_printf (uri, "%s" OWM_URI,
+    owm_context_get_host (self->context), "forecast", job->location_id,
+    owm_forecast_mode (&self->forecast_options), self->app_id);
+  if (self->forecast_options.max_points > 0)
+    owm_string_append_printf (uri, OWM_URI_COUNT,
+      self->forecast_options.max_points);
+
+  long http_code = 0;
+  owm_curl_fetch (self->context, owm_string_cstr (uri), NULL, NULL,
+    NULL, NULL, &job->data, &job->etag, &job->last_modified, &http_code,
+    &job->error);
+  job->fetched = time (NULL);
+  if (job->error && http_code == 404)
+    {
+    if (filter)
+      owm_location_filter_reject (filter, job->location_id);
+    free (job->error);
+    job->error = strdup (OWM_ERROR_UNKNOWN_LOCATION);
+    }
+  owm_string_destroy (uri);
+  return job->error == NULL;
+  }
+
+
+/*============================================================================
+ * owm_pipeline_parse
+ * The document is only kept after parsing if it is to go into the disk
+ *   cache
+ * =========================================================================*/
+static BOOL owm_pipeline_parse (OwmPipeline *self, OwmPipelineJob *job)
+  {
+  if (job->error) return TRUE;
+  job->forecast = owm_forecast_parse_ex (job->data, &self->forecast_options,
+    &job->error);
+  if (!owm_context_get_disk_cache (self->context))
+    {
+    free (job->data);
+    job->data = NULL;
+    }
+  if (!job->forecast) return FALSE;
+  owm_forecast_set_fetched (job->forecast, self->context, job->fetched);
+  return TRUE;
+  }
+
+
+/*============================================================================
+ * owm_pipeline_finish
+ * =========================================================================*/
+static BOOL owm_pipeline_finish (OwmPipeline *self, OwmPipelineJob *job)
+  {
+  OwmForecast *forecast = job->forecast;
+  if (forecast)
+    {
+    char buff[128];
+    const char *key = owm_forecast_cache_key (job->location_id,
+      &self->forecast_options, buff, sizeof (buff));
+    OwmCache *cache = owm_context_get_cache (self->context);
+    OwmDiskCache *disk_cache = owm_context_get_disk_cache (self->context);
+    if (cache)
+      owm_cache_insert (cache, "forecast", key, OWM_UNITS, forecast,
+        job->fetched);
+    if (disk_cache)
+      owm_disk_cache_store (disk_cache, "forecast", key, OWM_UNITS,
+        job->data, strlen (job->data), job->fetched, job->etag,
+        job->last_modified, NULL);
+
+    unsigned char *data = NULL;
+    size_t len = 0;
+    if (self->flags & OWM_PIPELINE_SERIALIZE)
+      {
+      len = owm_forecast_serialize (forecast, NULL, 0);
+      data = malloc (len);
+      owm_forecast_serialize (forecast, data, len);
+      }
+    self->callback (job->location_id, forecast, data, len, NULL,
+      self->user_data);
+    free (data);
+    }
+  else
+    self->callback (job->location_id, NULL, NULL, 0,
+      job->error ? job->error : "Unknown error", self->user_data);
+  owm_pipeline_job_free (job);
+  return TRUE;
+  }
+
+
+/*============================================================================
+ * owm_pipeline_worker
+ * The loop that every stage's threads run
+ * =========================================================================*/
+static void *owm_pipeline_worker (void *data)
+  {
+  OwmPipelineStage *stage = data;
+  OwmPipelineJob *job;
+  while ((job = owm_queue_pop (stage->queue)) != NULL)
+    {
+    double start = owm_pipeline_now ();
+    BOOL ok = stage->process (stage->pipeline, job);
+    uint64_t busy = (uint64_t)((owm_pipeline_now () - start) * 1e9);
+    __atomic_add_fetch (&stage->busy, busy, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&stage->items, 1, __ATOMIC_RELAXED);
+    if (!ok) __atomic_add_fetch (&stage->failures, 1, __ATOMIC_RELAXED);
+    if (stage->next)
+      {
+      double waited = owm_queue_push (stage->next->queue, job);
+      __atomic_add_fetch (&stage->blocked, (uint64_t)(waited * 1e9),
+        __ATOMIC_RELAXED);
+      }
+    else
+      {
+      // The job has been freed. Count it only now, so that the stats
+      //  agree once owm_pipeline_wait() returns
+      OwmPipeline *self = stage->pipeline;
+      pthread_mutex_lock (&self->mutex);
+      self->completed++;
+      if (self->completed == self->submitted)
+        pthread_cond_broadcast (&self->cond);
+      pthread_mutex_unlock (&self->mutex);
+      }
+    }
+  return NULL;
+  }
+
+
+/*============================================================================
+ * owm_pipeline_create
+ * =========================================================================*/
+OwmPipeline *owm_pipeline_create (OwmContext *context, const char *app_id,
+      const OwmForecastOptions *forecast_options,
+      const OwmPipelineOptions *options, OwmPipelineCallback callback,
+      void *user_data)
+  {
+  OwmPipeline *self = malloc (sizeof (OwmPipeline));
+  memset (self, 0, sizeof (OwmPipeline));
+  self->context = owm_context_ref
+    (context ? context : owm_context_get_default ());
+  self->app_id = strdup (app_id);
+  if (forecast_options) self->forecast_options = *forecast_options;
+  self->callback = callback;
+  self->user_data = user_data;
+  pthread_mutex_init (&self->mutex, NULL);
+  pthread_cond_init (&self->cond, NULL);
+
+  int fetchers = OWM_PIPELINE_DEFAULT_FETCHERS;
+  int parsers = (int)sysconf (_SC_NPROCESSORS_ONLN);
+  int queue_size = OWM_PIPELINE_DEFAULT_QUEUE;
+  if (options)
+    {
+    self->flags = options->flags;
+    if (options->fetchers > 0) fetchers = options->fetchers;
+    if (options->parsers > 0) parsers = options->parsers;
+    if (options->queue_size > 0) queue_size = options->queue_size;
+    }
+  if (parsers < 1) parsers = 1;
+
+  BOOL (*process[OWM_PIPELINE_STAGES]) (OwmPipeline *, OwmPipelineJob *) =
+    { owm_pipeline_fetch, owm_pipeline_parse, owm_pipeline_finish };
+  int threads[OWM_PIPELINE_STAGES] = { fetchers, parsers, 1 };
+  int s, i;
+  for (s = 0; s < OWM_PIPELINE_STAGES; s++)
+    {
+    OwmPipelineStage *stage = &self->stages[s];
+    stage->pipeline = self;
+    stage->process = process[s];
+    stage->next = s + 1 < OWM_PIPELINE_STAGES ? &self->stages[s + 1] : NULL;
+    stage->queue = owm_queue_create (queue_size);
+    stage->n_threads = threads[s];
+    stage->threads = malloc (stage->n_threads * sizeof (pthread_t));
+    }
+
+  self->started = owm_pipeline_now ();
+  for (s = 0; s < OWM_PIPELINE_STAGES; s++)
+    {
+    OwmPipelineStage *stage = &self->stages[s];
+    for (i = 0; i < stage->n_threads; i++)
+      pthread_create (&stage->threads[i], NULL, owm_pipeline_worker, stage);
+    }
+  return self;
+  }
+
+
+/*============================================================================
+ * owm_pipeline_destroy
+ * =========================================================================*/
+void owm_pipeline_destroy (OwmPipeline *self)
+  {
+  if (!self) return;
+  int s, i;
+  for (s = 0; s < OWM_PIPELINE_STAGES; s++)
+    {
+    OwmPipelineStage *stage = &self->stages[s];
+    for (i = 0; i < stage->n_threads; i++)
+      owm_queue_push (stage->queue, NULL);
+    for (i = 0; i < stage->n_threads; i++)
+      pthread_join (stage->threads[i], NULL);
+    }
+  for (s = 0; s < OWM_PIPELINE_STAGES; s++)
+    {
+    owm_queue_destroy (self->stages[s].queue);
+    free (self->stages[s].threads);
+    }
+  owm_context_destroy (self->context);
+  free (self->app_id);
+  pthread_cond_destroy (&self->cond);
+  pthread_mutex_destroy (&self->mutex);
+  free (self);
+  }
+
+
+/*============================================================================
+ * owm_pipeline_submit
+ * =========================================================================*/
+void owm_pipeline_submit (OwmPipeline *self, const char *location_id)
+  {
+  OwmPipelineJob *job = malloc (sizeof (OwmPipelineJob));
+  memset (job, 0, sizeof (OwmPipelineJob));
+  job->location_id = strdup (location_id);
+
+  pthread_mutex_lock (&self->mutex);
+  self->submitted++;
+  pthread_mutex_unlock (&self->mutex);
+  owm_queue_push (self->stages[OWM_PIPELINE_FETCH].queue, job);
+  }
+
+
+/*============================================================================
+ * owm_pipeline_wait
+ * =========================================================================*/
+void owm_pipeline_wait (OwmPipeline *self)
+  {
+  pthread_mutex_lock (&self->mutex);
+  while (self->completed < self->submitted)
+    pthread_cond_wait (&self->cond, &self->mutex);
+  pthread_mutex_unlock (&self->mutex);
+  }
+
+
+/*============================================================================
+ * owm_pipeline_get_stats
+ * =========================================================================*/
+void owm_pipeline_get_stats (OwmPipeline *self, OwmPipelineStats *stats)
+  {
+  memset (stats, 0, sizeof (OwmPipelineStats));
+  stats->elapsed = owm_pipeline_now () - self->started;
+  int s;
+  for (s = 0; s < OWM_PIPELINE_STAGES; s++)
+    {
+    const OwmPipelineStage *stage = &self->stages[s];
+    OwmPipelineStageStats *st = &stats->stages[s];
+    st->threads = stage->n_threads;
+    st->items = __atomic_load_n (&stage->items, __ATOMIC_RELAXED);
+    st->failures = __atomic_load_n (&stage->failures, __ATOMIC_RELAXED);
+    st->busy = __atomic_load_n (&stage->busy, __ATOMIC_RELAXED) / 1e9;
+    st->blocked = __atomic_load_n (&stage->blocked, __ATOMIC_RELAXED) / 1e9;
+    if (stats->elapsed > 0)
+      st->throughput = st->items / stats->elapsed;
+    st->queue_depth = owm_queue_get_depth (stage->queue);
+    st->queue_max_depth = owm_queue_get_max_depth (stage->queue);
+    st->queue_size = owm_queue_get_capacity (stage->queue);
+    }
+  pthread_mutex_lock (&self->mutex);
+  stats->submitted = self->submitted;
+  stats->completed = self->completed;
+  pthread_mutex_unlock (&self->mutex);
+  }
+
@@ -0,0 +1,181 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_private.h
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * Definitions shared between the library's translation units, but which
+ *   are not part of the public API. Nothing in include/owm/ should
+ *   include this file.
+ * =========================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <owm/owm_weather.h>
+#include <owm/owm_forecast.h>
+
+/* Round a size up so that whatever follows it in a block is suitably
+   aligned for any of the types we store there */
+#define OWM_ALIGN(n) (((n) + sizeof (double) - 1) & ~(sizeof (double) - 1))
+
+/*============================================================================
+ * OwmWeather opaque struct
+ * The forecast stores its points as a contiguous array of these, so the
+ *   definition has to be visible to owm_forecast.c as well as
+ *   owm_weather.c
+ * =========================================================================*/
+struct _OwmWeather
+  {
+  int valid;
+  time_t start_time;
+  time_t end_time;
+  OwmConditions conditions;
+  double temp;
+  double wind_direction;
+  double wind_x; // sin and cos of wind_direction, or zero if it is not
+  double wind_y; //  valid; see owm_weather_update_wind_vector()
+  double wind_speed;
+  double pressure;
+  double humidity;
+  double cloud_cover;
+  OwmPrecipitation precipitation;
+  };
+
+struct _OwmDb;
+
+/*============================================================================
+ * OwmForecast opaque struct
+ * The header, the points array and the daily summaries come from a 
+ *   single allocation, so destroying a forecast is one free(), however 
+ *   many points it holds. The exception is a view into a database (see
+ *   owm_db.c), whose points and summaries are in the database's mapping
+ * =========================================================================*/
+struct _OwmForecast
+  {
+  int refcount; // Updated atomically; see owm_forecast_ref()
+  size_t size; // Size of the whole allocation, including the points
+  time_t fetched; // When the forecast was retrieved from the server
+  time_t expires; // When the fetching context's cache says it goes stale,
+                  //  or zero if it did not come from a fetch
+  time_t sunrise;
+  time_t sunset;
+  int flags; // OWM_FORECAST_xxx flags it was created with
+  int fields; // OWM_VALID_xxx fields it was parsed with, or zero for all
+  int n_points;
+  int max_points;
+  OwmWeather *points;
+  int n_days;
+  int max_days;
+  OwmDailySummary *days;
+  struct _OwmDb *db; // The database this is a view into, or NULL
+  };
+
+/* Fields that contribute to a daily summary */
+#define OWM_SUMMARY_FIELDS (OWM_VALID_CONDITIONS | OWM_VALID_TEMP \
+          | OWM_VALID_WIND_SPEED | OWM_VALID_WIND_DIRECTION)
+
+#define OWM_SECONDS_PER_DAY 86400
+
+/* The most distinct condition codes we track when working out the modal
+   conditions for one day. With three-hourly points there can be at
+   most eight */
+#define OWM_DAY_MAX_CONDS 24
+
+/*============================================================================
+ * OwmDayAccumulator
+ * Running totals for one day, from which an OwmDailySummary is produced
+ * =========================================================================*/
+typedef struct _OwmDayAccumulator
+  {
+  long day; // Days since the epoch, UTC
+  int points;
+  int valid;
+  double min_temp;
+  double max_temp;
+  int n_conds;
+  OwmConditions conds[OWM_DAY_MAX_CONDS];
+  int cond_counts[OWM_DAY_MAX_CONDS];
+  int wind_speed_points;
+  double total_wind_speed;
+  int wind_dir_points;
+  double total_sin_wind_dir;
+  double total_cos_wind_dir;
+  } OwmDayAccumulator;
+
+void owm_weather_init (OwmWeather *self);
+void owm_weather_update_wind_vector (OwmWeather *self);
+
+OwmForecast *owm_forecast_create (int max_points, int max_days);
+void owm_forecast_begin_points (OwmForecast *self, OwmDayAccumulator *acc);
+void owm_forecast_add_point (OwmForecast *self, OwmDayAccumulator *acc, 
+       const OwmWeather *w);
+void owm_forecast_end_points (OwmForecast *self, OwmDayAccumulator *acc);
+void owm_forecast_set_rise_set (OwmForecast *self, time_t rise, time_t set);
+OwmForecast *owm_forecast_shrink (OwmForecast *self);
+const char *owm_forecast_mode (const OwmForecastOptions *options);
+const char *owm_forecast_cache_key (const char *location_id, 
+       const OwmForecastOptions *options, char *buff, size_t size);
+OwmForecast *owm_forecast_parse_json (const char *json, size_t len, 
+       const OwmForecastOptions *options, char **error);
+
+BOOL owm_cache_begin_refresh (OwmCache *self, const char *endpoint,
+       const char *location, const char *units);
+void owm_cache_end_refresh (OwmCache *self, const char *endpoint,
+       const char *location, const char *units);
+
+void owm_db_release (struct _OwmDb *self);
+
+struct _OwmContext;
+struct _OwmContext *owm_context_ref (struct _OwmContext *self);
+void *owm_context_take_handle (struct _OwmContext *self);
+void owm_context_give_handle (struct _OwmContext *self, void *handle);
+void owm_forecast_set_fetched (OwmForecast *self,
+       struct _OwmContext *context, time_t fetched);
+
+void owm_curl_init (void);
+void owm_curl_fetch (struct _OwmContext *context, const char *uri, 
+       const char *etag, const char *last_modified, 
+       void (*progress) (const char *data, size_t len, void *user_data),
+       void *user_data, char **result, char **new_etag, 
+       char **new_last_modified, long *http_code, char **error);
+
+/* Quantization scales for the binary formats. These are finer than the
+   precision OWM supplies */
+#define OWM_Q_TEMP      100.0
+#define OWM_Q_SPEED     100.0
+#define OWM_Q_DIRECTION 10.0
+#define OWM_Q_PRESSURE  100.0
+#define OWM_Q_PERCENT   10.0
+
+/*============================================================================
+ * OwmWriter and OwmReader
+ * Encoding and decoding for the binary formats; see owm_varint.c
+ * =========================================================================*/
+typedef struct _OwmWriter
+  {
+  unsigned char *buffer;
+  size_t size;
+  size_t pos; // Keeps counting after the buffer is full
+  } OwmWriter;
+
+typedef struct _OwmReader
+  {
+  const unsigned char *p;
+  const unsigned char *end;
+  BOOL ok; // Cleared on the first read past the end, or a bad value
+  } OwmReader;
+
+void owm_writer_byte (OwmWriter *w, unsigned char b);
+void owm_writer_u32 (OwmWriter *w, uint32_t v);
+void owm_writer_uvarint (OwmWriter *w, uint64_t v);
+void owm_writer_varint (OwmWriter *w, int64_t v);
+void owm_writer_quantized (OwmWriter *w, double v, double scale);
+unsigned char owm_reader_byte (OwmReader *r);
+uint32_t owm_reader_u32 (OwmReader *r);
+uint64_t owm_reader_uvarint (OwmReader *r);
+int64_t owm_reader_varint (OwmReader *r);
+double owm_reader_quantized (OwmReader *r, double scale);
+int owm_reader_count (OwmReader *r, int min_bytes);
+
+uint32_t owm_crc32_update (uint32_t crc, const void *data, size_t len);
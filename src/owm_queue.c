@@ -0,0 +1,218 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_queue.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * The items are held in a ring of cells, each with a sequence number that
+ *   says whether it is ready to be written or read at a given position in
+ *   the queue (after Dmitry Vyukov's bounded MPMC queue). Producers and
+ *   consumers claim positions with a compare-and-swap on the tail or the
+ *   head, and never take a lock.
+ * Two semaphores count the free cells and the full ones, so that a thread
+ *   that can't go on sleeps in the kernel instead of spinning. A thread
+ *   that gets past the semaphore is sure of a cell, but the one at its
+ *   position may still be in the hands of a slower thread that claimed
+ *   the position before it; it yields until that thread is done, which
+ *   is only ever a few instructions away.
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <owm/owm_defs.h>
+#include "owm_queue.h"
+
+typedef struct _OwmQueueCell
+  {
+  size_t sequence;
+  void *item;
+  } OwmQueueCell;
+
+struct _OwmQueue
+  {
+  OwmQueueCell *cells;
+  size_t mask;     // The ring size, a power of two, less one
+  int capacity;
+  sem_t free_cells;
+  sem_t full_cells;
+  // The head and the tail are written by different threads, so keep them
+  //  on different cache lines
+  size_t head __attribute__ ((aligned (64)));
+  size_t tail __attribute__ ((aligned (64)));
+  int max_depth;
+  };
+
+
+/*============================================================================
+ * owm_queue_create
+ * =========================================================================*/
+OwmQueue *owm_queue_create (int capacity)
+  {
+  if (capacity < 1) capacity = 1;
+  size_t size = 1;
+  while (size < (size_t)capacity) size *= 2;
+
+  OwmQueue *self = NULL;
+  if (posix_memalign ((void **)&self, 64, sizeof (OwmQueue)) != 0)
+    return NULL;
+  memset (self, 0, sizeof (OwmQueue));
+  self->cells = malloc (size * sizeof (OwmQueueCell));
+  self->mask = size - 1;
+  self->capacity = capacity;
+  size_t i;
+  for (i = 0; i < size; i++)
+    {
+    self->cells[i].sequence = i;
+    self->cells[i].item = NULL;
+    }
+  sem_init (&self->free_cells, 0, (unsigned int)capacity);
+  sem_init (&self->full_cells, 0, 0);
+  return self;
+  }
+
+
+/*============================================================================
+ * owm_queue_destroy
+ * =========================================================================*/
+void owm_queue_destroy (OwmQueue *self)
+  {
+  if (!self) return;
+  sem_destroy (&self->free_cells);
+  sem_destroy (&self->full_cells);
+  free (self->cells);
+  free (self);
+  }
+
+
+/*============================================================================
+ * owm_queue_wait
+ * Wait on a semaphore, returning the number of seconds it took. The clock
+ *   is only read if the semaphore isn't free at once
+ * =========================================================================*/
+static double owm_queue_wait (sem_t *sem)
+  {
+  if (sem_trywait (sem) == 0) return 0;
+  struct timespec start, end;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  while (sem_wait (sem) != 0)
+    ; // Interrupted by a signal
+  clock_gettime (CLOCK_MONOTONIC, &end);
+  return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  }
+
+
+/*============================================================================
+ * owm_queue_push
+ * =========================================================================*/
+double owm_queue_push (OwmQueue *self, void *item)
+  {
+  double waited = owm_queue_wait (&self->free_cells);
+
+  OwmQueueCell *cell;
+  size_t pos = __atomic_load_n (&self->tail, __ATOMIC_RELAXED);
+  for (;;)
+    {
+    cell = &self->cells[pos & self->mask];
+    size_t seq = __atomic_load_n (&cell->sequence, __ATOMIC_ACQUIRE);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+    if (diff == 0)
+      {
+      if (__atomic_compare_exchange_n (&self->tail, &pos, pos + 1, TRUE,
+          __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+      }
+    else if (diff < 0)
+      {
+      // The consumer of the last lap's item at this position has not
+      //  finished with the cell yet
+      sched_yield ();
+      pos = __atomic_load_n (&self->tail, __ATOMIC_RELAXED);
+      }
+    else
+      pos = __atomic_load_n (&self->tail, __ATOMIC_RELAXED);
+    }
+  cell->item = item;
+  __atomic_store_n (&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+
+  int depth = owm_queue_get_depth (self);
+  int max = __atomic_load_n (&self->max_depth, __ATOMIC_RELAXED);
+  while (depth > max && !__atomic_compare_exchange_n (&self->max_depth,
+      &max, depth, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+  sem_post (&self->full_cells);
+  return waited;
+  }
+
+
+/*============================================================================
+ * owm_queue_pop
+ * =========================================================================*/
+void *owm_queue_pop (OwmQueue *self)
+  {
+  owm_queue_wait (&self->full_cells);
+
+  OwmQueueCell *cell;
+  size_t pos = __atomic_load_n (&self->head, __ATOMIC_RELAXED);
+  for (;;)
+    {
+    cell = &self->cells[pos & self->mask];
+    size_t seq = __atomic_load_n (&cell->sequence, __ATOMIC_ACQUIRE);
+    intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+    if (diff == 0)
+      {
+      if (__atomic_compare_exchange_n (&self->head, &pos, pos + 1, TRUE,
+          __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+      }
+    else if (diff < 0)
+      {
+      // The producer of the item at this position has not finished
+      //  writing it yet
+      sched_yield ();
+      pos = __atomic_load_n (&self->head, __ATOMIC_RELAXED);
+      }
+    else
+      pos = __atomic_load_n (&self->head, __ATOMIC_RELAXED);
+    }
+  void *item = cell->item;
+  __atomic_store_n (&cell->sequence, pos + self->mask + 1, __ATOMIC_RELEASE);
+  sem_post (&self->free_cells);
+  return item;
+  }
+
+
+/*============================================================================
+ * owm_queue_get_depth
+ * =========================================================================*/
+int owm_queue_get_depth (const OwmQueue *self)
+  {
+  size_t head = __atomic_load_n (&self->head, __ATOMIC_RELAXED);
+  size_t tail = __atomic_load_n (&self->tail, __ATOMIC_RELAXED);
+  intptr_t depth = (intptr_t)(tail - head);
+  if (depth < 0) return 0;
+  if (depth > self->capacity) return self->capacity;
+  return (int)depth;
+  }
+
+
+/*============================================================================
+ * owm_queue_get_max_depth
+ * =========================================================================*/
+int owm_queue_get_max_depth (const OwmQueue *self)
+  {
+  return __atomic_load_n (&self->max_depth, __ATOMIC_RELAXED);
+  }
+
+
+/*============================================================================
+ * owm_queue_get_capacity
+ * =========================================================================*/
+int owm_queue_get_capacity (const OwmQueue *self)
+  {
+  return self->capacity;
+  }
+
@@ -0,0 +1,37 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_queue.h
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * A bounded queue of pointers, for the library's own use, that any number
+ *   of threads can push to and pop from at once. Pushing to a full queue
+ *   waits for room, and popping from an empty one waits for an item, so a
+ *   slow consumer holds back its producers rather than letting work pile
+ *   up in memory.
+ * =========================================================================*/
+
+#pragma once
+
+#include <owm/owm_defs.h>
+
+struct _OwmQueue;
+typedef struct _OwmQueue OwmQueue;
+
+/** Create a queue that holds up to capacity items */
+OwmQueue *owm_queue_create (int capacity);
+
+/** Free the queue. Any items still in it are not freed */
+void      owm_queue_destroy (OwmQueue *self);
+
+/** Add an item, waiting until there is room for it. Returns the number
+ of seconds spent waiting */
+double    owm_queue_push (OwmQueue *self, void *item);
+
+/** Take the oldest item, waiting until there is one */
+void     *owm_queue_pop (OwmQueue *self);
+
+/** The number of items in the queue now, and the most there have ever
+ been. Both are approximate while other threads are using the queue */
+int       owm_queue_get_depth (const OwmQueue *self);
+int       owm_queue_get_max_depth (const OwmQueue *self);
+int       owm_queue_get_capacity (const OwmQueue *self);
+
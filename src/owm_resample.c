@@ -0,0 +1,216 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_resample.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * Functions for looking up forecast points by time, and for
+ *   interpolating between them. The points of a forecast are in time
+ *   order, so we can use binary searches and single linear sweeps.
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <owm/owm_defs.h>
+#include <owm/owm_forecast.h>
+#include <owm/owm_weather.h>
+#include "owm_private.h"
+
+/* How values of a particular field may be interpolated */
+#define OWM_INTERP_LINEAR   0
+#define OWM_INTERP_CIRCULAR 1 // Angles in degrees, take the shorter way round
+#define OWM_INTERP_STEP     2 // Codes, like conditions, hold their value
+
+
+/*============================================================================
+ * owm_interpolation_kind
+ * =========================================================================*/
+static int owm_interpolation_kind (int field)
+  {
+  switch (field)
+    {
+    case OWM_VALID_WIND_DIRECTION:
+      return OWM_INTERP_CIRCULAR;
+    case OWM_VALID_CONDITIONS:
+    case OWM_VALID_PRECIPITATION:
+      return OWM_INTERP_STEP;
+    }
+  return OWM_INTERP_LINEAR;
+  }
+
+
+/*============================================================================
+ * owm_ceil_div
+ * Division of a (possibly negative) time offset by a positive step,
+ *   rounding up. This gives the index of the first sample at or after
+ *   the offset.
+ * =========================================================================*/
+static long owm_ceil_div (time_t a, long b)
+  {
+  long q = (long)(a / b);
+  if (a % b > 0) q++;
+  return q;
+  }
+
+
+/*============================================================================
+ * owm_sample_index
+ * Index of the first sample at or after time t, clamped to [lo,n]
+ * =========================================================================*/
+static int owm_sample_index (time_t t, time_t start, int step, int lo, int n)
+  {
+  long i = owm_ceil_div (t - start, step);
+  if (i < lo) return lo;
+  if (i > n) return n;
+  return (int)i;
+  }
+
+
+/*============================================================================
+ * owm_next_valid
+ * Index of the first point at or after i that has a value for field,
+ *   or -1
+ * =========================================================================*/
+static int owm_next_valid (const OwmForecast *self, int i, int field)
+  {
+  for (; i < self->n_points; i++)
+    {
+    if (self->points[i].valid & field) return i;
+    }
+  return -1;
+  }
+
+
+/*============================================================================
+ * owm_interpolate_run
+ * Fill samples i0 to i1-1 with values on the line from (t0,v0) to
+ *   (t1,v1). The loops have no branches or calls, so that the
+ *   compiler can vectorize them
+ * =========================================================================*/
+static void owm_interpolate_run (int kind, double v0, double v1,
+      time_t t0, time_t t1, time_t start, int step, int i0, int i1,
+      double *values, unsigned char *mask)
+  {
+  int i;
+  double d = v1 - v0;
+  if (kind == OWM_INTERP_CIRCULAR)
+    {
+    if (d > 180.0) d -= 360.0;
+    else if (d < -180.0) d += 360.0;
+    }
+  else if (kind == OWM_INTERP_STEP)
+    d = 0;
+
+  double scale = t1 > t0 ? d / (double)(t1 - t0) : 0;
+  double base = (double)(start - t0);
+  double fstep = step;
+  for (i = i0; i < i1; i++)
+    values[i] = v0 + scale * (base + fstep * i);
+
+  if (kind == OWM_INTERP_CIRCULAR)
+    {
+    for (i = i0; i < i1; i++)
+      values[i] -= 360.0 * floor (values[i] / 360.0);
+    }
+
+  if (mask && i1 > i0)
+    memset (mask + i0, 1, (size_t)(i1 - i0));
+  }
+
+
+/*============================================================================
+ * owm_forecast_find_point
+ * Binary search for the last point that starts at or before t. Returns
+ *   -1 if t is before the start of the forecast. The caller can check
+ *   the point's end time to see whether t is actually within it
+ * =========================================================================*/
+int owm_forecast_find_point (const OwmForecast *self, time_t t)
+  {
+  int lo = 0, hi = self->n_points;
+  while (lo < hi)
+    {
+    int mid = lo + (hi - lo) / 2;
+    if (self->points[mid].start_time <= t)
+      lo = mid + 1;
+    else
+      hi = mid;
+    }
+  return lo - 1;
+  }
+
+
+/*============================================================================
+ * owm_forecast_resample
+ * Work out the value of field at n times, start + i * step, and store
+ *   them in values[i]. Each point's value is taken to apply at its start
+ *   time. Between points, scalars are interpolated linearly, wind
+ *   direction the shorter way round the circle, and codes such as
+ *   conditions are held. After the last point, its value is held until
+ *   the point's end time. If mask is not NULL, mask[i] is set to 1 where
+ *   a value could be worked out, and 0 where it could not -- outside the
+ *   time range of the forecast, for example. Nothing is allocated.
+ *   Returns the number of valid samples.
+ * =========================================================================*/
+int owm_forecast_resample (const OwmForecast *self, int field,
+      time_t start, int step, int n, double *values, unsigned char *mask)
+  {
+  if (n <= 0 || step <= 0) return 0;
+  memset (values, 0, (size_t)n * sizeof (double));
+  if (mask) memset (mask, 0, (size_t)n);
+
+  const OwmWeather *p = self->points;
+  int kind = owm_interpolation_kind (field);
+
+  // Find the point that covers the first sample, or failing that, the
+  //  first point after it
+  int a = owm_forecast_find_point (self, start);
+  while (a >= 0 && !(p[a].valid & field)) a--;
+  if (a < 0) a = owm_next_valid (self, 0, field);
+  if (a < 0) return 0;
+
+  int i = owm_sample_index (p[a].start_time, start, step, 0, n);
+  int first = i;
+  while (i < n)
+    {
+    int b = owm_next_valid (self, a + 1, field);
+    if (b < 0) break;
+    time_t t0 = p[a].start_time;
+    time_t t1 = p[b].start_time;
+    int i_end = owm_sample_index (t1, start, step, i, n);
+    owm_interpolate_run (kind, owm_weather_get_field (&p[a], field),
+      owm_weather_get_field (&p[b], field), t0, t1, start, step,
+      i, i_end, values, mask);
+    i = i_end;
+    a = b;
+    }
+
+  if (i < n)
+    {
+    time_t end = (p[a].valid & OWM_VALID_END) ? p[a].end_time
+      : p[a].start_time + 1;
+    int i_end = owm_sample_index (end, start, step, i, n);
+    double v = owm_weather_get_field (&p[a], field);
+    owm_interpolate_run (OWM_INTERP_STEP, v, v, p[a].start_time, end,
+      start, step, i, i_end, values, mask);
+    i = i_end;
+    }
+
+  return i - first;
+  }
+
+
+/*============================================================================
+ * owm_forecast_interpolate
+ * Get the value of field at time t, interpolated as for
+ *   owm_forecast_resample(). Returns FALSE if there is no value at t.
+ * =========================================================================*/
+BOOL owm_forecast_interpolate (const OwmForecast *self, int field,
+      time_t t, double *value)
+  {
+  double v;
+  unsigned char m;
+  owm_forecast_resample (self, field, t, 1, 1, &v, &m);
+  if (m) *value = v;
+  return m ? TRUE : FALSE;
+  }
+
@@ -0,0 +1,584 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_scheduler.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * Locations waiting to be refreshed are kept in one binary heap per
+ *   priority, ordered by the time they fall due, and also in a hash table
+ *   by location ID. A location being fetched is in neither heap; it goes
+ *   back into one when the fetch finishes.
+ * There is no dispatcher thread: each idle worker takes the scheduler's
+ *   lock, and picks the most urgent due location itself, or else sleeps
+ *   until the next one falls due, or the budget allows another call.
+ * Times are in seconds on the monotonic clock, so that changes to the
+ *   system time don't disturb the schedule.
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <owm/owm_defs.h>
+#include <owm/owm_forecast.h>
+#include <owm/owm_context.h>
+#include <owm/owm_scheduler.h>
+#include "owm_private.h"
+
+/* Refreshes are brought forward by a random fraction, up to this, of
+   the location's max_age */
+#define OWM_SCHEDULER_JITTER 0.1
+
+/* The first retry after a failure is after this many seconds, doubling
+   with each further failure, up to the location's max_age */
+#define OWM_SCHEDULER_RETRY 30
+#define OWM_SCHEDULER_MAX_BACKOFF 6
+
+typedef struct _OwmSchedulerItem
+  {
+  struct _OwmSchedulerItem *chain; // Next in the same hash bucket
+  char *location_id;
+  uint32_t hash;
+  int priority;
+  int max_age;
+  double due;
+  int heap_index;  // -1 while being fetched
+  BOOL removed;    // Removed while being fetched; free it afterwards
+  int failures;    // Consecutive
+  } OwmSchedulerItem;
+
+typedef struct _OwmSchedulerHeap
+  {
+  OwmSchedulerItem **items;
+  int n;
+  int max;
+  } OwmSchedulerHeap;
+
+struct _OwmScheduler
+  {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  BOOL running;
+  OwmContext *context;
+  char *app_id;
+  OwmForecastOptions options;
+  OwmSchedulerCallback callback;
+  void *user_data;
+  int n_workers;
+  pthread_t *workers;
+  double rate;     // Tokens per second, or zero for no limit
+  double capacity;
+  double tokens;
+  double last_refill;
+  OwmSchedulerHeap heaps[OWM_SCHEDULER_PRIORITIES];
+  OwmSchedulerItem **buckets;
+  int n_buckets;
+  int n_items;
+  int in_flight;
+  unsigned long refreshes;
+  unsigned long failures;
+  unsigned long dispatched;
+  double total_lag;
+  unsigned int seed;
+  };
+
+
+/*============================================================================
+ * owm_scheduler_now
+ * =========================================================================*/
+static double owm_scheduler_now (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+  }
+
+
+/*============================================================================
+ * owm_scheduler_hash
+ * 32-bit FNV-1a
+ * =========================================================================*/
+static uint32_t owm_scheduler_hash (const char *s)
+  {
+  uint32_t hash = 2166136261u;
+  const unsigned char *p;
+  for (p = (const unsigned char *)s; *p; p++)
+    {
+    hash ^= *p;
+    hash *= 16777619u;
+    }
+  return hash;
+  }
+
+
+/*============================================================================
+ * owm_scheduler_heap_set
+ * =========================================================================*/
+static void owm_scheduler_heap_set (OwmSchedulerHeap *heap, int i,
+      OwmSchedulerItem *item)
+  {
+  heap->items[i] = item;
+  item->heap_index = i;
+  }
+
+
+/*============================================================================
+ * owm_scheduler_heap_up
+ * =========================================================================*/
+static void owm_scheduler_heap_up (OwmSchedulerHeap *heap, int i)
+  {
+  OwmSchedulerItem *item = heap->items[i];
+  while (i > 0)
+    {
+    int parent = (i - 1) / 2;
+    if (heap->items[parent]->due <= item->due) break;
+    owm_scheduler_heap_set (heap, i, heap->items[parent]);
+    i = parent;
+    }
+  owm_scheduler_heap_set (heap, i, item);
+  }
+
+
+/*============================================================================
+ * owm_scheduler_heap_down
+ * =========================================================================*/
+static void owm_scheduler_heap_down (OwmSchedulerHeap *heap, int i)
+  {
+  OwmSchedulerItem *item = heap->items[i];
+  for (;;)
+    {
+    int child = 2 * i + 1;
+    if (child >= heap->n) break;
+    if (child + 1 < heap->n
+        && heap->items[child + 1]->due < heap->items[child]->due)
+      child++;
+    if (item->due <= heap->items[child]->due) break;
+    owm_scheduler_heap_set (heap, i, heap->items[child]);
+    i = child;
+    }
+  owm_scheduler_heap_set (heap, i, item);
+  }
+
+
+/*============================================================================
+ * owm_scheduler_heap_push
+ * =========================================================================*/
+static void owm_scheduler_heap_push (OwmSchedulerHeap *heap,
+      OwmSchedulerItem *item)
+  {
+  if (heap->n == heap->max)
+    {
+    heap->max = heap->max ? heap->max * 2 : 64;
+    heap->items = realloc (heap->items,
+      heap->max * sizeof (OwmSchedulerItem *));
+    }
+  heap->items[heap->n] = item;
+  owm_scheduler_heap_up (heap, heap->n++);
+  }
+
+
+/*============================================================================
+ * owm_scheduler_heap_remove
+ * =========================================================================*/
+static void owm_scheduler_heap_remove (OwmSchedulerHeap *heap,
+      OwmSchedulerItem *item)
+  {
+  int i = item->heap_index;
+  item->heap_index = -1;
+  heap->n--;
+  if (i == heap->n) return;
+  // Put the last item in the gap, and move it whichever way it needs
+  OwmSchedulerItem *last = heap->items[heap->n];
+  owm_scheduler_heap_set (heap, i, last);
+  owm_scheduler_heap_up (heap, i);
+  owm_scheduler_heap_down (heap, last->heap_index);
+  }
+
+
+/*============================================================================
+ * owm_scheduler_find
+ * Call with the lock held
+ * =========================================================================*/
+static OwmSchedulerItem *owm_scheduler_find (const OwmScheduler *self,
+      const char *location_id, uint32_t hash)
+  {
+  OwmSchedulerItem *item = self->buckets[hash & (self->n_buckets - 1)];
+  while (item)
+    {
+    if (item->hash == hash && strcmp (item->location_id, location_id) == 0)
+      return item;
+    item = item->chain;
+    }
+  return NULL;
+  }
+
+
+/*============================================================================
+ * owm_scheduler_grow
+ * Double the number of hash buckets. Call with the lock held
+ * =========================================================================*/
+static void owm_scheduler_grow (OwmScheduler *self)
+  {
+  int n = self->n_buckets * 2;
+  OwmSchedulerItem **buckets = calloc ((size_t)n,
+    sizeof (OwmSchedulerItem *));
+  int i;
+  for (i = 0; i < self->n_buckets; i++)
+    {
+    OwmSchedulerItem *item = self->buckets[i];
+    while (item)
+      {
+      OwmSchedulerItem *chain = item->chain;
+      item->chain = buckets[item->hash & (n - 1)];
+      buckets[item->hash & (n - 1)] = item;
+      item = chain;
+      }
+    }
+  free (self->buckets);
+  self->buckets = buckets;
+  self->n_buckets = n;
+  }
+
+
+/*============================================================================
+ * owm_scheduler_item_free
+ * =========================================================================*/
+static void owm_scheduler_item_free (OwmSchedulerItem *item)
+  {
+  free (item->location_id);
+  free (item);
+  }
+
+
+/*============================================================================
+ * owm_scheduler_refill
+ * Top up the token bucket for the time since it was last topped up
+ * =========================================================================*/
+static void owm_scheduler_refill (OwmScheduler *self, double now)
+  {
+  if (self->rate > 0)
+    {
+    self->tokens += (now - self->last_refill) * self->rate;
+    if (self->tokens > self->capacity) self->tokens = self->capacity;
+    }
+  self->last_refill = now;
+  }
+
+
+/*============================================================================
+ * owm_scheduler_wait_until
+ * Wait for a signal, or until the given time. Call with the lock held
+ * =========================================================================*/
+static void owm_scheduler_wait_until (OwmScheduler *self, double when)
+  {
+  if (isinf (when))
+    {
+    pthread_cond_wait (&self->cond, &self->mutex);
+    return;
+    }
+  struct timespec ts;
+  ts.tv_sec = (time_t)when;
+  ts.tv_nsec = (long)((when - ts.tv_sec) * 1e9);
+  pthread_cond_timedwait (&self->cond, &self->mutex, &ts);
+  }
+
+
+/*============================================================================
+ * owm_scheduler_reschedule
+ * Put a location back in its heap after a fetch. Call with the lock held
+ * =========================================================================*/
+static void owm_scheduler_reschedule (OwmScheduler *self,
+      OwmSchedulerItem *item, BOOL ok, double now)
+  {
+  if (ok)
+    {
+    item->failures = 0;
+    double jitter = OWM_SCHEDULER_JITTER
+      * (rand_r (&self->seed) / (double)RAND_MAX);
+    item->due = now + item->max_age * (1.0 - jitter);
+    }
+  else
+    {
+    int backoff = item->failures < OWM_SCHEDULER_MAX_BACKOFF ?
+      item->failures : OWM_SCHEDULER_MAX_BACKOFF;
+    double retry = (double)OWM_SCHEDULER_RETRY * (1 << backoff);
+    item->failures++;
+    item->due = now + (retry < item->max_age ? retry : item->max_age);
+    }
+  owm_scheduler_heap_push (&self->heaps[item->priority], item);
+  }
+
+
+/*============================================================================
+ * owm_scheduler_worker
+ * =========================================================================*/
+static void *owm_scheduler_worker (void *data)
+  {
+  OwmScheduler *self = data;
+  pthread_mutex_lock (&self->mutex);
+  while (self->running)
+    {
+    double now = owm_scheduler_now ();
+    owm_scheduler_refill (self, now);
+
+    // The highest-priority location that is due, and failing that, the
+    //  time the next one falls due
+    OwmSchedulerItem *item = NULL;
+    double next = INFINITY;
+    int p;
+    for (p = OWM_SCHEDULER_PRIORITIES - 1; p >= 0; p--)
+      {
+      const OwmSchedulerHeap *heap = &self->heaps[p];
+      if (heap->n == 0) continue;
+      OwmSchedulerItem *top = heap->items[0];
+      if (top->due <= now)
+        {
+        if (!item) item = top;
+        }
+      else if (top->due < next)
+        next = top->due;
+      }
+    if (item && self->rate > 0 && self->tokens < 1.0)
+      {
+      next = now + (1.0 - self->tokens) / self->rate;
+      item = NULL;
+      }
+    if (!item)
+      {
+      owm_scheduler_wait_until (self, next);
+      continue;
+      }
+
+    owm_scheduler_heap_remove (&self->heaps[item->priority], item);
+    if (self->rate > 0) self->tokens -= 1.0;
+    self->in_flight++;
+    self->dispatched++;
+    self->total_lag += now - item->due;
+    pthread_mutex_unlock (&self->mutex);
+
+    // The item can't be freed while it is being fetched, and its
+    //  location ID never changes, so it can be used without the lock
+    char *error = NULL;
+    OwmForecast *forecast = owm_context_get_forecast (self->context,
+      self->app_id, item->location_id, &self->options, &error);
+    if (forecast)
+      self->callback (item->location_id, forecast, NULL, self->user_data);
+    else
+      self->callback (item->location_id, NULL,
+        error ? error : "Unknown error", self->user_data);
+    owm_forecast_destroy (forecast);
+    free (error);
+
+    pthread_mutex_lock (&self->mutex);
+    self->in_flight--;
+    if (forecast) self->refreshes++; else self->failures++;
+    if (item->removed)
+      owm_scheduler_item_free (item);
+    else
+      {
+      owm_scheduler_reschedule (self, item, forecast != NULL,
+        owm_scheduler_now ());
+      // Other workers may be sleeping until some later time
+      pthread_cond_broadcast (&self->cond);
+      }
+    }
+  pthread_mutex_unlock (&self->mutex);
+  return NULL;
+  }
+
+
+/*============================================================================
+ * owm_scheduler_create
+ * =========================================================================*/
+OwmScheduler *owm_scheduler_create (OwmContext *context, const char *app_id,
+      int workers, int calls_per_minute, const OwmForecastOptions *options,
+      OwmSchedulerCallback callback, void *user_data)
+  {
+  OwmScheduler *self = malloc (sizeof (OwmScheduler));
+  memset (self, 0, sizeof (OwmScheduler));
+
+  pthread_mutex_init (&self->mutex, NULL);
+  pthread_condattr_t attr;
+  pthread_condattr_init (&attr);
+  pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+  pthread_cond_init (&self->cond, &attr);
+  pthread_condattr_destroy (&attr);
+
+  self->running = TRUE;
+  self->context = owm_context_ref
+    (context ? context : owm_context_get_default ());
+  self->app_id = strdup (app_id);
+  if (options) self->options = *options;
+  self->callback = callback;
+  self->user_data = user_data;
+  self->n_buckets = 64;
+  self->buckets = calloc (self->n_buckets, sizeof (OwmSchedulerItem *));
+  self->seed = (unsigned int)time (NULL);
+
+  // The bucket holds no more than a second's worth of calls, so a burst
+  //  of due locations is still spread out
+  if (calls_per_minute > 0)
+    {
+    self->rate = calls_per_minute / 60.0;
+    self->capacity = self->rate > 1.0 ? self->rate : 1.0;
+    self->tokens = self->capacity;
+    }
+  self->last_refill = owm_scheduler_now ();
+
+  if (workers < 1) workers = 1;
+  self->workers = malloc (workers * sizeof (pthread_t));
+  int i;
+  for (i = 0; i < workers; i++)
+    {
+    if (pthread_create (&self->workers[i], NULL, owm_scheduler_worker,
+          self) != 0)
+      break;
+    }
+  self->n_workers = i;
+  return self;
+  }
+
+
+/*============================================================================
+ * owm_scheduler_destroy
+ * =========================================================================*/
+void owm_scheduler_destroy (OwmScheduler *self)
+  {
+  if (!self) return;
+  pthread_mutex_lock (&self->mutex);
+  self->running = FALSE;
+  pthread_cond_broadcast (&self->cond);
+  pthread_mutex_unlock (&self->mutex);
+  int i;
+  for (i = 0; i < self->n_workers; i++)
+    pthread_join (self->workers[i], NULL);
+
+  // Now that no fetches are running, every item is in the hash table
+  for (i = 0; i < self->n_buckets; i++)
+    {
+    OwmSchedulerItem *item = self->buckets[i];
+    while (item)
+      {
+      OwmSchedulerItem *chain = item->chain;
+      owm_scheduler_item_free (item);
+      item = chain;
+      }
+    }
+  for (i = 0; i < OWM_SCHEDULER_PRIORITIES; i++)
+    free (self->heaps[i].items);
+  free (self->buckets);
+  free (self->workers);
+  free (self->app_id);
+  owm_context_destroy (self->context);
+  pthread_cond_destroy (&self->cond);
+  pthread_mutex_destroy (&self->mutex);
+  free (self);
+  }
+
+
+/*============================================================================
+ * owm_scheduler_add
+ * =========================================================================*/
+void owm_scheduler_add (OwmScheduler *self, const char *location_id,
+      int priority, int max_age)
+  {
+  if (priority < 0) priority = 0;
+  if (priority >= OWM_SCHEDULER_PRIORITIES)
+    priority = OWM_SCHEDULER_PRIORITIES - 1;
+  if (max_age < 1) max_age = 1;
+  uint32_t hash = owm_scheduler_hash (location_id);
+
+  pthread_mutex_lock (&self->mutex);
+  OwmSchedulerItem *item = owm_scheduler_find (self, location_id, hash);
+  if (item)
+    {
+    item->max_age = max_age;
+    if (item->priority != priority && item->heap_index >= 0)
+      {
+      owm_scheduler_heap_remove (&self->heaps[item->priority], item);
+      item->priority = priority;
+      owm_scheduler_heap_push (&self->heaps[priority], item);
+      }
+    item->priority = priority;
+    }
+  else
+    {
+    item = malloc (sizeof (OwmSchedulerItem));
+    memset (item, 0, sizeof (OwmSchedulerItem));
+    item->location_id = strdup (location_id);
+    item->hash = hash;
+    item->priority = priority;
+    item->max_age = max_age;
+    // A new location is due at once. If many are added together, the
+    //  budget spreads their first fetches out, and the jitter keeps
+    //  them spread
+    item->due = owm_scheduler_now ();
+    if (self->n_items >= self->n_buckets) owm_scheduler_grow (self);
+    item->chain = self->buckets[hash & (self->n_buckets - 1)];
+    self->buckets[hash & (self->n_buckets - 1)] = item;
+    self->n_items++;
+    owm_scheduler_heap_push (&self->heaps[priority], item);
+    }
+  pthread_cond_signal (&self->cond);
+  pthread_mutex_unlock (&self->mutex);
+  }
+
+
+/*============================================================================
+ * owm_scheduler_remove
+ * =========================================================================*/
+void owm_scheduler_remove (OwmScheduler *self, const char *location_id)
+  {
+  uint32_t hash = owm_scheduler_hash (location_id);
+  pthread_mutex_lock (&self->mutex);
+  OwmSchedulerItem **pp = &self->buckets[hash & (self->n_buckets - 1)];
+  while (*pp && !((*pp)->hash == hash
+      && strcmp ((*pp)->location_id, location_id) == 0))
+    pp = &(*pp)->chain;
+  OwmSchedulerItem *item = *pp;
+  if (item)
+    {
+    *pp = item->chain;
+    self->n_items--;
+    if (item->heap_index >= 0)
+      {
+      owm_scheduler_heap_remove (&self->heaps[item->priority], item);
+      owm_scheduler_item_free (item);
+      }
+    else
+      item->removed = TRUE;
+    }
+  pthread_mutex_unlock (&self->mutex);
+  }
+
+
+/*============================================================================
+ * owm_scheduler_get_stats
+ * Counting the backlog means looking at every waiting location, but
+ *   this is meant to be called only now and again
+ * =========================================================================*/
+void owm_scheduler_get_stats (OwmScheduler *self, OwmSchedulerStats *stats)
+  {
+  memset (stats, 0, sizeof (OwmSchedulerStats));
+  pthread_mutex_lock (&self->mutex);
+  double now = owm_scheduler_now ();
+  int p, i;
+  for (p = 0; p < OWM_SCHEDULER_PRIORITIES; p++)
+    {
+    const OwmSchedulerHeap *heap = &self->heaps[p];
+    for (i = 0; i < heap->n; i++)
+      if (heap->items[i]->due <= now) stats->backlog++;
+    if (heap->n && now - heap->items[0]->due > stats->lag)
+      stats->lag = now - heap->items[0]->due;
+    }
+  stats->locations = self->n_items;
+  stats->in_flight = self->in_flight;
+  stats->refreshes = self->refreshes;
+  stats->failures = self->failures;
+  if (self->dispatched)
+    stats->mean_lag = self->total_lag / self->dispatched;
+  pthread_mutex_unlock (&self->mutex);
+  }
+
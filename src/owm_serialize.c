@@ -0,0 +1,257 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_serialize.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * Layout of version 2:
+ *   "OWMB", version (1 byte), forecast flags (1 byte), 2 zero bytes,
+ *   total length (4 bytes, little-endian)
+ *   sunrise, sunset - sunrise, fetch time
+ *   the OWM_VALID_xxx fields the forecast was parsed with, or zero
+ *   number of points, then for each point:
+ *     validity bits, start - previous start, end - start,
+ *     precipitation, and then each other field whose validity bit is
+ *     set, in bit order. Precipitation is always written, because the
+ *     parser sets it without marking it valid
+ *   number of days, then for each day:
+ *     day - previous day, point count, validity bits, and the fields
+ *     whose validity bits are set
+ *   CRC-32 of everything before it (4 bytes, little-endian)
+ * Version 1 is the same, but without the parsed fields; it is still read,
+ *   as a forecast parsed with all of them.
+ * Integers are LEB128 varints; signed ones are zigzag-encoded first. Times
+ *   are seconds. Because the points are three hours apart, and most
+ *   values are small after quantization, most fields take one or two
+ *   bytes.
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <owm/owm_defs.h>
+#include <owm/owm_forecast.h>
+#include <owm/owm_serialize.h>
+#include "owm_private.h"
+
+#define OWM_SERIALIZE_MAGIC "OWMB"
+#define OWM_SERIALIZE_HEADER 12
+
+
+/*============================================================================
+ * owm_forecast_serialize
+ * =========================================================================*/
+size_t owm_forecast_serialize (const OwmForecast *self,
+      unsigned char *buffer, size_t size)
+  {
+  OwmWriter w = { buffer, buffer ? size : 0, 0 };
+  int i;
+
+  for (i = 0; i < 4; i++)
+    owm_writer_byte (&w, OWM_SERIALIZE_MAGIC[i]);
+  owm_writer_byte (&w, OWM_SERIALIZE_VERSION);
+  owm_writer_byte (&w, (unsigned char)self->flags);
+  owm_writer_byte (&w, 0);
+  owm_writer_byte (&w, 0);
+  owm_writer_u32 (&w, 0); // Length, filled in at the end
+
+  owm_writer_varint (&w, self->sunrise);
+  owm_writer_varint (&w, self->sunset - self->sunrise);
+  owm_writer_varint (&w, self->fetched);
+  owm_writer_uvarint (&w, (unsigned int)self->fields);
+
+  owm_writer_uvarint (&w, self->n_points);
+  time_t last = 0;
+  for (i = 0; i < self->n_points; i++)
+    {
+    const OwmWeather *p = &self->points[i];
+    int v = p->valid;
+    owm_writer_uvarint (&w, v);
+    owm_writer_varint (&w, p->start_time - last);
+    owm_writer_varint (&w, p->end_time - p->start_time);
+    last = p->start_time;
+    owm_writer_varint (&w, p->precipitation);
+    if (v & OWM_VALID_CONDITIONS)
+      owm_writer_varint (&w, p->conditions);
+    if (v & OWM_VALID_TEMP)
+      owm_writer_quantized (&w, p->temp, OWM_Q_TEMP);
+    if (v & OWM_VALID_WIND_DIRECTION)
+      owm_writer_quantized (&w, p->wind_direction, OWM_Q_DIRECTION);
+    if (v & OWM_VALID_WIND_SPEED)
+      owm_writer_quantized (&w, p->wind_speed, OWM_Q_SPEED);
+    if (v & OWM_VALID_PRESSURE)
+      owm_writer_quantized (&w, p->pressure, OWM_Q_PRESSURE);
+    if (v & OWM_VALID_HUMIDITY)
+      owm_writer_quantized (&w, p->humidity, OWM_Q_PERCENT);
+    if (v & OWM_VALID_CLOUD_COVER)
+      owm_writer_quantized (&w, p->cloud_cover, OWM_Q_PERCENT);
+    }
+
+  owm_writer_uvarint (&w, self->n_days);
+  last = 0;
+  for (i = 0; i < self->n_days; i++)
+    {
+    const OwmDailySummary *d = &self->days[i];
+    int v = d->valid;
+    owm_writer_varint (&w, d->day - last);
+    last = d->day;
+    owm_writer_uvarint (&w, d->points);
+    owm_writer_uvarint (&w, v);
+    if (v & OWM_VALID_CONDITIONS)
+      owm_writer_varint (&w, d->modal_conditions);
+    if (v & OWM_VALID_TEMP)
+      {
+      owm_writer_quantized (&w, d->min_temp, OWM_Q_TEMP);
+      owm_writer_quantized (&w, d->max_temp, OWM_Q_TEMP);
+      }
+    if (v & OWM_VALID_WIND_DIRECTION)
+      owm_writer_quantized (&w, d->wind_direction, OWM_Q_DIRECTION);
+    if (v & OWM_VALID_WIND_SPEED)
+      owm_writer_quantized (&w, d->wind_speed, OWM_Q_SPEED);
+    }
+
+  size_t len = w.pos + 4;
+  if (len <= w.size)
+    {
+    // Patch in the length, then checksum everything so far
+    OwmWriter lw = { buffer + 8, 4, 0 };
+    owm_writer_u32 (&lw, (uint32_t)len);
+    owm_writer_u32 (&w, owm_crc32_update (0, buffer, w.pos));
+    }
+  return len;
+  }
+
+
+/*============================================================================
+ * owm_forecast_deserialize
+ * =========================================================================*/
+OwmForecast *owm_forecast_deserialize (const unsigned char *buffer,
+      size_t len, char **error)
+  {
+  if (len < OWM_SERIALIZE_HEADER + 4
+      || memcmp (buffer, OWM_SERIALIZE_MAGIC, 4) != 0)
+    {
+    if (error) *error = strdup ("Not a serialized forecast");
+    return NULL;
+    }
+  int version = buffer[4];
+  if (version < 1 || version > OWM_SERIALIZE_VERSION)
+    {
+    if (error)
+      asprintf (error, "Unsupported serialized forecast version %d",
+        buffer[4]);
+    return NULL;
+    }
+
+  OwmReader r = { buffer + 8, buffer + len, TRUE };
+  uint32_t stored_len = owm_reader_u32 (&r);
+  OwmReader cr = { buffer + len - 4, buffer + len, TRUE };
+  uint32_t crc = owm_reader_u32 (&cr);
+  if (stored_len != len || crc != owm_crc32_update (0, buffer, len - 4))
+    {
+    if (error) *error = strdup ("Serialized forecast is damaged");
+    return NULL;
+    }
+  r.end = buffer + len - 4;
+
+  int flags = buffer[5];
+  time_t sunrise = owm_reader_varint (&r);
+  time_t sunset = sunrise + owm_reader_varint (&r);
+  time_t fetched = owm_reader_varint (&r);
+  int fields = version >= 2 ? (int)owm_reader_uvarint (&r) : 0;
+
+  // Each point takes at least four bytes, and each day at least three
+  int n_points = owm_reader_count (&r, 4);
+  const unsigned char *points_start = r.p;
+  int i;
+  // Skip over the points to find the number of days, so that the
+  //  forecast can be allocated in one go. This is cheap, and means that
+  //  every field gets checked before we allocate anything
+  for (i = 0; i < n_points && r.ok; i++)
+    {
+    int v = (int)owm_reader_uvarint (&r);
+    int values = __builtin_popcount (v & ~(OWM_VALID_START | OWM_VALID_END
+      | OWM_VALID_PRECIPITATION));
+    int f;
+    for (f = 0; f < values + 3; f++)
+      owm_reader_uvarint (&r);
+    }
+  int n_days = owm_reader_count (&r, 3);
+  if (!r.ok)
+    {
+    if (error) *error = strdup ("Serialized forecast is damaged");
+    return NULL;
+    }
+
+  OwmForecast *self = owm_forecast_create (n_points, n_days);
+  self->flags = flags;
+  self->sunrise = sunrise;
+  self->sunset = sunset;
+  self->fetched = fetched;
+  self->fields = fields;
+
+  r.p = points_start;
+  time_t last = 0;
+  for (i = 0; i < n_points; i++)
+    {
+    OwmWeather *p = &self->points[i];
+    owm_weather_init (p);
+    int v = (int)owm_reader_uvarint (&r);
+    p->valid = v;
+    p->start_time = last + owm_reader_varint (&r);
+    p->end_time = p->start_time + owm_reader_varint (&r);
+    last = p->start_time;
+    p->precipitation = owm_reader_varint (&r);
+    if (v & OWM_VALID_CONDITIONS)
+      p->conditions = owm_reader_varint (&r);
+    if (v & OWM_VALID_TEMP)
+      p->temp = owm_reader_quantized (&r, OWM_Q_TEMP);
+    if (v & OWM_VALID_WIND_DIRECTION)
+      p->wind_direction = owm_reader_quantized (&r, OWM_Q_DIRECTION);
+    if (v & OWM_VALID_WIND_SPEED)
+      p->wind_speed = owm_reader_quantized (&r, OWM_Q_SPEED);
+    if (v & OWM_VALID_PRESSURE)
+      p->pressure = owm_reader_quantized (&r, OWM_Q_PRESSURE);
+    if (v & OWM_VALID_HUMIDITY)
+      p->humidity = owm_reader_quantized (&r, OWM_Q_PERCENT);
+    if (v & OWM_VALID_CLOUD_COVER)
+      p->cloud_cover = owm_reader_quantized (&r, OWM_Q_PERCENT);
+    owm_weather_update_wind_vector (p);
+    }
+  self->n_points = n_points;
+
+  owm_reader_uvarint (&r); // n_days, already known
+  last = 0;
+  for (i = 0; i < n_days; i++)
+    {
+    OwmDailySummary *d = &self->days[i];
+    memset (d, 0, sizeof (OwmDailySummary));
+    d->day = last + owm_reader_varint (&r);
+    last = d->day;
+    d->points = (int)owm_reader_uvarint (&r);
+    int v = (int)owm_reader_uvarint (&r);
+    d->valid = v;
+    if (v & OWM_VALID_CONDITIONS)
+      d->modal_conditions = owm_reader_varint (&r);
+    if (v & OWM_VALID_TEMP)
+      {
+      d->min_temp = owm_reader_quantized (&r, OWM_Q_TEMP);
+      d->max_temp = owm_reader_quantized (&r, OWM_Q_TEMP);
+      }
+    if (v & OWM_VALID_WIND_DIRECTION)
+      d->wind_direction = owm_reader_quantized (&r, OWM_Q_DIRECTION);
+    if (v & OWM_VALID_WIND_SPEED)
+      d->wind_speed = owm_reader_quantized (&r, OWM_Q_SPEED);
+    }
+  self->n_days = n_days;
+
+  if (!r.ok || r.p != r.end)
+    {
+    owm_forecast_destroy (self);
+    if (error) *error = strdup ("Serialized forecast is damaged");
+    return NULL;
+    }
+  return self;
+  }
+
@@ -0,0 +1,391 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_shm.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * The segment is an OwmShmHeader followed by a power-of-two number of
+ *   slots of equal size, each an OwmShmSlot followed by room for the
+ *   points and summaries, and rounded up to a cache line. Locations are
+ *   placed by hash, with linear probing. A slot, once given to a
+ *   location, keeps it, so a reader's probe always stops at the same
+ *   place as the publisher's did.
+ * Each slot's sequence number is odd while the publisher is writing to
+ *   it. A reader notes the number, copies the slot, and then checks that
+ *   the number was even and has not changed; if not, it tries again.
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <owm/owm_defs.h>
+#include <owm/owm_shm.h>
+#include "owm_private.h"
+
+#define OWM_SHM_MAGIC "OWMSHM\0\0"
+#define OWM_SHM_VERSION 2
+#define OWM_SHM_LINE 64
+#define OWM_SHM_ROUND(n) (((n) + OWM_SHM_LINE - 1) & ~(size_t)(OWM_SHM_LINE - 1))
+
+typedef struct _OwmShmHeader
+  {
+  char magic[8];
+  uint32_t version;
+  uint32_t weather_size;
+  uint32_t summary_size;
+  uint32_t n_slots;
+  uint32_t max_points;
+  uint32_t max_days;
+  uint64_t slot_size;
+  } OwmShmHeader;
+
+typedef struct _OwmShmSlot
+  {
+  uint32_t seq;
+  uint32_t used;
+  char location[OWM_SHM_MAX_LOCATION];
+  int64_t fetched;
+  int64_t sunrise;
+  int64_t sunset;
+  int32_t flags;
+  int32_t n_points;
+  int32_t n_days;
+  int32_t fields;
+  } OwmShmSlot;
+
+struct _OwmShm
+  {
+  char *map;
+  size_t map_len;
+  BOOL writable;
+  OwmShmHeader *header;
+  size_t points_offset; // Within a slot
+  size_t days_offset;
+  };
+
+
+/*============================================================================
+ * owm_shm_hash
+ * 32-bit FNV-1a
+ * =========================================================================*/
+static uint32_t owm_shm_hash (const char *s)
+  {
+  uint32_t hash = 2166136261u;
+  const unsigned char *p;
+  for (p = (const unsigned char *)s; *p; p++)
+    {
+    hash ^= *p;
+    hash *= 16777619u;
+    }
+  return hash;
+  }
+
+
+/*============================================================================
+ * owm_shm_new
+ * Wrap a mapping of the segment
+ * =========================================================================*/
+static OwmShm *owm_shm_new (void *map, size_t len, BOOL writable)
+  {
+  OwmShm *self = malloc (sizeof (OwmShm));
+  self->map = map;
+  self->map_len = len;
+  self->writable = writable;
+  self->header = map;
+  self->points_offset = OWM_ALIGN (sizeof (OwmShmSlot));
+  self->days_offset = self->points_offset
+    + OWM_ALIGN ((size_t)self->header->max_points * sizeof (OwmWeather));
+  return self;
+  }
+
+
+/*============================================================================
+ * owm_shm_slot
+ * =========================================================================*/
+static OwmShmSlot *owm_shm_slot (const OwmShm *self, uint32_t i)
+  {
+  return (OwmShmSlot *)(self->map + OWM_SHM_ROUND (sizeof (OwmShmHeader))
+    + i * self->header->slot_size);
+  }
+
+
+/*============================================================================
+ * owm_shm_create
+ * =========================================================================*/
+OwmShm *owm_shm_create (const char *name, int n_locations, int max_points,
+      int max_days, char **error)
+  {
+  uint32_t n_slots = 16;
+  while (n_slots < 2 * (uint32_t)n_locations) n_slots *= 2;
+  size_t slot_size = OWM_SHM_ROUND (OWM_ALIGN (sizeof (OwmShmSlot))
+    + OWM_ALIGN ((size_t)max_points * sizeof (OwmWeather))
+    + (size_t)max_days * sizeof (OwmDailySummary));
+  size_t len = OWM_SHM_ROUND (sizeof (OwmShmHeader)) + n_slots * slot_size;
+
+  // Start from a new segment, so that readers still attached to an old
+  //  one are not confused by a change of layout
+  shm_unlink (name);
+  int fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0)
+    {
+    if (error)
+      asprintf (error, "Can't create shared memory %s: %s", name,
+        strerror (errno));
+    return NULL;
+    }
+  void *map = MAP_FAILED;
+  if (ftruncate (fd, len) == 0)
+    map = mmap (NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+    {
+    if (error)
+      asprintf (error, "Can't map shared memory %s: %s", name,
+        strerror (errno));
+    close (fd);
+    shm_unlink (name);
+    return NULL;
+    }
+  close (fd);
+
+  // A new segment is zero-filled, so every slot starts out unused. The
+  //  magic number goes in last, so that a reader attaching early
+  //  doesn't see a half-made header
+  OwmShmHeader *h = map;
+  h->version = OWM_SHM_VERSION;
+  h->weather_size = sizeof (OwmWeather);
+  h->summary_size = sizeof (OwmDailySummary);
+  h->n_slots = n_slots;
+  h->max_points = max_points;
+  h->max_days = max_days;
+  h->slot_size = slot_size;
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+  memcpy (h->magic, OWM_SHM_MAGIC, 8);
+
+  return owm_shm_new (map, len, TRUE);
+  }
+
+
+/*============================================================================
+ * owm_shm_attach
+ * =========================================================================*/
+OwmShm *owm_shm_attach (const char *name, char **error)
+  {
+  int fd = shm_open (name, O_RDONLY, 0);
+  if (fd < 0)
+    {
+    if (error)
+      asprintf (error, "Can't open shared memory %s: %s", name,
+        strerror (errno));
+    return NULL;
+    }
+  struct stat sb;
+  void *map = MAP_FAILED;
+  size_t len = 0;
+  if (fstat (fd, &sb) == 0 && (size_t)sb.st_size >= sizeof (OwmShmHeader))
+    {
+    len = sb.st_size;
+    map = mmap (NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    }
+  close (fd);
+
+  if (map != MAP_FAILED)
+    {
+    const OwmShmHeader *h = map;
+    if (memcmp (h->magic, OWM_SHM_MAGIC, 8) == 0
+        && h->version == OWM_SHM_VERSION
+        && h->weather_size == sizeof (OwmWeather)
+        && h->summary_size == sizeof (OwmDailySummary)
+        && h->n_slots != 0 && (h->n_slots & (h->n_slots - 1)) == 0
+        && h->slot_size % OWM_SHM_LINE == 0
+        && OWM_ALIGN (sizeof (OwmShmSlot))
+             + OWM_ALIGN ((uint64_t)h->max_points * sizeof (OwmWeather))
+             + (uint64_t)h->max_days * sizeof (OwmDailySummary)
+             <= h->slot_size
+        && OWM_SHM_ROUND (sizeof (OwmShmHeader))
+             + (uint64_t)h->n_slots * h->slot_size == len)
+      return owm_shm_new (map, len, FALSE);
+    munmap (map, len);
+    }
+  if (error)
+    asprintf (error, "%s is not a forecast store", name);
+  return NULL;
+  }
+
+
+/*============================================================================
+ * owm_shm_detach
+ * =========================================================================*/
+void owm_shm_detach (OwmShm *self)
+  {
+  if (self)
+    {
+    munmap (self->map, self->map_len);
+    free (self);
+    }
+  }
+
+
+/*============================================================================
+ * owm_shm_unlink
+ * =========================================================================*/
+void owm_shm_unlink (const char *name)
+  {
+  shm_unlink (name);
+  }
+
+
+/*============================================================================
+ * owm_shm_publish
+ * =========================================================================*/
+BOOL owm_shm_publish (OwmShm *self, const char *location,
+      const OwmForecast *forecast, char **error)
+  {
+  const OwmShmHeader *h = self->header;
+  if (!self->writable)
+    {
+    if (error) *error = strdup ("Forecast store is attached read-only");
+    return FALSE;
+    }
+  if (strlen (location) >= OWM_SHM_MAX_LOCATION)
+    {
+    if (error) asprintf (error, "Location ID %s is too long", location);
+    return FALSE;
+    }
+  if ((uint32_t)forecast->n_points > h->max_points
+      || (uint32_t)forecast->n_days > h->max_days)
+    {
+    if (error)
+      asprintf (error, "Forecast for %s has too many points", location);
+    return FALSE;
+    }
+
+  uint32_t mask = h->n_slots - 1;
+  uint32_t s = owm_shm_hash (location) & mask;
+  uint32_t probes;
+  OwmShmSlot *slot = NULL;
+  for (probes = 0; probes <= mask; probes++, s = (s + 1) & mask)
+    {
+    OwmShmSlot *t = owm_shm_slot (self, s);
+    if (!t->used || strcmp (t->location, location) == 0)
+      {
+      slot = t;
+      break;
+      }
+    }
+  if (!slot)
+    {
+    if (error) asprintf (error, "No room in forecast store for %s", location);
+    return FALSE;
+    }
+
+  uint32_t seq = slot->seq;
+  __atomic_store_n (&slot->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+
+  if (!slot->used)
+    {
+    strcpy (slot->location, location);
+    slot->used = 1;
+    }
+  slot->fetched = forecast->fetched;
+  slot->sunrise = forecast->sunrise;
+  slot->sunset = forecast->sunset;
+  slot->flags = forecast->flags;
+  slot->fields = forecast->fields;
+  slot->n_points = forecast->n_points;
+  slot->n_days = forecast->n_days;
+  memcpy ((char *)slot + self->points_offset, forecast->points,
+    forecast->n_points * sizeof (OwmWeather));
+  memcpy ((char *)slot + self->days_offset, forecast->days,
+    forecast->n_days * sizeof (OwmDailySummary));
+
+  __atomic_store_n (&slot->seq, seq + 2, __ATOMIC_RELEASE);
+  return TRUE;
+  }
+
+
+/*============================================================================
+ * owm_shm_read_slot
+ * Copy a slot, if it holds the location, into a new forecast. The copy
+ *   may be torn, if the publisher was writing at the time, so everything
+ *   read is checked before it is used, and the caller must check the
+ *   sequence number afterwards. Sets *found to say whether the slot
+ *   holds the location, or is unused
+ * =========================================================================*/
+static OwmForecast *owm_shm_read_slot (const OwmShm *self,
+      const OwmShmSlot *slot, const char *location, BOOL *found)
+  {
+  const OwmShmHeader *h = self->header;
+  char slot_location[OWM_SHM_MAX_LOCATION];
+  *found = FALSE;
+  if (!slot->used) return NULL;
+  memcpy (slot_location, slot->location, OWM_SHM_MAX_LOCATION);
+  slot_location[OWM_SHM_MAX_LOCATION - 1] = 0;
+  if (strcmp (slot_location, location) != 0) return NULL;
+  *found = TRUE;
+
+  int n_points = slot->n_points;
+  int n_days = slot->n_days;
+  if (n_points < 0 || (uint32_t)n_points > h->max_points
+      || n_days < 0 || (uint32_t)n_days > h->max_days)
+    return NULL;
+  OwmForecast *ret = owm_forecast_create (n_points, n_days);
+  ret->fetched = slot->fetched;
+  ret->sunrise = slot->sunrise;
+  ret->sunset = slot->sunset;
+  ret->flags = slot->flags;
+  ret->fields = slot->fields;
+  ret->n_points = n_points;
+  ret->n_days = n_days;
+  memcpy (ret->points, (const char *)slot + self->points_offset,
+    n_points * sizeof (OwmWeather));
+  memcpy (ret->days, (const char *)slot + self->days_offset,
+    n_days * sizeof (OwmDailySummary));
+  return ret;
+  }
+
+
+/*============================================================================
+ * owm_shm_lookup
+ * =========================================================================*/
+OwmForecast *owm_shm_lookup (OwmShm *self, const char *location)
+  {
+  const OwmShmHeader *h = self->header;
+  uint32_t mask = h->n_slots - 1;
+  uint32_t s = owm_shm_hash (location) & mask;
+  uint32_t probes;
+  for (probes = 0; probes <= mask; probes++, s = (s + 1) & mask)
+    {
+    OwmShmSlot *slot = owm_shm_slot (self, s);
+    for (;;)
+      {
+      uint32_t seq = __atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE);
+      BOOL found = FALSE;
+      OwmForecast *ret = NULL;
+      BOOL used = FALSE;
+      if (!(seq & 1))
+        {
+        used = slot->used;
+        ret = owm_shm_read_slot (self, slot, location, &found);
+        }
+      __atomic_thread_fence (__ATOMIC_ACQUIRE);
+      if (!(seq & 1)
+          && __atomic_load_n (&slot->seq, __ATOMIC_RELAXED) == seq)
+        {
+        // A consistent copy
+        if (found) return ret;
+        if (!used) return NULL;
+        break; // Some other location; carry on probing
+        }
+      owm_forecast_destroy (ret);
+      }
+    }
+  return NULL;
+  }
+
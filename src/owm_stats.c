@@ -0,0 +1,249 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_stats.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <owm/owm_defs.h>
+#include <owm/owm_stats.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define OWM_STATS_X86
+#include <immintrin.h>
+#endif
+
+/* A kernel accumulates count, min, max and sum into stats, which the
+   caller initializes */
+typedef void (*OwmStatsKernel) (const double *values,
+   const unsigned char *mask, int n, OwmStats *stats);
+
+static OwmStatsKernel owm_stats_kernel;
+static const char *owm_stats_implementation;
+static pthread_once_t owm_stats_once = PTHREAD_ONCE_INIT;
+
+
+/*============================================================================
+ * owm_stats_kernel_scalar
+ * Plain C version, for CPUs without SSE2, and for the odd values left
+ *   over at the end of the vectorized loops
+ * =========================================================================*/
+static void owm_stats_kernel_scalar (const double *values,
+      const unsigned char *mask, int n, OwmStats *stats)
+  {
+  int i;
+  for (i = 0; i < n; i++)
+    {
+    if (mask && !mask[i]) continue;
+    double v = values[i];
+    if (v < stats->min) stats->min = v;
+    if (v > stats->max) stats->max = v;
+    stats->sum += v;
+    stats->count++;
+    }
+  }
+
+
+#ifdef OWM_STATS_X86
+
+/*============================================================================
+ * owm_stats_kernel_sse2
+ * Two values at a time. Masked-out values are replaced by +inf, -inf and
+ *   zero, so that they have no effect on the min, max and sum, and the
+ *   loop has no branches
+ * =========================================================================*/
+__attribute__ ((target ("sse2")))
+static void owm_stats_kernel_sse2 (const double *values,
+      const unsigned char *mask, int n, OwmStats *stats)
+  {
+  const __m128d pinf = _mm_set1_pd (INFINITY);
+  const __m128d ninf = _mm_set1_pd (-INFINITY);
+  __m128d vmin = pinf;
+  __m128d vmax = ninf;
+  __m128d vsum = _mm_setzero_pd ();
+  int count = 0;
+  int i;
+  for (i = 0; i + 2 <= n; i += 2)
+    {
+    __m128d v = _mm_loadu_pd (values + i);
+    if (mask)
+      {
+      __m128d m = _mm_castsi128_pd (_mm_set_epi64x
+        (mask[i + 1] ? -1 : 0, mask[i] ? -1 : 0));
+      vmin = _mm_min_pd (vmin,
+        _mm_or_pd (_mm_and_pd (m, v), _mm_andnot_pd (m, pinf)));
+      vmax = _mm_max_pd (vmax,
+        _mm_or_pd (_mm_and_pd (m, v), _mm_andnot_pd (m, ninf)));
+      vsum = _mm_add_pd (vsum, _mm_and_pd (m, v));
+      count += (mask[i] != 0) + (mask[i + 1] != 0);
+      }
+    else
+      {
+      vmin = _mm_min_pd (vmin, v);
+      vmax = _mm_max_pd (vmax, v);
+      vsum = _mm_add_pd (vsum, v);
+      count += 2;
+      }
+    }
+
+  double t[2];
+  _mm_storeu_pd (t, vmin);
+  if (t[0] < stats->min) stats->min = t[0];
+  if (t[1] < stats->min) stats->min = t[1];
+  _mm_storeu_pd (t, vmax);
+  if (t[0] > stats->max) stats->max = t[0];
+  if (t[1] > stats->max) stats->max = t[1];
+  _mm_storeu_pd (t, vsum);
+  stats->sum += t[0] + t[1];
+  stats->count += count;
+
+  owm_stats_kernel_scalar (values + i, mask ? mask + i : NULL, n - i, stats);
+  }
+
+
+/*============================================================================
+ * owm_stats_kernel_avx2
+ * Four values at a time. AVX2 is needed, rather than just AVX, for
+ *   widening the mask bytes to 64-bit lanes
+ * =========================================================================*/
+__attribute__ ((target ("avx2")))
+static void owm_stats_kernel_avx2 (const double *values,
+      const unsigned char *mask, int n, OwmStats *stats)
+  {
+  const __m256d pinf = _mm256_set1_pd (INFINITY);
+  const __m256d ninf = _mm256_set1_pd (-INFINITY);
+  const __m256i zero = _mm256_setzero_si256 ();
+  __m256d vmin = pinf;
+  __m256d vmax = ninf;
+  __m256d vsum = _mm256_setzero_pd ();
+  int count = 0;
+  int i;
+  for (i = 0; i + 4 <= n; i += 4)
+    {
+    __m256d v = _mm256_loadu_pd (values + i);
+    if (mask)
+      {
+      int bytes;
+      memcpy (&bytes, mask + i, sizeof (bytes));
+      __m256i wide = _mm256_cvtepu8_epi64 (_mm_cvtsi32_si128 (bytes));
+      __m256d m = _mm256_castsi256_pd (_mm256_xor_si256
+        (_mm256_cmpeq_epi64 (wide, zero), _mm256_set1_epi64x (-1)));
+      vmin = _mm256_min_pd (vmin, _mm256_blendv_pd (pinf, v, m));
+      vmax = _mm256_max_pd (vmax, _mm256_blendv_pd (ninf, v, m));
+      vsum = _mm256_add_pd (vsum, _mm256_and_pd (m, v));
+      count += __builtin_popcount (_mm256_movemask_pd (m));
+      }
+    else
+      {
+      vmin = _mm256_min_pd (vmin, v);
+      vmax = _mm256_max_pd (vmax, v);
+      vsum = _mm256_add_pd (vsum, v);
+      count += 4;
+      }
+    }
+
+  double t[4];
+  int j;
+  _mm256_storeu_pd (t, vmin);
+  for (j = 0; j < 4; j++) if (t[j] < stats->min) stats->min = t[j];
+  _mm256_storeu_pd (t, vmax);
+  for (j = 0; j < 4; j++) if (t[j] > stats->max) stats->max = t[j];
+  _mm256_storeu_pd (t, vsum);
+  stats->sum += (t[0] + t[1]) + (t[2] + t[3]);
+  stats->count += count;
+
+  owm_stats_kernel_scalar (values + i, mask ? mask + i : NULL, n - i, stats);
+  }
+
+#endif
+
+
+/*============================================================================
+ * owm_stats_init
+ * Pick the best kernel that this CPU supports. Called once only
+ * =========================================================================*/
+static void owm_stats_init (void)
+  {
+  owm_stats_kernel = owm_stats_kernel_scalar;
+  owm_stats_implementation = "scalar";
+#ifdef OWM_STATS_X86
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    {
+    owm_stats_kernel = owm_stats_kernel_avx2;
+    owm_stats_implementation = "avx2";
+    }
+  else if (__builtin_cpu_supports ("sse2"))
+    {
+    owm_stats_kernel = owm_stats_kernel_sse2;
+    owm_stats_implementation = "sse2";
+    }
+#endif
+  }
+
+
+/*============================================================================
+ * owm_stats_get_implementation
+ * =========================================================================*/
+const char *owm_stats_get_implementation (void)
+  {
+  pthread_once (&owm_stats_once, owm_stats_init);
+  return owm_stats_implementation;
+  }
+
+
+/*============================================================================
+ * owm_stats_compute
+ * =========================================================================*/
+void owm_stats_compute (const double *values, const unsigned char *mask,
+      int n, OwmStats *stats)
+  {
+  pthread_once (&owm_stats_once, owm_stats_init);
+  memset (stats, 0, sizeof (OwmStats));
+  stats->min = INFINITY;
+  stats->max = -INFINITY;
+  if (n > 0)
+    owm_stats_kernel (values, mask, n, stats);
+  if (stats->count > 0)
+    stats->mean = stats->sum / stats->count;
+  }
+
+
+/*============================================================================
+ * owm_stats_wind_unit_vectors
+ * =========================================================================*/
+void owm_stats_wind_unit_vectors (const double *directions, int n,
+      double *x, double *y)
+  {
+  int i;
+  for (i = 0; i < n; i++)
+    {
+    double rad = directions[i] / 360.0 * 2.0 * M_PI;
+    x[i] = sin (rad);
+    y[i] = cos (rad);
+    }
+  }
+
+
+/*============================================================================
+ * owm_stats_wind_vector_mean
+ * The same calculation as the daily summary uses, but with the sums
+ *   done by the vectorized kernel
+ * =========================================================================*/
+double owm_stats_wind_vector_mean (const double *x, const double *y,
+      const unsigned char *mask, int n)
+  {
+  OwmStats sx, sy;
+  owm_stats_compute (x, mask, n, &sx);
+  owm_stats_compute (y, mask, n, &sy);
+  // Avoid a div by zero here -- wind directions can, in theory cancel out
+  if (sy.count == 0 || sy.sum == 0.0) return 0.0;
+  double ret = atan2 (sx.sum, sy.sum) * 360.0 / 2.0 / M_PI;
+  if (ret < 0) ret += 360.0;
+  return ret;
+  }
+
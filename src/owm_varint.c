@@ -0,0 +1,159 @@
+/*============================================================================
+ * libopenweathermap
+ * owm_varint.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * Readers and writers for the library's binary formats. Integers are
+ *   LEB128 varints, and signed ones are zigzag-encoded first, so that
+ *   small values of either sign take few bytes. A writer with no room
+ *   left keeps counting, so that the same code can be used to size a 
+ *   buffer and then to fill it. A reader never goes past the end of its
+ *   buffer; instead it clears its ok flag, and returns zeros.
+ * =========================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <owm/owm_defs.h>
+#include "owm_private.h"
+
+
+/*============================================================================
+ * owm_writer_byte
+ * =========================================================================*/
+void owm_writer_byte (OwmWriter *w, unsigned char b)
+  {
+  if (w->pos < w->size) w->buffer[w->pos] = b;
+  w->pos++;
+  }
+
+
+/*============================================================================
+ * owm_writer_u32
+ * Fixed-width, little-endian
+ * =========================================================================*/
+void owm_writer_u32 (OwmWriter *w, uint32_t v)
+  {
+  int i;
+  for (i = 0; i < 4; i++)
+    owm_writer_byte (w, (v >> (8 * i)) & 0xFF);
+  }
+
+
+/*============================================================================
+ * owm_writer_uvarint
+ * =========================================================================*/
+void owm_writer_uvarint (OwmWriter *w, uint64_t v)
+  {
+  while (v >= 0x80)
+    {
+    owm_writer_byte (w, (v & 0x7F) | 0x80);
+    v >>= 7;
+    }
+  owm_writer_byte (w, (unsigned char)v);
+  }
+
+
+/*============================================================================
+ * owm_writer_varint
+ * Signed values, zigzag-encoded so that small negative numbers are short
+ * =========================================================================*/
+void owm_writer_varint (OwmWriter *w, int64_t v)
+  {
+  owm_writer_uvarint (w, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+  }
+
+
+/*============================================================================
+ * owm_writer_quantized
+ * =========================================================================*/
+void owm_writer_quantized (OwmWriter *w, double v, double scale)
+  {
+  owm_writer_varint (w, llround (v * scale));
+  }
+
+
+/*============================================================================
+ * owm_reader_byte
+ * =========================================================================*/
+unsigned char owm_reader_byte (OwmReader *r)
+  {
+  if (r->p >= r->end)
+    {
+    r->ok = FALSE;
+    return 0;
+    }
+  return *r->p++;
+  }
+
+
+/*============================================================================
+ * owm_reader_u32
+ * =========================================================================*/
+uint32_t owm_reader_u32 (OwmReader *r)
+  {
+  uint32_t v = 0;
+  int i;
+  for (i = 0; i < 4; i++)
+    v |= (uint32_t)owm_reader_byte (r) << (8 * i);
+  return v;
+  }
+
+
+/*============================================================================
+ * owm_reader_uvarint
+ * =========================================================================*/
+uint64_t owm_reader_uvarint (OwmReader *r)
+  {
+  // Most values in the archive and serialized forecasts are deltas that
+  //  fit in one byte
+  if (r->p < r->end && *r->p < 0x80) return *r->p++;
+  uint64_t v = 0;
+  int shift;
+  for (shift = 0; shift < 64; shift += 7)
+    {
+    unsigned char b = owm_reader_byte (r);
+    v |= (uint64_t)(b & 0x7F) << shift;
+    if (!(b & 0x80)) return v;
+    }
+  r->ok = FALSE; // Too long to be a 64-bit value
+  return 0;
+  }
+
+
+/*============================================================================
+ * owm_reader_varint
+ * =========================================================================*/
+int64_t owm_reader_varint (OwmReader *r)
+  {
+  uint64_t v = owm_reader_uvarint (r);
+  return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+  }
+
+
+/*============================================================================
+ * owm_reader_quantized
+ * =========================================================================*/
+double owm_reader_quantized (OwmReader *r, double scale)
+  {
+  return owm_reader_varint (r) / scale;
+  }
+
+
+/*============================================================================
+ * owm_reader_count
+ * Read a count of items, each of which takes at least min_bytes. A count
+ *   that the rest of the buffer could not possibly hold is rejected
+ *   before anything is allocated for it
+ * =========================================================================*/
+int owm_reader_count (OwmReader *r, int min_bytes)
+  {
+  uint64_t n = owm_reader_uvarint (r);
+  if (n > (uint64_t)(r->end - r->p) / min_bytes)
+    {
+    r->ok = FALSE;
+    return 0;
+    }
+  return (int)n;
+  }
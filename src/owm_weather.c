@@ -9,40 +9,39 @@
 #include <malloc.h>
 #include <string.h>
 #include <time.h>
+#include <math.h>
 #include <owm/owm_defs.h>
 #include <owm/owm_config.h>
 #include <owm/owm_data.h>
 #include <owm/owm_weather.h>
+#include <owm/owm_curl.h>
+#include <owm/owm_string.h>
+#include <owm/owm_location_filter.h>
+#include <owm/owm_context.h>
 #include "sxmlc.h"
+#include "owm_private.h"
+#include "owm_parse.h"
 
 
 /*============================================================================
- * OwmWeather opaque struct 
+ * owm_weather_create
  * =========================================================================*/
-struct _OwmWeather
+OwmWeather *owm_weather_create (void)
   {
-  int valid;
-  time_t start_time;
-  time_t end_time;
-  OwmConditions conditions;
-  double temp;
-  double wind_direction;
-  double wind_speed;
-  double pressure;
-  double humidity;
-  double cloud_cover;
-  OwmPrecipitation precipitation;
-  };
+  OwmWeather *self = malloc (sizeof (OwmWeather));
+  owm_weather_init (self);
+  return self;
+  }
 
 
 /*============================================================================
- * owm_weather_create
+ * owm_weather_init
+ * Clear an OwmWeather in place. This is used for points that live inside
+ *   a forecast's own allocation, rather than being created individually
  * =========================================================================*/
-OwmWeather *owm_weather_create (void)
+void owm_weather_init (OwmWeather *self)
   {
-  OwmWeather *self = malloc (sizeof (OwmWeather));
   memset (self, 0, sizeof (OwmWeather));
-  return self;
   }
 
 
@@ -352,6 +351,28 @@ void owm_weather_set_precipitation (OwmWeather *self,
   }
 
 
+/*============================================================================
+ * owm_weather_update_wind_vector
+ * Work out the unit vector of the wind direction, which is what averaging
+ *   needs. Parsers that set wind_direction directly call this, or leave
+ *   it to owm_forecast_add_point()
+ * =========================================================================*/
+void owm_weather_update_wind_vector (OwmWeather *self)
+  {
+  if (self->valid & OWM_VALID_WIND_DIRECTION)
+    {
+    double rad = self->wind_direction / 360.0 * 2.0 * M_PI;
+    self->wind_x = sin (rad);
+    self->wind_y = cos (rad);
+    }
+  else
+    {
+    self->wind_x = 0;
+    self->wind_y = 0;
+    }
+  }
+
+
 /*============================================================================
  * owm_weather_set_wind_direction
  * =========================================================================*/
@@ -359,6 +380,7 @@ void owm_weather_set_wind_direction (OwmWeather *self, double wind)
   {
   self->wind_direction = wind;
   self->valid |= OWM_VALID_WIND_DIRECTION;
+  owm_weather_update_wind_vector (self);
   }
 
 
@@ -479,5 +501,166 @@ const char *owm_weather_get_wind_direction_string (const OwmWeather *self)
   }
 
 
+/*============================================================================
+ * owm_weather_get_field
+ * Get any numeric property as a double, selected by its OWM_VALID_xxx 
+ *   code. Times are returned as seconds since the epoch. Returns zero for 
+ *   an unrecognized field. 
+ * =========================================================================*/
+double owm_weather_get_field (const OwmWeather *self, int field)
+  {
+  switch (field)
+    {
+    case OWM_VALID_CONDITIONS: return self->conditions;
+    case OWM_VALID_TEMP: return self->temp;
+    case OWM_VALID_START: return (double)self->start_time;
+    case OWM_VALID_END: return (double)self->end_time;
+    case OWM_VALID_PRECIPITATION: return self->precipitation;
+    case OWM_VALID_WIND_DIRECTION: return self->wind_direction;
+    case OWM_VALID_WIND_SPEED: return self->wind_speed;
+    case OWM_VALID_PRESSURE: return self->pressure;
+    case OWM_VALID_HUMIDITY: return self->humidity;
+    case OWM_VALID_CLOUD_COVER: return self->cloud_cover;
+    }
+  return 0;
+  }
+
+
+/*============================================================================
+ * owm_weather_parse_current
+ * Parse the document from OWM's current-weather endpoint. This describes
+ *   the weather with mostly the same elements as a forecast point, but 
+ *   the wind is in a <wind> element, and most values are in a 'value'
+ *   attribute. The start and end times are both the time of the last 
+ *   observation
+ * =========================================================================*/
+OwmWeather *owm_weather_parse_current (const char *xml, char **error)
+  {
+  OwmWeather *ret = NULL;
+
+  XMLDoc doc;
+  XMLDoc_init (&doc);
+  XMLNode *root = NULL;
+  if (XMLDoc_parse_buffer_DOM (xml, "openweathermap", &doc) 
+      && doc.i_root >= 0)
+    root = XMLDoc_root (&doc);
+  if (root && strcmp (root->tag, "current") == 0)
+    {
+    ret = owm_weather_create ();
+    int i, l = root->n_children;
+    for (i = 0; i < l; i++)
+      {
+      XMLNode *r1 = root->children[i]; 
+      if (strcmp (r1->tag, "temperature") == 0)
+        owm_weather_set_temperature (ret, owm_parse_temp (r1));
+      else if (strcmp (r1->tag, "weather") == 0)
+        owm_weather_set_conditions (ret, owm_parse_conditions (r1));
+      else if (strcmp (r1->tag, "precipitation") == 0)
+        {
+        int j;
+        OwmPrecipitation precipitation = OWM_PRECIP_NONE;
+        for (j = 0; j < r1->n_attributes; j++)
+          {
+          if (strcmp (r1->attributes[j].name, "mode") == 0)
+            precipitation = owm_parse_precipitation_type 
+              (r1->attributes[j].value);
+          }
+        owm_weather_set_precipitation (ret, precipitation);
+        ret->valid |= OWM_VALID_PRECIPITATION;
+        }
+      else if (strcmp (r1->tag, "wind") == 0)
+        {
+        int j;
+        for (j = 0; j < r1->n_children; j++)
+          {
+          XMLNode *w1 = r1->children[j];
+          if (strcmp (w1->tag, "speed") == 0)
+            owm_weather_set_wind_speed (ret, 
+              owm_parse_number (w1, "value") * OWM_PARSE_MPS_TO_MPH);
+          else if (strcmp (w1->tag, "direction") == 0)
+            owm_weather_set_wind_direction (ret, 
+              owm_parse_number (w1, "value"));
+          }
+        }
+      else if (strcmp (r1->tag, "pressure") == 0)
+        owm_weather_set_pressure (ret, owm_parse_pressure (r1));
+      else if (strcmp (r1->tag, "humidity") == 0)
+        owm_weather_set_humidity (ret, owm_parse_humidity (r1));
+      else if (strcmp (r1->tag, "clouds") == 0)
+        owm_weather_set_cloud_cover (ret, owm_parse_number (r1, "value"));
+      else if (strcmp (r1->tag, "lastupdate") == 0)
+        {
+        int j;
+        for (j = 0; j < r1->n_attributes; j++)
+          {
+          if (strcmp (r1->attributes[j].name, "value") == 0)
+            {
+            time_t t = owm_parse_time_value (r1->attributes[j].value);
+            owm_weather_set_start_time (ret, t);
+            owm_weather_set_end_time (ret, t);
+            }
+          }
+        }
+      }
+    }
+  else
+    {
+    asprintf (error, "Can't parse XML");
+    }
+  XMLDoc_free (&doc);
+  return ret;
+  }
+
+
+/*============================================================================
+ * owm_weather_get_current
+ * =========================================================================*/
+OwmWeather *owm_weather_get_current (const char *app_id, 
+    const char *location_id, char **error)
+  {
+  return owm_context_get_current (owm_context_get_default (), app_id, 
+    location_id, error);
+  }
 
 
+/*============================================================================
+ * owm_context_get_current
+ * Get the current conditions at location_id. The document is about a 
+ *   twentieth the size of a forecast, and is not cached: it changes 
+ *   whenever the station reports
+ * =========================================================================*/
+OwmWeather *owm_context_get_current (OwmContext *self, const char *app_id,
+    const char *location_id, char **error)
+  {
+  OwmWeather *ret = NULL;
+  OwmLocationFilter *filter = owm_context_get_location_filter (self);
+  if (filter && !owm_location_filter_check (filter, location_id))
+    {
+    *error = strdup (OWM_ERROR_UNKNOWN_LOCATION);
+    return NULL;
+    }
+
+  OwmString *uri = owm_string_create_empty();
+  owm_string_append_printf (uri, "%s" OWM_URI, owm_context_get_host (self),
+    "weather", location_id, "xml", app_id);
+
+  char *result = NULL;
+  long http_code = 0;
+  owm_curl_fetch (self, owm_string_cstr (uri), NULL, NULL, NULL, NULL,
+    &result, NULL, NULL, &http_code, error);
+  if (*error == NULL)
+    {
+    ret = owm_weather_parse_current (result, error);
+    }
+  else if (http_code == 404)
+    {
+    if (filter)
+      owm_location_filter_reject (filter, location_id);
+    free (*error);
+    *error = strdup (OWM_ERROR_UNKNOWN_LOCATION);
+    }
+
+  free (result);
+  owm_string_destroy (uri);
+  return ret;
+  }
@@ -0,0 +1,243 @@
+/*============================================================================
+ * libopenweathermap test drivers
+ * archive_bench.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * Usage: archive_bench [locations] [runs per location]
+ * Builds an archive of forecast runs in a temporary file: the fixtures,
+ *   issued every three hours, at locations whose temperatures range from
+ *   arctic to tropical. Reports the size of a run, the time to append
+ *   and to reopen, and the rate at which owm_archive_scan() decodes
+ *   points, which should be some millions a second. Then searches for the hottest temperatures with
+ *   owm_archive_scan_values(), checks that it finds the same runs as a
+ *   full scan that looks at every point, and reports how much faster it
+ *   is for reading only the blocks whose ranges might match.
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <owm/owm.h>
+#include "owm_private.h"
+#include "test_util.h"
+
+#define ISSUE_INTERVAL (3 * 3600)
+
+typedef struct _Tally
+  {
+  long runs;
+  long points;
+  unsigned long hash; // Of the matching runs' locations and issue times
+  double min, max; // When searching by value
+  BOOL filter;
+  } Tally;
+
+
+/*============================================================================
+ * location_offset
+ * How much warmer than the fixture a location is
+ * =========================================================================*/
+static double location_offset (int l)
+  {
+  return (l % 100) * 0.4 - 30;
+  }
+
+
+/*============================================================================
+ * callback
+ * =========================================================================*/
+static BOOL callback (const char *location_id, time_t issued,
+    const OwmForecast *forecast, void *user_data)
+  {
+  Tally *tally = user_data;
+  if (tally->filter)
+    {
+    int i, n = owm_forecast_get_points (forecast);
+    for (i = 0; i < n; i++)
+      {
+      const OwmWeather *w = owm_forecast_get_point (forecast, i);
+      double t = owm_weather_get_temperature (w);
+      if ((owm_weather_get_valid (w) & OWM_VALID_TEMP)
+          && t >= tally->min && t <= tally->max)
+        break;
+      }
+    if (i == n) return TRUE;
+    }
+  tally->runs++;
+  tally->points += owm_forecast_get_points (forecast);
+  tally->hash += (unsigned long)atoi (location_id) * 1000003ul
+    ^ (unsigned long)issued;
+  return TRUE;
+  }
+
+
+/*============================================================================
+ * main
+ * =========================================================================*/
+int main (int argc, char **argv)
+  {
+  int locations = argc > 1 ? atoi (argv[1]) : 1000;
+  int runs = argc > 2 ? atoi (argv[2]) : 20;
+  OwmForecast *models[TEST_FIXTURES];
+  double *temps[TEST_FIXTURES];
+  time_t *starts[TEST_FIXTURES], *ends[TEST_FIXTURES];
+  int i, j, l, r;
+
+  // Mutable copies of the fixtures, and their original times and
+  //  temperatures
+  for (i = 0; i < TEST_FIXTURES; i++)
+    {
+    char name[64];
+    snprintf (name, sizeof (name), "%s.xml", test_fixtures[i]);
+    char *xml = test_load (name, NULL);
+    OwmForecast *f = owm_forecast_parse (xml, NULL);
+    size_t len = owm_forecast_serialize (f, NULL, 0);
+    unsigned char *buff = malloc (len);
+    owm_forecast_serialize (f, buff, len);
+    models[i] = owm_forecast_deserialize (buff, len, NULL);
+    free (buff);
+    owm_forecast_destroy (f);
+    free (xml);
+    OwmForecast *m = models[i];
+    temps[i] = malloc (m->n_points * sizeof (double));
+    starts[i] = malloc (m->n_points * sizeof (time_t));
+    ends[i] = malloc (m->n_points * sizeof (time_t));
+    for (j = 0; j < m->n_points; j++)
+      {
+      temps[i][j] = m->points[j].temp;
+      starts[i][j] = m->points[j].start_time;
+      ends[i][j] = m->points[j].end_time;
+      }
+    }
+
+  char path[] = "/tmp/archive_benchXXXXXX";
+  int fd = mkstemp (path);
+  close (fd);
+  char *error = NULL;
+  OwmArchive *archive = owm_archive_open (path, &error);
+  if (!archive)
+    {
+    fprintf (stderr, "%s\n", error);
+    unlink (path);
+    return EXIT_FAILURE;
+    }
+
+  // Append the runs, issue by issue, as a collector would
+  double hottest = -1e9;
+  long total_points = 0;
+  double t0 = test_now ();
+  for (r = 0; r < runs; r++)
+    {
+    for (l = 0; l < locations; l++)
+      {
+      i = (l + r) % TEST_FIXTURES;
+      OwmForecast *m = models[i];
+      for (j = 0; j < m->n_points; j++)
+        {
+        m->points[j].start_time = starts[i][j] + r * ISSUE_INTERVAL;
+        m->points[j].end_time = ends[i][j] + r * ISSUE_INTERVAL;
+        m->points[j].temp = temps[i][j] + location_offset (l) + r * 0.01;
+        if ((m->points[j].valid & OWM_VALID_TEMP)
+            && m->points[j].temp > hottest)
+          hottest = m->points[j].temp;
+        }
+      char id[16];
+      snprintf (id, sizeof (id), "%d", l);
+      if (!owm_archive_append (archive, id, starts[i][0]
+          + r * ISSUE_INTERVAL, m, &error))
+        {
+        test_fail ("append: %s", error);
+        free (error);
+        error = NULL;
+        }
+      total_points += m->n_points;
+      }
+    }
+  double t1 = test_now ();
+  owm_archive_close (archive);
+
+  archive = owm_archive_open (path, &error);
+  double t2 = test_now ();
+  if (!archive)
+    {
+    fprintf (stderr, "%s\n", error);
+    unlink (path);
+    return EXIT_FAILURE;
+    }
+  FILE *fp = fopen (path, "r");
+  fseek (fp, 0, SEEK_END);
+  long size = ftell (fp);
+  fclose (fp);
+  int n_runs = owm_archive_get_runs (archive);
+  printf ("%d runs, %ld points, %.0f bytes per run\n", n_runs, total_points,
+    (double)size / n_runs);
+  printf ("append %8.3f s %10.0f runs/s\n", t1 - t0, n_runs / (t1 - t0));
+  printf ("reopen %8.3f s\n", t2 - t1);
+  if (n_runs != locations * runs)
+    test_fail ("%d runs after reopening, expected %d", n_runs,
+      locations * runs);
+
+  // Everything, best of three
+  double best = 0;
+  long points = 0;
+  for (i = 0; i < 3; i++)
+    {
+    Tally all;
+    memset (&all, 0, sizeof (all));
+    double t3 = test_now ();
+    points = owm_archive_scan (archive, NULL, 0, 0x7fffffff, callback,
+      &all, &error);
+    double t4 = test_now ();
+    if (i == 0 || t4 - t3 < best) best = t4 - t3;
+    if (points != total_points || all.runs != n_runs)
+      test_fail ("the scan found %ld points in %ld runs", points, all.runs);
+    }
+  printf ("scan   %8.3f s %10.0f points/s\n", best, points / best);
+
+  // The hottest temperatures, first by looking at every point, and then
+  //  by value
+  Tally brute, indexed;
+  memset (&brute, 0, sizeof (brute));
+  brute.filter = TRUE;
+  brute.min = hottest - 2;
+  brute.max = 1000;
+  indexed = brute;
+  indexed.filter = FALSE;
+  double t5 = test_now ();
+  owm_archive_scan (archive, NULL, 0, 0x7fffffff, callback, &brute, &error);
+  double t6 = test_now ();
+  owm_archive_scan_values (archive, NULL, 0, 0x7fffffff, OWM_VALID_TEMP,
+    brute.min, brute.max, callback, &indexed, &error);
+  double t7 = test_now ();
+  printf ("temperatures of %.1f and above: %ld runs\n", brute.min,
+    brute.runs);
+  printf ("  every block %8.3f s\n", t6 - t5);
+  printf ("  by value    %8.3f s  x%.1f\n", t7 - t6, (t6 - t5) / (t7 - t6));
+  if (brute.runs == 0)
+    test_fail ("no runs were hot enough");
+  if (indexed.runs != brute.runs || indexed.hash != brute.hash)
+    test_fail ("owm_archive_scan_values() found %ld runs, expected %ld",
+      indexed.runs, brute.runs);
+  if (t7 - t6 >= t6 - t5)
+    test_fail ("the search by value was no faster than a full scan");
+
+  // A value that no block holds
+  memset (&indexed, 0, sizeof (indexed));
+  owm_archive_scan_values (archive, NULL, 0, 0x7fffffff, OWM_VALID_TEMP,
+    hottest + 1, 1000, callback, &indexed, &error);
+  if (indexed.runs)
+    test_fail ("%ld runs are hotter than the hottest", indexed.runs);
+
+  owm_archive_close (archive);
+  unlink (path);
+  for (i = 0; i < TEST_FIXTURES; i++)
+    {
+    owm_forecast_destroy (models[i]);
+    free (temps[i]);
+    free (starts[i]);
+    free (ends[i]);
+    }
+  return test_exit_status ();
+  }
+
@@ -0,0 +1,213 @@
+/*============================================================================
+ * libopenweathermap test drivers
+ * city_index_bench.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * Usage: city_index_bench [locations] [queries]
+ * Builds an OwmCityIndex over a generated city list, of 200,000
+ *   locations unless told otherwise, and reports the time taken. Then
+ *   times owm_city_index_nearest() and owm_city_index_within() at random
+ *   places, some near towns and some in empty ocean, some boxes crossing
+ *   the 180th meridian, and reports the median and 99th percentile
+ *   latency of each. Every hundredth query is checked against a search
+ *   of every location.
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <owm/owm.h>
+#include "test_util.h"
+
+#define NEAREST 10
+#define RAD (M_PI / 180.0)
+#define EARTH_RADIUS 6371.0088
+
+static const OwmCityList *list;
+static int n_cities;
+
+
+/*============================================================================
+ * compare_double
+ * =========================================================================*/
+static int compare_double (const void *a, const void *b)
+  {
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+  }
+
+
+/*============================================================================
+ * compare_int
+ * =========================================================================*/
+static int compare_int (const void *a, const void *b)
+  {
+  return *(const int *)a - *(const int *)b;
+  }
+
+
+/*============================================================================
+ * distance
+ * Great-circle distance in km, by the haversine formula
+ * =========================================================================*/
+static double distance (double lat1, double lon1, double lat2, double lon2)
+  {
+  double s = sin ((lat2 - lat1) * RAD / 2);
+  double t = sin ((lon2 - lon1) * RAD / 2);
+  double a = s * s + cos (lat1 * RAD) * cos (lat2 * RAD) * t * t;
+  return 2 * EARTH_RADIUS * asin (sqrt (a > 1 ? 1 : a));
+  }
+
+
+/*============================================================================
+ * check_nearest
+ * The distances found should be the NEAREST smallest of all, give or
+ *   take the precision the index holds points to
+ * =========================================================================*/
+static void check_nearest (double lat, double lon, const int *indexes,
+    const double *distances, int found, double *scratch)
+  {
+  int i;
+  for (i = 0; i < n_cities; i++)
+    scratch[i] = distance (lat, lon, owm_city_list_get_lat (list, i),
+      owm_city_list_get_lon (list, i));
+  qsort (scratch, n_cities, sizeof (double), compare_double);
+  if (found != NEAREST)
+    test_fail ("nearest %f,%f: found %d", lat, lon, found);
+  for (i = 0; i < found; i++)
+    {
+    double d = distance (lat, lon, owm_city_list_get_lat (list, indexes[i]),
+      owm_city_list_get_lon (list, indexes[i]));
+    if (fabs (d - scratch[i]) > 0.01 || fabs (d - distances[i]) > 0.01)
+      {
+      test_fail ("nearest %f,%f: number %d is %.3f km away, reported as "
+        "%.3f, but the %dth nearest is %.3f", lat, lon, i, d, distances[i],
+        i + 1, scratch[i]);
+      break;
+      }
+    }
+  }
+
+
+/*============================================================================
+ * check_within
+ * =========================================================================*/
+static void check_within (double lat_min, double lon_min, double lat_max,
+    double lon_max, int *indexes, int found, int *scratch)
+  {
+  int i, n = 0;
+  for (i = 0; i < n_cities; i++)
+    {
+    double lat = owm_city_list_get_lat (list, i);
+    double lon = owm_city_list_get_lon (list, i);
+    BOOL in_lon = lon_min <= lon_max ? lon >= lon_min && lon <= lon_max
+      : lon >= lon_min || lon <= lon_max;
+    if (lat >= lat_min && lat <= lat_max && in_lon) scratch[n++] = i;
+    }
+  qsort (indexes, found, sizeof (int), compare_int);
+  if (found != n || memcmp (indexes, scratch, n * sizeof (int)) != 0)
+    test_fail ("within %f,%f to %f,%f: found %d, expected %d", lat_min,
+      lon_min, lat_max, lon_max, found, n);
+  }
+
+
+/*============================================================================
+ * report
+ * =========================================================================*/
+static void report (const char *what, double *times, int n)
+  {
+  qsort (times, n, sizeof (double), compare_double);
+  printf ("%-24s p50 %7.2f us  p99 %7.2f us\n", what, times[n / 2] * 1e6,
+    times[n * 99 / 100] * 1e6);
+  }
+
+
+/*============================================================================
+ * main
+ * =========================================================================*/
+int main (int argc, char **argv)
+  {
+  int n = argc > 1 ? atoi (argv[1]) : 200000;
+  int queries = argc > 2 ? atoi (argv[2]) : 5000;
+  int i;
+
+  char *path = test_city_list_write (n);
+  char *error = NULL;
+  OwmCityList *l = owm_city_list_load (path, 0, &error);
+  unlink (path);
+  free (path);
+  if (!l)
+    {
+    fprintf (stderr, "%s\n", error);
+    return EXIT_FAILURE;
+    }
+  list = l;
+  n_cities = owm_city_list_get_count (list);
+
+  double t0 = test_now ();
+  OwmCityIndex *index = owm_city_index_create (list);
+  printf ("%d locations, index built in %.1f ms\n", n_cities,
+    (test_now () - t0) * 1e3);
+
+  double *times = malloc (queries * sizeof (double));
+  double *scratch = malloc (n_cities * sizeof (double));
+  int *found = malloc (n_cities * sizeof (int));
+  int *expected = malloc (n_cities * sizeof (int));
+  double distances[NEAREST];
+
+  // Half the queries near a town, and half anywhere
+  srand (17);
+  for (i = 0; i < queries; i++)
+    {
+    double lat, lon;
+    if (i % 2)
+      {
+      int c = rand () % n_cities;
+      lat = owm_city_list_get_lat (list, c) + 0.1 * rand () / RAND_MAX;
+      lon = owm_city_list_get_lon (list, c) + 0.1 * rand () / RAND_MAX;
+      }
+    else
+      {
+      lat = asin (2.0 * rand () / RAND_MAX - 1) / RAD;
+      lon = 360.0 * rand () / RAND_MAX - 180;
+      }
+    double t = test_now ();
+    int k = owm_city_index_nearest (index, lat, lon, NEAREST, found,
+      distances);
+    times[i] = test_now () - t;
+    if (i % 100 == 0)
+      check_nearest (lat, lon, found, distances, k, scratch);
+    }
+  report ("nearest 10", times, queries);
+
+  // Boxes of up to five degrees, some across the 180th meridian
+  long total = 0;
+  for (i = 0; i < queries; i++)
+    {
+    double lat_min = asin (2.0 * rand () / RAND_MAX - 1) / RAD;
+    double lat_max = lat_min + 5.0 * rand () / RAND_MAX;
+    double lon_min = i % 20 == 0 ? 178 : 360.0 * rand () / RAND_MAX - 180;
+    double lon_max = lon_min + 5.0 * rand () / RAND_MAX;
+    if (lon_max >= 180) lon_max -= 360;
+    double t = test_now ();
+    int k = owm_city_index_within (index, lat_min, lon_min, lat_max,
+      lon_max, found, n_cities);
+    times[i] = test_now () - t;
+    total += k;
+    if (i % 100 == 0)
+      check_within (lat_min, lon_min, lat_max, lon_max, found, k, expected);
+    }
+  report ("within 5 degrees", times, queries);
+  printf ("%.1f locations per box\n", (double)total / queries);
+
+  free (times);
+  free (scratch);
+  free (found);
+  free (expected);
+  owm_city_index_destroy (index);
+  owm_city_list_destroy (l);
+  return test_exit_status ();
+  }
+
@@ -0,0 +1,132 @@
+/*============================================================================
+ * libopenweathermap test drivers
+ * city_list_bench.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * Usage: city_list_bench [locations]
+ * Writes a generated city list, of 200,000 locations unless told
+ *   otherwise, and loads it with one thread and then with one per CPU.
+ *   Reports the speed of each load, and the memory that the list takes,
+ *   both as owm_city_list_get_size() has it and as the growth in the
+ *   process's resident set. Then checks every location against the one
+ *   that was written, looking each up by ID.
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <sys/stat.h>
+#include <owm/owm.h>
+#include "test_util.h"
+
+
+/*============================================================================
+ * resident
+ * The process's resident set, in bytes
+ * =========================================================================*/
+static long resident (void)
+  {
+  long pages = 0, rss = 0;
+  FILE *f = fopen ("/proc/self/statm", "r");
+  if (f)
+    {
+    if (fscanf (f, "%ld %ld", &pages, &rss) != 2) rss = 0;
+    fclose (f);
+    }
+  return rss * sysconf (_SC_PAGESIZE);
+  }
+
+
+/*============================================================================
+ * load
+ * Load the list, best of three, and report the speed
+ * =========================================================================*/
+static OwmCityList *load (const char *path, int threads, size_t size)
+  {
+  OwmCityList *list = NULL;
+  double best = 0;
+  int r;
+  for (r = 0; r < 3; r++)
+    {
+    char *error = NULL;
+    if (list) owm_city_list_destroy (list);
+    double t0 = test_now ();
+    list = owm_city_list_load (path, threads, &error);
+    double t = test_now () - t0;
+    if (!list)
+      {
+      fprintf (stderr, "%s\n", error);
+      unlink (path);
+      exit (EXIT_FAILURE);
+      }
+    if (r == 0 || t < best) best = t;
+    }
+  int n = owm_city_list_get_count (list);
+  printf ("%-20s %8.1f ms %8.1f MB/s %10.0f locations/s\n",
+    threads == 1 ? "load, 1 thread" : "load, 1 per CPU", best * 1e3,
+    size / best / 1e6, n / best);
+  return list;
+  }
+
+
+/*============================================================================
+ * main
+ * =========================================================================*/
+int main (int argc, char **argv)
+  {
+  int n = argc > 1 ? atoi (argv[1]) : 200000;
+  int i;
+
+  char *path = test_city_list_write (n);
+  struct stat sb;
+  stat (path, &sb);
+  printf ("%d locations, %.1f MB of JSON, %ld CPUs online\n", n,
+    sb.st_size / 1e6, sysconf (_SC_NPROCESSORS_ONLN));
+
+  // The memory that loading uses only while it runs is handed back to
+  //  the system before each measurement, so that the growth is what the
+  //  list keeps
+  owm_city_list_destroy (load (path, 1, sb.st_size));
+  malloc_trim (0);
+  long before = resident ();
+  OwmCityList *list = load (path, 0, sb.st_size);
+  malloc_trim (0);
+  long after = resident ();
+  printf ("size %.2f MB (%.1f bytes per location), resident set grew by "
+    "%.2f MB\n", owm_city_list_get_size (list) / 1e6,
+    (double)owm_city_list_get_size (list) / n, (after - before) / 1e6);
+
+  if (owm_city_list_get_count (list) != n)
+    test_fail ("%d locations, expected %d", owm_city_list_get_count (list),
+      n);
+  int wrong = 0;
+  for (i = 0; i < n; i++)
+    {
+    TestCity city;
+    test_city (i, &city);
+    int index = owm_city_list_find_id (list, city.id);
+    if (index < 0
+        || owm_city_list_get_id (list, index) != city.id
+        || strcmp (owm_city_list_get_name (list, index), city.name) != 0
+        || strcmp (owm_city_list_get_country (list, index), city.country)
+          != 0
+        || (float)owm_city_list_get_lat (list, index) != (float)city.lat
+        || (float)owm_city_list_get_lon (list, index) != (float)city.lon)
+      {
+      if (wrong++ < 5)
+        test_fail ("location %d (%s) did not read back", city.id,
+          city.name);
+      }
+    }
+  if (wrong) printf ("%d locations did not read back\n", wrong);
+  if (owm_city_list_find_id (list, 999) != -1)
+    test_fail ("found an ID that isn't in the list");
+
+  owm_city_list_destroy (list);
+  unlink (path);
+  free (path);
+  return test_exit_status ();
+  }
+
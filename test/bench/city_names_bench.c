@@ -0,0 +1,256 @@
+/*============================================================================
+ * libopenweathermap test drivers
+ * city_names_bench.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * Usage: city_names_bench [locations] [queries]
+ * Builds an OwmCityNames over a generated city list, of 200,000
+ *   locations unless told otherwise, with a distinct priority for each,
+ *   and reports the time taken and the memory used. Then times
+ *   owm_city_names_prefix() with the first few letters of names, and
+ *   owm_city_names_fuzzy() with names that have a letter changed, and
+ *   reports the median and 99th percentile latency of each. Some of the
+ *   queries are checked against a search of every name.
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <owm/owm.h>
+#include "test_util.h"
+
+#define K 10
+#define MAX_DISTANCE 2
+
+static const OwmCityList *list;
+static int n_cities;
+static float *priorities;
+static char **folded;
+
+
+/*============================================================================
+ * fold
+ * The names in the generated list are ASCII, apart from e-acute
+ * =========================================================================*/
+static char *fold (const char *s)
+  {
+  char *ret = malloc (strlen (s) + 1), *d = ret;
+  for (; *s; s++)
+    {
+    if ((unsigned char)s[0] == 0xc3 && (unsigned char)s[1] == 0xa9)
+      {
+      *d++ = 'e';
+      s++;
+      }
+    else
+      *d++ = *s >= 'A' && *s <= 'Z' ? *s + 'a' - 'A' : *s;
+    }
+  *d = 0;
+  return ret;
+  }
+
+
+/*============================================================================
+ * edit_distance
+ * =========================================================================*/
+static int edit_distance (const char *a, const char *b)
+  {
+  int la = strlen (a), lb = strlen (b), i, j;
+  int row[64];
+  for (j = 0; j <= lb; j++) row[j] = j;
+  for (i = 1; i <= la; i++)
+    {
+    int diag = row[0];
+    row[0] = i;
+    for (j = 1; j <= lb; j++)
+      {
+      int up = row[j];
+      int v = diag + (a[i - 1] != b[j - 1]);
+      if (up + 1 < v) v = up + 1;
+      if (row[j - 1] + 1 < v) v = row[j - 1] + 1;
+      row[j] = v;
+      diag = up;
+      }
+    }
+  return row[lb];
+  }
+
+
+/* A match found by brute force */
+typedef struct _Match
+  {
+  int city;
+  int distance;
+  } Match;
+
+
+/*============================================================================
+ * compare_match
+ * Nearest first, and then highest priority first
+ * =========================================================================*/
+static int compare_match (const void *a, const void *b)
+  {
+  const Match *x = a, *y = b;
+  if (x->distance != y->distance) return x->distance - y->distance;
+  float px = priorities[x->city], py = priorities[y->city];
+  return px > py ? -1 : px < py;
+  }
+
+
+/*============================================================================
+ * check
+ * Compare what a search found with the best K of the brute-force
+ *   matches
+ * =========================================================================*/
+static void check (const char *what, const char *query, Match *matches,
+    int n, const int *indexes, int found)
+  {
+  int i;
+  qsort (matches, n, sizeof (Match), compare_match);
+  if (n > K) n = K;
+  if (found != n)
+    {
+    test_fail ("%s \"%s\": found %d, expected %d", what, query, found, n);
+    return;
+    }
+  for (i = 0; i < n; i++)
+    if (indexes[i] != matches[i].city)
+      {
+      test_fail ("%s \"%s\": number %d is %s, expected %s", what, query, i,
+        owm_city_list_get_name (list, indexes[i]),
+        owm_city_list_get_name (list, matches[i].city));
+      return;
+      }
+  }
+
+
+/*============================================================================
+ * compare_double
+ * =========================================================================*/
+static int compare_double (const void *a, const void *b)
+  {
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+  }
+
+
+/*============================================================================
+ * report
+ * =========================================================================*/
+static void report (const char *what, double *times, int n)
+  {
+  qsort (times, n, sizeof (double), compare_double);
+  printf ("%-24s p50 %8.2f us  p99 %8.2f us\n", what, times[n / 2] * 1e6,
+    times[n * 99 / 100] * 1e6);
+  }
+
+
+/*============================================================================
+ * main
+ * =========================================================================*/
+int main (int argc, char **argv)
+  {
+  int n = argc > 1 ? atoi (argv[1]) : 200000;
+  int queries = argc > 2 ? atoi (argv[2]) : 2000;
+  int i, j;
+
+  char *path = test_city_list_write (n);
+  char *error = NULL;
+  OwmCityList *l = owm_city_list_load (path, 0, &error);
+  unlink (path);
+  free (path);
+  if (!l)
+    {
+    fprintf (stderr, "%s\n", error);
+    return EXIT_FAILURE;
+    }
+  list = l;
+  n_cities = owm_city_list_get_count (list);
+  priorities = malloc (n_cities * sizeof (float));
+  folded = malloc (n_cities * sizeof (char *));
+  for (i = 0; i < n_cities; i++)
+    {
+    priorities[i] = (float)((long)i * 7919 % n_cities);
+    folded[i] = fold (owm_city_list_get_name (list, i));
+    }
+
+  double t0 = test_now ();
+  OwmCityNames *names = owm_city_names_create (list, priorities);
+  printf ("%d locations, built in %.1f ms, %.2f MB\n", n_cities,
+    (test_now () - t0) * 1e3, owm_city_names_get_size (names) / 1e6);
+
+  double *times = malloc (queries * sizeof (double));
+  Match *matches = malloc (n_cities * sizeof (Match));
+  int indexes[K];
+
+  // The first one to five letters of a name, as it is written
+  srand (23);
+  for (i = 0; i < queries; i++)
+    {
+    const char *name = owm_city_list_get_name (list, rand () % n_cities);
+    char query[16];
+    int len = 1 + rand () % 5;
+    if ((unsigned char)name[len - 1] == 0xc3) len++;
+    snprintf (query, sizeof (query), "%.*s", len, name);
+    double t = test_now ();
+    int found = owm_city_names_prefix (names, query, K, indexes);
+    times[i] = test_now () - t;
+    if (i % 20 == 0)
+      {
+      char *q = fold (query);
+      size_t q_len = strlen (q);
+      int m = 0;
+      for (j = 0; j < n_cities; j++)
+        if (strncmp (folded[j], q, q_len) == 0)
+          {
+          matches[m].city = j;
+          matches[m++].distance = 0;
+          }
+      check ("prefix", query, matches, m, indexes, found);
+      free (q);
+      }
+    }
+  report ("prefix, best 10", times, queries);
+
+  // A name with one letter changed
+  int fuzzy = queries / 4;
+  for (i = 0; i < fuzzy; i++)
+    {
+    char query[64];
+    snprintf (query, sizeof (query), "%s",
+      folded[rand () % n_cities]);
+    query[rand () % strlen (query)] = 'a' + rand () % 26;
+    int distances[K];
+    double t = test_now ();
+    int found = owm_city_names_fuzzy (names, query, MAX_DISTANCE, K,
+      indexes, distances);
+    times[i] = test_now () - t;
+    if (i % 25 == 0)
+      {
+      int m = 0;
+      for (j = 0; j < n_cities; j++)
+        {
+        int d = edit_distance (folded[j], query);
+        if (d <= MAX_DISTANCE)
+          {
+          matches[m].city = j;
+          matches[m++].distance = d;
+          }
+        }
+      check ("fuzzy", query, matches, m, indexes, found);
+      }
+    }
+  report ("fuzzy, 2 edits, best 10", times, fuzzy);
+
+  for (i = 0; i < n_cities; i++)
+    free (folded[i]);
+  free (folded);
+  free (priorities);
+  free (times);
+  free (matches);
+  owm_city_names_destroy (names);
+  owm_city_list_destroy (l);
+  return test_exit_status ();
+  }
+
@@ -0,0 +1,224 @@
+/*============================================================================
+ * libopenweathermap test drivers
+ * field_mask_bench.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * Usage: field_mask_bench [rounds]
+ * Parses each XML fixture with owm_forecast_parse_ex() and a range of
+ *   field masks and point limits, and reports, for each, the bytes of
+ *   tags that are decoded and the bytes that are scanned at all, and the
+ *   CPU time per parse. These are set against a parse of the whole
+ *   document into a tree by sxmlc, which is what every parse cost before
+ *   the document was scanned. Checks that each point has the fields
+ *   asked for, with the same values as a parse of every field, and that
+ *   parsing a single field, or a few points, takes less time than
+ *   parsing everything.
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <owm/owm.h>
+#include "sxmlc.h"
+#include "owm_parse.h"
+#include "test_util.h"
+
+#define MASKS 4
+
+static const struct
+  {
+  const char *name;
+  int fields;
+  int max_points;
+  } masks[MASKS] =
+  {
+  { "every field", 0, 0 },
+  { "temperature", OWM_VALID_TEMP, 0 },
+  { "temperature, wind", OWM_VALID_TEMP | OWM_VALID_WIND_SPEED
+    | OWM_VALID_WIND_DIRECTION, 0 },
+  { "every field, 8 points", 0, 8 },
+  };
+
+/* The elements of <time>, as the parser knows them */
+static const struct
+  {
+  const char *tag;
+  int field;
+  } elements[] =
+  {
+  { "temperature", OWM_VALID_TEMP },
+  { "symbol", OWM_VALID_CONDITIONS },
+  { "precipitation", OWM_VALID_PRECIPITATION },
+  { "windDirection", OWM_VALID_WIND_DIRECTION },
+  { "windSpeed", OWM_VALID_WIND_SPEED },
+  { "pressure", OWM_VALID_PRESSURE },
+  { "humidity", OWM_VALID_HUMIDITY },
+  { "clouds", OWM_VALID_CLOUD_COVER },
+  };
+
+
+/*============================================================================
+ * cpu_now
+ * =========================================================================*/
+static double cpu_now (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+  }
+
+
+/*============================================================================
+ * count_bytes
+ * Walk the document as owm_forecast_parse_ex() does, and count the bytes
+ *   of the tags it would decode, and the bytes it would scan before it
+ *   stopped
+ * =========================================================================*/
+static void count_bytes (const char *xml, int fields, int max_points,
+    size_t *decoded, size_t *scanned)
+  {
+  OwmXmlScanner s;
+  OwmXmlTag tag;
+  int points = 0;
+  size_t i;
+  if (!fields) fields = ~0;
+  *decoded = 0;
+  owm_xml_init (&s, xml, strlen (xml));
+  while (max_points == 0 || points < max_points)
+    {
+    OwmXmlType type = owm_xml_next (&s, &tag);
+    if (type == OWM_XML_END || type == OWM_XML_ERROR) break;
+    if (type == OWM_XML_CLOSE)
+      {
+      if (tag.depth == 2 && owm_xml_is (&tag, "time")) points++;
+      continue;
+      }
+    if ((tag.depth == 1 && owm_xml_is (&tag, "sun"))
+        || (tag.depth == 2 && owm_xml_is (&tag, "time")))
+      *decoded += tag.len;
+    else if (tag.depth == 3)
+      {
+      for (i = 0; i < sizeof (elements) / sizeof (elements[0]); i++)
+        if (owm_xml_is (&tag, elements[i].tag)
+            && (elements[i].field & fields))
+          *decoded += tag.len;
+      }
+    }
+  *scanned = s.p - xml;
+  }
+
+
+/*============================================================================
+ * check
+ * Every point of f should hold just the fields asked for, with the values
+ *   that all has
+ * =========================================================================*/
+static void check (const char *what, const OwmForecast *all,
+    const OwmForecast *f, int fields, int max_points)
+  {
+  int n = owm_forecast_get_points (all);
+  if (max_points && n > max_points) n = max_points;
+  if (owm_forecast_get_points (f) != n)
+    {
+    test_fail ("%s: %d points, expected %d", what,
+      owm_forecast_get_points (f), n);
+    return;
+    }
+  int i, field;
+  for (i = 0; i < n; i++)
+    {
+    const OwmWeather *x = owm_forecast_get_point (all, i);
+    const OwmWeather *y = owm_forecast_get_point (f, i);
+    int valid = owm_weather_get_valid (x)
+      & (fields ? fields | OWM_VALID_START | OWM_VALID_END : ~0);
+    if (owm_weather_get_valid (y) != valid
+        || owm_weather_get_start_time (y) != owm_weather_get_start_time (x))
+      {
+      test_fail ("%s: point %d is valid for %x, expected %x", what, i,
+        owm_weather_get_valid (y), valid);
+      return;
+      }
+    for (field = 1; field <= OWM_VALID_CLOUD_COVER; field <<= 1)
+      if ((valid & field) && owm_weather_get_field (x, field)
+          != owm_weather_get_field (y, field))
+        test_fail ("%s: point %d field %x differs", what, i, field);
+    }
+  }
+
+
+/*============================================================================
+ * main
+ * =========================================================================*/
+int main (int argc, char **argv)
+  {
+  int rounds = argc > 1 ? atoi (argv[1]) : 300;
+  int i, m, r;
+
+  for (i = 0; i < TEST_FIXTURES; i++)
+    {
+    char name[64];
+    snprintf (name, sizeof (name), "%s.xml", test_fixtures[i]);
+    size_t len;
+    char *xml = test_load (name, &len);
+
+    // The whole document into a tree, as sxmlc builds it
+    double t0 = cpu_now ();
+    for (r = 0; r < rounds; r++)
+      {
+      XMLDoc doc;
+      XMLDoc_init (&doc);
+      XMLDoc_parse_buffer_DOM (xml, "openweathermap", &doc);
+      XMLDoc_free (&doc);
+      }
+    double dom = (cpu_now () - t0) / rounds;
+    printf ("%s, %zu bytes\n", name, len);
+    printf ("  %-22s decoded %6zu scanned %6zu %8.1f us\n", "sxmlc tree",
+      len, len, dom * 1e6);
+
+    OwmForecast *all = owm_forecast_parse (xml, NULL);
+    double times[MASKS];
+    for (m = 0; m < MASKS; m++)
+      {
+      OwmForecastOptions options;
+      memset (&options, 0, sizeof (options));
+      options.fields = masks[m].fields;
+      options.max_points = masks[m].max_points;
+
+      OwmForecast *f = owm_forecast_parse_ex (xml, &options, NULL);
+      char what[128];
+      snprintf (what, sizeof (what), "%s, %s", name, masks[m].name);
+      if (!all || !f)
+        test_fail ("%s: failed to parse", what);
+      else
+        check (what, all, f, masks[m].fields, masks[m].max_points);
+      if (f) owm_forecast_destroy (f);
+
+      // Best of three, to keep the comparisons below steady
+      int k;
+      for (k = 0; k < 3; k++)
+        {
+        t0 = cpu_now ();
+        for (r = 0; r < rounds; r++)
+          owm_forecast_destroy (owm_forecast_parse_ex (xml, &options,
+            NULL));
+        double t = (cpu_now () - t0) / rounds;
+        if (k == 0 || t < times[m]) times[m] = t;
+        }
+
+      size_t decoded, scanned;
+      count_bytes (xml, masks[m].fields, masks[m].max_points, &decoded,
+        &scanned);
+      printf ("  %-22s decoded %6zu scanned %6zu %8.1f us  x%.1f\n",
+        masks[m].name, decoded, scanned, times[m] * 1e6, dom / times[m]);
+      }
+    if (times[1] >= times[0])
+      test_fail ("%s: parsing the temperature alone was no faster", name);
+    if (times[3] >= times[0])
+      test_fail ("%s: parsing 8 points was no faster", name);
+    if (all) owm_forecast_destroy (all);
+    free (xml);
+    }
+  return test_exit_status ();
+  }
+
@@ -0,0 +1,143 @@
+/*============================================================================
+ * libopenweathermap test drivers
+ * grid_workload.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * Usage: grid_workload [requests]
+ * A synthetic workload for owm_context_get_forecast_by_coords(): users
+ *   clustered around 200 towns in a five-degree square, half of them in
+ *   the 20 most popular towns, each request a GPS fix with about 50 m of
+ *   noise around a place within a couple of kilometres of the town
+ *   centre. The same requests are made with each of a range of grid
+ *   sizes, each time with an empty cache, against the stand-in server,
+ *   and the cache's hit rate and the number of requests that reached the
+ *   server are reported. Then checks the names of some grid cells, which
+ *   need as many decimal places as their grid.
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <owm/owm.h>
+#include "test_util.h"
+
+#define TOWNS 200
+#define POPULAR 20
+
+
+/*============================================================================
+ * gauss
+ * A normally-distributed random number, with unit variance
+ * =========================================================================*/
+static double gauss (void)
+  {
+  double u = (rand () + 1.0) / (RAND_MAX + 2.0);
+  double v = (rand () + 1.0) / (RAND_MAX + 2.0);
+  return sqrt (-2 * log (u)) * cos (2 * M_PI * v);
+  }
+
+
+/*============================================================================
+ * main
+ * =========================================================================*/
+int main (int argc, char **argv)
+  {
+  int n = argc > 1 ? atoi (argv[1]) : 4000;
+  static const double grids[] = { 0.000001, 0.001, 0.01, 0.05, 0.1 };
+  double towns[TOWNS][2];
+  int i, g;
+
+  srand (7);
+  for (i = 0; i < TOWNS; i++)
+    {
+    towns[i][0] = 50 + 5.0 * rand () / RAND_MAX;
+    towns[i][1] = -2 + 5.0 * rand () / RAND_MAX;
+    }
+
+  OwmContext *context = owm_context_create ();
+  owm_context_set_host (context, test_server_start ());
+
+  printf ("%d requests around %d towns\n", n, TOWNS);
+  printf ("%10s %8s %8s %8s %8s\n", "grid", "hits", "misses", "server",
+    "hit rate");
+  double last_rate = -1;
+  for (g = 0; g < (int)(sizeof (grids) / sizeof (grids[0])); g++)
+    {
+    OwmCache *cache = owm_cache_create (256 * 1024 * 1024);
+    owm_context_set_cache (context, cache);
+    OwmForecastOptions options;
+    memset (&options, 0, sizeof (options));
+    options.grid = grids[g];
+    unsigned long before = test_server_get_requests ();
+
+    srand (11);
+    for (i = 0; i < n; i++)
+      {
+      int t = rand () % TOWNS;
+      if (rand () % 2) t = rand () % POPULAR;
+      double lat = towns[t][0] + gauss () * 0.015 + gauss () * 0.0005;
+      double lon = towns[t][1] + gauss () * 0.02 + gauss () * 0.0007;
+      char *error = NULL;
+      OwmForecast *f = owm_context_get_forecast_by_coords (context, "test",
+        lat, lon, &options, &error);
+      if (!f)
+        {
+        test_fail ("%f,%f: %s", lat, lon, error);
+        free (error);
+        break;
+        }
+      owm_forecast_destroy (f);
+      }
+
+    OwmCacheStats stats;
+    owm_cache_get_stats (cache, &stats);
+    unsigned long server = test_server_get_requests () - before;
+    double rate = 100.0 * stats.hits / (stats.hits + stats.misses);
+    printf ("%10.6f %8lu %8lu %8lu %7.1f%%\n", grids[g], stats.hits,
+      stats.misses, server, rate);
+    if (server != stats.misses)
+      test_fail ("grid %f: %lu requests reached the server, for %lu misses",
+        grids[g], server, stats.misses);
+    if (rate < last_rate)
+      test_fail ("grid %f: hit rate fell as the grid grew", grids[g]);
+    last_rate = rate;
+
+    owm_context_set_cache (context, NULL);
+    owm_cache_destroy (cache);
+    }
+
+  // The cells are named with as many decimal places as the grid needs
+  static const struct { double grid, lat, lon; const char *key; } cells[] =
+    {
+    { 0.25, 51.3, 0.3, "51.25,0.25" },
+    { 0.25, 51.05, -0.6, "51.00,-0.50" },
+    { 0.05, 51.07, 0.33, "51.05,0.35" },
+    { 0.5, -33.8, 151.2, "-34.0,151.0" },
+    };
+  OwmCache *cache = owm_cache_create (16 * 1024 * 1024);
+  owm_context_set_cache (context, cache);
+  for (i = 0; i < (int)(sizeof (cells) / sizeof (cells[0])); i++)
+    {
+    OwmForecastOptions options;
+    memset (&options, 0, sizeof (options));
+    options.grid = cells[i].grid;
+    char *error = NULL;
+    OwmForecast *f = owm_context_get_forecast_by_coords (context, "test",
+      cells[i].lat, cells[i].lon, &options, &error);
+    if (f) owm_forecast_destroy (f);
+    free (error);
+    f = owm_cache_lookup (cache, "forecast", cells[i].key, OWM_UNITS);
+    if (f)
+      owm_forecast_destroy (f);
+    else
+      test_fail ("grid %g: %f,%f is not cached as %s", cells[i].grid,
+        cells[i].lat, cells[i].lon, cells[i].key);
+    }
+  owm_context_set_cache (context, NULL);
+  owm_cache_destroy (cache);
+
+  owm_context_destroy (context);
+  return test_exit_status ();
+  }
+
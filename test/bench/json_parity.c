@@ -0,0 +1,220 @@
+/*============================================================================
+ * libopenweathermap test drivers
+ * json_parity.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * Usage: json_parity [rounds]
+ * Parses each fixture that comes in both forms, XML and JSON, with
+ *   owm_forecast_parse_ex() and a range of options, and checks that the
+ *   two give the same points, daily summaries, and sunrise and sunset.
+ *   Also checks that the same is true of forecasts fetched from the
+ *   stand-in server with and without OWM_FORECAST_JSON; that truncated
+ *   JSON documents fail cleanly; and that some malformed ones fail. Then
+ *   reports the time each form takes to parse.
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <owm/owm.h>
+#include "test_util.h"
+
+#define OPTION_SETS 5
+
+
+/*============================================================================
+ * same_value
+ * =========================================================================*/
+static BOOL same_value (double a, double b)
+  {
+  return fabs (a - b) <= 1e-9 * fmax (1, fabs (a));
+  }
+
+
+/*============================================================================
+ * compare
+ * =========================================================================*/
+static void compare (const char *what, OwmForecast *a, OwmForecast *b)
+  {
+  if (!a || !b)
+    {
+    test_fail ("%s: %s failed to parse", what, a ? "JSON" : "XML");
+    return;
+    }
+  int n = owm_forecast_get_points (a);
+  if (n != owm_forecast_get_points (b))
+    {
+    test_fail ("%s: %d points, against %d", what,
+      owm_forecast_get_points (b), n);
+    return;
+    }
+  int i, field;
+  for (i = 0; i < n; i++)
+    {
+    const OwmWeather *x = owm_forecast_get_point (a, i);
+    const OwmWeather *y = owm_forecast_get_point (b, i);
+    if (owm_weather_get_valid (x) != owm_weather_get_valid (y))
+      test_fail ("%s: point %d is valid for %x, against %x", what, i,
+        owm_weather_get_valid (y), owm_weather_get_valid (x));
+    for (field = 1; field <= OWM_VALID_CLOUD_COVER; field <<= 1)
+      {
+      double u = owm_weather_get_field (x, field);
+      double v = owm_weather_get_field (y, field);
+      if (!same_value (u, v))
+        test_fail ("%s: point %d field %x is %f, against %f", what, i,
+          field, v, u);
+      }
+    }
+
+  OwmDailySummary da[10], db[10];
+  int na = owm_forecast_get_daily_summaries (a, da, 10);
+  int nb = owm_forecast_get_daily_summaries (b, db, 10);
+  if (na != nb)
+    test_fail ("%s: %d days, against %d", what, nb, na);
+  else for (i = 0; i < na; i++)
+    {
+    if (da[i].points != db[i].points || da[i].valid != db[i].valid
+        || da[i].modal_conditions != db[i].modal_conditions
+        || !same_value (da[i].min_temp, db[i].min_temp)
+        || !same_value (da[i].max_temp, db[i].max_temp)
+        || !same_value (da[i].wind_speed, db[i].wind_speed)
+        || !same_value (da[i].wind_direction, db[i].wind_direction))
+      test_fail ("%s: day %d differs", what, i);
+    }
+
+  time_t rise_a, set_a, rise_b, set_b;
+  owm_forecast_get_rise_set (a, &rise_a, &set_a);
+  owm_forecast_get_rise_set (b, &rise_b, &set_b);
+  if (rise_a != rise_b || set_a != set_b)
+    test_fail ("%s: sunrise and sunset differ", what);
+  }
+
+
+/*============================================================================
+ * check_truncated
+ * Parse every prefix of the document, or every step'th. None should
+ *   crash, and, because the document is cut short, none should succeed
+ * =========================================================================*/
+static void check_truncated (const char *name, char *json, size_t step)
+  {
+  size_t len = strlen (json), k;
+  int accepted = 0;
+  for (k = 1; k < len; k += step)
+    {
+    char c = json[k];
+    json[k] = 0;
+    char *error = NULL;
+    OwmForecast *f = owm_forecast_parse_ex (json, NULL, &error);
+    if (f)
+      {
+      accepted++;
+      owm_forecast_destroy (f);
+      }
+    free (error);
+    json[k] = c;
+    }
+  if (accepted)
+    test_fail ("%s: %d truncated documents parsed", name, accepted);
+  }
+
+
+/*============================================================================
+ * check_fetched
+ * =========================================================================*/
+static void check_fetched (void)
+  {
+  OwmContext *context = owm_context_create ();
+  owm_context_set_host (context, test_server_start ());
+  OwmForecastOptions options;
+  memset (&options, 0, sizeof (options));
+  char *error = NULL;
+  OwmForecast *a = owm_context_get_forecast (context, "test", "2643743",
+    &options, &error);
+  free (error);
+  error = NULL;
+  options.flags = OWM_FORECAST_JSON;
+  OwmForecast *b = owm_context_get_forecast (context, "test", "2643743",
+    &options, &error);
+  free (error);
+  compare ("fetched", a, b);
+  if (a) owm_forecast_destroy (a);
+  if (b) owm_forecast_destroy (b);
+  owm_context_destroy (context);
+  }
+
+
+/*============================================================================
+ * main
+ * =========================================================================*/
+int main (int argc, char **argv)
+  {
+  int rounds = argc > 1 ? atoi (argv[1]) : 2000;
+  OwmForecastOptions options[OPTION_SETS];
+  int i, o, r;
+
+  memset (options, 0, sizeof (options));
+  options[1].fields = OWM_VALID_TEMP | OWM_VALID_CONDITIONS
+    | OWM_VALID_WIND_SPEED;
+  options[2].max_points = 8;
+  options[3].flags = OWM_FORECAST_SUMMARY_ONLY;
+  options[4].fields = OWM_VALID_PRECIPITATION | OWM_VALID_HUMIDITY;
+  options[4].max_points = 13;
+
+  char *xml[TEST_FIXTURES], *json[TEST_FIXTURES];
+  for (i = 0; i < TEST_FIXTURES; i++)
+    {
+    char name[64];
+    snprintf (name, sizeof (name), "%s.xml", test_fixtures[i]);
+    xml[i] = test_load (name, NULL);
+    snprintf (name, sizeof (name), "%s.json", test_fixtures[i]);
+    json[i] = test_load (name, NULL);
+    for (o = 0; o < OPTION_SETS; o++)
+      {
+      OwmForecast *a = owm_forecast_parse_ex (xml[i], &options[o], NULL);
+      OwmForecast *b = owm_forecast_parse_ex (json[i], &options[o], NULL);
+      char what[64];
+      snprintf (what, sizeof (what), "%s, options %d", test_fixtures[i], o);
+      compare (what, a, b);
+      if (a) owm_forecast_destroy (a);
+      if (b) owm_forecast_destroy (b);
+      }
+    check_truncated (name, json[i], i == 0 ? 1 : 97);
+    }
+
+  static const char *bad[] = { "{}", "{\"list\":5}",
+    "{\"list\":[{\"dt\":1}]]" };
+  for (i = 0; i < (int)(sizeof (bad) / sizeof (bad[0])); i++)
+    {
+    char *error = NULL;
+    OwmForecast *f = owm_forecast_parse_ex (bad[i], NULL, &error);
+    if (f)
+      {
+      test_fail ("%s parsed", bad[i]);
+      owm_forecast_destroy (f);
+      }
+    free (error);
+    }
+
+  check_fetched ();
+
+  printf ("%-10s %8s %10s %8s %10s %8s\n", "fixture", "XML", "us",
+    "JSON", "us", "speedup");
+  for (i = 0; i < TEST_FIXTURES; i++)
+    {
+    double t0 = test_now ();
+    for (r = 0; r < rounds; r++)
+      owm_forecast_destroy (owm_forecast_parse_ex (xml[i], NULL, NULL));
+    double t1 = test_now ();
+    for (r = 0; r < rounds; r++)
+      owm_forecast_destroy (owm_forecast_parse_ex (json[i], NULL, NULL));
+    double t2 = test_now ();
+    printf ("%-10s %8zu %10.1f %8zu %10.1f %7.1fx\n", test_fixtures[i],
+      strlen (xml[i]), (t1 - t0) * 1e6 / rounds, strlen (json[i]),
+      (t2 - t1) * 1e6 / rounds, (t1 - t0) / (t2 - t1));
+    free (xml[i]);
+    free (json[i]);
+    }
+  return test_exit_status ();
+  }
+
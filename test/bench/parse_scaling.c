@@ -0,0 +1,158 @@
+/*============================================================================
+ * libopenweathermap test drivers
+ * parse_scaling.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * Usage: parse_scaling [max threads] [parses per thread]
+ * Parses the forecast fixture, alternately as XML and as JSON, and works
+ *   out its daily summaries, in 1, 2, 4... threads at once, checking
+ *   every result against one parsed beforehand. Reports the parses per
+ *   second for each number of threads, and the speedup over one thread.
+ *   With no shared state in the parsers, the speedup should follow the
+ *   number of threads up to the number of CPUs online, and then level
+ *   off, so the check is against the smaller of the two: a speedup of
+ *   less than SCALING times that fails. On a single CPU, then, no
+ *   speedup is expected, and more threads need only not slow parsing
+ *   down by much. Then fetches forecasts
+ *   from the stand-in server in the same numbers of threads, all sharing
+ *   one context, and checks that none fail.
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <owm/owm.h>
+#include "test_util.h"
+
+#define MAX_DAYS 8
+#define SCALING 0.6
+
+static char *xml;
+static char *json;
+static int parses;
+static int expected_points;
+static int expected_days;
+static OwmDailySummary expected[MAX_DAYS];
+static OwmContext *context;
+
+
+/*============================================================================
+ * parse_thread
+ * =========================================================================*/
+static void *parse_thread (void *data)
+  {
+  (void)data;
+  int i;
+  for (i = 0; i < parses; i++)
+    {
+    char *error = NULL;
+    OwmForecast *f = owm_forecast_parse_ex (i & 1 ? json : xml, NULL,
+      &error);
+    if (!f)
+      {
+      test_fail ("parse: %s", error);
+      free (error);
+      continue;
+      }
+    OwmDailySummary days[MAX_DAYS];
+    int n = owm_forecast_get_daily_summaries (f, days, MAX_DAYS);
+    if (owm_forecast_get_points (f) != expected_points
+        || n != expected_days
+        || memcmp (days, expected, n * sizeof (OwmDailySummary)) != 0)
+      test_fail ("parse %d gave a different forecast", i);
+    owm_forecast_destroy (f);
+    }
+  return NULL;
+  }
+
+
+/*============================================================================
+ * fetch_thread
+ * =========================================================================*/
+static void *fetch_thread (void *data)
+  {
+  (void)data;
+  int i;
+  for (i = 0; i < 20; i++)
+    {
+    char *error = NULL;
+    OwmForecast *f = owm_context_get_forecast (context, "test", "2643743",
+      NULL, &error);
+    if (!f || owm_forecast_get_points (f) != expected_points)
+      test_fail ("fetch: %s", error ? error : "wrong forecast");
+    if (f) owm_forecast_destroy (f);
+    free (error);
+    }
+  return NULL;
+  }
+
+
+/*============================================================================
+ * run
+ * Run the function in n threads, and return the time taken
+ * =========================================================================*/
+static double run (void *(*function) (void *), int n)
+  {
+  pthread_t threads[n];
+  int i;
+  double start = test_now ();
+  for (i = 0; i < n; i++)
+    pthread_create (&threads[i], NULL, function, NULL);
+  for (i = 0; i < n; i++)
+    pthread_join (threads[i], NULL);
+  return test_now () - start;
+  }
+
+
+/*============================================================================
+ * main
+ * =========================================================================*/
+int main (int argc, char **argv)
+  {
+  int max_threads = argc > 1 ? atoi (argv[1]) : 8;
+  parses = argc > 2 ? atoi (argv[2]) : 200;
+  int n;
+
+  xml = test_load ("forecast.xml", NULL);
+  json = test_load ("forecast.json", NULL);
+  OwmForecast *f = owm_forecast_parse (xml, NULL);
+  expected_points = owm_forecast_get_points (f);
+  expected_days = owm_forecast_get_daily_summaries (f, expected, MAX_DAYS);
+  owm_forecast_destroy (f);
+
+  long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+  printf ("%ld CPUs online\n", cpus);
+  printf ("%8s %12s %8s %8s\n", "threads", "parses/s", "speedup",
+    "at least");
+  double base = 0;
+  for (n = 1; n <= max_threads; n *= 2)
+    {
+    double rate = n * parses / run (parse_thread, n);
+    if (n == 1) base = rate;
+    double ideal = n < cpus ? n : cpus;
+    printf ("%8d %12.0f %7.2fx %7.2fx\n", n, rate, rate / base,
+      ideal * SCALING);
+    if (n > 1 && rate / base < ideal * SCALING)
+      test_fail ("%d threads on %ld CPUs gave a speedup of %.2f, expected "
+        "at least %.2f", n, cpus, rate / base, ideal * SCALING);
+    }
+  if (cpus < max_threads)
+    printf ("no more than %ldx is expected, with %ld CPUs\n", cpus, cpus);
+
+  context = owm_context_create ();
+  owm_context_set_host (context, test_server_start ());
+  for (n = 1; n <= max_threads; n *= 2)
+    {
+    double t = run (fetch_thread, n);
+    printf ("%d threads sharing a context: %d fetches in %.1f ms\n", n,
+      n * 20, t * 1e3);
+    }
+  owm_context_destroy (context);
+
+  free (xml);
+  free (json);
+  return test_exit_status ();
+  }
+
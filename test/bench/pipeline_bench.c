@@ -0,0 +1,219 @@
+/*============================================================================
+ * libopenweathermap test drivers
+ * pipeline_bench.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * Usage: pipeline_bench [locations] [latency in ms]
+ * Refreshes a batch of locations from the stand-in server, which waits
+ *   for the given latency before each answer, as the real server would;
+ *   every 50th location is one the server doesn't know. First one at a
+ *   time with owm_context_get_forecast(), then with pipelines with 1, 8
+ *   and 32 fetch threads, and with JSON. Reports the rate of each, and
+ *   the pipeline's statistics, and checks that every location was
+ *   finished, with the right result.
+ * Then checks that the pipeline fills the context's cache, that the
+ *   serialized forecasts read back, that a slow callback holds back the
+ *   earlier stages without their queues overflowing, and that a pipeline
+ *   destroyed without waiting still finishes its batch.
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <owm/owm.h>
+#include "test_util.h"
+
+typedef struct _Tally
+  {
+  int ok;
+  int unknown;
+  int delay; // Microseconds to spend in each callback
+  } Tally;
+
+
+/*============================================================================
+ * callback
+ * =========================================================================*/
+static void callback (const char *location_id, OwmForecast *forecast,
+    const unsigned char *data, size_t len, const char *error,
+    void *user_data)
+  {
+  Tally *tally = user_data;
+  if (forecast)
+    {
+    tally->ok++;
+    if (owm_forecast_get_points (forecast) != 40)
+      test_fail ("%s: %d points", location_id,
+        owm_forecast_get_points (forecast));
+    if (data)
+      {
+      OwmForecast *copy = owm_forecast_deserialize (data, len, NULL);
+      if (!copy || owm_forecast_get_points (copy)
+          != owm_forecast_get_points (forecast))
+        test_fail ("%s: the serialized forecast doesn't read back",
+          location_id);
+      if (copy) owm_forecast_destroy (copy);
+      }
+    }
+  else if (strcmp (error, OWM_ERROR_UNKNOWN_LOCATION) == 0)
+    tally->unknown++;
+  else
+    test_fail ("%s: %s", location_id, error);
+  if (tally->delay) usleep (tally->delay);
+  }
+
+
+/*============================================================================
+ * print_stats
+ * =========================================================================*/
+static void print_stats (const OwmPipelineStats *stats)
+  {
+  static const char *names[OWM_PIPELINE_STAGES] =
+    { "fetch", "parse", "finish" };
+  int i;
+  for (i = 0; i < OWM_PIPELINE_STAGES; i++)
+    {
+    const OwmPipelineStageStats *s = &stats->stages[i];
+    printf ("  %-6s %2d threads %5lu items %5.0f/s busy %6.3f s "
+      "blocked %6.3f s queue %d/%d\n", names[i], s->threads, s->items,
+      s->throughput, s->busy, s->blocked, s->queue_max_depth,
+      s->queue_size);
+    }
+  }
+
+
+/*============================================================================
+ * run
+ * Refresh n locations with a pipeline, check the results, and return its
+ *   statistics
+ * =========================================================================*/
+static void run (OwmContext *context, const char *title, int n, int latency,
+    const OwmForecastOptions *forecast_options,
+    const OwmPipelineOptions *options, int delay, OwmPipelineStats *stats)
+  {
+  Tally tally = { 0, 0, delay };
+  int i, unknown = 0;
+  double start = test_now ();
+  OwmPipeline *pipeline = owm_pipeline_create (context, "test",
+    forecast_options, options, callback, &tally);
+  for (i = 0; i < n; i++)
+    {
+    char id[32];
+    if (i % 50 == 49)
+      {
+      strcpy (id, "404");
+      unknown++;
+      }
+    else
+      snprintf (id, sizeof (id), "d%d_%d", latency, i);
+    owm_pipeline_submit (pipeline, id);
+    }
+  owm_pipeline_wait (pipeline);
+  double elapsed = test_now () - start;
+  owm_pipeline_get_stats (pipeline, stats);
+  owm_pipeline_destroy (pipeline);
+
+  printf ("%-24s %4d in %6.3f s %6.0f/s\n", title, n, elapsed, n / elapsed);
+  print_stats (stats);
+  if (tally.ok + tally.unknown != n || tally.unknown != unknown
+      || stats->completed != (unsigned long)n)
+    test_fail ("%s: %d found and %d unknown, of %d", title, tally.ok,
+      tally.unknown, n);
+  }
+
+
+/*============================================================================
+ * main
+ * =========================================================================*/
+int main (int argc, char **argv)
+  {
+  int n = argc > 1 ? atoi (argv[1]) : 200;
+  int latency = argc > 2 ? atoi (argv[2]) : 20;
+  OwmContext *context = owm_context_create ();
+  owm_context_set_host (context, test_server_start ());
+  OwmPipelineOptions options;
+  OwmPipelineStats stats;
+  int i;
+
+  double start = test_now ();
+  for (i = 0; i < n; i++)
+    {
+    char id[32], *error = NULL;
+    snprintf (id, sizeof (id), "d%d_%d", latency, i);
+    OwmForecast *f = owm_context_get_forecast (context, "test", id, NULL,
+      &error);
+    if (f) owm_forecast_destroy (f);
+    free (error);
+    }
+  double elapsed = test_now () - start;
+  printf ("%-24s %4d in %6.3f s %6.0f/s\n", "one at a time", n, elapsed,
+    n / elapsed);
+
+  static const int fetchers[] = { 1, 8, 32 };
+  for (i = 0; i < 3; i++)
+    {
+    char title[64];
+    memset (&options, 0, sizeof (options));
+    options.fetchers = fetchers[i];
+    snprintf (title, sizeof (title), "pipeline, %d fetchers", fetchers[i]);
+    run (context, title, n, latency, NULL, &options, 0, &stats);
+    }
+  OwmForecastOptions json;
+  memset (&json, 0, sizeof (json));
+  json.flags = OWM_FORECAST_JSON;
+  memset (&options, 0, sizeof (options));
+  run (context, "pipeline, JSON", n, latency, &json, &options, 0, &stats);
+
+  // The cache, and serialized forecasts
+  OwmCache *cache = owm_cache_create (64 << 20);
+  owm_context_set_cache (context, cache);
+  memset (&options, 0, sizeof (options));
+  options.fetchers = 4;
+  options.parsers = 2;
+  options.flags = OWM_PIPELINE_SERIALIZE;
+  run (context, "serialized, cached", 60, 0, NULL, &options, 0, &stats);
+  OwmCacheStats cache_stats;
+  owm_cache_get_stats (cache, &cache_stats);
+  if (cache_stats.entries != 59)
+    test_fail ("%d entries in the cache, expected 59", cache_stats.entries);
+  OwmForecast *f = owm_cache_lookup (cache, "forecast", "d0_3", OWM_UNITS);
+  if (!f || owm_forecast_is_stale (f))
+    test_fail ("the pipeline's forecast isn't fresh in the cache");
+  if (f) owm_forecast_destroy (f);
+  owm_context_set_cache (context, NULL);
+  owm_cache_destroy (cache);
+
+  // Backpressure from a slow callback
+  memset (&options, 0, sizeof (options));
+  options.fetchers = 4;
+  options.parsers = 2;
+  options.queue_size = 2;
+  run (context, "slow callback", 40, 0, NULL, &options, 20000, &stats);
+  for (i = 0; i < OWM_PIPELINE_STAGES; i++)
+    if (stats.stages[i].queue_max_depth > 2)
+      test_fail ("stage %d queued %d items", i,
+        stats.stages[i].queue_max_depth);
+  if (stats.stages[OWM_PIPELINE_PARSE].blocked == 0)
+    test_fail ("the parse stage never waited for the finish stage");
+
+  // Destroying without waiting
+  Tally tally = { 0, 0, 0 };
+  memset (&options, 0, sizeof (options));
+  options.queue_size = 3;
+  OwmPipeline *pipeline = owm_pipeline_create (context, "test", NULL,
+    &options, callback, &tally);
+  for (i = 0; i < 20; i++)
+    {
+    char id[32];
+    snprintf (id, sizeof (id), "d5_%d", i);
+    owm_pipeline_submit (pipeline, id);
+    }
+  owm_pipeline_destroy (pipeline);
+  if (tally.ok != 20)
+    test_fail ("destroyed without waiting: %d of 20 finished", tally.ok);
+
+  owm_context_destroy (context);
+  return test_exit_status ();
+  }
+
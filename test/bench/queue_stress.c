@@ -0,0 +1,103 @@
+/*============================================================================
+ * libopenweathermap test drivers
+ * queue_stress.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * Usage: queue_stress [items per producer]
+ * Four producers push distinct items through an OwmQueue with room for
+ *   only five, to four consumers, so that both sides spend much of their
+ *   time waiting on each other. Checks that every item arrives exactly
+ *   once, and that the queue never held more than its capacity; and
+ *   reports the rate at which items passed through.
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "owm_queue.h"
+#include "test_util.h"
+
+#define PRODUCERS 4
+#define CONSUMERS 4
+#define CAPACITY 5
+
+static OwmQueue *queue;
+static long items;
+static unsigned char *seen;
+static long duplicates;
+
+
+/*============================================================================
+ * producer
+ * Items are numbered from 1, because NULL tells a consumer to stop
+ * =========================================================================*/
+static void *producer (void *data)
+  {
+  intptr_t base = (intptr_t)data * items;
+  intptr_t i;
+  for (i = 0; i < items; i++)
+    owm_queue_push (queue, (void *)(base + i + 1));
+  return NULL;
+  }
+
+
+/*============================================================================
+ * consumer
+ * =========================================================================*/
+static void *consumer (void *data)
+  {
+  (void)data;
+  for (;;)
+    {
+    intptr_t item = (intptr_t)owm_queue_pop (queue);
+    if (!item) return NULL;
+    if (__atomic_fetch_add (&seen[item - 1], 1, __ATOMIC_RELAXED))
+      __atomic_add_fetch (&duplicates, 1, __ATOMIC_RELAXED);
+    }
+  }
+
+
+/*============================================================================
+ * main
+ * =========================================================================*/
+int main (int argc, char **argv)
+  {
+  items = argc > 1 ? atol (argv[1]) : 200000;
+  long total = PRODUCERS * items, i;
+  seen = calloc (total, 1);
+  queue = owm_queue_create (CAPACITY);
+  pthread_t producers[PRODUCERS], consumers[CONSUMERS];
+
+  double start = test_now ();
+  for (i = 0; i < CONSUMERS; i++)
+    pthread_create (&consumers[i], NULL, consumer, NULL);
+  for (i = 0; i < PRODUCERS; i++)
+    pthread_create (&producers[i], NULL, producer, (void *)(intptr_t)i);
+  for (i = 0; i < PRODUCERS; i++)
+    pthread_join (producers[i], NULL);
+  for (i = 0; i < CONSUMERS; i++)
+    owm_queue_push (queue, NULL);
+  for (i = 0; i < CONSUMERS; i++)
+    pthread_join (consumers[i], NULL);
+  double elapsed = test_now () - start;
+
+  long missing = 0;
+  for (i = 0; i < total; i++)
+    if (!seen[i]) missing++;
+  printf ("%d producers, %d consumers, capacity %d: %ld items in %.3f s "
+    "(%.0f/s), most waiting %d\n", PRODUCERS, CONSUMERS, CAPACITY, total,
+    elapsed, total / elapsed, owm_queue_get_max_depth (queue));
+  if (missing || duplicates)
+    test_fail ("%ld items missing, %ld delivered twice", missing,
+      duplicates);
+  if (owm_queue_get_max_depth (queue) > CAPACITY)
+    test_fail ("the queue held %d items", owm_queue_get_max_depth (queue));
+  if (owm_queue_get_depth (queue) != 0)
+    test_fail ("%d items left in the queue", owm_queue_get_depth (queue));
+
+  owm_queue_destroy (queue);
+  free (seen);
+  return test_exit_status ();
+  }
+
@@ -0,0 +1,123 @@
+/*============================================================================
+ * libopenweathermap test drivers
+ * scheduler_bench.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * Usage: scheduler_bench [locations] [latency in ms]
+ * Registers a batch of locations with a scheduler whose context points at
+ *   the stand-in server, which waits for the given latency before each
+ *   answer; one location is one the server doesn't know. Waits for each
+ *   to be refreshed once, reports the rate, and checks that every fetch
+ *   went to the stand-in server, with the right result. Then checks that
+ *   a budget of API calls holds the scheduler back.
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <owm/owm.h>
+#include "test_util.h"
+
+typedef struct _Tally
+  {
+  pthread_mutex_t mutex;
+  int ok;
+  int unknown;
+  } Tally;
+
+
+/*============================================================================
+ * callback
+ * =========================================================================*/
+static void callback (const char *location_id, OwmForecast *forecast,
+    const char *error, void *user_data)
+  {
+  Tally *tally = user_data;
+  pthread_mutex_lock (&tally->mutex);
+  if (forecast)
+    tally->ok++;
+  else if (strcmp (location_id, "404") == 0)
+    tally->unknown++;
+  else
+    test_fail ("%s: %s", location_id, error);
+  pthread_mutex_unlock (&tally->mutex);
+  }
+
+
+/*============================================================================
+ * run
+ * Register n locations, one of them unknown, and wait up to timeout
+ *   seconds for each to have been fetched once. Returns the time taken
+ * =========================================================================*/
+static double run (OwmContext *context, int n, int latency,
+    int calls_per_minute, double timeout, Tally *tally)
+  {
+  int i;
+  memset (tally, 0, sizeof (Tally));
+  pthread_mutex_init (&tally->mutex, NULL);
+  double start = test_now ();
+  OwmScheduler *scheduler = owm_scheduler_create (context, "test", 8,
+    calls_per_minute, NULL, callback, tally);
+  for (i = 0; i < n; i++)
+    {
+    char id[32];
+    if (i == n / 2)
+      strcpy (id, "404");
+    else
+      snprintf (id, sizeof (id), "d%d_%d", latency, i);
+    owm_scheduler_add (scheduler, id, i % OWM_SCHEDULER_PRIORITIES, 3600);
+    }
+  OwmSchedulerStats stats;
+  do
+    {
+    usleep (10000);
+    owm_scheduler_get_stats (scheduler, &stats);
+    } while (stats.refreshes + stats.failures < (unsigned long)n
+      && test_now () - start < timeout);
+  double elapsed = test_now () - start;
+  owm_scheduler_destroy (scheduler);
+  pthread_mutex_destroy (&tally->mutex);
+  return elapsed;
+  }
+
+
+/*============================================================================
+ * main
+ * =========================================================================*/
+int main (int argc, char **argv)
+  {
+  int n = argc > 1 ? atoi (argv[1]) : 200;
+  int latency = argc > 2 ? atoi (argv[2]) : 20;
+  OwmContext *context = owm_context_create ();
+  owm_context_set_host (context, test_server_start ());
+  Tally tally;
+
+  // Anything not fetched from the stand-in server fails, so this also
+  //  checks that the scheduler used the context
+  unsigned long requests = test_server_get_requests ();
+  double t = run (context, n, latency, 0, 30, &tally);
+  printf ("%-24s %4d in %6.3f s %6.0f/s\n", "no budget, 8 workers", n, t,
+    n / t);
+  if (tally.ok != n - 1 || tally.unknown != 1)
+    test_fail ("%d found and %d unknown, of %d", tally.ok, tally.unknown,
+      n);
+  if (test_server_get_requests () - requests != (unsigned long)n - 1)
+    test_fail ("the stand-in server served %lu forecasts, expected %d",
+      test_server_get_requests () - requests, n - 1);
+
+  // 600 calls a minute is ten a second, with a second's worth in hand, so
+  //  30 locations take about two seconds
+  t = run (context, 30, 0, 600, 10, &tally);
+  printf ("%-24s %4d in %6.3f s %6.0f/s\n", "600 calls a minute", 30, t,
+    30 / t);
+  if (tally.ok + tally.unknown != 30)
+    test_fail ("%d of 30 fetched within the budget", tally.ok + tally.unknown);
+  if (t < 1.5)
+    test_fail ("30 fetches took %.3f s, within a budget of 10 a second", t);
+
+  owm_context_destroy (context);
+  return test_exit_status ();
+  }
+
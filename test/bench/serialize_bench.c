@@ -0,0 +1,211 @@
+/*============================================================================
+ * libopenweathermap test drivers
+ * serialize_bench.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * Usage: serialize_bench [rounds]
+ * Checks that the fields a forecast was parsed with survive
+ *   owm_forecast_serialize() and owm_forecast_deserialize(), a database
+ *   written by owm_db_builder_write(), and a shared memory segment; and
+ *   that a forecast in the version 1 form, which has no record of the
+ *   fields, still reads back. Then reports the size of each fixture in
+ *   binary form against its XML, and how fast it is encoded and decoded
+ *   compared with parsing the XML.
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <owm/owm.h>
+#include "owm_private.h"
+#include "test_util.h"
+
+#define FIELDS (OWM_VALID_TEMP | OWM_VALID_WIND_SPEED)
+
+
+/*============================================================================
+ * same_points
+ * Temperatures are kept to 0.01 degrees
+ * =========================================================================*/
+static BOOL same_points (const OwmForecast *a, const OwmForecast *b)
+  {
+  if (a->n_points != b->n_points || a->n_days != b->n_days) return FALSE;
+  int i;
+  for (i = 0; i < a->n_points; i++)
+    {
+    const OwmWeather *p = &a->points[i], *q = &b->points[i];
+    if (p->valid != q->valid || p->start_time != q->start_time
+        || ((p->valid & OWM_VALID_TEMP)
+             && fabs (p->temp - q->temp) > 0.005))
+      return FALSE;
+    }
+  return TRUE;
+  }
+
+
+/*============================================================================
+ * check_copies
+ * Check that the fields are kept by each of the ways of copying a
+ *   forecast
+ * =========================================================================*/
+static void check_copies (const char *name, OwmForecast *f)
+  {
+  char *error = NULL;
+  size_t len = owm_forecast_serialize (f, NULL, 0);
+  unsigned char *buff = malloc (len);
+  owm_forecast_serialize (f, buff, len);
+  OwmForecast *copy = owm_forecast_deserialize (buff, len, &error);
+  if (!copy)
+    test_fail ("%s: deserialize: %s", name, error);
+  else
+    {
+    if (copy->fields != f->fields)
+      test_fail ("%s: deserialized fields %x, expected %x", name,
+        copy->fields, f->fields);
+    if (!same_points (f, copy))
+      test_fail ("%s: deserialized points differ", name);
+    owm_forecast_destroy (copy);
+    }
+  free (buff);
+
+  char path[64];
+  snprintf (path, sizeof (path), "/tmp/owm_serialize_bench.%d.db",
+    (int)getpid ());
+  OwmDbBuilder *builder = owm_db_builder_create ();
+  owm_db_builder_add (builder, "2643743", f);
+  OwmDb *db = NULL;
+  if (!owm_db_builder_write (builder, path, &error)
+      || !(db = owm_db_open (path, &error)))
+    test_fail ("%s: database: %s", name, error);
+  else
+    {
+    OwmForecast *view = owm_db_lookup (db, "2643743");
+    if (!view || view->fields != f->fields)
+      test_fail ("%s: database lost the fields", name);
+    if (view) owm_forecast_destroy (view);
+    owm_db_close (db);
+    }
+  owm_db_builder_destroy (builder);
+  unlink (path);
+
+  snprintf (path, sizeof (path), "/owm_serialize_bench.%d", (int)getpid ());
+  OwmShm *shm = owm_shm_create (path, 4, f->n_points, f->n_days, &error);
+  if (!shm || !owm_shm_publish (shm, "2643743", f, &error))
+    test_fail ("%s: shared memory: %s", name, error);
+  else
+    {
+    OwmForecast *snap = owm_shm_lookup (shm, "2643743");
+    if (!snap || snap->fields != f->fields)
+      test_fail ("%s: shared memory lost the fields", name);
+    if (snap) owm_forecast_destroy (snap);
+    }
+  if (shm) owm_shm_detach (shm);
+  owm_shm_unlink (path);
+  }
+
+
+/*============================================================================
+ * check_version_1
+ * Rewrite the serialized form of f as version 1, by taking out the
+ *   fields, and check that it still reads
+ * =========================================================================*/
+static void check_version_1 (const char *name, const OwmForecast *f)
+  {
+  size_t len = owm_forecast_serialize (f, NULL, 0);
+  unsigned char *buff = malloc (len);
+  owm_forecast_serialize (f, buff, len);
+
+  // The fields follow the header and three varints
+  size_t pos = 12;
+  int i;
+  for (i = 0; i < 3; i++)
+    while (buff[pos++] & 0x80);
+  size_t skip = 1;
+  while (buff[pos + skip - 1] & 0x80) skip++;
+  memmove (buff + pos, buff + pos + skip, len - pos - skip);
+  len -= skip;
+  buff[4] = 1;
+  OwmWriter w = { buff + 8, 4, 0 };
+  owm_writer_u32 (&w, (uint32_t)len);
+  w.buffer = buff + len - 4;
+  w.pos = 0;
+  owm_writer_u32 (&w, owm_crc32_update (0, buff, len - 4));
+
+  char *error = NULL;
+  OwmForecast *copy = owm_forecast_deserialize (buff, len, &error);
+  if (!copy)
+    test_fail ("%s: version 1: %s", name, error);
+  else
+    {
+    if (copy->fields != 0)
+      test_fail ("%s: version 1 read with fields %x", name, copy->fields);
+    if (!same_points (f, copy))
+      test_fail ("%s: version 1 points differ", name);
+    owm_forecast_destroy (copy);
+    }
+  free (buff);
+  }
+
+
+/*============================================================================
+ * main
+ * =========================================================================*/
+int main (int argc, char **argv)
+  {
+  int rounds = argc > 1 ? atoi (argv[1]) : 2000;
+  int i, r;
+
+  printf ("%-10s %8s %8s %10s %10s %10s\n", "fixture", "XML", "binary",
+    "parse us", "encode us", "decode us");
+  for (i = 0; i < TEST_FIXTURES; i++)
+    {
+    char name[64], *error = NULL;
+    size_t xml_len;
+    snprintf (name, sizeof (name), "%s.xml", test_fixtures[i]);
+    char *xml = test_load (name, &xml_len);
+
+    OwmForecastOptions options;
+    memset (&options, 0, sizeof (options));
+    options.fields = FIELDS;
+    OwmForecast *f = owm_forecast_parse_ex (xml, &options, &error);
+    if (!f || f->fields != FIELDS)
+      {
+      test_fail ("%s: parse with fields: %s", name, f ? "fields" : error);
+      free (xml);
+      continue;
+      }
+    check_copies (name, f);
+    check_version_1 (name, f);
+    owm_forecast_destroy (f);
+
+    f = owm_forecast_parse (xml, &error);
+    check_copies (name, f);
+    check_version_1 (name, f);
+
+    size_t len = owm_forecast_serialize (f, NULL, 0);
+    unsigned char *buff = malloc (len);
+
+    double t0 = test_now ();
+    for (r = 0; r < rounds; r++)
+      owm_forecast_destroy (owm_forecast_parse (xml, NULL));
+    double t1 = test_now ();
+    for (r = 0; r < rounds; r++)
+      owm_forecast_serialize (f, buff, len);
+    double t2 = test_now ();
+    for (r = 0; r < rounds; r++)
+      owm_forecast_destroy (owm_forecast_deserialize (buff, len, NULL));
+    double t3 = test_now ();
+
+    printf ("%-10s %8zu %8zu %10.2f %10.2f %10.2f\n", test_fixtures[i],
+      xml_len, len, (t1 - t0) * 1e6 / rounds, (t2 - t1) * 1e6 / rounds,
+      (t3 - t2) * 1e6 / rounds);
+
+    free (buff);
+    owm_forecast_destroy (f);
+    free (xml);
+    }
+  return test_exit_status ();
+  }
+
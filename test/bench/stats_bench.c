@@ -0,0 +1,225 @@
+/*============================================================================
+ * libopenweathermap test drivers
+ * stats_bench.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * Usage: stats_bench [forecasts] [rounds]
+ * Works out fleet-wide statistics -- minimum, maximum and mean temperature,
+ *   and the vector mean of the wind direction, over every point of a set
+ *   of forecasts -- in three ways, checks that they agree, and reports the
+ *   time each takes:
+ *   - per point, as owm_forecast_get_daily_summary() did before summaries
+ *     were precomputed: a validity branch per field, and sin() and cos()
+ *     per wind direction;
+ *   - through the public interface: copying the temperatures out with
+ *     owm_forecast_get_field(), and the wind unit vectors, worked out
+ *     when the forecasts were parsed, with
+ *     owm_forecast_get_wind_vectors(), and then using the owm_stats.h
+ *     functions;
+ *   - with the owm_stats.h functions alone, on arrays that were
+ *     extracted beforehand, as a program that keeps its fleet in arrays
+ *     would.
+ * The public path should be faster than the per-point loop.
+ * The forecasts are copies of the fixtures, each in its own allocation.
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <owm/owm.h>
+#include "test_util.h"
+
+#define POINTS 40
+
+typedef struct _Result
+  {
+  double min, max, mean, wind;
+  } Result;
+
+
+/*============================================================================
+ * make_fleet
+ * =========================================================================*/
+static OwmForecast **make_fleet (int n)
+  {
+  OwmForecast *models[TEST_FIXTURES];
+  int i;
+  for (i = 0; i < TEST_FIXTURES; i++)
+    {
+    char name[64], *error = NULL;
+    snprintf (name, sizeof (name), "%s.xml", test_fixtures[i]);
+    char *xml = test_load (name, NULL);
+    models[i] = owm_forecast_parse (xml, &error);
+    if (!models[i])
+      {
+      fprintf (stderr, "%s: %s\n", name, error);
+      exit (EXIT_FAILURE);
+      }
+    free (xml);
+    }
+
+  OwmForecast **fleet = malloc (n * sizeof (OwmForecast *));
+  for (i = 0; i < n; i++)
+    {
+    const OwmForecast *model = models[i % TEST_FIXTURES];
+    size_t len = owm_forecast_serialize (model, NULL, 0);
+    unsigned char *buff = malloc (len);
+    owm_forecast_serialize (model, buff, len);
+    fleet[i] = owm_forecast_deserialize (buff, len, NULL);
+    free (buff);
+    }
+  for (i = 0; i < TEST_FIXTURES; i++)
+    owm_forecast_destroy (models[i]);
+  return fleet;
+  }
+
+
+/*============================================================================
+ * per_point
+ * The way the original summary code worked
+ * =========================================================================*/
+static void per_point (OwmForecast **fleet, int n, Result *r)
+  {
+  double min = INFINITY, max = -INFINITY, sum = 0, s = 0, c = 0;
+  int count = 0, f, i;
+  for (f = 0; f < n; f++)
+    {
+    int points = owm_forecast_get_points (fleet[f]);
+    for (i = 0; i < points; i++)
+      {
+      const OwmWeather *w = owm_forecast_get_point (fleet[f], i);
+      if (owm_weather_get_valid (w) & OWM_VALID_TEMP)
+        {
+        double temp = owm_weather_get_temperature (w);
+        if (temp < min) min = temp;
+        if (temp > max) max = temp;
+        sum += temp;
+        count++;
+        }
+      if (owm_weather_get_valid (w) & OWM_VALID_WIND_DIRECTION)
+        {
+        double dir = owm_weather_get_wind_direction (w);
+        c += cos (dir / 360.0 * 2.0 * M_PI);
+        s += sin (dir / 360.0 * 2.0 * M_PI);
+        }
+      }
+    }
+  r->min = min;
+  r->max = max;
+  r->mean = count ? sum / count : 0;
+  r->wind = atan2 (s, c) * 360.0 / 2.0 / M_PI;
+  if (r->wind < 0) r->wind += 360.0;
+  }
+
+
+/*============================================================================
+ * extract
+ * Copy the temperatures and wind unit vectors of the fleet into arrays.
+ *   Returns the number of points
+ * =========================================================================*/
+static int extract (OwmForecast **fleet, int n, double *temp,
+    unsigned char *temp_mask, double *x, double *y, 
+    unsigned char *dir_mask)
+  {
+  int f, total = 0;
+  for (f = 0; f < n; f++)
+    {
+    owm_forecast_get_field (fleet[f], OWM_VALID_TEMP, temp + total,
+      temp_mask + total, POINTS);
+    total += owm_forecast_get_wind_vectors (fleet[f], x + total, 
+      y + total, dir_mask + total, POINTS);
+    }
+  return total;
+  }
+
+
+/*============================================================================
+ * kernels
+ * =========================================================================*/
+static void kernels (const double *temp, const unsigned char *temp_mask,
+    const double *x, const double *y, const unsigned char *dir_mask,
+    int total, Result *r)
+  {
+  OwmStats stats;
+  owm_stats_compute (temp, temp_mask, total, &stats);
+  r->min = stats.min;
+  r->max = stats.max;
+  r->mean = stats.mean;
+  r->wind = owm_stats_wind_vector_mean (x, y, dir_mask, total);
+  }
+
+
+/*============================================================================
+ * check
+ * =========================================================================*/
+static void check (const char *what, const Result *a, const Result *b)
+  {
+  double wind = fabs (a->wind - b->wind);
+  if (wind > 180) wind = 360 - wind;
+  if (a->min != b->min || a->max != b->max
+      || fabs (a->mean - b->mean) > 1e-9 * fabs (a->mean) || wind > 1e-6)
+    test_fail ("%s: %f %f %f %f, expected %f %f %f %f", what, b->min,
+      b->max, b->mean, b->wind, a->min, a->max, a->mean, a->wind);
+  }
+
+
+/*============================================================================
+ * main
+ * =========================================================================*/
+int main (int argc, char **argv)
+  {
+  int n = argc > 1 ? atoi (argv[1]) : 50000;
+  int rounds = argc > 2 ? atoi (argv[2]) : 5;
+  OwmForecast **fleet = make_fleet (n);
+  double *temp = malloc ((size_t)n * POINTS * sizeof (double));
+  double *x = malloc ((size_t)n * POINTS * sizeof (double));
+  double *y = malloc ((size_t)n * POINTS * sizeof (double));
+  unsigned char *temp_mask = malloc ((size_t)n * POINTS);
+  unsigned char *dir_mask = malloc ((size_t)n * POINTS);
+
+  Result expected, got;
+  double t_point = 0, t_extract = 0, t_kernels = 0;
+  int r, total = 0;
+  for (r = 0; r < rounds; r++)
+    {
+    double t0 = test_now ();
+    per_point (fleet, n, &expected);
+    double t1 = test_now ();
+    total = extract (fleet, n, temp, temp_mask, x, y, dir_mask);
+    double t2 = test_now ();
+    kernels (temp, temp_mask, x, y, dir_mask, total, &got);
+    double t3 = test_now ();
+    check ("public path", &expected, &got);
+    t_point += t1 - t0;
+    t_extract += t2 - t1;
+    t_kernels += t3 - t2;
+    }
+
+  double points = (double)total * rounds;
+  printf ("%d forecasts, %d points, %d rounds, owm_stats uses %s\n", n,
+    total, rounds, owm_stats_get_implementation ());
+  printf ("per-point loop        %8.3f ms/round %8.1f Mpoints/s\n",
+    t_point * 1e3 / rounds, points / t_point / 1e6);
+  printf ("public path           %8.3f ms/round %8.1f Mpoints/s  x%.1f\n",
+    (t_extract + t_kernels) * 1e3 / rounds,
+    points / (t_extract + t_kernels) / 1e6,
+    t_point / (t_extract + t_kernels));
+  printf ("kernels on arrays     %8.3f ms/round %8.1f Mpoints/s  x%.1f\n",
+    t_kernels * 1e3 / rounds, points / t_kernels / 1e6,
+    t_point / t_kernels);
+
+  int i;
+  for (i = 0; i < n; i++)
+    owm_forecast_destroy (fleet[i]);
+  free (fleet);
+  free (temp);
+  free (x);
+  free (y);
+  free (temp_mask);
+  free (dir_mask);
+  if (t_extract + t_kernels >= t_point)
+    test_fail ("the public path is no faster than the per-point loop");
+  return test_exit_status ();
+  }
+
@@ -0,0 +1,390 @@
+/*============================================================================
+ * libopenweathermap test drivers
+ * test_util.c
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * The stand-in server has one thread that accepts connections, and one
+ *   thread per connection, which answers requests on it until the client
+ *   closes it. It understands just enough HTTP for libcurl.
+ * =========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "test_util.h"
+
+const char *test_fixtures[TEST_FIXTURES] = { "forecast", "fc2", "fc3" };
+
+static int test_failures = 0;
+static unsigned long test_server_requests = 0;
+static char *test_server_forecast_xml;
+static char *test_server_forecast_json;
+static int test_server_socket = -1;
+static char test_server_host[64];
+
+
+/*============================================================================
+ * test_now
+ * =========================================================================*/
+double test_now (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+  }
+
+
+/*============================================================================
+ * test_load
+ * =========================================================================*/
+char *test_load (const char *name, size_t *len)
+  {
+  const char *dir = getenv ("OWM_TEST_DATA");
+  char path[512];
+  snprintf (path, sizeof (path), "%s/%s", dir ? dir : "data", name);
+  FILE *f = fopen (path, "rb");
+  if (!f)
+    {
+    fprintf (stderr, "Can't open %s\n", path);
+    exit (EXIT_FAILURE);
+    }
+  fseek (f, 0, SEEK_END);
+  long size = ftell (f);
+  rewind (f);
+  char *buff = malloc (size + 1);
+  if (fread (buff, 1, size, f) != (size_t)size)
+    {
+    fprintf (stderr, "Can't read %s\n", path);
+    exit (EXIT_FAILURE);
+    }
+  buff[size] = 0;
+  fclose (f);
+  if (len) *len = size;
+  return buff;
+  }
+
+
+/*============================================================================
+ * test_fail
+ * =========================================================================*/
+void test_fail (const char *fmt, ...)
+  {
+  va_list ap;
+  va_start (ap, fmt);
+  printf ("FAIL: ");
+  vprintf (fmt, ap);
+  printf ("\n");
+  va_end (ap);
+  __atomic_add_fetch (&test_failures, 1, __ATOMIC_RELAXED);
+  }
+
+
+/*============================================================================
+ * test_exit_status
+ * =========================================================================*/
+int test_exit_status (void)
+  {
+  return test_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+
+
+/*============================================================================
+ * test_hash
+ * A well-mixed 64-bit hash of a number, from which the generated city
+ *   list takes its random choices
+ * =========================================================================*/
+static uint64_t test_hash (uint64_t x)
+  {
+  x += 0x9E3779B97F4A7C15ull;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+  return x ^ (x >> 31);
+  }
+
+
+/*============================================================================
+ * test_uniform
+ * A number in [0, 1) from a hash
+ * =========================================================================*/
+static double test_uniform (uint64_t h)
+  {
+  return (h >> 11) / 9007199254740992.0;
+  }
+
+
+/*============================================================================
+ * test_city
+ * =========================================================================*/
+void test_city (int i, TestCity *city)
+  {
+  static const char *syllables[] = { "ka", "lo", "mi", "ber", "ton",
+    "ville", "san", "ta", "ri", "no", "por", "ham", "ing", "dor", "el",
+    "an", "mar", "chester", "burg", "ford", "ley", "wick", "stad", "hof",
+    "ova", "grad", "pur", "abad", "ena", "os" };
+  uint64_t h = test_hash (i);
+  int cluster = h % 2000, k;
+
+  // Some names are much commoner than others, as in the real list
+  uint64_t n = test_hash (h % 5 == 0 ? (uint64_t)(h >> 40) % 300 : h);
+  int syllables_in_name = 2 + n % 2;
+  city->name[0] = 0;
+  for (k = 0; k < syllables_in_name; k++)
+    {
+    n = test_hash (n);
+    strcat (city->name, syllables[n % 30]);
+    }
+  city->name[0] += 'A' - 'a';
+  char *e = strchr (city->name, 'e');
+  if (e && h % 23 == 0)
+    {
+    memmove (e + 2, e + 1, strlen (e + 1) + 1);
+    memcpy (e, "\xc3\xa9", 2); // e-acute
+    }
+
+  uint64_t c = test_hash (cluster + 1000000);
+  city->country[0] = 'A' + c % 26;
+  city->country[1] = 'A' + (c >> 8) % 26;
+  city->country[2] = 0;
+  double lat = asin (2 * test_uniform (test_hash (c)) - 1) * 180 / M_PI;
+  double lon = test_uniform (test_hash (c + 1)) * 360 - 180;
+  lat += (test_uniform (test_hash (h + 1)) - 0.5) * 3;
+  lon += (test_uniform (test_hash (h + 2)) - 0.5) * 4;
+  if (lat > 89) lat = 89;
+  if (lat < -89) lat = -89;
+  if (lon >= 180) lon -= 360;
+  if (lon < -180) lon += 360;
+  // As written to the file, and read back
+  char buff[32];
+  snprintf (buff, sizeof (buff), "%.6f", lat);
+  city->lat = atof (buff);
+  snprintf (buff, sizeof (buff), "%.6f", lon);
+  city->lon = atof (buff);
+  // Unique, but not in the order of the file
+  city->id = 1000 + i * 8 + (int)(h >> 60) % 8;
+  }
+
+
+/*============================================================================
+ * test_city_list_write
+ * =========================================================================*/
+char *test_city_list_write (int n)
+  {
+  char *path = strdup ("/tmp/city_listXXXXXX");
+  int fd = mkstemp (path);
+  FILE *f = fd >= 0 ? fdopen (fd, "w") : NULL;
+  if (!f)
+    {
+    fprintf (stderr, "Can't create %s\n", path);
+    exit (EXIT_FAILURE);
+    }
+  int stride = n % 7919 ? 7919 : 1, p;
+  fprintf (f, "[\n");
+  for (p = 0; p < n; p++)
+    {
+    TestCity city;
+    test_city ((int)((long)p * stride % n), &city);
+    char name[128];
+    const char *s = city.name;
+    char *d = name;
+    for (; *s; s++)
+      {
+      // Half the accented letters are escaped
+      if ((unsigned char)*s == 0xc3 && city.id % 2)
+        {
+        d += sprintf (d, "\\u00e9");
+        s++;
+        }
+      else
+        *d++ = *s;
+      }
+    *d = 0;
+    fprintf (f, "  {\n    \"id\": %d,\n    \"name\": \"%s\",\n"
+      "    \"state\": \"\",\n    \"country\": \"%s\",\n    \"coord\": {\n"
+      "      \"lon\": %.6f,\n      \"lat\": %.6f\n    }\n  }%s\n", city.id,
+      name, city.country, city.lon, city.lat, p < n - 1 ? "," : "");
+    }
+  fprintf (f, "]\n");
+  if (fclose (f) != 0)
+    {
+    fprintf (stderr, "Can't write %s\n", path);
+    exit (EXIT_FAILURE);
+    }
+  return path;
+  }
+
+
+/*============================================================================
+ * test_server_trim
+ * Cut a forecast document down to its first n points
+ * =========================================================================*/
+static char *test_server_trim (const char *xml, int n)
+  {
+  const char *p = xml;
+  int i;
+  for (i = 0; i < n && p; i++)
+    {
+    p = strstr (p, "</time>");
+    if (p) p += strlen ("</time>");
+    }
+  const char *tail = p ? strstr (p, "</forecast>") : NULL;
+  if (!tail) return strdup (xml);
+  char *ret = NULL;
+  if (asprintf (&ret, "%.*s%s", (int)(p - xml), xml, tail) < 0) return NULL;
+  return ret;
+  }
+
+
+/*============================================================================
+ * test_server_answer
+ * Write the response to one request. Returns -1 if the connection has
+ *   failed
+ * =========================================================================*/
+static int test_server_answer (int fd, const char *path)
+  {
+  const char *id = strstr (path, "id=");
+  if (id)
+    {
+    int delay;
+    if (sscanf (id, "id=d%d_", &delay) == 1 && delay > 0)
+      usleep (delay * 1000);
+    if (strncmp (id, "id=404&", 7) == 0)
+      {
+      const char *r = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+      return write (fd, r, strlen (r)) < 0 ? -1 : 0;
+      }
+    }
+
+  char *trimmed = NULL;
+  const char *body = test_server_forecast_xml;
+  if (strstr (path, "mode=json"))
+    body = test_server_forecast_json;
+  else
+    {
+    const char *cnt = strstr (path, "cnt=");
+    if (cnt) body = trimmed = test_server_trim (body, atoi (cnt + 4));
+    }
+
+  char header[128];
+  size_t len = strlen (body);
+  snprintf (header, sizeof (header), "HTTP/1.1 200 OK\r\n"
+    "Content-Length: %zu\r\nETag: \"v1\"\r\n\r\n", len);
+  // One write, so that the body doesn't wait on the client's delayed ACK
+  struct iovec iov[2] = { { header, strlen (header) },
+    { (void *)body, len } };
+  int ret = writev (fd, iov, 2) < 0 ? -1 : 0;
+  free (trimmed);
+  __atomic_add_fetch (&test_server_requests, 1, __ATOMIC_RELAXED);
+  return ret;
+  }
+
+
+/*============================================================================
+ * test_server_connection
+ * =========================================================================*/
+static void *test_server_connection (void *data)
+  {
+  int fd = (int)(long)data;
+  char buff[8192];
+  size_t have = 0;
+  for (;;)
+    {
+    char *end;
+    buff[have] = 0;
+    while (!(end = strstr (buff, "\r\n\r\n")))
+      {
+      if (have == sizeof (buff) - 1) goto done;
+      ssize_t n = read (fd, buff + have, sizeof (buff) - 1 - have);
+      if (n <= 0) goto done;
+      have += n;
+      buff[have] = 0;
+      }
+    char path[4096];
+    if (sscanf (buff, "GET %4095s", path) != 1) goto done;
+    if (test_server_answer (fd, path) != 0) goto done;
+    end += 4;
+    have -= end - buff;
+    memmove (buff, end, have);
+    }
+done:
+  close (fd);
+  return NULL;
+  }
+
+
+/*============================================================================
+ * test_server_accept
+ * =========================================================================*/
+static void *test_server_accept (void *data)
+  {
+  (void)data;
+  for (;;)
+    {
+    int fd = accept (test_server_socket, NULL, NULL);
+    if (fd < 0) continue;
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init (&attr);
+    pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create (&thread, &attr, test_server_connection,
+        (void *)(long)fd) != 0)
+      close (fd);
+    pthread_attr_destroy (&attr);
+    }
+  return NULL;
+  }
+
+
+/*============================================================================
+ * test_server_start
+ * =========================================================================*/
+const char *test_server_start (void)
+  {
+  if (test_server_socket >= 0) return test_server_host;
+  signal (SIGPIPE, SIG_IGN);
+  test_server_forecast_xml = test_load ("forecast.xml", NULL);
+  test_server_forecast_json = test_load ("forecast.json", NULL);
+
+  struct sockaddr_in addr;
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  socklen_t addr_len = sizeof (addr);
+  test_server_socket = socket (AF_INET, SOCK_STREAM, 0);
+  if (test_server_socket < 0
+      || bind (test_server_socket, (struct sockaddr *)&addr, addr_len) != 0
+      || listen (test_server_socket, 128) != 0
+      || getsockname (test_server_socket, (struct sockaddr *)&addr,
+           &addr_len) != 0)
+    {
+    perror ("Can't start the stand-in server");
+    exit (EXIT_FAILURE);
+    }
+  snprintf (test_server_host, sizeof (test_server_host),
+    "http://127.0.0.1:%d", ntohs (addr.sin_port));
+
+  pthread_t thread;
+  pthread_create (&thread, NULL, test_server_accept, NULL);
+  pthread_detach (thread);
+  return test_server_host;
+  }
+
+
+/*============================================================================
+ * test_server_get_requests
+ * =========================================================================*/
+unsigned long test_server_get_requests (void)
+  {
+  return __atomic_load_n (&test_server_requests, __ATOMIC_RELAXED);
+  }
+
@@ -0,0 +1,74 @@
+/*============================================================================
+ * libopenweathermap test drivers
+ * test_util.h
+ * Copyright (c)2018 Kevin Boone, GPL v3.0
+ * Helpers shared by the programs in test/bench: timing, loading the
+ *   fixtures in test/data, and a stand-in for the OWM server that runs on
+ *   the loopback interface, so that the network paths can be measured
+ *   without an APP ID or a connection to the internet.
+ * =========================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+
+/* The fixtures that come in matching XML and JSON forms */
+#define TEST_FIXTURES 3
+extern const char *test_fixtures[TEST_FIXTURES];
+
+/* A location in a generated city list, as it should read back */
+typedef struct _TestCity
+  {
+  int id;
+  char name[64];
+  char country[3];
+  double lat;
+  double lon;
+  } TestCity;
+
+#ifdef __CPLUSPLUS
+  extern "C" {
+#endif
+
+/** Seconds on the monotonic clock */
+double       test_now (void);
+
+/** Read a file from the data directory -- $OWM_TEST_DATA, or "data" --
+ into a nul-terminated buffer, which the caller frees. Exits the program
+ if the file can't be read */
+char        *test_load (const char *name, size_t *len);
+
+/** Start the stand-in server on a free port on 127.0.0.1, and return the
+ host to pass to owm_context_set_host(). It answers forecast requests
+ with forecast.xml, trimmed to cnt points if cnt is given, or
+ forecast.json for mode=json; and location ID 404 with a 404. A location ID of the form d<ms>_<anything>
+ is answered after a delay of <ms> milliseconds, to stand in for the
+ latency of the real server. Connections are kept alive. The server
+ runs until the program exits */
+const char  *test_server_start (void);
+
+/** The number of requests the stand-in server has answered */
+unsigned long test_server_get_requests (void);
+
+/** Get location i of a generated city list. The same i always gives the
+ same location */
+void         test_city (int i, TestCity *city);
+
+/** Write a city list of n locations, in the pretty-printed form of OWM's
+ city.list.json, to a new temporary file, and return its path, which the
+ caller frees after removing the file. The locations are clustered around
+ a couple of thousand centres, many names recur, and some have accented
+ letters, some of them escaped. Exits the program if the file can't be
+ written */
+char        *test_city_list_write (int n);
+
+/** Report a failed check, and remember it for test_exit_status() */
+void         test_fail (const char *fmt, ...);
+
+/** EXIT_SUCCESS if test_fail() has not been called */
+int          test_exit_status (void);
+
+#ifdef __CPLUSPLUS
+ }
+#endif
+